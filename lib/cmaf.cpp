@@ -0,0 +1,259 @@
+#include "cmaf.h"
+#include "defines.h"
+#include "mp4.h"
+#include "mp4_generic.h"
+#include "timing.h"
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+
+/// Bytes at the start of a segment page that hold its state, the segment itself follows.
+/// Layout: 64-bit amount of bytes written, 32-bit PID of the writer, 32-bit flags, 32-bit change
+/// counter that readers wait on through a futex, 32 bits padding.
+#define CMAF_SEGMENT_HEADER 24
+#define CMAF_SEGMENT_DONE 1
+
+namespace CMAF {
+  /// Builds the CMAF header (initialization segment) for a track: ftyp and a moov without samples.
+  std::string trackHeader(DTSC::Track & Trk){
+    std::string ret;
+    MP4::BoxWriter W(ret);
+    W.start("ftyp");
+    W.bytes("cmfc", 4);
+    W.int32(0);
+    W.bytes("cmfciso6dash", 12);
+    W.end();
+
+    W.start("moov");
+    MP4::MVHD mvhdBox(0);
+    mvhdBox.setTrackID(Trk.trackID + 1);
+    W.box(mvhdBox);
+
+    W.start("trak");
+    MP4::TKHD tkhdBox(Trk, true);
+    tkhdBox.setDuration(0);
+    W.box(tkhdBox);
+    W.start("mdia");
+    MP4::MDHD mdhdBox(0);
+    mdhdBox.setLanguage(Trk.lang);
+    W.box(mdhdBox);
+    MP4::HDLR hdlrBox(Trk.type, Trk.getIdentifier());
+    W.box(hdlrBox);
+    W.start("minf");
+    if (Trk.type == "video"){
+      MP4::VMHD vmhdBox;
+      vmhdBox.setFlags(1);
+      W.box(vmhdBox);
+    }else if (Trk.type == "audio"){
+      MP4::SMHD smhdBox;
+      W.box(smhdBox);
+    }
+    MP4::DINF dinfBox;
+    MP4::DREF drefBox;
+    dinfBox.setContent(drefBox, 0);
+    W.box(dinfBox);
+
+    W.start("stbl");
+    MP4::STSD stsdBox(0);
+    if (Trk.type == "video"){
+      MP4::VisualSampleEntry sampleEntry(Trk);
+      stsdBox.setEntry(sampleEntry, 0);
+    }else if (Trk.type == "audio"){
+      MP4::AudioSampleEntry sampleEntry(Trk);
+      stsdBox.setEntry(sampleEntry, 0);
+    }
+    W.box(stsdBox);
+    //All samples are in the fragments, so the sample tables are empty
+    W.startFull("stts", 0, 0);
+    W.int32(0);
+    W.end();
+    W.startFull("stsc", 0, 0);
+    W.int32(0);
+    W.end();
+    W.startFull("stsz", 0, 0);
+    W.int32(0);
+    W.int32(0);
+    W.end();
+    W.startFull("stco", 0, 0);
+    W.int32(0);
+    W.end();
+    W.end();//stbl
+    W.end();//minf
+    W.end();//mdia
+    W.end();//trak
+
+    W.start("mvex");
+    MP4::TREX trexBox(Trk.trackID);
+    W.box(trexBox);
+    W.end();
+    W.end();//moov
+    return ret;
+  }
+
+  /// Appends the moof and mdat header of a CMAF chunk to out. The sample data (dataSize bytes) goes right after.
+  /// The sequence number must increase with every chunk of the track, baseTime is the time of the first sample.
+  void chunkHeader(std::string & out, DTSC::Track & Trk, uint32_t sequence, uint64_t baseTime, const std::deque<sample> & samples, uint64_t dataSize){
+    MP4::BoxWriter W(out);
+    size_t moofStart = W.position();
+    W.start("moof");
+    W.startFull("mfhd", 0, 0);
+    W.int32(sequence);
+    W.end();
+    W.start("traf");
+    W.startFull("tfhd", 0, MP4::tfhdBaseIsMoof);
+    W.int32(Trk.trackID);
+    W.end();
+    W.startFull("tfdt", 1, 0);
+    W.int64(baseTime);
+    W.end();
+    W.startFull("trun", 0, MP4::trundataOffset | MP4::trunsampleDuration | MP4::trunsampleSize | MP4::trunsampleFlags | MP4::trunsampleOffsets);
+    W.int32(samples.size());
+    size_t dataOffsetPos = W.position();
+    W.int32(0);
+    for (std::deque<sample>::const_iterator it = samples.begin(); it != samples.end(); ++it){
+      W.int32(it->duration);
+      W.int32(it->size);
+      //sync samples depend on nothing, others depend on earlier samples and are not sync samples
+      W.int32(it->keyframe ? 0x02000000 : 0x01010000);
+      W.int32(it->offset);
+    }
+    W.end();//trun
+    W.end();//traf
+    W.end();//moof
+    //The sample data starts right after the mdat header
+    W.setInt32(dataOffsetPos, W.position() - moofStart + ((dataSize + 8 > 0xFFFFFFFFull) ? 16 : 8));
+    W.header("mdat", dataSize);
+  }
+
+  /// Returns true if pkt no longer belongs to the segment of Trk that starts at segmentStart.
+  /// segmentEnd is the start of the next key, or zero if that is not known yet. In that case the
+  /// same rules DTSC::Track::update uses to start a new key decide, so this works on live packets
+  /// before the metadata has caught up with them.
+  bool endsSegment(const DTSC::Track & Trk, uint64_t segmentStart, uint64_t segmentEnd, const DTSC::Packet & pkt){
+    uint64_t time = pkt.getTime();
+    if (segmentEnd){return time >= segmentEnd;}
+    if (time <= segmentStart){return false;}
+    if (pkt.getFlag("keyframe")){return true;}
+    return (Trk.type != "video" && time >= AUDIO_KEY_INTERVAL && time - segmentStart >= AUDIO_KEY_INTERVAL);
+  }
+
+  segmentPage::segmentPage(){}
+
+  /// Opens the page for the given segment, creating it if it does not exist yet.
+  /// Of several processes opening a new segment at once, exactly one creates the page; the others
+  /// attach to it, waiting briefly for the creator to size it.
+  bool segmentPage::open(const std::string & streamName, unsigned long tid, unsigned long keyNum){
+    char pageName[NAME_BUFFER_SIZE];
+    snprintf(pageName, NAME_BUFFER_SIZE, SHM_CMAF_SEGMENT, streamName.c_str(), tid, keyNum);
+    for (size_t i = 0; i < 50; ++i){
+      if (page.create(pageName, CMAF_SEGMENT_PAGE_SIZE)){
+        //The page outlives this process, the buffer removes it along with the key
+        page.master = false;
+        return true;
+      }
+      page.init(pageName, 0, false, false);
+      if (page && page.len >= CMAF_SEGMENT_HEADER){return true;}
+      page.close();
+      Util::sleep(1);
+    }
+    return false;
+  }
+
+  /// Attempts to become the writer of this segment.
+  /// Succeeds if nobody is writing it, or the process that was writing it is gone.
+  bool segmentPage::claim(){
+    if (!page || isDone()){return false;}
+    volatile uint32_t * writer = (uint32_t *)(page.mapped + 8);
+    uint32_t current = *writer;
+    if (current == (uint32_t)getpid()){return true;}
+    if (current && writerAlive()){return false;}
+    return __sync_bool_compare_and_swap(writer, current, (uint32_t)getpid());
+  }
+
+  /// Writes len bytes of the segment at position pos, making everything up to there available to readers.
+  /// A writer that took over only makes bytes available once it got past what was already there.
+  /// Returns false if the segment does not fit the page.
+  bool segmentPage::write(uint64_t pos, const char * data, size_t len){
+    if (!page){return false;}
+    if (pos + len > (uint64_t)page.len - CMAF_SEGMENT_HEADER){
+      FAIL_MSG("Segment %s does not fit its page of %" PRIu64 " bytes", page.name.c_str(), (uint64_t)page.len);
+      return false;
+    }
+    memcpy(page.mapped + CMAF_SEGMENT_HEADER + pos, data, len);
+    __sync_synchronize();
+    volatile uint64_t * written = (uint64_t *)page.mapped;
+    if (pos + len > *written){
+      *written = pos + len;
+      changed();
+    }
+    return true;
+  }
+
+  /// Signals waiting readers that the state of the segment changed.
+  void segmentPage::changed(){
+    volatile uint32_t * counter = (uint32_t *)(page.mapped + 16);
+    __sync_fetch_and_add(counter, 1);
+    IPC::futexWake(counter);
+  }
+
+  /// Waits up to ms milliseconds for more than seen bytes to become available, for the segment to
+  /// complete, or for its writer to stop writing it.
+  /// Returns false on timeout.
+  bool segmentPage::wait(uint64_t seen, uint32_t ms){
+    if (!page){return false;}
+    volatile uint32_t * counter = (uint32_t *)(page.mapped + 16);
+    uint32_t current = *counter;
+    __sync_synchronize();
+    if (available() > seen || isDone()){return true;}
+    return IPC::futexWait(counter, current, ms);
+  }
+
+  /// Marks the segment as complete.
+  void segmentPage::finish(){
+    if (!page){return;}
+    __sync_fetch_and_or((uint32_t *)(page.mapped + 12), CMAF_SEGMENT_DONE);
+    changed();
+  }
+
+  /// Stops writing the segment, allowing another process to take over.
+  void segmentPage::drop(){
+    if (!page){return;}
+    if (__sync_bool_compare_and_swap((uint32_t *)(page.mapped + 8), (uint32_t)getpid(), 0)){changed();}
+  }
+
+  /// Returns the amount of bytes of the segment that can be sent.
+  uint64_t segmentPage::available() const{
+    if (!page){return 0;}
+    uint64_t ret = *(volatile uint64_t *)page.mapped;
+    __sync_synchronize();
+    return ret;
+  }
+
+  /// Returns a pointer to the start of the segment.
+  const char * segmentPage::data() const{
+    return page.mapped + CMAF_SEGMENT_HEADER;
+  }
+
+  /// Returns true if the segment is complete.
+  bool segmentPage::isDone() const{
+    if (!page){return false;}
+    return *(volatile uint32_t *)(page.mapped + 12) & CMAF_SEGMENT_DONE;
+  }
+
+  /// Returns true if a process claimed this segment, and that process is still running.
+  bool segmentPage::writerAlive() const{
+    if (!page){return false;}
+    pid_t writer = *(volatile uint32_t *)(page.mapped + 8);
+    if (!writer){return false;}
+    return (kill(writer, 0) == 0 || errno == EPERM);
+  }
+
+  /// Removes the page of the given segment, if there is one.
+  void segmentPage::erase(const std::string & streamName, unsigned long tid, unsigned long keyNum){
+    char pageName[NAME_BUFFER_SIZE];
+    snprintf(pageName, NAME_BUFFER_SIZE, SHM_CMAF_SEGMENT, streamName.c_str(), tid, keyNum);
+    IPC::sharedPage seg(pageName, 0, false, false);
+    seg.master = true;
+  }
+}
+
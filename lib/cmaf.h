@@ -0,0 +1,52 @@
+#pragma once
+#include <string>
+#include <deque>
+#include "dtsc.h"
+#include "shared_memory.h"
+
+/// Length of a CMAF chunk in ms. Segments are sent as a series of chunks of (at least) this length.
+#define CMAF_CHUNK_DURATION 200
+
+/// Size of a shared segment page. Pages are sparse, only the written part takes up memory.
+#define CMAF_SEGMENT_PAGE_SIZE DEFAULT_DATA_PAGE_SIZE
+
+namespace CMAF {
+  /// A single sample inside a CMAF chunk.
+  struct sample{
+    uint32_t duration;
+    uint32_t size;
+    int32_t offset;
+    bool keyframe;
+  };
+
+  std::string trackHeader(DTSC::Track & Trk);
+  void chunkHeader(std::string & out, DTSC::Track & Trk, uint32_t sequence, uint64_t baseTime, const std::deque<sample> & samples, uint64_t dataSize);
+  bool endsSegment(const DTSC::Track & Trk, uint64_t segmentStart, uint64_t segmentEnd, const DTSC::Packet & pkt);
+
+  ///\brief A single fMP4 segment of a single track, in shared memory.
+  ///
+  ///One process writes the segment as packets arrive, any number of others send it out while it is
+  ///being written, sleeping on a futex in between writes. Writers always produce the same bytes for
+  ///the same segment, so when a writer dies another process can take over by writing the segment
+  ///again from the start.
+  ///The pages are removed by the buffer, when the key they belong to is removed from the stream.
+  class segmentPage{
+    public:
+      segmentPage();
+      bool open(const std::string & streamName, unsigned long tid, unsigned long keyNum);
+      bool claim();
+      bool write(uint64_t pos, const char * data, size_t len);
+      void finish();
+      void drop();
+      uint64_t available() const;
+      const char * data() const;
+      bool isDone() const;
+      bool writerAlive() const;
+      bool wait(uint64_t seen, uint32_t ms);
+      static void erase(const std::string & streamName, unsigned long tid, unsigned long keyNum);
+    private:
+      void changed();
+      IPC::sharedPage page;
+  };
+}
+
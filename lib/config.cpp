@@ -31,8 +31,13 @@
 #include <pwd.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 
 bool Util::Config::is_active = false;
 bool Util::Config::is_restarting = false;
@@ -331,8 +336,134 @@ int Util::Config::forkServer(Socket::Server &server_socket, int (*callback)(Sock
   return 0;
 }
 
-int Util::Config::serveThreadedSocket(int (*callback)(Socket::Connection &)){
-  Socket::Server server_socket;
+/// Idle workers retire after this many milliseconds without a connection, if the pool is over target.
+#define PREFORK_IDLE_TIMEOUT 10000
+/// The pool grows to at most this many times the configured amount of spare workers.
+#define PREFORK_MAX_GROWTH 16
+
+/// State shared between a pre-forking listener and its workers, in anonymous shared memory.
+struct preforkPool{
+  volatile uint32_t idle;///< Workers waiting for a connection, including ones that are still starting.
+  volatile uint32_t target;///< Amount of idle workers the listener currently aims for.
+  volatile uint32_t accepted;///< Total amount of connections accepted by workers.
+  volatile uint32_t stopping;///< Set when the listener stops; idle workers exit when they see it.
+};
+
+/// Waits up to ms milliseconds for the listening socket to become readable.
+/// With EPOLLEXCLUSIVE only one of the idle workers is woken per incoming connection.
+static bool waitForConnection(int sock, int epfd, int ms){
+#ifdef EPOLLEXCLUSIVE
+  if (epfd != -1){
+    struct epoll_event ev;
+    return epoll_wait(epfd, &ev, 1, ms) > 0;
+  }
+#endif
+  struct pollfd pfd;
+  pfd.fd = sock;
+  pfd.events = POLLIN;
+  return poll(&pfd, 1, ms) > 0;
+}
+
+/// Body of a pre-forked worker: waits for a single connection and handles it.
+/// Retires early if the pool has more idle workers than the listener wants, or the listener stops.
+static int preforkWorker(Socket::Server &server_socket, int (*callback)(Socket::Connection &), preforkPool *pool){
+  uint64_t idleSince = Util::bootMS();
+  int epfd = -1;
+#ifdef EPOLLEXCLUSIVE
+  epfd = epoll_create(1);
+  if (epfd != -1){
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.fd = server_socket.getSocket();
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, server_socket.getSocket(), &ev) == -1){
+      ::close(epfd);
+      epfd = -1;
+    }
+  }
+#endif
+  bool retired = false;
+  while (!retired && Util::Config::is_active && server_socket.connected() && !pool->stopping){
+    if (waitForConnection(server_socket.getSocket(), epfd, 1000)){
+      Socket::Connection S = server_socket.accept();
+      if (S.connected()){
+        __sync_fetch_and_sub(&pool->idle, 1);
+        __sync_fetch_and_add(&pool->accepted, 1);
+        if (epfd != -1){::close(epfd);}
+        server_socket.drop();
+        munmap(pool, sizeof(preforkPool));
+        return callback(S);
+      }
+    }
+    if (Util::bootMS() - idleSince > PREFORK_IDLE_TIMEOUT){
+      uint32_t cur = pool->idle;
+      if (cur > pool->target && __sync_bool_compare_and_swap(&pool->idle, cur, cur - 1)){
+        HIGH_MSG("Idle worker retiring, %" PRIu32 " spare workers left", cur - 1);
+        retired = true;
+      }
+    }
+  }
+  if (!retired){__sync_fetch_and_sub(&pool->idle, 1);}
+  if (epfd != -1){::close(epfd);}
+  server_socket.drop();
+  return 0;
+}
+
+/// Like forkServer, but forks workers before connections arrive instead of after.
+/// At least spare workers are kept waiting on the listening socket. When connections come in faster
+/// than that, the pool grows to match the connection rate of the last second, up to
+/// PREFORK_MAX_GROWTH times spare. Surplus workers retire after PREFORK_IDLE_TIMEOUT.
+/// Every worker handles a single connection, exactly like a child of forkServer would.
+int Util::Config::preforkServer(Socket::Server &server_socket, int (*callback)(Socket::Connection &), uint32_t spare){
+  preforkPool *pool = (preforkPool *)mmap(0, sizeof(preforkPool), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (pool == MAP_FAILED){
+    WARN_MSG("Could not allocate worker pool, forking per connection instead: %s", strerror(errno));
+    return forkServer(server_socket, callback);
+  }
+  memset(pool, 0, sizeof(preforkPool));
+  pool->target = spare;
+  uint32_t maxSpare = spare * PREFORK_MAX_GROWTH;
+  uint32_t lastAccepted = 0;
+  uint64_t lastRate = Util::bootMS();
+  Util::Procs::socketList.insert(server_socket.getSocket());
+  while (is_active && server_socket.connected()){
+    uint64_t now = Util::bootMS();
+    if (now - lastRate >= 1000){
+      uint32_t rate = pool->accepted - lastAccepted;
+      lastAccepted += rate;
+      lastRate = now;
+      pool->target = std::max(spare, std::min(rate, maxSpare));
+    }
+    while (is_active && pool->idle < pool->target){
+      __sync_fetch_and_add(&pool->idle, 1);
+      pid_t myid = fork();
+      if (myid == 0){
+        //workers must never shut down the shared listening socket from a signal handler
+        serv_sock_pointer = 0;
+        return preforkWorker(server_socket, callback, pool);
+      }
+      if (myid < 0){
+        __sync_fetch_and_sub(&pool->idle, 1);
+        FAIL_MSG("Could not fork worker: %s", strerror(errno));
+        break;
+      }
+      HIGH_MSG("Forked new worker process %i", (int)myid);
+    }
+    Util::sleep(10);
+  }
+  pool->stopping = 1;
+  Util::Procs::socketList.erase(server_socket.getSocket());
+  if (!is_restarting){
+    server_socket.close();
+  }
+  munmap(pool, sizeof(preforkPool));
+  return 0;
+}
+
+/// Opens the listening socket shared by all serve*Socket functions and activates the config.
+/// Uses an already listening socket on fd 0 if there is one, else the configured "socket", or
+/// "port" and "interface". The opened socket is moved to fd 0 where possible.
+/// Returns false if no socket could be opened.
+bool Util::Config::openServeSocket(Socket::Server &server_socket){
   if (Socket::checkTrueSocket(0)){
     server_socket = Socket::Server(0);
   }else if (vals.isMember("socket")){
@@ -342,7 +473,7 @@ int Util::Config::serveThreadedSocket(int (*callback)(Socket::Connection &)){
   }
   if (!server_socket.connected()){
     DEVEL_MSG("Failure to open socket");
-    return 1;
+    return false;
   }
   Socket::getSocketName(server_socket.getSocket(), Util::listenInterface, Util::listenPort);
   serv_sock_pointer = &server_socket;
@@ -354,6 +485,12 @@ int Util::Config::serveThreadedSocket(int (*callback)(Socket::Connection &)){
       close(oldSock);
     }
   }
+  return true;
+}
+
+int Util::Config::serveThreadedSocket(int (*callback)(Socket::Connection &)){
+  Socket::Server server_socket;
+  if (!openServeSocket(server_socket)){return 1;}
   int r = threadServer(server_socket, callback);
   serv_sock_pointer = 0;
   return r;
@@ -361,28 +498,27 @@ int Util::Config::serveThreadedSocket(int (*callback)(Socket::Connection &)){
 
 int Util::Config::serveForkedSocket(int (*callback)(Socket::Connection &S)){
   Socket::Server server_socket;
-  if (Socket::checkTrueSocket(0)){
-    server_socket = Socket::Server(0);
-  }else if (vals.isMember("socket")){
-    server_socket = Socket::Server(Util::getTmpFolder() + getString("socket"));
-  } else if (vals.isMember("port") && vals.isMember("interface")){
-    server_socket = Socket::Server(getInteger("port"), getString("interface"), false);
-  }
-  if (!server_socket.connected()){
-    DEVEL_MSG("Failure to open socket");
-    return 1;
-  }
-  Socket::getSocketName(server_socket.getSocket(), Util::listenInterface, Util::listenPort);
-  serv_sock_pointer = &server_socket;
-  activate();
-  if (server_socket.getSocket()){
-    int oldSock = server_socket.getSocket();
-    if (!dup2(oldSock, 0)){
-      server_socket = Socket::Server(0);
-      close(oldSock);
-    }
+  if (!openServeSocket(server_socket)){return 1;}
+  int r;
+  if (vals.isMember("prefork") && getInteger("prefork") > 0){
+    r = preforkServer(server_socket, callback, getInteger("prefork"));
+  }else{
+    r = forkServer(server_socket, callback);
   }
-  int r = forkServer(server_socket, callback);
+  serv_sock_pointer = 0;
+  return r;
+}
+
+/// Opens the configured listening socket like serveThreadedSocket does, but instead of spawning a
+/// thread per accepted connection the socket is handed to the given loop function as a whole.
+/// The loop is expected to run until is_active becomes false or the socket is closed.
+int Util::Config::serveEventSocket(int (*loop)(Socket::Server &S)){
+  Socket::Server server_socket;
+  if (!openServeSocket(server_socket)){return 1;}
+  Util::Procs::socketList.insert(server_socket.getSocket());
+  int r = loop(server_socket);
+  Util::Procs::socketList.erase(server_socket.getSocket());
+  server_socket.close();
   serv_sock_pointer = 0;
   return r;
 }
@@ -527,6 +663,15 @@ void Util::Config::addConnectorOptions(int port, JSON::Value &capabilities){
   capabilities["optional"]["interface"]["short"] = "i";
   capabilities["optional"]["interface"]["type"] = "str";
 
+  capabilities["optional"]["prefork"]["name"] = "Pre-forked workers";
+  capabilities["optional"]["prefork"]["help"] =
+      "Amount of idle worker processes to keep ready for new connections. The pool grows with the "
+      "connection rate and shrinks again when idle. Zero forks a process per connection instead.";
+  capabilities["optional"]["prefork"]["type"] = "uint";
+  capabilities["optional"]["prefork"]["short"] = "P";
+  capabilities["optional"]["prefork"]["option"] = "--prefork";
+  capabilities["optional"]["prefork"]["default"] = (int64_t)0;
+
   addBasicConnectorOptions(capabilities);
 }// addConnectorOptions
 
@@ -20,6 +20,7 @@ namespace Util{
     JSON::Value vals; ///< Holds all current config values
     int long_count;
     static void signal_handler(int signum, siginfo_t *sigInfo, void *ignore);
+    bool openServeSocket(Socket::Server &server_socket);
 
   public:
     // variables
@@ -41,9 +42,11 @@ namespace Util{
     void activate();
     int threadServer(Socket::Server &server_socket, int (*callback)(Socket::Connection &S));
     int forkServer(Socket::Server &server_socket, int (*callback)(Socket::Connection &S));
+    int preforkServer(Socket::Server &server_socket, int (*callback)(Socket::Connection &S), uint32_t spare);
     int serveThreadedSocket(int (*callback)(Socket::Connection &S));
     int serveForkedSocket(int (*callback)(Socket::Connection &S));
     int servePlainSocket(int (*callback)(Socket::Connection &S));
+    int serveEventSocket(int (*loop)(Socket::Server &S));
     void addOptionsFromCapabilities(const JSON::Value &capabilities);
     void addBasicConnectorOptions(JSON::Value &capabilities);
     void addConnectorOptions(int port, JSON::Value &capabilities);
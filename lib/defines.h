@@ -116,6 +116,13 @@ static inline void show_stackframe(){}
 /// The size used for stream data pages under Windows, where they cannot be size-detected.
 #define DEFAULT_DATA_PAGE_SIZE SHM_DATASIZE * 1024 * 1024
 
+/// Size of a huge page. Live data pages are sized in multiples of this, and large shared memory
+/// pages are mapped with huge page advice where the platform supports it.
+#define SHM_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+/// The smallest data page allocated for a live track, used for low bitrate tracks.
+#define MIN_DATA_PAGE_SIZE SHM_HUGEPAGE_SIZE
+
 /// The size used for server configuration pages.
 #define DEFAULT_CONF_PAGE_SIZE 4 * 1024 * 1024
 
@@ -127,6 +134,11 @@ static inline void show_stackframe(){}
 /// Does not affect live streams.
 #define FLIP_MIN_DURATION 20000
 
+/// Amount of file data a single header generation thread parses in one go.
+#define HEADER_CHUNK_SIZE (32 * 1024 * 1024)
+/// Maximum amount of threads used to generate a single header.
+#define HEADER_MAX_THREADS 8
+
 /// Interval where the input refreshes the user data for stats etc.
 #define INPUT_USER_INTERVAL 1000
 
@@ -144,8 +156,25 @@ static inline void show_stackframe(){}
 #define SHM_TRACK_INDEX "MstTRID%s@%lu" //%s stream name, %lu track ID
 #define SHM_TRACK_INDEX_SIZE 8192
 #define SHM_TRACK_DATA "MstDATA%s@%lu_%lu" //%s stream name, %lu track ID, %lu page #
+#define SHM_CMAF_SEGMENT "MstCMAF%s@%lu_%lu" //%s stream name, %lu track ID, %lu key #
 #define SHM_STATISTICS "MstSTAT"
 #define SHM_USERS "MstUSER%s" //%s stream name
+#define SHM_PAGE_REQUESTS "MstPREQ%s" //%s stream name
+#define SHM_TRACK_NEGOTIATION "MstTNEG%s" //%s stream name
+#define SHM_BUFFER_HOST "MstBHST"
+#define SHM_MANIFESTS "MstMANI%s" //%s stream name
+/// Amount of manifests the manifest cache of a stream can hold.
+#define MANIFEST_CACHE_SLOTS 32
+/// Room for a single cached manifest. Pages are sparse, only the used part takes up memory.
+#define MANIFEST_CACHE_SLOT_SIZE (512 * 1024)
+/// Amount of live streams a single buffer host process can serve.
+#define BUFFER_HOST_STREAMS 4096
+/// Room for the buffer arguments of one hosted stream.
+#define BUFFER_HOST_ARGS_SIZE 1024
+/// Amount of tracks that can be negotiated with the buffer at the same time.
+#define TRACK_NEG_RECORDS 1024
+/// Temporary track ids used while negotiating through the negotiation channel start here.
+#define TRACK_NEG_TEMP_BASE 0x10000
 #define SEM_LIVE "/MstLIVE%s" //%s stream name
 #define SEM_INPUT "/MstInpt%s" //%s stream name
 #define SHM_CAPA "MstCapa"
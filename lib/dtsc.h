@@ -89,6 +89,7 @@ namespace DTSC {
       Scan getIndice(size_t num) const;
       std::string getIndiceName(size_t num) const;
       size_t getSize() const;
+      bool nextMember(size_t & cursor, Scan & value, const char *& name, size_t & nameLen) const;
 
       char getType() const;
       bool asBool() const;
@@ -284,6 +285,7 @@ namespace DTSC {
       Track();      
       Track(JSON::Value & trackRef);
       Track(Scan & trackRef);
+      void reinit(Scan & trackRef);
       void clearParts();
             
       inline operator bool() const {
@@ -329,7 +331,9 @@ namespace DTSC {
       int height;
       int fpks;
       void removeFirstKey();
+      void removeFirstKeys(size_t count);
       uint32_t secsSinceFirstFragmentInsert();
+      uint32_t secsSinceFragmentInsert(size_t fragIndex);
     private:
       std::string cachedIdent;
       std::deque<uint32_t> fragInsertTime;
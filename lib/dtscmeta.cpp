@@ -724,6 +724,39 @@ namespace DTSC {
     return "";
   }
   
+  /// Steps to the next member of this object or array, in a single pass.
+  /// Unlike getIndice and getMember, which scan from the start on every call, this continues
+  /// from the given cursor. Start with a cursor of zero; returns false after the last member.
+  /// For arrays, name is set to null and nameLen to zero.
+  bool Scan::nextMember(size_t & cursor, Scan & value, const char *& name, size_t & nameLen) const {
+    char type = getType();
+    if (type != DTSC_OBJ && type != DTSC_CON && type != DTSC_ARR) {
+      return false;
+    }
+    char * i = p + (cursor ? cursor : 1);
+    char * max = p + len;
+    if (i + 1 >= max || i[0] + i[1] == 0) {
+      return false;
+    }
+    name = 0;
+    nameLen = 0;
+    if (type != DTSC_ARR) {
+      if (i + 2 >= max) {
+        return false;//out of packet!
+      }
+      nameLen = Bit::btohs(i);
+      name = i + 2;
+      i += 2 + nameLen;
+    }
+    char * next = skipDTSC(i, max);
+    if (!next) {
+      return false;
+    }
+    value = Scan(i, next - i);
+    cursor = next - p;
+    return true;
+  }
+
   /// Returns the first byte of this DTSC value, or 0 on error.
   char Scan::getType() const {
     if (!p) {
@@ -1171,62 +1204,113 @@ namespace DTSC {
     }
   }
 
-  ///\brief Constructs a track from a JSON::Value
+  ///\brief Constructs a track from a DTSC::Scan
   Track::Track(Scan & trackRef) {
-    if (trackRef.getMember("fragments").getType() == DTSC_STR) {
-      char * tmp = 0;
-      size_t tmplen = 0;
-      trackRef.getMember("fragments").getString(tmp, tmplen);
-      fragments = std::deque<Fragment>((Fragment *)tmp, ((Fragment *)tmp) + (tmplen / PACKED_FRAGMENT_SIZE));
-    }
-    if (trackRef.getMember("keys").getType() == DTSC_STR) {
-      char * tmp = 0;
-      size_t tmplen = 0;
-      trackRef.getMember("keys").getString(tmp, tmplen);
-      keys = std::deque<Key>((Key *)tmp, ((Key *)tmp) + (tmplen / PACKED_KEY_SIZE));
-    }
-    if (trackRef.getMember("parts").getType() == DTSC_STR) {
-      char * tmp = 0;
-      size_t tmplen = 0;
-      trackRef.getMember("parts").getString(tmp, tmplen);
-      parts = std::deque<Part>((Part *)tmp, ((Part *)tmp) + (tmplen / 9));
-    }
-    trackID = trackRef.getMember("trackid").asInt();
-    firstms = trackRef.getMember("firstms").asInt();
-    lastms = trackRef.getMember("lastms").asInt();
-    bps = trackRef.getMember("bps").asInt();
-    max_bps = trackRef.getMember("maxbps").asInt();
-    missedFrags = trackRef.getMember("missed_frags").asInt();
-    codec = trackRef.getMember("codec").asString();
-    type = trackRef.getMember("type").asString();
-    init = trackRef.getMember("init").asString();
-    if (trackRef.getMember("lang")){
-      lang = trackRef.getMember("lang").asString();
-    }
-    if (type == "audio") {
-      rate = trackRef.getMember("rate").asInt();
-      size = trackRef.getMember("size").asInt();
-      channels = trackRef.getMember("channels").asInt();
-    }
-    if (type == "video") {
-      width = trackRef.getMember("width").asInt();
-      height = trackRef.getMember("height").asInt();
-      fpks = trackRef.getMember("fpks").asInt();
-    }
-    if (trackRef.getMember("keysizes").getType() == DTSC_STR) {
-      char * tmp = 0;
-      size_t tmplen = 0;
-      trackRef.getMember("keysizes").getString(tmp, tmplen);
-      for (unsigned int i = 0; i < tmplen; i += 4){
-        keySizes.push_back((((long unsigned)tmp[i]) << 24) | (((long unsigned)tmp[i+1]) << 16) | (((long unsigned int)tmp[i+2]) << 8) | tmp[i+3]);
+    reinit(trackRef);
+  }
+
+  /// Returns true if the member name equals the given string literal.
+  static inline bool memberIs(const char * name, size_t nameLen, const char * lit, size_t litLen) {
+    return nameLen == litLen && !memcmp(name, lit, litLen);
+  }
+#define MEMBER_IS(lit) memberIs(name, nameLen, lit, sizeof(lit) - 1)
+
+  ///\brief Replaces the contents of this track with the track stored in a DTSC::Scan.
+  ///Walks the members of the track object once, copying the packed fragment, key and part
+  ///arrays straight into their containers.
+  void Track::reinit(Scan & trackRef) {
+    fragments.clear();
+    keys.clear();
+    keySizes.clear();
+    parts.clear();
+    trackID = 0;
+    firstms = 0;
+    lastms = 0;
+    bps = 0;
+    max_bps = 0;
+    missedFrags = 0;
+    codec.clear();
+    type.clear();
+    init.clear();
+    lang.clear();
+    rate = 0;
+    size = 0;
+    channels = 0;
+    width = 0;
+    height = 0;
+    fpks = 0;
+    minKeepAway = 0;
+    cachedIdent.clear();
+    fragInsertTime.clear();
+    size_t cursor = 0;
+    Scan val;
+    const char * name = 0;
+    size_t nameLen = 0;
+    while (trackRef.nextMember(cursor, val, name, nameLen)) {
+      if (val.getType() == DTSC_STR && (MEMBER_IS("fragments") || MEMBER_IS("keys") || MEMBER_IS("parts") || MEMBER_IS("keysizes"))) {
+        char * tmp = 0;
+        size_t tmplen = 0;
+        val.getString(tmp, tmplen);
+        if (MEMBER_IS("fragments")) {
+          fragments.assign((Fragment *)tmp, ((Fragment *)tmp) + (tmplen / PACKED_FRAGMENT_SIZE));
+        } else if (MEMBER_IS("keys")) {
+          keys.assign((Key *)tmp, ((Key *)tmp) + (tmplen / PACKED_KEY_SIZE));
+        } else if (MEMBER_IS("parts")) {
+          parts.assign((Part *)tmp, ((Part *)tmp) + (tmplen / 9));
+        } else {
+          for (unsigned int i = 0; i + 3 < tmplen; i += 4){
+            keySizes.push_back((((long unsigned)tmp[i]) << 24) | (((long unsigned)tmp[i+1]) << 16) | (((long unsigned int)tmp[i+2]) << 8) | tmp[i+3]);
+          }
+        }
+      } else if (MEMBER_IS("trackid")) {
+        trackID = val.asInt();
+      } else if (MEMBER_IS("firstms")) {
+        firstms = val.asInt();
+      } else if (MEMBER_IS("lastms")) {
+        lastms = val.asInt();
+      } else if (MEMBER_IS("bps")) {
+        bps = val.asInt();
+      } else if (MEMBER_IS("maxbps")) {
+        max_bps = val.asInt();
+      } else if (MEMBER_IS("missed_frags")) {
+        missedFrags = val.asInt();
+      } else if (MEMBER_IS("codec")) {
+        codec = val.asString();
+      } else if (MEMBER_IS("type")) {
+        type = val.asString();
+      } else if (MEMBER_IS("init")) {
+        init = val.asString();
+      } else if (MEMBER_IS("lang")) {
+        lang = val.asString();
+      } else if (MEMBER_IS("rate")) {
+        rate = val.asInt();
+      } else if (MEMBER_IS("size")) {
+        size = val.asInt();
+      } else if (MEMBER_IS("channels")) {
+        channels = val.asInt();
+      } else if (MEMBER_IS("width")) {
+        width = val.asInt();
+      } else if (MEMBER_IS("height")) {
+        height = val.asInt();
+      } else if (MEMBER_IS("fpks")) {
+        fpks = val.asInt();
+      } else if (MEMBER_IS("keepaway") && val.getType() == DTSC_INT) {
+        minKeepAway = val.asInt();
       }
     }
-    if (trackRef.getMember("keepaway").getType() == DTSC_INT){
-      minKeepAway = trackRef.getMember("keepaway").asInt();
-    }else{
-      minKeepAway = 0;
+    //audio and video properties only apply to their own track type
+    if (type != "audio") {
+      rate = 0;
+      size = 0;
+      channels = 0;
+    }
+    if (type != "video") {
+      width = 0;
+      height = 0;
+      fpks = 0;
     }
   }
+#undef MEMBER_IS
 
   ///\brief Updates a track and its metadata given new packet properties.
   ///Will also insert keyframes on non-video tracks, and creates fragments
@@ -1328,15 +1412,42 @@ namespace DTSC {
     }
   }
 
+  /// Removes the first count keys at once, with their parts and any fragments no longer fully buffered.
+  /// Equivalent to calling removeFirstKey count times, but touches every container only once.
+  /// Always leaves at least one key in place.
+  void Track::removeFirstKeys(size_t count){
+    if (count >= keys.size()){count = keys.size() - 1;}
+    if (!count){return;}
+    HIGH_MSG("Erasing keys %d:%lu-%lu", trackID, keys[0].getNumber(), keys[count - 1].getNumber());
+    size_t partCount = 0;
+    for (size_t i = 0; i < count; ++i){partCount += keys[i].getParts();}
+    parts.erase(parts.begin(), parts.begin() + std::min(partCount, parts.size()));
+    keys.erase(keys.begin(), keys.begin() + count);
+    keySizes.erase(keySizes.begin(), keySizes.begin() + std::min(count, keySizes.size()));
+    firstms = keys[0].getTime();
+    size_t fragCount = 0;
+    while (fragCount < fragments.size() && fragments[fragCount].getNumber() < keys[0].getNumber()){++fragCount;}
+    fragments.erase(fragments.begin(), fragments.begin() + fragCount);
+    fragInsertTime.erase(fragInsertTime.begin(), fragInsertTime.begin() + std::min(fragCount, fragInsertTime.size()));
+    missedFrags += fragCount;
+  }
+
   /// Returns the amount of whole seconds since the first fragment was inserted into the buffer.
   /// This assumes playback from the start of the buffer at time of insert, meaning that
   /// the time is offset by that difference. E.g.: if a buffer is 50s long, the newest fragment
   /// will have a value of 0 until 50s have passed, after which it will increase at a rate of
   /// 1 per second.
   uint32_t Track::secsSinceFirstFragmentInsert(){
+    return secsSinceFragmentInsert(0);
+  }
+
+  /// Returns the amount of whole seconds since the fragment at the given index was inserted into
+  /// the buffer, in the same way as secsSinceFirstFragmentInsert.
+  uint32_t Track::secsSinceFragmentInsert(size_t fragIndex){
+    if (fragIndex >= fragInsertTime.size()){return 0;}
     uint32_t bs = Util::bootSecs();
-    if (bs > fragInsertTime.front()){
-      return bs - fragInsertTime.front();
+    if (bs > fragInsertTime[fragIndex]){
+      return bs - fragInsertTime[fragIndex];
     }else{
       return 0;
     }
@@ -1449,18 +1560,16 @@ namespace DTSC {
       inputLocalVars = source.getScan().getMember("inputlocalvars").asJSON();
     }
     Scan tmpTracks = source.getScan().getMember("tracks");
-    unsigned int num = 0;
+    size_t cursor = 0;
     Scan tmpTrack;
-    do {
-      tmpTrack = tmpTracks.getIndice(num);
-      if (tmpTrack.asBool()) {
-        unsigned int trackId = tmpTrack.getMember("trackid").asInt();
-        if (trackId) {
-          tracks[trackId] = Track(tmpTrack);
-        }
-        num++;
+    const char * name = 0;
+    size_t nameLen = 0;
+    while (tmpTracks.nextMember(cursor, tmpTrack, name, nameLen) && tmpTrack.asBool()) {
+      unsigned int trackId = tmpTrack.getMember("trackid").asInt();
+      if (trackId) {
+        tracks[trackId].reinit(tmpTrack);
       }
-    } while (tmpTrack.asBool());
+    }
   }
 
   ///\brief Creates a meta object from a JSON::Value
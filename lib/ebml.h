@@ -1,3 +1,4 @@
+#pragma once
 #include <stdint.h>
 #include <string>
 
@@ -75,6 +76,8 @@ namespace EBML{
     EID_CUETIME = 0x33,
     EID_CUEPOINT = 0x3B,
     EID_TAGS = 0x254c367,
+    EID_CHAPTERS = 0x43a770,
+    EID_ATTACHMENTS = 0x941a469,
     EID_CODECDELAY = 0x16AA,
     EID_SEEKPREROLL = 0x16BB,
     EID_UNKNOWN = 0
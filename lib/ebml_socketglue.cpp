@@ -2,6 +2,18 @@
 
 namespace EBML{
 
+  /// Writes val as an EBML variable size integer to p, the way sendUniInt would send it.
+  /// Returns the amount of bytes written, at most 8.
+  static uint8_t writeUniInt(char *p, const uint64_t val){
+    uint8_t wSize = UniInt::writeSize(val);
+    if (!wSize){
+      p[0] = '\377'; // Unknown size, all ones.
+      return 1;
+    }
+    UniInt::writeInt(p, val);
+    return wSize;
+  }
+
   void sendUniInt(Socket::Connection &C, const uint64_t val){
     uint8_t wSize = UniInt::writeSize(val);
     if (!wSize){
@@ -142,15 +154,24 @@ namespace EBML{
     char *dataPointer = 0;
     pkt.getString("data", dataPointer, dataLen);
     uint32_t blockSize = UniInt::writeSize(pkt.getTrackId()) + 3 + dataLen;
-    sendElemHead(C, EID_SIMPLEBLOCK, blockSize);
-    sendUniInt(C, pkt.getTrackId());
-    char blockHead[3] ={0, 0, 0};
-    if (pkt.hasMember("keyframe") || forceKeyframe){blockHead[2] = 0x80;}
+    // element head, track number and block head are built in one buffer, then sent with the data
+    char head[24];
+    char *p = head;
+    p += writeUniInt(p, EID_SIMPLEBLOCK);
+    p += writeUniInt(p, blockSize);
+    p += writeUniInt(p, pkt.getTrackId());
+    p[0] = p[1] = p[2] = 0;
+    if (pkt.hasMember("keyframe") || forceKeyframe){p[2] = 0x80;}
     int offset = 0;
     if (pkt.hasMember("offset")){offset = pkt.getInt("offset");}
-    Bit::htobs(blockHead, (int16_t)(pkt.getTime() + offset - clusterTime));
-    C.SendNow(blockHead, 3);
-    C.SendNow(dataPointer, dataLen);
+    Bit::htobs(p, (int16_t)(pkt.getTime() + offset - clusterTime));
+    p += 3;
+    struct iovec parts[2];
+    parts[0].iov_base = head;
+    parts[0].iov_len = p - head;
+    parts[1].iov_base = dataPointer;
+    parts[1].iov_len = dataLen;
+    C.SendNow(parts, 2);
   }
 
   uint32_t sizeSimpleBlock(uint64_t trackId, uint32_t dataSize){
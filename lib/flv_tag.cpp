@@ -260,6 +260,7 @@ FLV::Tag::Tag(){
   len = 0;
   buf = 0;
   data = 0;
+  external = false;
   isKeyframe = false;
   done = true;
   sofar = 0;
@@ -273,7 +274,9 @@ FLV::Tag::Tag(const Tag &O){
   done = true;
   sofar = 0;
   len = O.len;
+  buf = 0;
   data = 0;
+  external = false;
   if (len > 0){
     if (checkBufferSize()){memcpy(data, O.data, len);}
   }
@@ -288,6 +291,7 @@ FLV::Tag::Tag(const RTMPStream::Chunk &O){
   len = 0;
   buf = 0;
   data = 0;
+  external = false;
   isKeyframe = false;
   done = true;
   sofar = 0;
@@ -297,7 +301,7 @@ FLV::Tag::Tag(const RTMPStream::Chunk &O){
 /// Generic destructor that frees the allocated memory in the internal data variable, if any.
 FLV::Tag::~Tag(){
   if (data){
-    free(data);
+    if (!external){free(data);}
     data = 0;
     buf = 0;
     len = 0;
@@ -705,6 +709,37 @@ bool FLV::Tag::MemLoader(char *D, unsigned int S, unsigned int &P){
   return false;
 }// Tag::MemLoader
 
+/// Points this tag at the whole tag at position P of a data buffer in memory, without copying it.
+/// The tag is only valid for as long as the buffer is, and must not be modified through the setters.
+/// Any of the loader functions make the tag use a buffer of its own again.
+/// \param D The location of the data buffer.
+/// \param S The size of the data buffer.
+/// \param P The position of the tag in the data buffer. Moved past the tag on success.
+/// \return True if a whole tag is present at P, false otherwise.
+bool FLV::Tag::MemView(char *D, uint64_t S, uint64_t &P){
+  if (P + 15 > S){return false;}
+  char *T = D + P;
+  if (T[0] > 0x12){
+    FLV::Parse_Error = true;
+    Error_Str = "Invalid Tag received (";
+    Error_Str += (char)(T[0] + 32);
+    Error_Str += ").";
+    return false;
+  }
+  uint64_t tagLen = (T[1] << 16) + (T[2] << 8) + T[3] + 15;
+  if (P + tagLen > S){return false;}
+  if (data && !external){free(data);}
+  external = true;
+  data = T;
+  len = tagLen;
+  buf = 0;
+  done = true;
+  sofar = 0;
+  isKeyframe = ((data[0] == 0x09) && (((data[11] & 0xf0) >> 4) == 1));
+  P += tagLen;
+  return true;
+}
+
 /// Helper function for FLV::FileLoader.
 /// This function will try to read count bytes from file f into buffer.
 /// This function should be called repeatedly until true.
@@ -942,6 +977,12 @@ void FLV::Tag::toMeta(DTSC::Meta &metadata, AMF::Object &amf_storage, unsigned i
 /// Attempts to resize data buffer if not/
 /// \returns True if buffer is large enough, false otherwise.
 bool FLV::Tag::checkBufferSize(){
+  if (external){
+    //stop viewing the external tag, and start out with a buffer of our own
+    external = false;
+    data = 0;
+    buf = 0;
+  }
   if (buf < len || !data){
     char *newdata = (char *)realloc(data, len);
     // on realloc fail, retain the old data
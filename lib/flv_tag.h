@@ -57,6 +57,7 @@ namespace FLV{
     bool DTSCMetaInit(DTSC::Meta &M, std::set<long unsigned int> &selTracks);
     void toMeta(DTSC::Meta &metadata, AMF::Object &amf_storage, unsigned int reTrack = 0);
     bool MemLoader(char *D, unsigned int S, unsigned int &P);
+    bool MemView(char *D, uint64_t S, uint64_t &P);
     bool FileLoader(FILE *f);
     unsigned int getTrackID();
     char *getData();
@@ -64,6 +65,7 @@ namespace FLV{
 
   protected:
     int buf;            ///< Maximum length of buffer space.
+    bool external;      ///< True if data points into memory this tag does not own, see MemView.
     bool done;          ///< Body reading done?
     unsigned int sofar; ///< How many bytes are read sofar?
     void setLen();
@@ -801,11 +801,15 @@ void HTTP::Parser::Chunkify(const char *data, unsigned int size, Socket::Connect
       len[--offset] = hexa[t_size & 0xf];
       t_size >>= 4;
     }
-    conn.SendNow(len + offset, 10 - offset);
-    // send the chunk itself
-    conn.SendNow(data, size);
-    // append \r\n
-    conn.SendNow("\r\n", 2);
+    // send size line, the chunk itself and the trailing \r\n in a single write
+    struct iovec parts[3];
+    parts[0].iov_base = len + offset;
+    parts[0].iov_len = 10 - offset;
+    parts[1].iov_base = (void *)data;
+    parts[1].iov_len = size;
+    parts[2].iov_base = (void *)"\r\n";
+    parts[2].iov_len = 2;
+    conn.SendNow(parts, 3);
   }else{
     // just send the chunk itself
     conn.SendNow(data, size);
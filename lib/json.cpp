@@ -3,8 +3,10 @@
 #include "json.h"
 #include "bitfields.h"
 #include "defines.h"
+#include "util.h"
 #include <arpa/inet.h> //for htonl
 #include <fstream>
+#include <iterator>
 #include <sstream>
 #include <stdint.h> //for uint64_t
 #include <stdlib.h>
@@ -241,6 +243,69 @@ static std::string read_string(char separator, std::istream &fromstream){
   return out;
 }
 
+/// Buffer counterpart of read_string: reads a string up to the separator, advancing p past it.
+/// Unescaped runs are appended in one go instead of character by character.
+static void read_string(char separator, const char *&p, const char *end, std::string &out){
+  uint32_t fullChar = 0;
+  while (p < end){
+    if (*p != '\\'){
+      if (fullChar){
+        out += UTF8(fullChar >> 16);
+        fullChar = 0;
+      }
+      const char *run = p;
+      while (p < end && *p != separator && *p != '\\'){++p;}
+      out.append(run, p - run);
+      if (p < end && *p == separator){
+        ++p;
+        return;
+      }
+      continue;
+    }
+    if (++p >= end){break;}
+    char c = *(p++);
+    if (fullChar && c != 'u'){
+      out += UTF8(fullChar >> 16);
+      fullChar = 0;
+    }
+    switch (c){
+    case 'b': out += '\b'; break;
+    case '\\': out += '\\'; break;
+    case 'f': out += '\f'; break;
+    case 'n': out += '\n'; break;
+    case 'r': out += '\r'; break;
+    case 't': out += '\t'; break;
+    case 'x':{
+      char d1 = (p < end) ? *(p++) : 0;
+      char d2 = (p < end) ? *(p++) : 0;
+      out.append(1, (c2hex(d2) + (c2hex(d1) << 4)));
+      break;
+    }
+    case 'u':{
+      char d[4];
+      for (int j = 0; j < 4; ++j){d[j] = (p < end) ? *(p++) : 0;}
+      uint32_t tmpChar = (c2hex(d[3]) + (c2hex(d[2]) << 4) + (c2hex(d[1]) << 8) + (c2hex(d[0]) << 16));
+      if (fullChar && (tmpChar < 0xDC00 || tmpChar > 0xDFFF)){
+        // not a low surrogate - handle high surrogate separately!
+        out += UTF8(fullChar >> 16);
+        fullChar = 0;
+      }
+      fullChar |= tmpChar;
+      if (fullChar >= 0xD800 && fullChar <= 0xDBFF){
+        // possibly high surrogate! Read next characters before handling...
+        fullChar <<= 16; // save as high surrogate
+      }else{
+        out += UTF8(fullChar);
+        fullChar = 0;
+      }
+      break;
+    }
+    default: out.append(1, c); break;
+    }
+  }
+  if (fullChar){out += UTF8(fullChar >> 16);}
+}
+
 static std::string UTF16(uint32_t c){
   if (c > 0xFFFF){
     c -= 0x010000;
@@ -254,9 +319,18 @@ static std::string UTF16(uint32_t c){
   return ret;
 }
 
-std::string JSON::string_escape(const std::string &val){
-  std::string out = "\"";
+/// Appends the JSON-escaped form of val to out, including the surrounding quotes.
+static void string_escape(const std::string &val, std::string &out){
+  out += '"';
   for (size_t i = 0; i < val.size(); ++i){
+    // copy runs of characters that need no escaping in one go
+    size_t run = i;
+    while (run < val.size() && val[run] >= 32 && val[run] <= 126 && val[run] != '"' && val[run] != '\\'){++run;}
+    if (run != i){
+      out.append(val.data() + i, run - i);
+      i = run;
+      if (i >= val.size()){break;}
+    }
     const char &c = val.data()[i];
     switch (c){
     case '"': out += "\\\""; break;
@@ -311,7 +385,13 @@ std::string JSON::string_escape(const std::string &val){
       break;
     }
   }
-  out += "\"";
+  out += '"';
+}
+
+std::string JSON::string_escape(const std::string &val){
+  std::string out;
+  out.reserve(val.size() + 2);
+  ::string_escape(val, out);
   return out;
 }
 
@@ -456,6 +536,120 @@ JSON::Value::Value(std::istream &fromstream){
   if (negative){intVal *= -1;}
 }
 
+/// Parses a value from the buffer in a single pass, advancing p past it.
+/// Follows the same rules as the std::istream constructor, but builds members and elements
+/// directly in place instead of parsing them into temporaries and copying those over.
+void JSON::Value::parse(const char *&p, const char *end){
+  null();
+  bool reading_object = false;
+  bool reading_array = false;
+  bool negative = false;
+  bool stop = false;
+  while (!stop && p < end){
+    char c = *p;
+    switch (c){
+    case '{':
+      reading_object = true;
+      ++p;
+      myType = OBJECT;
+      break;
+    case '[':
+      reading_array = true;
+      ++p;
+      myType = ARRAY;
+      arrVal.push_back(new Value());
+      arrVal.back()->parse(p, end);
+      if (arrVal.back()->myType == EMPTY){
+        delete arrVal.back();
+        arrVal.pop_back();
+      }
+      break;
+    case '\'':
+    case '"':
+      ++p;
+      if (!reading_object){
+        myType = STRING;
+        read_string(c, p, end, strVal);
+        stop = true;
+      }else{
+        std::string tmpstr;
+        read_string(c, p, end, tmpstr);
+        (*this)[tmpstr].parse(p, end);
+      }
+      break;
+    case '-':
+      ++p;
+      negative = true;
+      break;
+    case '0':
+    case '1':
+    case '2':
+    case '3':
+    case '4':
+    case '5':
+    case '6':
+    case '7':
+    case '8':
+    case '9':
+      ++p;
+      if (myType != INTEGER && myType != DOUBLE){myType = INTEGER;}
+      if (myType == INTEGER){
+        intVal *= 10;
+        intVal += c - '0';
+      }else{
+        dblDivider *= 10;
+        dblVal += ((double)((c - '0')) / dblDivider);
+      }
+      break;
+    case '.':
+      ++p;
+      myType = DOUBLE;
+      if (negative){
+        dblVal = -intVal;
+        dblDivider = -1;
+      }else{
+        dblVal = intVal;
+        dblDivider = 1;
+      }
+      break;
+    case ',':
+      if (!reading_object && !reading_array){
+        stop = true;
+        break;
+      }
+      ++p;
+      if (reading_array){
+        append(Value());
+        arrVal.back()->parse(p, end);
+      }
+      break;
+    case '}':
+      if (reading_object){++p;}
+      stop = true;
+      break;
+    case ']':
+      if (reading_array){++p;}
+      stop = true;
+      break;
+    case 't':
+    case 'T':
+    case 'f':
+    case 'F':
+    case 'n':
+    case 'N':
+      while (p < end && *p != ',' && *p != ']' && *p != '}'){++p;}
+      myType = (c == 'n' || c == 'N') ? EMPTY : BOOL;
+      intVal = (c == 't' || c == 'T') ? 1 : 0;
+      stop = true;
+      break;
+    default:
+      ++p; // ignore this character
+      break;
+    }
+  }
+  if (negative){intVal *= -1;}
+}
+
 /// Sets this JSON::Value to the given string.
 JSON::Value::Value(const std::string &val){
   myType = STRING;
@@ -1078,61 +1272,59 @@ std::string &JSON::Value::toNetPacked(){
 /// Converts this JSON::Value to valid JSON notation and returns it.
 /// Makes absolutely no attempts to pretty-print anything. :-)
 std::string JSON::Value::toString() const{
+  std::string out;
+  appendString(out);
+  return out;
+}
+
+/// Appends the JSON notation of this JSON::Value to out.
+/// Used by toString, so nested values are written into a single buffer instead of being
+/// converted to separate strings and concatenated.
+void JSON::Value::appendString(std::string &out) const{
   switch (myType){
   case INTEGER:{
-    std::stringstream st;
-    st << intVal;
-    return st.str();
+    char tmp[24];
+    out.append(tmp, snprintf(tmp, 24, "%lld", intVal));
     break;
   }
   case DOUBLE:{
-    std::stringstream st;
-    st.precision(10);
-    st << std::fixed << dblVal;
-    return st.str();
-    break;
-  }
-  case BOOL:{
-    if (intVal != 0){
-      return "true";
+    char tmp[64];
+    int len = snprintf(tmp, 64, "%.10f", dblVal);
+    if (len < 64){
+      out.append(tmp, len);
     }else{
-      return "false";
+      std::stringstream st;
+      st.precision(10);
+      st << std::fixed << dblVal;
+      out += st.str();
     }
     break;
   }
-  case STRING:{
-    return JSON::string_escape(strVal);
-    break;
-  }
+  case BOOL: out += (intVal != 0) ? "true" : "false"; break;
+  case STRING: ::string_escape(strVal, out); break;
   case ARRAY:{
-    std::string tmp = "[";
-    if (arrVal.size() > 0){
-      jsonForEachConst(*this, i){
-        tmp += i->toString();
-        if (i.num() + 1 != arrVal.size()){tmp += ",";}
-      }
+    out += '[';
+    for (std::vector<Value *>::const_iterator it = arrVal.begin(); it != arrVal.end(); ++it){
+      if (it != arrVal.begin()){out += ',';}
+      (*it)->appendString(out);
     }
-    tmp += "]";
-    return tmp;
+    out += ']';
     break;
   }
   case OBJECT:{
-    std::string tmp2 = "{";
-    if (objVal.size() > 0){
-      jsonForEachConst(*this, i){
-        tmp2 += JSON::string_escape(i.key()) + ":";
-        tmp2 += i->toString();
-        if (i.num() + 1 != objVal.size()){tmp2 += ",";}
-      }
+    out += '{';
+    for (std::map<std::string, Value *>::const_iterator it = objVal.begin(); it != objVal.end(); ++it){
+      if (it != objVal.begin()){out += ',';}
+      ::string_escape(it->first, out);
+      out += ':';
+      it->second->appendString(out);
     }
-    tmp2 += "}";
-    return tmp2;
+    out += '}';
     break;
   }
   case EMPTY:
-  default: return "null";
+  default: out += "null"; break;
   }
-  return "null"; // should never get here...
 }
 
 /// Converts this JSON::Value to valid JSON notation and returns it.
@@ -1224,7 +1416,7 @@ void JSON::Value::prepend(const JSON::Value &rhs){
     null();
     myType = ARRAY;
   }
-  arrVal.push_front(new JSON::Value(rhs));
+  arrVal.insert(arrVal.begin(), new JSON::Value(rhs));
 }
 
 /// For array and object JSON::Value objects, reduces them
@@ -1234,9 +1426,10 @@ void JSON::Value::prepend(const JSON::Value &rhs){
 /// do anything if the size is already lower or equal to the
 /// given size.
 void JSON::Value::shrink(unsigned int size){
-  while (arrVal.size() > size){
-    delete arrVal.front();
-    arrVal.pop_front();
+  if (arrVal.size() > size){
+    std::vector<Value *>::iterator cut = arrVal.end() - size;
+    for (std::vector<Value *>::iterator it = arrVal.begin(); it != cut; ++it){delete *it;}
+    arrVal.erase(arrVal.begin(), cut);
   }
   while (objVal.size() > size){
     delete objVal.begin()->second;
@@ -1253,7 +1446,7 @@ void JSON::Value::removeMember(const std::string &name){
   }
 }
 
-void JSON::Value::removeMember(const std::deque<Value *>::iterator &it){
+void JSON::Value::removeMember(const std::vector<Value *>::iterator &it){
   delete (*it);
   arrVal.erase(it);
 }
@@ -1323,25 +1516,30 @@ unsigned int JSON::Value::size() const{
   return objVal.size() + arrVal.size();
 }
 
-/// Converts a std::string to a JSON::Value.
+/// Parses JSON text from a buffer into the given JSON::Value, in a single pass.
+void JSON::fromString(const char *data, uint32_t data_len, Value &ret){
+  ret.parse(data, data + data_len);
+}
+
+/// Converts a buffer holding JSON text to a JSON::Value.
 JSON::Value JSON::fromString(const char *data, uint32_t data_len){
-  std::string str(data, data_len);
-  return JSON::fromString(str);
+  JSON::Value ret;
+  fromString(data, data_len, ret);
+  return ret;
 }
 
 /// Converts a std::string to a JSON::Value.
 JSON::Value JSON::fromString(const std::string &json){
-  std::istringstream is(json);
-  return JSON::Value(is);
+  JSON::Value ret;
+  fromString(json.data(), json.size(), ret);
+  return ret;
 }
 
 /// Converts a file to a JSON::Value.
 JSON::Value JSON::fromFile(const std::string &filename){
-  std::ifstream File;
-  File.open(filename.c_str());
-  JSON::Value ret(File);
-  File.close();
-  return ret;
+  std::ifstream File(filename.c_str());
+  std::string data((std::istreambuf_iterator<char>(File)), std::istreambuf_iterator<char>());
+  return fromString(data);
 }
 
 /// Parses a single DTMI type - used recursively by the JSON::fromDTMI functions.
@@ -1472,3 +1670,199 @@ JSON::Value JSON::fromDTMI2(const char *data, uint64_t len, uint32_t &i){
   return ret;
 }
 
+
+/// Size at which the Writer buffer is flushed to its destination.
+#define JSON_WRITER_BUFFER 16384
+
+/// Creates a Writer that sends to the given connection, optionally in HTTP/1.1 chunked format.
+JSON::Writer::Writer(Socket::Connection &c, bool chunk){
+  conn = &c;
+  cb = 0;
+  str = 0;
+  chunked = chunk;
+  finished = false;
+  afterKey = false;
+}
+
+/// Creates a Writer that hands its output to the given callback, optionally in HTTP/1.1 chunked format.
+JSON::Writer::Writer(Util::DataCallback &c, bool chunk){
+  conn = 0;
+  cb = &c;
+  str = 0;
+  chunked = chunk;
+  finished = false;
+  afterKey = false;
+}
+
+/// Creates a Writer that appends its output to the given string.
+JSON::Writer::Writer(std::string &s){
+  conn = 0;
+  cb = 0;
+  str = &s;
+  chunked = false;
+  finished = false;
+  afterKey = false;
+}
+
+/// Flushes any output that is still buffered, but does not finish a chunked stream.
+JSON::Writer::~Writer(){
+  flush();
+}
+
+/// Sends data to the destination, bypassing the buffer.
+void JSON::Writer::emit(const char *data, size_t len){
+  if (conn){conn->SendNow(data, len);}
+  if (cb){cb->dataCallback(data, len);}
+  if (str){str->append(data, len);}
+}
+
+/// Writes out the buffered output, as a single chunk if chunked.
+void JSON::Writer::flush(){
+  if (!buffer.size()){return;}
+  if (chunked){
+    char len[12];
+    int l = snprintf(len, 12, "%zx\r\n", buffer.size());
+    buffer.insert(0, len, l);
+    buffer.append("\r\n", 2);
+  }
+  emit(buffer.data(), buffer.size());
+  buffer.clear();
+}
+
+/// Flushes all output and, if chunked, sends the terminating chunk.
+/// Nothing may be written after calling this.
+void JSON::Writer::finish(){
+  if (finished){return;}
+  flush();
+  if (chunked){emit("0\r\n\r\n", 5);}
+  finished = true;
+}
+
+/// Inserts a comma if needed before the next element, and flushes if the buffer is full.
+void JSON::Writer::separate(){
+  if (buffer.size() >= JSON_WRITER_BUFFER){flush();}
+  if (afterKey){
+    afterKey = false;
+    return;
+  }
+  if (empty.size()){
+    if (!empty.back()){buffer += ',';}
+    empty.back() = false;
+  }
+}
+
+JSON::Writer &JSON::Writer::beginObject(){
+  separate();
+  buffer += '{';
+  empty.push_back(true);
+  return *this;
+}
+
+JSON::Writer &JSON::Writer::endObject(){
+  buffer += '}';
+  if (empty.size()){empty.pop_back();}
+  return *this;
+}
+
+JSON::Writer &JSON::Writer::beginArray(){
+  separate();
+  buffer += '[';
+  empty.push_back(true);
+  return *this;
+}
+
+JSON::Writer &JSON::Writer::endArray(){
+  buffer += ']';
+  if (empty.size()){empty.pop_back();}
+  return *this;
+}
+
+/// Writes an object member name; must be followed by exactly one value or container.
+JSON::Writer &JSON::Writer::key(const std::string &k){
+  separate();
+  buffer += string_escape(k);
+  buffer += ':';
+  afterKey = true;
+  return *this;
+}
+
+JSON::Writer &JSON::Writer::value(const std::string &v){
+  separate();
+  buffer += string_escape(v);
+  return *this;
+}
+
+JSON::Writer &JSON::Writer::value(const char *v){
+  return value(std::string(v));
+}
+
+JSON::Writer &JSON::Writer::value(int32_t v){
+  return value((int64_t)v);
+}
+
+JSON::Writer &JSON::Writer::value(int64_t v){
+  separate();
+  char tmp[24];
+  buffer.append(tmp, snprintf(tmp, 24, "%" PRId64, v));
+  return *this;
+}
+
+JSON::Writer &JSON::Writer::value(uint32_t v){
+  return value((uint64_t)v);
+}
+
+JSON::Writer &JSON::Writer::value(uint64_t v){
+  separate();
+  char tmp[24];
+  buffer.append(tmp, snprintf(tmp, 24, "%" PRIu64, v));
+  return *this;
+}
+
+JSON::Writer &JSON::Writer::value(double v){
+  separate();
+  char tmp[64];
+  buffer.append(tmp, snprintf(tmp, 64, "%.10f", v));
+  return *this;
+}
+
+JSON::Writer &JSON::Writer::value(bool v){
+  separate();
+  if (v){
+    buffer.append("true", 4);
+  }else{
+    buffer.append("false", 5);
+  }
+  return *this;
+}
+
+/// Writes an existing JSON::Value, recursing into containers so large values are streamed as well.
+JSON::Writer &JSON::Writer::value(const Value &v){
+  if (v.isObject()){
+    beginObject();
+    jsonForEachConst(v, i){
+      key(i.key());
+      value(*i);
+    }
+    return endObject();
+  }
+  if (v.isArray()){
+    beginArray();
+    jsonForEachConst(v, i){value(*i);}
+    return endArray();
+  }
+  separate();
+  buffer += v.toString();
+  return *this;
+}
+
+JSON::Writer &JSON::Writer::null(){
+  separate();
+  buffer.append("null", 4);
+  return *this;
+}
+
+/// Writes data as-is, outside of the JSON structure (e.g. a JSONP callback wrapper).
+JSON::Writer &JSON::Writer::raw(const std::string &data){
+  buffer += data;
+  return *this;
+}
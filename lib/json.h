@@ -2,7 +2,6 @@
 
 #pragma once
 #include "socket.h"
-#include <deque>
 #include <istream>
 #include <map>
 #include <set>
@@ -12,6 +11,10 @@
 
 static const std::set<std::string> emptyset;
 
+namespace Util{
+  class DataCallback;
+}
+
 /// JSON-related classes and functions
 namespace JSON{
 
@@ -25,6 +28,7 @@ namespace JSON{
   class Value{
     friend class Iter;
     friend class ConstIter;
+    friend void fromString(const char *data, uint32_t data_len, Value &ret);
 
   private:
     ValueType myType;
@@ -32,8 +36,10 @@ namespace JSON{
     std::string strVal;
     double dblVal;
     double dblDivider;
-    std::deque<Value *> arrVal;
+    std::vector<Value *> arrVal;
     std::map<std::string, Value *> objVal;
+    void parse(const char *&p, const char *end);
+    void appendString(std::string &out) const;
 
   public:
     // constructors/destructors
@@ -96,7 +102,7 @@ namespace JSON{
     void prepend(const Value &rhs);
     void shrink(uint32_t size);
     void removeMember(const std::string &name);
-    void removeMember(const std::deque<Value *>::iterator &it);
+    void removeMember(const std::vector<Value *>::iterator &it);
     void removeMember(const std::map<std::string, Value *>::iterator &it);
     void removeNullMembers();
     bool isMember(const std::string &name) const;
@@ -117,6 +123,7 @@ namespace JSON{
   Value fromDTMI(const char *data, uint64_t len, uint32_t &i);
   Value fromString(const std::string &json);
   Value fromString(const char *data, uint32_t data_len);
+  void fromString(const char *data, uint32_t data_len, Value &ret);
   Value fromFile(const std::string &filename);
   void fromDTMI2(const std::string &data, Value &ret);
   void fromDTMI2(const char *data, uint64_t len, uint32_t &i, Value &ret);
@@ -137,7 +144,7 @@ namespace JSON{
     ValueType myType;
     Value *r;
     uint32_t i;
-    std::deque<Value *>::iterator aIt;
+    std::vector<Value *>::iterator aIt;
     std::map<std::string, Value *>::iterator oIt;
   };
   class ConstIter{
@@ -153,9 +160,50 @@ namespace JSON{
     ValueType myType;
     const Value *r;
     uint32_t i;
-    std::deque<Value *>::const_iterator aIt;
+    std::vector<Value *>::const_iterator aIt;
     std::map<std::string, Value *>::const_iterator oIt;
   };
+  /// Writes JSON text incrementally to a socket, callback or string, without building a Value tree.
+  /// Separators between members and elements are inserted automatically. Output is collected in a
+  /// small buffer that is flushed whenever it fills up; if chunked is set, every flush is framed as
+  /// one HTTP/1.1 chunk and finish() sends the terminating zero-length chunk.
+  class Writer{
+  public:
+    Writer(Socket::Connection &conn, bool chunked = false);
+    Writer(Util::DataCallback &cb, bool chunked = false);
+    Writer(std::string &str);
+    ~Writer();
+    Writer &beginObject();
+    Writer &endObject();
+    Writer &beginArray();
+    Writer &endArray();
+    Writer &key(const std::string &k);
+    Writer &value(const std::string &v);
+    Writer &value(const char *v);
+    Writer &value(int32_t v);
+    Writer &value(int64_t v);
+    Writer &value(uint32_t v);
+    Writer &value(uint64_t v);
+    Writer &value(double v);
+    Writer &value(bool v);
+    Writer &value(const Value &v);
+    Writer &null();
+    Writer &raw(const std::string &data);
+    void flush();
+    void finish();
+
+  private:
+    void separate();
+    void emit(const char *data, size_t len);
+    Socket::Connection *conn;
+    Util::DataCallback *cb;
+    std::string *str;
+    bool chunked;
+    bool finished;
+    bool afterKey; ///< True if a key was just written, so no separator is needed.
+    std::vector<bool> empty; ///< Per open container, true while it has no elements yet.
+    std::string buffer;
+  };
 #define jsonForEach(val, i) for (JSON::Iter i(val); i; ++i)
 #define jsonForEachConst(val, i) for (JSON::ConstIter i(val); i; ++i)
 }// namespace JSON
@@ -890,4 +890,128 @@ namespace MP4 {
     return r.str();
   }
 
+
+  /// Creates a writer that appends boxes to the given buffer.
+  BoxWriter::BoxWriter(std::string & target) : buffer(target){}
+
+  /// Opens a box of the given type, writing a zero size placeholder.
+  /// The actual size is back-patched by the matching end() call.
+  /// Large boxes get a 64-bit size field, and are needed for contents that may exceed 4GiB.
+  void BoxWriter::start(const char * type, bool large){
+    openBoxes.push_back(buffer.size());
+    if (large){
+      buffer.append("\000\000\000\001", 4);
+      buffer.append(type, 4);
+      buffer.append(8, '\000');
+    }else{
+      buffer.append(4, '\000');
+      buffer.append(type, 4);
+    }
+  }
+
+  /// Opens a full box of the given type, writing its version and flags.
+  void BoxWriter::startFull(const char * type, uint8_t version, uint32_t flags){
+    start(type);
+    int32(((uint32_t)version << 24) | (flags & 0xFFFFFF));
+  }
+
+  /// Closes the box opened last, back-patching its size now that its contents are known.
+  void BoxWriter::end(){
+    if (!openBoxes.size()){
+      FAIL_MSG("Attempt to close a box that was never opened");
+      return;
+    }
+    size_t boxStart = openBoxes.back();
+    openBoxes.pop_back();
+    uint64_t boxSize = buffer.size() - boxStart;
+    if (buffer[boxStart + 3] == 1 && !buffer[boxStart] && !buffer[boxStart + 1] && !buffer[boxStart + 2]){
+      setInt64(boxStart + 8, boxSize);
+      return;
+    }
+    if (boxSize > 0xFFFFFFFFull){
+      FAIL_MSG("Box %.4s of %" PRIu64 " bytes was not opened as a large box", buffer.data() + boxStart + 4, boxSize);
+    }
+    setInt32(boxStart, boxSize);
+  }
+
+  /// Writes only the header of a box, for when its contents are sent separately (e.g. mdat).
+  /// Uses a 64-bit size field only when the box would not fit a 32-bit one.
+  void BoxWriter::header(const char * type, uint64_t payloadSize){
+    if (payloadSize + 8 > 0xFFFFFFFFull){
+      int32(1);
+      buffer.append(type, 4);
+      int64(payloadSize + 16);
+    }else{
+      int32(payloadSize + 8);
+      buffer.append(type, 4);
+    }
+  }
+
+  /// Writes a complete box built the usual way.
+  void BoxWriter::box(Box & newBox){
+    buffer.append(newBox.asBox(), newBox.boxedSize());
+  }
+
+  void BoxWriter::int8(uint8_t val){
+    buffer.append(1, (char)val);
+  }
+
+  void BoxWriter::int16(uint16_t val){
+    char tmp[2];
+    Bit::htobs(tmp, val);
+    buffer.append(tmp, 2);
+  }
+
+  void BoxWriter::int24(uint32_t val){
+    char tmp[3];
+    Bit::htob24(tmp, val);
+    buffer.append(tmp, 3);
+  }
+
+  void BoxWriter::int32(uint32_t val){
+    char tmp[4];
+    Bit::htobl(tmp, val);
+    buffer.append(tmp, 4);
+  }
+
+  void BoxWriter::int64(uint64_t val){
+    char tmp[8];
+    Bit::htobll(tmp, val);
+    buffer.append(tmp, 8);
+  }
+
+  void BoxWriter::bytes(const char * newData, size_t len){
+    buffer.append(newData, len);
+  }
+
+  /// Writes a zero-terminated string.
+  void BoxWriter::string(const std::string & str){
+    buffer.append(str.data(), str.size());
+    buffer.append(1, '\000');
+  }
+
+  /// Writes len zero bytes, e.g. to hold a table that is filled in later through setInt32/setInt64.
+  void BoxWriter::zeroes(size_t len){
+    buffer.append(len, '\000');
+  }
+
+  /// Overwrites a value written earlier, at the given position in the buffer.
+  void BoxWriter::setInt32(size_t position, uint32_t val){
+    Bit::htobl((char *)buffer.data() + position, val);
+  }
+
+  /// Overwrites a value written earlier, at the given position in the buffer.
+  void BoxWriter::setInt64(size_t position, uint64_t val){
+    Bit::htobll((char *)buffer.data() + position, val);
+  }
+
+  /// Returns the position in the buffer the next value will be written at.
+  size_t BoxWriter::position() const{
+    return buffer.size();
+  }
+
+  /// Makes room for at least len more bytes, so large tables are written without reallocations.
+  void BoxWriter::reserve(size_t len){
+    buffer.reserve(buffer.size() + len);
+  }
 }
@@ -124,4 +124,36 @@ namespace MP4 {
       Box & getContent(uint32_t no);
       std::string toPrettyCFBString(uint32_t indent, std::string boxName);
   };
+
+  ///\brief Writes boxes straight into a single buffer, in the order they appear in the file.
+  ///
+  ///start() writes a box header with a zero size placeholder, and the matching end() back-patches
+  ///the size once all contents are written. Children are written in place inside their parents
+  ///instead of being copied into them, so building a box tree costs a single pass over its
+  ///contents. Only header() writes a final size up front, for boxes whose payload is sent separately.
+  ///Tables of known length can be reserved up front.
+  class BoxWriter {
+    public:
+      BoxWriter(std::string & target);
+      void start(const char * type, bool large = false);
+      void startFull(const char * type, uint8_t version, uint32_t flags);
+      void end();
+      void header(const char * type, uint64_t payloadSize);
+      void box(Box & newBox);
+      void int8(uint8_t val);
+      void int16(uint16_t val);
+      void int24(uint32_t val);
+      void int32(uint32_t val);
+      void int64(uint64_t val);
+      void bytes(const char * newData, size_t len);
+      void string(const std::string & str);
+      void zeroes(size_t len);
+      void setInt32(size_t position, uint32_t val);
+      void setInt64(size_t position, uint64_t val);
+      size_t position() const;
+      void reserve(size_t len);
+    private:
+      std::string & buffer;
+      std::vector<size_t> openBoxes;///< Starts of the boxes that are not closed yet
+  };
 }
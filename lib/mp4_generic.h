@@ -1,3 +1,4 @@
+#pragma once
 #include "mp4.h"
 
 namespace MP4 {
@@ -21,6 +21,50 @@
 #include <accctrl.h>
 #endif
 
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <climits>
+#endif
+
+/// Amount of request slots in a pageRequests queue.
+#define PAGE_REQ_SLOTS 64
+/// Size of a pageRequests page: request and completion counters, then per slot state, track and key.
+#define PAGE_REQ_SIZE (8 + PAGE_REQ_SLOTS * 12)
+#define PAGE_REQ_EMPTY 0
+#define PAGE_REQ_CLAIMED 1
+#define PAGE_REQ_FULL 2
+
+/// Size of a trackNegotiation page: request and answer counters, then per record its state,
+/// sequence number, pusher PID, pushed track, final track and first key.
+#define TRACK_NEG_SIZE (8 + TRACK_NEG_RECORDS * 24)
+#define TRACK_NEG_EMPTY 0
+#define TRACK_NEG_CLAIMED 1
+#define TRACK_NEG_REQUEST 2
+#define TRACK_NEG_BUSY 3
+#define TRACK_NEG_ACCEPTED 4
+#define TRACK_NEG_DECLINED 5
+
+/// Size of a bufferHost page: request counter and host PID, then per record its state, argument
+/// length and the arguments themselves.
+#define BUFFER_HOST_RECORD (8 + BUFFER_HOST_ARGS_SIZE)
+#define BUFFER_HOST_SIZE (8 + BUFFER_HOST_STREAMS * BUFFER_HOST_RECORD)
+#define BUFFER_HOST_EMPTY 0
+#define BUFFER_HOST_CLAIMED 1
+#define BUFFER_HOST_REQUEST 2
+#define BUFFER_HOST_STARTING 3
+#define BUFFER_HOST_RUNNING 4
+#define BUFFER_HOST_FAILED 5
+
+/// Size of the state of a manifestCache slot: sequence number, writer PID, version, length and key.
+/// The cache itself starts with its version, the PID of the buffer that owns it and a closed flag,
+/// the slot data follows all slot states.
+#define MANIFEST_HEADER 16
+#define MANIFEST_SLOT_STATE 64
+#define MANIFEST_KEY_SIZE (MANIFEST_SLOT_STATE - 20)
+#define MANIFEST_DATA_START (MANIFEST_HEADER + MANIFEST_CACHE_SLOTS * MANIFEST_SLOT_STATE)
+#define MANIFEST_CACHE_SIZE (MANIFEST_DATA_START + MANIFEST_CACHE_SLOTS * MANIFEST_CACHE_SLOT_SIZE)
+
 
 /// Forces a disconnect to all users.
 static void killStatistics(char * data, size_t len, unsigned int id){
@@ -502,8 +546,73 @@ namespace IPC {
         mapped = 0;
         return;
       }
+#if defined(MADV_HUGEPAGE) && !defined(NOHUGEPAGES)
+      //Ask for huge pages on large mappings. Where shmem huge pages are enabled (shmem_enabled set
+      //to advise or always) this saves TLB entries and page tables in every process mapping it.
+      if (len >= SHM_HUGEPAGE_SIZE){
+        madvise(mapped, len, MADV_HUGEPAGE);
+      }
 #endif
+#endif
+    }
+  }
+
+  ///\brief Creates a new page, but only if no page with that name exists yet.
+  ///Unlike init in master mode, an existing page is never truncated or taken over, so exactly one
+  ///of several processes racing to create the same page succeeds. The others should attach to it.
+  ///\param name_ The name of the page to be created
+  ///\param len_ The size to make the page
+  ///\return True if the page was created and mapped, false if it already existed or on error.
+  bool sharedPage::create(const std::string & name_, uint64_t len_){
+    close();
+    name = name_;
+    len = len_;
+    master = false;
+    mapped = 0;
+    if (!name.size()){return false;}
+#if defined(__CYGWIN__) || defined(_WIN32)
+    //Under cygwin, all pages are 4 bytes longer than claimed.
+    handle = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, len + 4, name.c_str());
+    if (!handle){return false;}
+    if (GetLastError() == ERROR_ALREADY_EXISTS){
+      CloseHandle(handle);
+      handle = 0;
+      return false;
+    }
+    master = true;
+    mapped = (char *)MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    if (!mapped){
+      FAIL_MSG("MapViewOfFile for page %s failed with error code %u", name.c_str(), GetLastError());
+      close();
+      return false;
+    }
+    Bit::htobl(mapped, len);
+    mapped += 4;
+#else
+    handle = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, ACCESSPERMS);
+    if (handle == -1){
+      handle = 0;
+      if (errno != EEXIST){HIGH_MSG("shm_open for page %s failed: %s", name.c_str(), strerror(errno));}
+      return false;
+    }
+    master = true;
+    if (ftruncate(handle, len) < 0){
+      FAIL_MSG("truncate to %" PRIu64 " for page %s failed: %s", len, name.c_str(), strerror(errno));
+      close();
+      return false;
     }
+    mapped = (char *)mmap(0, len, PROT_READ | PROT_WRITE, MAP_SHARED, handle, 0);
+    if (mapped == MAP_FAILED){
+      FAIL_MSG("mmap for page %s failed: %s", name.c_str(), strerror(errno));
+      mapped = 0;
+      close();
+      return false;
+    }
+#if defined(MADV_HUGEPAGE) && !defined(NOHUGEPAGES)
+    if (len >= SHM_HUGEPAGE_SIZE){madvise(mapped, len, MADV_HUGEPAGE);}
+#endif
+#endif
+    return true;
   }
 
 #endif
@@ -625,6 +734,39 @@ namespace IPC {
     }
   }
 
+  ///\brief Creates a new file, but only if no file with that name exists yet.
+  ///Unlike init in master mode, an existing file is never truncated or taken over.
+  ///\param name_ The name of the file to be created
+  ///\param len_ The size to make the file
+  ///\return True if the file was created and mapped, false if it already existed or on error.
+  bool sharedFile::create(const std::string & name_, uint64_t len_){
+    close();
+    name = name_;
+    len = len_;
+    master = false;
+    mapped = 0;
+    if (!name.size()){return false;}
+    handle = open(std::string(Util::getTmpFolder() + name).c_str(), O_CREAT | O_EXCL | O_RDWR, (mode_t)0600);
+    if (handle == -1){
+      handle = 0;
+      return false;
+    }
+    master = true;
+    if (ftruncate(handle, len) < 0){
+      INFO_MSG("ftruncate to len for shf page %s failed: %s", name.c_str(), strerror(errno));
+      close();
+      return false;
+    }
+    mapped = (char *)mmap(0, len, PROT_READ | PROT_WRITE, MAP_SHARED, handle, 0);
+    if (mapped == MAP_FAILED){
+      mapped = 0;
+      close();
+      return false;
+    }
+    return true;
+  }
+
+
   ///\brief Default destructor
   sharedFile::~sharedFile() {
     close();
@@ -1303,5 +1445,513 @@ namespace IPC {
     Bit::htobs(data + (offset * 6) + 4, keynum);
 
   }
-}
 
+  /// Waits up to ms milliseconds for the 32-bit word at addr to change from val.
+  /// Returns true if woken up (or the value already differed), false on timeout.
+  bool futexWait(volatile uint32_t * addr, uint32_t val, uint32_t ms){
+#if defined(__linux__)
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000;
+    if (syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, 0, 0) == 0){return true;}
+    return errno != ETIMEDOUT;
+#else
+    //No futexes available: poll in short intervals instead
+    uint64_t until = Util::bootMS() + ms;
+    while (*addr == val && Util::bootMS() < until){Util::sleep(5);}
+    return *addr != val;
+#endif
+  }
+
+  /// Wakes up all processes waiting on the 32-bit word at addr.
+  void futexWake(volatile uint32_t * addr){
+#if defined(__linux__)
+    syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+#endif
+  }
+
+  pageRequests::pageRequests(){
+    lastRequest = 0;
+  }
+
+  /// Opens the request queue for the given stream.
+  /// The input creates it with master set; outputs open it without waiting for it to exist.
+  void pageRequests::init(const std::string & streamName, bool master){
+    char pageName[NAME_BUFFER_SIZE];
+    snprintf(pageName, NAME_BUFFER_SIZE, SHM_PAGE_REQUESTS, streamName.c_str());
+    page.init(pageName, PAGE_REQ_SIZE, master, false);
+    if (page.mapped && master){memset(page.mapped, 0, PAGE_REQ_SIZE);}
+    lastRequest = 0;
+  }
+
+  /// Returns true if the queue is opened.
+  pageRequests::operator bool() const{
+    return page.mapped;
+  }
+
+  /// Posts a request for the page holding key of track, and wakes up the input.
+  /// Returns false if the queue is not available or full.
+  bool pageRequests::post(uint32_t track, uint32_t key){
+    if (!page.mapped){return false;}
+    volatile uint32_t * words = (volatile uint32_t *)page.mapped;
+    for (size_t i = 0; i < PAGE_REQ_SLOTS; ++i){
+      volatile uint32_t * slot = words + 2 + i * 3;
+      if (!__sync_bool_compare_and_swap(slot, PAGE_REQ_EMPTY, PAGE_REQ_CLAIMED)){continue;}
+      slot[1] = track;
+      slot[2] = key;
+      __sync_synchronize();
+      slot[0] = PAGE_REQ_FULL;
+      __sync_fetch_and_add(words, 1);
+      futexWake(words);
+      return true;
+    }
+    return false;
+  }
+
+  /// Takes any one posted request out of the queue. Only to be called by the input.
+  /// Returns false if no request is pending.
+  bool pageRequests::get(uint32_t & track, uint32_t & key){
+    if (!page.mapped){return false;}
+    volatile uint32_t * words = (volatile uint32_t *)page.mapped;
+    for (size_t i = 0; i < PAGE_REQ_SLOTS; ++i){
+      volatile uint32_t * slot = words + 2 + i * 3;
+      if (slot[0] != PAGE_REQ_FULL){continue;}
+      __sync_synchronize();
+      track = slot[1];
+      key = slot[2];
+      __sync_synchronize();
+      slot[0] = PAGE_REQ_EMPTY;
+      return true;
+    }
+    return false;
+  }
+
+  /// Waits up to ms milliseconds for new requests. Returns true as soon as any were posted since
+  /// the previous call, after which they should be taken out with get().
+  bool pageRequests::waitRequest(uint32_t ms){
+    if (!page.mapped){
+      Util::wait(ms);
+      return false;
+    }
+    volatile uint32_t * words = (volatile uint32_t *)page.mapped;
+    if (words[0] == lastRequest){futexWait(words, lastRequest, ms);}
+    bool changed = (words[0] != lastRequest);
+    lastRequest = words[0];
+    return changed;
+  }
+
+  /// Signals all waiting outputs that the input finished handling requests.
+  void pageRequests::markCompleted(){
+    if (!page.mapped){return;}
+    volatile uint32_t * words = (volatile uint32_t *)page.mapped;
+    __sync_fetch_and_add(words + 1, 1);
+    futexWake(words + 1);
+  }
+
+  /// Returns the current completion counter, to be passed to waitCompleted later.
+  uint32_t pageRequests::completed() const{
+    if (!page.mapped){return 0;}
+    return ((volatile uint32_t *)page.mapped)[1];
+  }
+
+  /// Waits up to ms milliseconds for the input to complete requests after the completion counter
+  /// was at since. Returns true if it did, false on timeout.
+  bool pageRequests::waitCompleted(uint32_t since, uint32_t ms){
+    if (!page.mapped){
+      Util::wait(ms);
+      return false;
+    }
+    volatile uint32_t * done = ((volatile uint32_t *)page.mapped) + 1;
+    if (*done == since){futexWait(done, since, ms);}
+    return *done != since;
+  }
+
+  trackNegotiation::trackNegotiation(){
+    lastRequest = 0;
+  }
+
+  /// Opens the negotiation channel for the given stream.
+  /// The buffer creates it with master set; pushing processes open it without waiting for it to exist.
+  void trackNegotiation::init(const std::string & streamName, bool master){
+    char pageName[NAME_BUFFER_SIZE];
+    snprintf(pageName, NAME_BUFFER_SIZE, SHM_TRACK_NEGOTIATION, streamName.c_str());
+    page.init(pageName, TRACK_NEG_SIZE, master, false);
+    if (page.mapped && master){memset(page.mapped, 0, TRACK_NEG_SIZE);}
+    lastRequest = 0;
+  }
+
+  /// Returns true if the channel is opened.
+  trackNegotiation::operator bool() const{
+    return page.mapped;
+  }
+
+  /// Returns the temporary track id whose metadata page belongs to the given record.
+  uint32_t trackNegotiation::tempTrack(uint32_t record){
+    return TRACK_NEG_TEMP_BASE + record;
+  }
+
+  /// Claims a free record for a new negotiation, returning its number, or -1 if none are free.
+  int32_t trackNegotiation::claim(){
+    if (!page.mapped){return -1;}
+    volatile uint32_t * words = (volatile uint32_t *)page.mapped;
+    for (size_t i = 0; i < TRACK_NEG_RECORDS; ++i){
+      volatile uint32_t * rec = words + 2 + i * 6;
+      if (!__sync_bool_compare_and_swap(rec, TRACK_NEG_EMPTY, TRACK_NEG_CLAIMED)){continue;}
+      __sync_fetch_and_add(rec + 1, 1);
+      return i;
+    }
+    return -1;
+  }
+
+  /// Posts the negotiation request in a claimed record, and wakes up the buffer.
+  /// The metadata page of tempTrack(record) must already be written.
+  void trackNegotiation::request(uint32_t record, uint32_t pid, uint32_t track){
+    if (!page.mapped || record >= TRACK_NEG_RECORDS){return;}
+    volatile uint32_t * words = (volatile uint32_t *)page.mapped;
+    volatile uint32_t * rec = words + 2 + record * 6;
+    rec[2] = pid;
+    rec[3] = track;
+    __sync_synchronize();
+    rec[0] = TRACK_NEG_REQUEST;
+    __sync_fetch_and_add(words, 1);
+    futexWake(words);
+  }
+
+  /// Checks for an answer to the request in the given record.
+  /// Returns 1 if the track was accepted, filling finalTrack and firstKey, -1 if it was declined,
+  /// and 0 if the buffer has not answered yet.
+  int trackNegotiation::answer(uint32_t record, uint32_t & finalTrack, uint32_t & firstKey){
+    if (!page.mapped || record >= TRACK_NEG_RECORDS){return -1;}
+    volatile uint32_t * rec = ((volatile uint32_t *)page.mapped) + 2 + record * 6;
+    uint32_t state = rec[0];
+    if (state != TRACK_NEG_ACCEPTED && state != TRACK_NEG_DECLINED){return 0;}
+    __sync_synchronize();
+    finalTrack = rec[4];
+    firstKey = rec[5];
+    return (state == TRACK_NEG_ACCEPTED) ? 1 : -1;
+  }
+
+  /// Waits up to ms milliseconds for the buffer to answer the request in the given record.
+  /// Returns true if it was answered.
+  bool trackNegotiation::waitAnswer(uint32_t record, uint32_t ms){
+    if (!page.mapped || record >= TRACK_NEG_RECORDS){return false;}
+    volatile uint32_t * answers = ((volatile uint32_t *)page.mapped) + 1;
+    uint32_t finalTrack, firstKey;
+    uint64_t until = Util::bootMS() + ms;
+    while (true){
+      uint32_t since = *answers;
+      if (answer(record, finalTrack, firstKey)){return true;}
+      uint64_t now = Util::bootMS();
+      if (now >= until){return false;}
+      futexWait(answers, since, until - now);
+    }
+  }
+
+  /// Gives a claimed record back, whether or not it was answered.
+  void trackNegotiation::release(uint32_t record){
+    if (!page.mapped || record >= TRACK_NEG_RECORDS){return;}
+    volatile uint32_t * rec = ((volatile uint32_t *)page.mapped) + 2 + record * 6;
+    __sync_synchronize();
+    rec[0] = TRACK_NEG_EMPTY;
+  }
+
+  /// Wakes up the buffer without posting a request, so it looks at its users right away.
+  void trackNegotiation::notify(){
+    if (!page.mapped){return;}
+    volatile uint32_t * words = (volatile uint32_t *)page.mapped;
+    __sync_fetch_and_add(words, 1);
+    futexWake(words);
+  }
+
+  /// Takes any one posted request out of the channel. Only to be called by the buffer.
+  /// Returns false if no request is pending.
+  bool trackNegotiation::get(uint32_t & record, uint32_t & seq, uint32_t & pid, uint32_t & track){
+    if (!page.mapped){return false;}
+    volatile uint32_t * words = (volatile uint32_t *)page.mapped;
+    for (size_t i = 0; i < TRACK_NEG_RECORDS; ++i){
+      volatile uint32_t * rec = words + 2 + i * 6;
+      if (!__sync_bool_compare_and_swap(rec, TRACK_NEG_REQUEST, TRACK_NEG_BUSY)){continue;}
+      record = i;
+      seq = rec[1];
+      pid = rec[2];
+      track = rec[3];
+      return true;
+    }
+    return false;
+  }
+
+  /// Answers the request taken out with get(), and wakes up the pushing process.
+  /// Does nothing if the pusher gave up on the request in the meantime.
+  void trackNegotiation::respond(uint32_t record, uint32_t seq, bool accepted, uint32_t finalTrack, uint32_t firstKey){
+    if (!page.mapped || record >= TRACK_NEG_RECORDS){return;}
+    volatile uint32_t * words = (volatile uint32_t *)page.mapped;
+    volatile uint32_t * rec = words + 2 + record * 6;
+    if (rec[0] != TRACK_NEG_BUSY || rec[1] != seq){return;}
+    rec[4] = finalTrack;
+    rec[5] = firstKey;
+    __sync_synchronize();
+    if (!__sync_bool_compare_and_swap(rec, TRACK_NEG_BUSY, accepted ? TRACK_NEG_ACCEPTED : TRACK_NEG_DECLINED)){return;}
+    __sync_fetch_and_add(words + 1, 1);
+    futexWake(words + 1);
+  }
+
+  /// Returns true if any requests or notifications were posted since the previous call, without waiting.
+  bool trackNegotiation::pending(){
+    if (!page.mapped){return false;}
+    uint32_t current = ((volatile uint32_t *)page.mapped)[0];
+    bool changed = (current != lastRequest);
+    lastRequest = current;
+    return changed;
+  }
+
+  /// Waits up to ms milliseconds for new requests or notifications. Returns true as soon as any
+  /// were posted since the previous call.
+  bool trackNegotiation::waitRequest(uint32_t ms){
+    if (!page.mapped){
+      Util::wait(ms);
+      return false;
+    }
+    volatile uint32_t * words = (volatile uint32_t *)page.mapped;
+    if (words[0] == lastRequest){futexWait(words, lastRequest, ms);}
+    bool changed = (words[0] != lastRequest);
+    lastRequest = words[0];
+    return changed;
+  }
+
+  bufferHost::bufferHost(){
+    lastRequest = 0;
+  }
+
+  /// Opens the buffer host table. The host creates it with master set, clearing any old contents;
+  /// buffer processes open it without waiting for it to exist. Returns true if the table is opened.
+  bool bufferHost::init(bool master){
+    page.init(SHM_BUFFER_HOST, BUFFER_HOST_SIZE, master, false);
+    if (page.mapped && master){memset(page.mapped, 0, BUFFER_HOST_SIZE);}
+    lastRequest = 0;
+    return page.mapped;
+  }
+
+  /// Returns true if the table is opened.
+  bufferHost::operator bool() const{
+    return page.mapped;
+  }
+
+  /// Returns true if a host process is currently running for this table.
+  bool bufferHost::hostAlive() const{
+    if (!page.mapped){return false;}
+    uint32_t pid = ((volatile uint32_t *)page.mapped)[1];
+    return pid > 1 && Util::Procs::isRunning(pid);
+  }
+
+  /// Hands a stream over to the host. The arguments are the buffer arguments, each terminated by a
+  /// zero byte. Returns the record used, or -1 if the arguments do not fit or no record is free.
+  int32_t bufferHost::post(const std::string & args){
+    if (!page.mapped || args.size() > BUFFER_HOST_ARGS_SIZE){return -1;}
+    volatile uint32_t * words = (volatile uint32_t *)page.mapped;
+    for (size_t i = 0; i < BUFFER_HOST_STREAMS; ++i){
+      volatile uint32_t * rec = (volatile uint32_t *)(page.mapped + 8 + i * BUFFER_HOST_RECORD);
+      if (!__sync_bool_compare_and_swap(rec, BUFFER_HOST_EMPTY, BUFFER_HOST_CLAIMED)){continue;}
+      rec[1] = args.size();
+      memcpy((char *)(rec + 2), args.data(), args.size());
+      __sync_synchronize();
+      rec[0] = BUFFER_HOST_REQUEST;
+      __sync_fetch_and_add(words, 1);
+      futexWake(words);
+      return i;
+    }
+    return -1;
+  }
+
+  /// Waits up to ms milliseconds for the host to start serving the stream posted in the given record.
+  /// Returns 1 if it is served, -1 if the host failed to start it or went away, and 0 on timeout,
+  /// in which case the host is still in the middle of starting it.
+  /// A request the host did not pick up in time is withdrawn, and counts as failed.
+  int bufferHost::waitStarted(uint32_t record, uint32_t ms){
+    if (!page.mapped || record >= BUFFER_HOST_STREAMS){return -1;}
+    volatile uint32_t * rec = (volatile uint32_t *)(page.mapped + 8 + record * BUFFER_HOST_RECORD);
+    uint64_t until = Util::bootMS() + ms;
+    while (true){
+      uint32_t state = rec[0];
+      if (state == BUFFER_HOST_RUNNING){return 1;}
+      if (state == BUFFER_HOST_FAILED){
+        rec[0] = BUFFER_HOST_EMPTY;
+        return -1;
+      }
+      //a restarted host starts out with an empty table
+      if (state == BUFFER_HOST_EMPTY){return -1;}
+      if (!hostAlive()){return -1;}
+      if (Util::bootMS() >= until){
+        if (__sync_bool_compare_and_swap(rec, BUFFER_HOST_REQUEST, BUFFER_HOST_EMPTY)){return -1;}
+        return 0;
+      }
+      Util::sleep(10);
+    }
+  }
+
+  /// Registers the given process as the host serving this table.
+  void bufferHost::setHost(uint32_t pid){
+    if (!page.mapped){return;}
+    ((volatile uint32_t *)page.mapped)[1] = pid;
+  }
+
+  /// Takes any one handed over stream out of the table. Only to be called by the host.
+  /// Returns false if none are waiting.
+  bool bufferHost::get(uint32_t & record, std::string & args){
+    if (!page.mapped){return false;}
+    for (size_t i = 0; i < BUFFER_HOST_STREAMS; ++i){
+      volatile uint32_t * rec = (volatile uint32_t *)(page.mapped + 8 + i * BUFFER_HOST_RECORD);
+      if (!__sync_bool_compare_and_swap(rec, BUFFER_HOST_REQUEST, BUFFER_HOST_STARTING)){continue;}
+      record = i;
+      uint32_t len = rec[1];
+      if (len > BUFFER_HOST_ARGS_SIZE){len = BUFFER_HOST_ARGS_SIZE;}
+      args.assign((const char *)(rec + 2), len);
+      return true;
+    }
+    return false;
+  }
+
+  /// Marks a stream taken out with get() as served, or as failed to start.
+  /// A failed record is freed by the process that handed the stream over.
+  void bufferHost::started(uint32_t record, bool success){
+    if (!page.mapped || record >= BUFFER_HOST_STREAMS){return;}
+    volatile uint32_t * rec = (volatile uint32_t *)(page.mapped + 8 + record * BUFFER_HOST_RECORD);
+    __sync_synchronize();
+    rec[0] = success ? BUFFER_HOST_RUNNING : BUFFER_HOST_FAILED;
+  }
+
+  /// Frees the record of a stream the host stopped serving.
+  void bufferHost::release(uint32_t record){
+    if (!page.mapped || record >= BUFFER_HOST_STREAMS){return;}
+    volatile uint32_t * rec = (volatile uint32_t *)(page.mapped + 8 + record * BUFFER_HOST_RECORD);
+    rec[0] = BUFFER_HOST_EMPTY;
+  }
+
+  /// Returns true if the given record holds a stream that is (being) served, filling its arguments.
+  bool bufferHost::running(uint32_t record, std::string & args) const{
+    if (!page.mapped || record >= BUFFER_HOST_STREAMS){return false;}
+    volatile uint32_t * rec = (volatile uint32_t *)(page.mapped + 8 + record * BUFFER_HOST_RECORD);
+    if (rec[0] != BUFFER_HOST_RUNNING && rec[0] != BUFFER_HOST_STARTING){return false;}
+    uint32_t len = rec[1];
+    if (len > BUFFER_HOST_ARGS_SIZE){len = BUFFER_HOST_ARGS_SIZE;}
+    args.assign((const char *)(rec + 2), len);
+    return true;
+  }
+
+  /// Waits up to ms milliseconds for streams to be handed over. Returns true as soon as any were
+  /// posted since the previous call.
+  bool bufferHost::waitRequest(uint32_t ms){
+    if (!page.mapped){
+      Util::wait(ms);
+      return false;
+    }
+    volatile uint32_t * words = (volatile uint32_t *)page.mapped;
+    if (words[0] == lastRequest){futexWait(words, lastRequest, ms);}
+    bool changed = (words[0] != lastRequest);
+    lastRequest = words[0];
+    return changed;
+  }
+
+  manifestCache::manifestCache(){}
+
+  /// Marks the cache as closed if we own it, so outputs that still have it opened let go of it.
+  manifestCache::~manifestCache(){
+    if (page.mapped && page.master){*(volatile uint32_t *)(page.mapped + 12) = 1;}
+  }
+
+  /// Opens the manifest cache of the given stream.
+  /// The buffer creates it with master set; outputs open it without waiting for it to exist.
+  void manifestCache::init(const std::string & streamName, bool master){
+    char pageName[NAME_BUFFER_SIZE];
+    snprintf(pageName, NAME_BUFFER_SIZE, SHM_MANIFESTS, streamName.c_str());
+    page.init(pageName, MANIFEST_CACHE_SIZE, master, false);
+    if (page.mapped && master){
+      memset(page.mapped, 0, MANIFEST_DATA_START);
+      *(volatile uint32_t *)(page.mapped + 8) = getpid();
+      //start from the current time, so versions are not reused when the buffer restarts
+      *(volatile uint64_t *)page.mapped = Util::unixMS();
+    }
+  }
+
+  /// Returns true if the opened cache is still the one of the running buffer.
+  /// A restarted buffer creates a new cache under the same name, so a cache that was closed or whose
+  /// owner is gone must be opened again to see new versions.
+  bool manifestCache::isCurrent() const{
+    if (!page.mapped){return false;}
+    if (*(volatile uint32_t *)(page.mapped + 12)){return false;}
+    uint32_t owner = *(volatile uint32_t *)(page.mapped + 8);
+    return owner && Util::Procs::isRunning(owner);
+  }
+
+  /// Returns true if the cache is opened.
+  manifestCache::operator bool() const{
+    return page.mapped;
+  }
+
+  /// Returns the current version of the manifests, or zero if the cache is not opened.
+  uint64_t manifestCache::version() const{
+    if (!page.mapped){return 0;}
+    uint64_t ret = *(volatile uint64_t *)page.mapped;
+    __sync_synchronize();
+    return ret;
+  }
+
+  /// Sets the current version of the manifests, making every manifest stored so far outdated.
+  void manifestCache::setVersion(uint64_t version){
+    if (!page.mapped){return;}
+    __sync_synchronize();
+    *(volatile uint64_t *)page.mapped = version;
+  }
+
+  /// Fills manifest with the manifest stored under key for the given version.
+  /// Returns false if there is none, or it is being written at this moment.
+  bool manifestCache::get(const std::string & key, uint64_t version, std::string & manifest) const{
+    if (!page.mapped || !version || key.size() >= MANIFEST_KEY_SIZE){return false;}
+    for (size_t i = 0; i < MANIFEST_CACHE_SLOTS; ++i){
+      char * slot = page.mapped + MANIFEST_HEADER + i * MANIFEST_SLOT_STATE;
+      volatile uint32_t * seq = (volatile uint32_t *)slot;
+      uint32_t before = *seq;
+      if (before & 1){continue;}
+      __sync_synchronize();
+      if (*(volatile uint64_t *)(slot + 8) != version || strncmp(slot + 20, key.c_str(), MANIFEST_KEY_SIZE)){continue;}
+      uint32_t len = *(volatile uint32_t *)(slot + 16);
+      if (len > MANIFEST_CACHE_SLOT_SIZE){continue;}
+      manifest.assign(page.mapped + MANIFEST_DATA_START + i * MANIFEST_CACHE_SLOT_SIZE, len);
+      __sync_synchronize();
+      if (*seq == before){return true;}
+    }
+    return false;
+  }
+
+  /// Stores a manifest under key, for the given version.
+  /// Reuses the slot of the key if there is one, and otherwise any slot that holds no current manifest.
+  /// Does nothing if the manifest does not fit, or all slots are in use.
+  void manifestCache::put(const std::string & key, uint64_t version, const std::string & manifest){
+    if (!page.mapped || !version || key.size() >= MANIFEST_KEY_SIZE || manifest.size() > MANIFEST_CACHE_SLOT_SIZE){return;}
+    uint32_t pid = getpid();
+    for (int pass = 0; pass < 2; ++pass){
+      for (size_t i = 0; i < MANIFEST_CACHE_SLOTS; ++i){
+        char * slot = page.mapped + MANIFEST_HEADER + i * MANIFEST_SLOT_STATE;
+        //first pass: the slot of this key, second pass: any slot without a current manifest
+        if (pass == 0 && strncmp(slot + 20, key.c_str(), MANIFEST_KEY_SIZE)){continue;}
+        if (pass == 1 && *(volatile uint64_t *)(slot + 8) == version){continue;}
+        volatile uint32_t * seq = (volatile uint32_t *)slot;
+        volatile uint32_t * writer = seq + 1;
+        uint32_t current = *writer;
+        if (current && Util::Procs::isRunning(current)){return;}//someone else is storing it already
+        if (!__sync_bool_compare_and_swap(writer, current, pid)){return;}
+        //a writer that died halfway left the sequence number odd
+        uint32_t odd = *seq | 1;
+        *seq = odd;
+        __sync_synchronize();
+        memcpy(page.mapped + MANIFEST_DATA_START + i * MANIFEST_CACHE_SLOT_SIZE, manifest.data(), manifest.size());
+        *(volatile uint32_t *)(slot + 16) = manifest.size();
+        *(volatile uint64_t *)(slot + 8) = version;
+        strncpy(slot + 20, key.c_str(), MANIFEST_KEY_SIZE);
+        __sync_synchronize();
+        *seq = odd + 1;
+        *writer = 0;
+        return;
+      }
+    }
+  }
+}
@@ -108,6 +108,7 @@ namespace IPC {
       ~sharedFile();
       operator bool() const;
       void init(const std::string & name_, uint64_t len_, bool master_ =  false, bool autoBackoff = true);
+      bool create(const std::string & name_, uint64_t len_);
       void operator =(sharedFile & rhs);
       bool operator < (const sharedFile & rhs) const {
         return name < rhs.name;
@@ -141,6 +142,7 @@ namespace IPC {
     ~sharedPage();
     operator bool() const;
     void init(const std::string & name_, uint64_t len_, bool master_ =  false, bool autoBackoff = true);
+    bool create(const std::string & name_, uint64_t len_);
     void operator =(sharedPage & rhs);
     bool operator < (const sharedPage & rhs) const {
       return name < rhs.name;
@@ -252,6 +254,111 @@ namespace IPC {
       bool hasCounter;
   };
 
+  bool futexWait(volatile uint32_t * addr, uint32_t val, uint32_t ms);
+  void futexWake(volatile uint32_t * addr);
+
+  ///\brief A shared memory queue through which outputs ask the input of a stream to load pages.
+  ///
+  ///Any number of outputs may post (track, key) requests; the input that created the queue is the
+  ///only consumer. Requests and completions are both signalled through futexes on the shared page,
+  ///so the input wakes up as soon as a request is posted, and waiting outputs as soon as it is done.
+  ///When the queue is full, posting fails and the regular user page polling picks up the request.
+  class pageRequests {
+    public:
+      pageRequests();
+      void init(const std::string & streamName, bool master);
+      operator bool() const;
+      bool post(uint32_t track, uint32_t key);
+      bool get(uint32_t & track, uint32_t & key);
+      bool waitRequest(uint32_t ms);
+      void markCompleted();
+      uint32_t completed() const;
+      bool waitCompleted(uint32_t since, uint32_t ms);
+    private:
+      sharedPage page;
+      uint32_t lastRequest;
+  };
+
+  ///\brief A shared memory channel through which pushing processes negotiate new tracks with the buffer.
+  ///
+  ///A pushing process claims a free record, writes the track metadata to the metadata page of the
+  ///record's temporary track id, and posts the request. The buffer, the only consumer, is woken up
+  ///through a futex and answers with the final track id and first key number, waking the pusher in
+  ///turn. Records are only held for the duration of a negotiation, and every claim bumps the
+  ///sequence number of its record, so answers to abandoned requests never reach a later claimer.
+  class trackNegotiation {
+    public:
+      trackNegotiation();
+      void init(const std::string & streamName, bool master);
+      operator bool() const;
+      static uint32_t tempTrack(uint32_t record);
+      //used by pushing processes
+      int32_t claim();
+      void request(uint32_t record, uint32_t pid, uint32_t track);
+      int answer(uint32_t record, uint32_t & finalTrack, uint32_t & firstKey);
+      bool waitAnswer(uint32_t record, uint32_t ms);
+      void release(uint32_t record);
+      void notify();
+      //used by the buffer
+      bool get(uint32_t & record, uint32_t & seq, uint32_t & pid, uint32_t & track);
+      void respond(uint32_t record, uint32_t seq, bool accepted, uint32_t finalTrack = 0, uint32_t firstKey = 0);
+      bool waitRequest(uint32_t ms);
+      bool pending();
+    private:
+      sharedPage page;
+      uint32_t lastRequest;
+  };
+
+  ///\brief A shared memory table through which live stream buffers are handed to a buffer host process.
+  ///
+  ///A buffer process that finds a running host claims a free record, writes its arguments into it and
+  ///wakes the host through a futex. The host starts serving the stream and marks the record running,
+  ///after which the original process exits. Records stay filled for as long as their stream is
+  ///hosted, so the stream buffers can be cleaned up if the host crashes.
+  class bufferHost {
+    public:
+      bufferHost();
+      bool init(bool master);
+      operator bool() const;
+      bool hostAlive() const;
+      //used by buffer processes handing their stream over
+      int32_t post(const std::string & args);
+      int waitStarted(uint32_t record, uint32_t ms);
+      //used by the host
+      void setHost(uint32_t pid);
+      bool get(uint32_t & record, std::string & args);
+      void started(uint32_t record, bool success);
+      void release(uint32_t record);
+      bool running(uint32_t record, std::string & args) const;
+      bool waitRequest(uint32_t ms);
+    private:
+      sharedPage page;
+      uint32_t lastRequest;
+  };
+
+  ///\brief A per-stream shared memory cache of generated manifests, such as playlists and bootstraps.
+  ///
+  ///The buffer owns the cache and bumps its version whenever the keys or tracks of the stream change.
+  ///Outputs store every manifest they generate under a key of their choosing, tagged with the version
+  ///that was current before they read the metadata, and any output can then send a manifest with the
+  ///current version without generating it again. Slots are written under a sequence lock, so readers
+  ///never block and simply generate the manifest themselves if a slot is being written.
+  ///The cache records the buffer that owns it, so outputs can tell when the buffer restarted.
+  class manifestCache {
+    public:
+      manifestCache();
+      ~manifestCache();
+      void init(const std::string & streamName, bool master);
+      operator bool() const;
+      bool isCurrent() const;
+      uint64_t version() const;
+      void setVersion(uint64_t version);
+      bool get(const std::string & key, uint64_t version, std::string & manifest) const;
+      void put(const std::string & key, uint64_t version, const std::string & manifest);
+    private:
+      sharedPage page;
+  };
+
   class userConnection {
     public:
       userConnection(char * _data);
@@ -549,6 +549,7 @@ void Socket::Connection::clear(){
   Error = false;
   Blocking = false;
   skipCount = 0;
+  vectoredWrites = true;
 #ifdef SSL
   sslConnected = false;
   server_fd = 0;
@@ -971,6 +972,63 @@ void Socket::Connection::SendNow(const std::string &data){
   SendNow(data.data(), data.size());
 }
 
+/// The most buffers SendNow will combine into a single vectored write.
+#define SENDNOW_MAX_IOV 16
+
+/// Will not buffer anything but always send right away. Blocks.
+/// Sends all given buffers in order. On plain connections this is a single writev call (repeated
+/// only for partial writes), so a frame header, its payload and any trailer go out in one system
+/// call without first being copied together. Clearing vectoredWrites sends every buffer with a
+/// write of its own instead, which is mostly useful for comparing the two.
+void Socket::Connection::SendNow(const struct iovec *vec, size_t count){
+  bool vectored = vectoredWrites && !skipCount && count <= SENDNOW_MAX_IOV;
+#ifdef SSL
+  if (sslConnected){vectored = false;}
+#endif
+  if (!vectored){
+    for (size_t i = 0; i < count; ++i){SendNow((const char *)vec[i].iov_base, vec[i].iov_len);}
+    return;
+  }
+  struct iovec parts[SENDNOW_MAX_IOV];
+  size_t total = 0;
+  for (size_t i = 0; i < count; ++i){
+    parts[i] = vec[i];
+    total += vec[i].iov_len;
+  }
+  bool bing = isBlocking();
+  if (!bing){setBlocking(true);}
+  struct iovec *cur = parts;
+  while (total && connected()){
+    ssize_t r = writev(sSend, cur, count);
+    if (r < 0){
+      if (errno == EINTR || errno == EWOULDBLOCK){continue;}
+      Error = true;
+      lastErr = strerror(errno);
+      INSANE_MSG("Could not write data! Error: %s", lastErr.c_str());
+      close();
+      break;
+    }
+    if (r == 0){
+      DONTEVEN_MSG("Socket closed by remote");
+      close();
+      break;
+    }
+    up += r;
+    total -= r;
+    // skip the buffers that were written completely, then advance into the partial one
+    while (count && (size_t)r >= cur->iov_len){
+      r -= cur->iov_len;
+      ++cur;
+      --count;
+    }
+    if (count){
+      cur->iov_base = (char *)cur->iov_base + r;
+      cur->iov_len -= r;
+    }
+  }
+  if (!bing){setBlocking(false);}
+}
+
 void Socket::Connection::skipBytes(uint32_t byteCount){
   INFO_MSG("Skipping first %" PRIu32 " bytes going to socket", byteCount);
   skipCount = byteCount;
@@ -1228,6 +1286,7 @@ Socket::Connection::Connection(const Connection &rhs){
   up = rhs.up;
   down = rhs.down;
   downbuffer = rhs.downbuffer;
+  vectoredWrites = rhs.vectoredWrites;
 #ifdef SSL
   if (!rhs.sslConnected){
 #endif
@@ -1262,6 +1321,7 @@ Socket::Connection &Socket::Connection::operator=(const Socket::Connection &rhs)
   up = rhs.up;
   down = rhs.down;
   downbuffer = rhs.downbuffer;
+  vectoredWrites = rhs.vectoredWrites;
 #ifdef SSL
   if (!rhs.sslConnected){
 #endif
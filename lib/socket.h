@@ -13,6 +13,7 @@
 #include <string>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <unistd.h>
 
@@ -147,8 +148,10 @@ namespace Socket{
     void SendNow(const char *data); ///< Will not buffer anything but always send right away. Blocks.
     void SendNow(const char *data,
                  size_t len); ///< Will not buffer anything but always send right away. Blocks.
+    void SendNow(const struct iovec *vec, size_t count); ///< Sends several buffers in one write. Blocks.
     void skipBytes(uint32_t byteCount);
     uint32_t skipCount;
+    bool vectoredWrites; ///< If false, SendNow sends multiple buffers as separate writes. Defaults to true.
     // stats related methods
     unsigned int connTime(); ///< Returns the time this socket has been connected.
     uint64_t dataUp();       ///< Returns total amount of bytes sent.
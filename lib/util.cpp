@@ -958,5 +958,39 @@ namespace Util{
   RelAccXFieldData RelAccX::getFieldData(const std::string & fName) const {
     return fields.at(fName);
   }
-}
 
+  /// Like getFieldData, but returns false instead of throwing if the field does not exist.
+  bool RelAccX::getFieldData(const std::string & fName, RelAccXFieldData & fd) const {
+    std::map<std::string, RelAccXFieldData>::const_iterator it = fields.find(fName);
+    if (it == fields.end()){return false;}
+    fd = it->second;
+    return true;
+  }
+
+  const RelAccXFieldDef StateLogSchema::fields[StateLogSchema::FIELD_COUNT] = {
+    {"time", RAX_64UINT, 0},
+    {"kind", RAX_32STRING, 0},
+    {"msg", RAX_512STRING, 0},
+    {"strm", RAX_128STRING, 0}
+  };
+
+  const RelAccXFieldDef StateAccsSchema::fields[StateAccsSchema::FIELD_COUNT] = {
+    {"time", RAX_64UINT, 0},
+    {"session", RAX_32STRING, 0},
+    {"stream", RAX_128STRING, 0},
+    {"connector", RAX_32STRING, 0},
+    {"host", RAX_64STRING, 0},
+    {"duration", RAX_32UINT, 0},
+    {"up", RAX_64UINT, 0},
+    {"down", RAX_64UINT, 0},
+    {"tags", RAX_256STRING, 0}
+  };
+
+  const RelAccXFieldDef StateStreamsSchema::fields[StateStreamsSchema::FIELD_COUNT] = {
+    {"stream", RAX_128STRING, 0},
+    {"status", RAX_UINT, 1},
+    {"viewers", RAX_64UINT, 0},
+    {"inputs", RAX_64UINT, 0},
+    {"outputs", RAX_64UINT, 0}
+  };
+}
@@ -6,7 +6,10 @@
 #include <map>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <algorithm>
 #include "defines.h"
+#include "bitfields.h"
 
 namespace Util{
   bool isDirectory(const std::string &path);
@@ -177,6 +180,8 @@ namespace Util{
 
       FieldAccX getFieldAccX(const std::string & fName);
       RelAccXFieldData getFieldData(const std::string & fName) const;
+      bool getFieldData(const std::string & fName, RelAccXFieldData & fd) const;
+      inline char * getData() const{return p;}
     protected:
       static uint32_t getDefaultSize(uint8_t fType);
       std::map<std::string, RelAccXFieldData> fields;
@@ -195,4 +200,131 @@ namespace Util{
       RelAccX * src;
       RelAccXFieldData field;
   };
+
+  /// Describes a single field of a compile-time RelAccX schema.
+  struct RelAccXFieldDef{
+    const char * name;
+    uint8_t type;
+    uint32_t size; ///< Zero means the default size for the type
+  };
+
+  /// Typed accessor for RelAccX structures with a schema known at compile time.
+  /// The Schema class must provide an enum ending in FIELD_COUNT and a static const
+  /// RelAccXFieldDef fields[FIELD_COUNT] array indexed by that enum.
+  /// Field offsets are resolved once, on construction. After that all reads and writes are plain
+  /// pointer arithmetic, without any by-name lookups. The generic RelAccX functions remain available.
+  template <class Schema> class RelAccXTable : public RelAccX{
+    public:
+      using RelAccX::getPointer;
+      using RelAccX::getInt;
+      using RelAccX::setInt;
+      using RelAccX::setString;
+      using RelAccX::getFieldAccX;
+
+      /// Opens the structure at data. If create is true and the structure is not ready yet, the
+      /// schema fields are added and the structure is set to ready.
+      RelAccXTable(char * data = NULL, bool waitReady = true, bool create = false) : RelAccX(data, waitReady && !create){
+        compatible = false;
+        recOffset = 0;
+        recSize = 0;
+        if (!getData()){return;}
+        if (create && !RelAccX::isReady()){
+          for (size_t i = 0; i < Schema::FIELD_COUNT; ++i){
+            addField(Schema::fields[i].name, Schema::fields[i].type, Schema::fields[i].size);
+          }
+          setReady();
+        }
+        if (!RelAccX::isReady()){return;}
+        compatible = true;
+        for (size_t i = 0; i < Schema::FIELD_COUNT; ++i){
+          if (!getFieldData(Schema::fields[i].name, fd[i]) || (fd[i].type & 0xF0) != (Schema::fields[i].type & 0xF0)){
+            WARN_MSG("RelAccX structure does not match schema: field %s missing or of wrong type", Schema::fields[i].name);
+            compatible = false;
+            fd[i] = RelAccXFieldData(0, 0, 0);
+          }
+        }
+        recOffset = getOffset();
+        recSize = getRSize();
+      }
+
+      /// True if the structure is ready and contains all schema fields with matching types.
+      bool isReady() const{return compatible && RelAccX::isReady();}
+
+      /// Returns a pointer to field f of the given record.
+      inline char * getPointer(size_t f, uint64_t recordNo) const{
+        uint32_t rCount = getRCount();
+        return getData() + recOffset + (rCount ? recordNo % rCount : recordNo) * recSize + fd[f].offset;
+      }
+
+      /// Returns the value of integer field f in the given record.
+      inline uint64_t getInt(size_t f, uint64_t recordNo) const{
+        const char * ptr = getPointer(f, recordNo);
+        bool isSigned = ((fd[f].type & 0xF0) == RAX_INT);
+        switch (fd[f].size){
+          case 1: return isSigned ? (uint64_t)*(int8_t *)ptr : *(uint8_t *)ptr;
+          case 2: return isSigned ? (uint64_t)*(int16_t *)ptr : *(uint16_t *)ptr;
+          case 3: return Bit::btoh24(ptr);
+          case 4: return isSigned ? (uint64_t)*(int32_t *)ptr : *(uint32_t *)ptr;
+          case 8: return *(uint64_t *)ptr;
+          default: return 0;
+        }
+      }
+
+      /// Writes val to integer field f in the given record.
+      inline void setInt(size_t f, uint64_t val, uint64_t recordNo){
+        char * ptr = getPointer(f, recordNo);
+        switch (fd[f].size){
+          case 1: *(uint8_t *)ptr = val; return;
+          case 2: *(uint16_t *)ptr = val; return;
+          case 3: Bit::htob24(ptr, val); return;
+          case 4: *(uint32_t *)ptr = val; return;
+          case 8: *(uint64_t *)ptr = val; return;
+          default: return;
+        }
+      }
+
+      /// Writes val to string field f in the given record, always zero-terminating it.
+      inline void setString(size_t f, const std::string & val, uint64_t recordNo){
+        if (!fd[f].size){return;}
+        char * ptr = getPointer(f, recordNo);
+        size_t len = std::min((size_t)fd[f].size - 1, val.size());
+        memcpy(ptr, val.data(), len);
+        ptr[len] = 0;
+      }
+
+      /// Copies integer field f of records [startRec, endRec) into out, which must be big enough.
+      /// Returns the amount of values written.
+      size_t getInts(size_t f, uint64_t startRec, uint64_t endRec, uint64_t * out) const{
+        size_t count = 0;
+        for (uint64_t i = startRec; i < endRec; ++i){out[count++] = getInt(f, i);}
+        return count;
+      }
+
+      /// Returns a FieldAccX for field f, for code that works with generic field accessors.
+      FieldAccX getFieldAccX(size_t f){return FieldAccX(this, fd[f]);}
+
+    private:
+      RelAccXFieldData fd[Schema::FIELD_COUNT];
+      uint16_t recOffset;
+      uint32_t recSize;
+      bool compatible;
+  };
+
+  /// Schema of the controller log buffer, SHM_STATE_LOGS.
+  struct StateLogSchema{
+    enum{TIME, KIND, MSG, STRM, FIELD_COUNT};
+    static const RelAccXFieldDef fields[FIELD_COUNT];
+  };
+
+  /// Schema of the controller access log buffer, SHM_STATE_ACCS.
+  struct StateAccsSchema{
+    enum{TIME, SESSION, STREAM, CONNECTOR, HOST, DURATION, UP, DOWN, TAGS, FIELD_COUNT};
+    static const RelAccXFieldDef fields[FIELD_COUNT];
+  };
+
+  /// Schema of the controller stream state table, SHM_STATE_STREAMS.
+  struct StateStreamsSchema{
+    enum{STREAM, STATUS, VIEWERS, INPUTS, OUTPUTS, FIELD_COUNT};
+    static const RelAccXFieldDef fields[FIELD_COUNT];
+  };
 }
@@ -146,22 +146,27 @@ namespace HTTP{
   
   void Websocket::sendFrame(const char * data, unsigned int len, unsigned int frameType){
     char header[10];
+    struct iovec parts[2];
+    parts[0].iov_base = header;
     header[0] = 0x80 + frameType;//FIN + frameType
     if (len < 126){
       header[1] = len;
-      C.SendNow(header, 2);
+      parts[0].iov_len = 2;
     }else{
       if (len <= 0xFFFF){
         header[1] = 126;
         Bit::htobs(header+2, len);
-        C.SendNow(header, 4);
+        parts[0].iov_len = 4;
       }else{
         header[1] = 127;
         Bit::htobll(header+2, len);
-        C.SendNow(header, 10);
+        parts[0].iov_len = 10;
       }
     }
-    C.SendNow(data, len);
+    //header and payload go out in a single write
+    parts[1].iov_base = (void*)data;
+    parts[1].iov_len = len;
+    C.SendNow(parts, 2);
   }
   
   void Websocket::sendFrame(const std::string & data){
@@ -3,7 +3,9 @@
 
 #include <mist/util.h>
 #include "controller_api.h"
+#include "controller_accesslog.h"
 #include "controller_capabilities.h"
+#include "controller_apiloop.h"
 #include "controller_connectors.h"
 #include "controller_statistics.h"
 #include "controller_storage.h"
@@ -138,9 +140,23 @@ int main_loop(int argc, char **argv){
                        "\"help\":\"Username to transfer privileges to, default is root.\"}");
   stored_user["default"] = Controller::Storage["config"]["controller"]["username"];
   if (!stored_user["default"]){stored_user["default"] = "root";}
+  JSON::Value stored_accesslog =
+      JSON::fromString("{\"long\":\"accesslog\", \"short\":\"A\", \"arg\":\"string\", "
+                       "\"help\":\"Directory to keep a persistent binary access log in. Disabled "
+                       "if empty.\"}");
+  stored_accesslog["default"] = Controller::Storage["config"]["controller"]["accesslog"];
+  if (!stored_accesslog["default"]){stored_accesslog["default"] = "";}
+  JSON::Value stored_accessdays =
+      JSON::fromString("{\"long\":\"accesslogdays\", \"short\":\"D\", \"arg\":\"integer\", "
+                       "\"help\":\"Amount of days to keep persistent access log records for. Zero "
+                       "keeps them forever.\"}");
+  stored_accessdays["default"] = Controller::Storage["config"]["controller"]["accesslogdays"];
+  if (!stored_accessdays["default"]){stored_accessdays["default"] = 30;}
   Controller::conf.addOption("port", stored_port);
   Controller::conf.addOption("interface", stored_interface);
   Controller::conf.addOption("username", stored_user);
+  Controller::conf.addOption("accesslog", stored_accesslog);
+  Controller::conf.addOption("accesslogdays", stored_accessdays);
   Controller::conf.addOption(
       "account", JSON::fromString("{\"long\":\"account\", \"short\":\"a\", \"arg\":\"string\" "
                                   "\"default\":\"\", \"help\":\"A username:password string to "
@@ -241,6 +257,15 @@ int main_loop(int argc, char **argv){
     Controller::conf.getOption("username", true)[0u] =
         Controller::Storage["config"]["controller"]["username"];
   }
+  if (Controller::Storage["config"]["controller"]["accesslog"]){
+    Controller::conf.getOption("accesslog", true)[0u] =
+        Controller::Storage["config"]["controller"]["accesslog"];
+  }
+  if (Controller::Storage["config"]["controller"]["accesslogdays"]){
+    Controller::conf.getOption("accesslogdays", true)[0u] =
+        Controller::Storage["config"]["controller"]["accesslogdays"];
+  }
+  Controller::accessLogInit(Controller::conf.getString("accesslog"), Controller::conf.getInteger("accesslogdays"));
   Controller::writeConfig();
   Controller::checkAvailProtocols();
   Controller::writeCapabilities();
@@ -417,10 +442,12 @@ int main_loop(int argc, char **argv){
   tthread::thread monitorThread(statusMonitor, 0);
   // start UDP API thread
   tthread::thread UDPAPIThread(Controller::handleUDPAPI, 0);
+  // start persistent access log writer thread
+  tthread::thread accessLogThread(Controller::accessLogWriter, 0);
 
   // start main loop
   while (Controller::conf.is_active){
-    Controller::conf.serveThreadedSocket(Controller::handleAPIConnection);
+    Controller::conf.serveEventSocket(Controller::handleAPIEventLoop);
     // print shutdown reason
     std::string shutdown_reason;
     if (!Controller::conf.is_active){
@@ -439,6 +466,8 @@ int main_loop(int argc, char **argv){
   monitorThread.join();
   HIGH_MSG("Joining UDP API thread...");
   UDPAPIThread.join();
+  HIGH_MSG("Joining access log thread...");
+  accessLogThread.join();
   // write config
   tthread::lock_guard<tthread::mutex> guard(Controller::logMutex);
   Controller::writeConfigToDisk();
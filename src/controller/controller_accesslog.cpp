@@ -0,0 +1,530 @@
+/// \file controller_accesslog.cpp
+/// Persistent, segment-rotated binary access log.
+///
+/// Finished sessions are queued in memory by accessLogAppend and written to disk in batches by the
+/// accessLogWriter thread. Each batch becomes one self-describing block, appended to the current
+/// segment file (access_<epoch>.mal). A new segment is started every hour or 64 MiB, and segments
+/// older than the retention period are removed.
+///
+/// Block layout (all integers big endian):
+///     4 bytes magic "MAL1"
+///     4 bytes total block length
+///     4 bytes record count N
+///     8 bytes time of the oldest record in the block
+///     8 bytes time of the newest record in the block
+///     4 bytes header length (offset of the first column)
+///     2 bytes stream dictionary entry count, followed by per entry: 2 bytes length, name
+///     Columns: N x 8 bytes time, N x 4 bytes duration, N x 8 bytes up, N x 8 bytes down,
+///              N x 2 bytes stream dictionary index,
+///              then N x (2 bytes length, data) each for session, connector, host and tags.
+/// The block headers double as the time/stream index, so queries only read blocks that can contain
+/// matching records. Only the blocks of the segment currently being written are indexed one by
+/// one; finished segments are collapsed into a single summary entry, and their block headers are
+/// read from disk as a query walks them. The index thus holds one entry per segment in the
+/// retention period, plus at most one per block of the current segment.
+/// If records arrive faster than they can be written, at most ACCLOG_MAX_PENDING are kept in
+/// memory; the rest are dropped and counted.
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <set>
+#include <vector>
+#include <mist/bitfields.h>
+#include <mist/defines.h>
+#include <mist/json.h>
+#include <mist/timing.h>
+#include <mist/tinythread.h>
+#include <mist/util.h>
+#include "controller_accesslog.h"
+#include "controller_storage.h"
+
+#define ACCLOG_MAGIC "MAL1"
+/// Size of the block header up to and including the stream dictionary entry count.
+#define ACCLOG_FIXED_HDR 34
+/// Maximum age in seconds of a segment file before a new one is started.
+#define ACCLOG_SEGMENT_AGE 3600
+/// Maximum size in bytes of a segment file before a new one is started.
+#define ACCLOG_SEGMENT_SIZE (64 * 1024 * 1024)
+/// Maximum time in milliseconds records are kept in memory before being written.
+#define ACCLOG_FLUSH_INTERVAL 5000
+/// Maximum amount of records per block. Reaching this amount also triggers an early write.
+#define ACCLOG_BATCH 4096
+/// Maximum amount of records waiting to be written. Records beyond this are dropped.
+#define ACCLOG_MAX_PENDING (16 * ACCLOG_BATCH)
+
+namespace Controller {
+  /// In-memory index entry for a range of one or more consecutive blocks on disk.
+  struct accessBlock {
+    std::string file;
+    uint64_t offset;
+    uint64_t length;
+    uint64_t count;
+    uint64_t firstTime;
+    uint64_t lastTime;
+    std::set<std::string> streams;
+  };
+
+  static std::string logDir;
+  static uint64_t retention = 0; ///< Retention period in seconds, zero for forever.
+  static tthread::mutex pendingMutex;
+  static std::vector<accessRecord> pending; ///< Records waiting to be written, guarded by pendingMutex.
+  static tthread::mutex indexMutex;
+  static std::deque<accessBlock> blockIndex; ///< All blocks on disk, oldest first, guarded by indexMutex.
+  static uint64_t dropped = 0; ///< Records dropped because too many were pending, guarded by pendingMutex.
+  static std::string segFile;
+  static int segFd = -1;
+  static uint64_t segStart = 0;
+  static uint64_t segSize = 0;
+
+  static void putInt(std::string & out, uint64_t val, size_t bytes){
+    char buf[8];
+    switch (bytes){
+      case 2: Bit::htobs(buf, val); break;
+      case 4: Bit::htobl(buf, val); break;
+      default: Bit::htobll(buf, val); break;
+    }
+    out.append(buf, bytes);
+  }
+
+  static void putString(std::string & out, const std::string & val){
+    size_t len = std::min(val.size(), (size_t)0xFFFF);
+    putInt(out, len, 2);
+    out.append(val.data(), len);
+  }
+
+  /// Encodes records [start, end) into a single block, filling the index entry with its details.
+  static void encodeBlock(const std::vector<accessRecord> & recs, size_t start, size_t end, std::string & out, accessBlock & blk){
+    std::map<std::string, uint16_t> strmIds;
+    std::vector<const std::string *> strmNames;
+    blk.count = end - start;
+    blk.firstTime = recs[start].time;
+    blk.lastTime = recs[start].time;
+    blk.streams.clear();
+    for (size_t i = start; i < end; ++i){
+      if (recs[i].time < blk.firstTime){blk.firstTime = recs[i].time;}
+      if (recs[i].time > blk.lastTime){blk.lastTime = recs[i].time;}
+      if (!strmIds.count(recs[i].stream)){
+        strmIds[recs[i].stream] = strmNames.size();
+        strmNames.push_back(&(recs[i].stream));
+        blk.streams.insert(recs[i].stream);
+      }
+    }
+    out.clear();
+    out.append(ACCLOG_MAGIC, 4);
+    putInt(out, 0, 4);//block length, filled in below
+    putInt(out, blk.count, 4);
+    putInt(out, blk.firstTime, 8);
+    putInt(out, blk.lastTime, 8);
+    putInt(out, 0, 4);//header length, filled in below
+    putInt(out, strmNames.size(), 2);
+    for (size_t i = 0; i < strmNames.size(); ++i){putString(out, *strmNames[i]);}
+    Bit::htobl((char *)out.data() + 28, out.size());
+    for (size_t i = start; i < end; ++i){putInt(out, recs[i].time, 8);}
+    for (size_t i = start; i < end; ++i){putInt(out, recs[i].duration, 4);}
+    for (size_t i = start; i < end; ++i){putInt(out, recs[i].up, 8);}
+    for (size_t i = start; i < end; ++i){putInt(out, recs[i].down, 8);}
+    for (size_t i = start; i < end; ++i){putInt(out, strmIds[recs[i].stream], 2);}
+    for (size_t i = start; i < end; ++i){putString(out, recs[i].session);}
+    for (size_t i = start; i < end; ++i){putString(out, recs[i].connector);}
+    for (size_t i = start; i < end; ++i){putString(out, recs[i].host);}
+    for (size_t i = start; i < end; ++i){putString(out, recs[i].tags);}
+    Bit::htobl((char *)out.data() + 4, out.size());
+    blk.length = out.size();
+  }
+
+  /// Reads the header of the block at the given offset of an open segment file into blk.
+  /// Returns false if there is no (complete) valid block at that position.
+  static bool readBlockHeader(int fd, uint64_t offset, uint64_t fileSize, accessBlock & blk){
+    char hdr[ACCLOG_FIXED_HDR];
+    if (offset + ACCLOG_FIXED_HDR > fileSize){return false;}
+    if (pread(fd, hdr, ACCLOG_FIXED_HDR, offset) != ACCLOG_FIXED_HDR){return false;}
+    if (memcmp(hdr, ACCLOG_MAGIC, 4)){return false;}
+    blk.offset = offset;
+    blk.length = Bit::btohl(hdr + 4);
+    blk.count = Bit::btohl(hdr + 8);
+    blk.firstTime = Bit::btohll(hdr + 12);
+    blk.lastTime = Bit::btohll(hdr + 20);
+    uint32_t hdrLen = Bit::btohl(hdr + 28);
+    uint16_t strmCount = Bit::btohs(hdr + 32);
+    if (hdrLen < ACCLOG_FIXED_HDR || hdrLen > blk.length || offset + blk.length > fileSize){return false;}
+    std::string dict(hdrLen - ACCLOG_FIXED_HDR, (char)0);
+    if (dict.size() && pread(fd, (char *)dict.data(), dict.size(), offset + ACCLOG_FIXED_HDR) != (ssize_t)dict.size()){return false;}
+    blk.streams.clear();
+    size_t pos = 0;
+    for (uint16_t i = 0; i < strmCount; ++i){
+      if (pos + 2 > dict.size()){return false;}
+      uint16_t len = Bit::btohs(dict.data() + pos);
+      if (pos + 2 + len > dict.size()){return false;}
+      blk.streams.insert(dict.substr(pos + 2, len));
+      pos += 2 + len;
+    }
+    return true;
+  }
+
+  /// Extends the summary entry sum with the directly following block blk.
+  static void mergeBlock(accessBlock & sum, const accessBlock & blk){
+    if (!sum.count && !sum.length){
+      sum = blk;
+      return;
+    }
+    sum.length = blk.offset + blk.length - sum.offset;
+    sum.count += blk.count;
+    if (blk.firstTime < sum.firstTime){sum.firstTime = blk.firstTime;}
+    if (blk.lastTime > sum.lastTime){sum.lastTime = blk.lastTime;}
+    sum.streams.insert(blk.streams.begin(), blk.streams.end());
+  }
+
+  /// Collapses the trailing index entries of the given segment into a single summary entry.
+  /// Must be called with indexMutex held.
+  static void collapseSegment(const std::string & file){
+    size_t first = blockIndex.size();
+    while (first && blockIndex[first - 1].file == file){--first;}
+    if (blockIndex.size() - first < 2){return;}
+    accessBlock sum = blockIndex[first];
+    for (size_t i = first + 1; i < blockIndex.size(); ++i){mergeBlock(sum, blockIndex[i]);}
+    blockIndex.erase(blockIndex.begin() + first, blockIndex.end());
+    blockIndex.push_back(sum);
+  }
+
+  /// Rebuilds the in-memory index from the segment files present in the log directory.
+  /// Writing always continues in a new segment, so every segment found gets a single summary entry.
+  static void scanSegments(){
+    DIR * d = opendir(logDir.c_str());
+    if (!d){
+      FAIL_MSG("Could not open access log directory %s: %s", logDir.c_str(), strerror(errno));
+      return;
+    }
+    std::map<uint64_t, std::string> segments;
+    struct dirent * dp;
+    while ((dp = readdir(d))){
+      std::string name = dp->d_name;
+      if (name.size() < 12 || name.substr(0, 7) != "access_" || name.substr(name.size() - 4) != ".mal"){continue;}
+      segments[strtoull(name.c_str() + 7, 0, 10)] = logDir + "/" + name;
+    }
+    closedir(d);
+    tthread::lock_guard<tthread::mutex> guard(indexMutex);
+    for (std::map<uint64_t, std::string>::iterator it = segments.begin(); it != segments.end(); ++it){
+      int fd = open(it->second.c_str(), O_RDONLY);
+      if (fd < 0){continue;}
+      struct stat st;
+      fstat(fd, &st);
+      uint64_t offset = 0;
+      accessBlock blk, sum;
+      blk.file = it->second;
+      sum.length = 0;
+      sum.count = 0;
+      while (readBlockHeader(fd, offset, st.st_size, blk)){
+        mergeBlock(sum, blk);
+        offset += blk.length;
+      }
+      if (sum.length){blockIndex.push_back(sum);}
+      if (offset < (uint64_t)st.st_size){
+        WARN_MSG("Ignoring %" PRIu64 " trailing bytes in access log segment %s", (uint64_t)st.st_size - offset, it->second.c_str());
+      }
+      close(fd);
+    }
+    INFO_MSG("Access log index contains %zu of %zu segments", blockIndex.size(), segments.size());
+  }
+
+  /// Sets up the persistent access log in the given directory.
+  /// Does nothing if the directory is empty, which keeps the persistent access log disabled.
+  void accessLogInit(const std::string & directory, uint32_t retentionDays){
+    if (!directory.size()){return;}
+    if (!Util::createPath(directory)){
+      FAIL_MSG("Could not create access log directory %s - persistent access log disabled", directory.c_str());
+      return;
+    }
+    logDir = directory;
+    retention = retentionDays * 86400ull;
+    scanSegments();
+  }
+
+  bool accessLogEnabled(){return logDir.size();}
+
+  /// Queues a record for writing by the accessLogWriter thread.
+  /// Drops the record if ACCLOG_MAX_PENDING records are already waiting.
+  void accessLogAppend(const accessRecord & rec){
+    if (!logDir.size()){return;}
+    tthread::lock_guard<tthread::mutex> guard(pendingMutex);
+    if (pending.size() >= ACCLOG_MAX_PENDING){
+      ++dropped;
+      return;
+    }
+    pending.push_back(rec);
+  }
+
+  /// Starts a new segment file if there is none yet, or the current one is too old or too big.
+  static bool rotateSegment(uint64_t now){
+    if (segFd != -1 && now - segStart < ACCLOG_SEGMENT_AGE && segSize < ACCLOG_SEGMENT_SIZE){return true;}
+    if (segFd != -1){
+      close(segFd);
+      tthread::lock_guard<tthread::mutex> guard(indexMutex);
+      collapseSegment(segFile);
+    }
+    segStart = now;
+    segFile = logDir + "/access_" + JSON::Value(now).asString() + ".mal";
+    segFd = open(segFile.c_str(), O_WRONLY | O_APPEND | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP);
+    if (segFd == -1){
+      FAIL_MSG("Could not open access log segment %s: %s", segFile.c_str(), strerror(errno));
+      return false;
+    }
+    struct stat st;
+    fstat(segFd, &st);
+    segSize = st.st_size;
+    return true;
+  }
+
+  /// Removes segments of which all records are older than the retention period.
+  static void expireSegments(uint64_t now){
+    if (!retention || now < retention){return;}
+    uint64_t cutOff = now - retention;
+    tthread::lock_guard<tthread::mutex> guard(indexMutex);
+    while (blockIndex.size() && blockIndex.front().file != segFile){
+      std::string file = blockIndex.front().file;
+      size_t blocks = 0;
+      bool expired = true;
+      while (blocks < blockIndex.size() && blockIndex[blocks].file == file){
+        if (blockIndex[blocks].lastTime >= cutOff){expired = false;}
+        ++blocks;
+      }
+      if (!expired){return;}
+      INFO_MSG("Removing expired access log segment %s", file.c_str());
+      unlink(file.c_str());
+      blockIndex.erase(blockIndex.begin(), blockIndex.begin() + blocks);
+    }
+  }
+
+  /// Writes the given records to disk, in blocks of at most ACCLOG_BATCH records.
+  static void writeRecords(const std::vector<accessRecord> & recs){
+    std::string data;
+    accessBlock blk;
+    for (size_t start = 0; start < recs.size(); start += ACCLOG_BATCH){
+      size_t end = std::min(start + ACCLOG_BATCH, recs.size());
+      if (!rotateSegment(Util::epoch())){return;}
+      encodeBlock(recs, start, end, data, blk);
+      size_t written = 0;
+      while (written < data.size()){
+        ssize_t ret = write(segFd, data.data() + written, data.size() - written);
+        if (ret < 0){
+          if (errno == EINTR){continue;}
+          FAIL_MSG("Could not write to access log segment %s: %s", segFile.c_str(), strerror(errno));
+          //Forget about the partial block; the index scan skips it on the next start
+          close(segFd);
+          segFd = -1;
+          return;
+        }
+        written += ret;
+      }
+      blk.file = segFile;
+      blk.offset = segSize;
+      segSize += data.size();
+      tthread::lock_guard<tthread::mutex> guard(indexMutex);
+      blockIndex.push_back(blk);
+    }
+  }
+
+  /// Writer thread for the persistent access log.
+  /// Writes pending records every ACCLOG_FLUSH_INTERVAL ms, or sooner if a full batch is pending.
+  /// Keeps running until both the config is inactive and nothing is pending anymore.
+  void accessLogWriter(void * np){
+    if (!logDir.size()){return;}
+    std::vector<accessRecord> batch;
+    uint64_t lastFlush = Util::bootMS();
+    bool active = true;
+    while (active){
+      active = conf.is_active;
+      size_t pendCount;
+      uint64_t lost = 0;
+      {
+        tthread::lock_guard<tthread::mutex> guard(pendingMutex);
+        pendCount = pending.size();
+        if (pendCount && (pendCount >= ACCLOG_BATCH || !active || Util::bootMS() - lastFlush >= ACCLOG_FLUSH_INTERVAL)){
+          batch.swap(pending);
+          lost = dropped;
+          dropped = 0;
+        }
+      }
+      if (lost){
+        WARN_MSG("Access log could not keep up: dropped %" PRIu64 " records", lost);
+      }
+      if (batch.size()){
+        writeRecords(batch);
+        batch.clear();
+        lastFlush = Util::bootMS();
+        expireSegments(Util::epoch());
+        continue;
+      }
+      if (pendCount < ACCLOG_BATCH && active){Util::sleep(100);}
+    }
+    if (segFd != -1){
+      close(segFd);
+      segFd = -1;
+    }
+  }
+
+  /// Sends the JSON representation of a record, buffering output into chunks.
+  static void sendRecord(const accessRecord & rec, bool first, std::string & buf, HTTP::Parser & H, Socket::Connection & conn){
+    char nums[128];
+    if (!first){buf += ",\n";}
+    snprintf(nums, 128, "[%" PRIu64 ",", rec.time);
+    buf += nums;
+    buf += JSON::string_escape(rec.session) + ",";
+    buf += JSON::string_escape(rec.stream) + ",";
+    buf += JSON::string_escape(rec.connector) + ",";
+    buf += JSON::string_escape(rec.host) + ",";
+    snprintf(nums, 128, "%" PRIu32 ",%" PRIu64 ",%" PRIu64 ",", rec.duration, rec.up, rec.down);
+    buf += nums;
+    buf += JSON::string_escape(rec.tags) + "]";
+    if (buf.size() > 64 * 1024){
+      H.Chunkify(buf, conn);
+      buf.clear();
+    }
+  }
+
+  static std::string getString(const char * & ptr, const char * end){
+    if (ptr + 2 > end){return "";}
+    uint16_t len = Bit::btohs(ptr);
+    if (ptr + 2 + len > end){
+      ptr = end;
+      return "";
+    }
+    std::string ret(ptr + 2, len);
+    ptr += 2 + len;
+    return ret;
+  }
+
+  /// Decodes a block and sends all records matching the time range and (optional) stream name.
+  /// Returns the amount of records sent.
+  static uint64_t sendBlock(const std::string & data, uint64_t startTime, uint64_t endTime, const std::string & stream, bool first, std::string & buf, HTTP::Parser & H, Socket::Connection & conn){
+    if (data.size() < ACCLOG_FIXED_HDR){return 0;}
+    const char * d = data.data();
+    const char * end = d + data.size();
+    uint32_t count = Bit::btohl(d + 8);
+    uint32_t hdrLen = Bit::btohl(d + 28);
+    uint16_t strmCount = Bit::btohs(d + 32);
+    if (hdrLen + count * 30ull > data.size()){return 0;}
+    std::vector<std::string> strmNames;
+    const char * ptr = d + ACCLOG_FIXED_HDR;
+    for (uint16_t i = 0; i < strmCount; ++i){strmNames.push_back(getString(ptr, d + hdrLen));}
+    const char * times = d + hdrLen;
+    const char * durations = times + count * 8;
+    const char * ups = durations + count * 4;
+    const char * downs = ups + count * 8;
+    const char * strms = downs + count * 8;
+    //Find the start of each of the variable-length string columns
+    const char * strCols[4];
+    ptr = strms + count * 2;
+    for (size_t c = 0; c < 4; ++c){
+      strCols[c] = ptr;
+      for (uint32_t i = 0; i < count && ptr + 2 <= end; ++i){ptr += 2 + Bit::btohs(ptr);}
+    }
+    uint64_t sent = 0;
+    accessRecord rec;
+    for (uint32_t i = 0; i < count; ++i){
+      rec.time = Bit::btohll(times + i * 8);
+      uint16_t strmId = Bit::btohs(strms + i * 2);
+      bool match = (rec.time >= startTime && rec.time <= endTime && strmId < strmNames.size());
+      if (match && stream.size() && strmNames[strmId] != stream){match = false;}
+      if (!match){
+        for (size_t c = 0; c < 4; ++c){getString(strCols[c], end);}
+        continue;
+      }
+      rec.stream = strmNames[strmId];
+      rec.duration = Bit::btohl(durations + i * 4);
+      rec.up = Bit::btohll(ups + i * 8);
+      rec.down = Bit::btohll(downs + i * 8);
+      rec.session = getString(strCols[0], end);
+      rec.connector = getString(strCols[1], end);
+      rec.host = getString(strCols[2], end);
+      rec.tags = getString(strCols[3], end);
+      sendRecord(rec, first && !sent, buf, H, conn);
+      ++sent;
+    }
+    return sent;
+  }
+
+  /// Handles a query on the persistent access log, streaming the results as they are read.
+  /// \api
+  /// `/accesslog` HTTP requests return all records in the persistent access log that match the
+  /// given filters, as a JSON array sent in chunked transfer encoding:
+  /// ~~~~~~~~~~~~~~~{.js}
+  /// [
+  ///   [
+  ///     1398978357, //unix timestamp of the end of the session
+  ///     "", //session identifier
+  ///     "example", //stream name
+  ///     "HLS", //connector name
+  ///     "127.0.0.1", //host
+  ///     32, //duration in seconds
+  ///     1024, //bytes sent by the client
+  ///     1048576, //bytes sent to the client
+  ///     "" //tags
+  ///   ],
+  ///   //the above structure repeated for all matching records
+  /// ]
+  /// ~~~~~~~~~~~~~~~
+  /// The optional `start` and `end` variables limit the results to the given unix time range
+  /// (inclusive), and `stream` limits them to a single stream. Records are written to disk in
+  /// batches, so the last few seconds of records may not be visible yet.
+  void handleAccessLogQuery(HTTP::Parser & H, Socket::Connection & conn){
+    uint64_t startTime = 0;
+    uint64_t endTime = 0xFFFFFFFFFFFFFFFFull;
+    if (H.GetVar("start").size()){startTime = JSON::Value(H.GetVar("start")).asInt();}
+    if (H.GetVar("end").size()){endTime = JSON::Value(H.GetVar("end")).asInt();}
+    std::string stream = H.GetVar("stream");
+    HTTP::Parser R;
+    R.SetHeader("Content-Type", "application/json");
+    R.SetHeader("Server", "MistServer/" PACKAGE_VERSION);
+    R.setCORSHeaders();
+    if (!logDir.size()){
+      R.SetBody("[]\n");
+      R.SendResponse("404", "Persistent access log not enabled", conn);
+      return;
+    }
+    //Take a copy of the matching index entries, so writes can continue while we send
+    std::deque<accessBlock> blocks;
+    {
+      tthread::lock_guard<tthread::mutex> guard(indexMutex);
+      for (std::deque<accessBlock>::iterator it = blockIndex.begin(); it != blockIndex.end(); ++it){
+        if (it->lastTime < startTime || it->firstTime > endTime){continue;}
+        if (stream.size() && !it->streams.count(stream)){continue;}
+        blocks.push_back(*it);
+      }
+    }
+    R.StartResponse("200", "OK", H, conn);
+    std::string buf = "[";
+    std::string data;
+    std::string openFile;
+    int fd = -1;
+    uint64_t sent = 0;
+    accessBlock blk;
+    for (std::deque<accessBlock>::iterator it = blocks.begin(); it != blocks.end() && conn; ++it){
+      if (it->file != openFile){
+        if (fd != -1){close(fd);}
+        openFile = it->file;
+        fd = open(openFile.c_str(), O_RDONLY);
+      }
+      if (fd == -1){continue;}
+      //Summary entries cover several blocks; walk their headers to skip the ones that cannot match
+      uint64_t offset = it->offset;
+      uint64_t rangeEnd = it->offset + it->length;
+      while (offset < rangeEnd && conn && readBlockHeader(fd, offset, rangeEnd, blk)){
+        offset += blk.length;
+        if (blk.lastTime < startTime || blk.firstTime > endTime){continue;}
+        if (stream.size() && !blk.streams.count(stream)){continue;}
+        data.resize(blk.length);
+        if (pread(fd, (char *)data.data(), blk.length, offset - blk.length) != (ssize_t)blk.length){break;}
+        sent += sendBlock(data, startTime, endTime, stream, !sent, buf, R, conn);
+      }
+    }
+    if (fd != -1){close(fd);}
+    buf += "]\n";
+    R.Chunkify(buf, conn);
+    R.Chunkify("", 0, conn);
+  }
+}
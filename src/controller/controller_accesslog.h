@@ -0,0 +1,25 @@
+#pragma once
+#include <mist/socket.h>
+#include <mist/http_parser.h>
+#include <string>
+
+namespace Controller {
+  /// A single finished session, as stored in the persistent access log.
+  struct accessRecord {
+    uint64_t time;
+    std::string session;
+    std::string stream;
+    std::string connector;
+    std::string host;
+    uint32_t duration;
+    uint64_t up;
+    uint64_t down;
+    std::string tags;
+  };
+
+  void accessLogInit(const std::string & directory, uint32_t retentionDays);
+  bool accessLogEnabled();
+  void accessLogAppend(const accessRecord & rec);
+  void accessLogWriter(void * np);
+  void handleAccessLogQuery(HTTP::Parser & H, Socket::Connection & conn);
+}
@@ -13,6 +13,7 @@
 #include "controller_connectors.h"
 #include "controller_capabilities.h"
 #include "controller_statistics.h"
+#include "controller_accesslog.h"
 
 /// Returns the challenge string for authentication, given the socket connection.
 std::string getChallenge(Socket::Connection & conn){
@@ -108,11 +109,11 @@ class streamStat{
       inputs = 0;
       outputs = 0;
     }
-    streamStat(const Util::RelAccX & rlx, uint64_t entry){
-      status = rlx.getInt("status", entry);
-      viewers = rlx.getInt("viewers", entry);
-      inputs = rlx.getInt("inputs", entry);
-      outputs = rlx.getInt("outputs", entry);
+    streamStat(const Controller::streamsTable & rlx, uint64_t entry){
+      status = rlx.getInt(Util::StateStreamsSchema::STATUS, entry);
+      viewers = rlx.getInt(Util::StateStreamsSchema::VIEWERS, entry);
+      inputs = rlx.getInt(Util::StateStreamsSchema::INPUTS, entry);
+      outputs = rlx.getInt(Util::StateStreamsSchema::OUTPUTS, entry);
     }
     bool operator ==(const streamStat &b) const{
       return (status == b.status && viewers == b.viewers && inputs == b.inputs && outputs == b.outputs);
@@ -136,9 +137,9 @@ void Controller::handleWebSocket(HTTP::Parser & H, Socket::Connection & C){
   IPC::sharedPage shmLogs(SHM_STATE_LOGS, 1024*1024);
   IPC::sharedPage shmAccs(SHM_STATE_ACCS, 1024*1024);
   IPC::sharedPage shmStreams(SHM_STATE_STREAMS, 1024*1024);
-  Util::RelAccX rlxStreams(shmStreams.mapped);
-  Util::RelAccX rlxLog(shmLogs.mapped);
-  Util::RelAccX rlxAccs(shmAccs.mapped);
+  Controller::streamsTable rlxStreams(shmStreams.mapped);
+  Controller::logTable rlxLog(shmLogs.mapped);
+  Controller::accsTable rlxAccs(shmAccs.mapped);
   if (!rlxStreams.isReady()){doStreams = false;}
   uint64_t logPos = 0;
   bool doLog = false;
@@ -150,7 +151,7 @@ void Controller::handleWebSocket(HTTP::Parser & H, Socket::Connection & C){
     if (logs.substr(0, 6) == "since:"){
       uint64_t startLogs = JSON::Value(logs.substr(6)).asInt();
       logPos = rlxLog.getDeleted();
-      while (logPos < rlxLog.getEndPos() && rlxLog.getInt("time", logPos) < startLogs){++logPos;}
+      while (logPos < rlxLog.getEndPos() && rlxLog.getInt(Util::StateLogSchema::TIME, logPos) < startLogs){++logPos;}
     }else{
       uint64_t numLogs = JSON::Value(logs).asInt();
       if (logPos <= numLogs){
@@ -166,7 +167,7 @@ void Controller::handleWebSocket(HTTP::Parser & H, Socket::Connection & C){
     if (accs.substr(0, 6) == "since:"){
       uint64_t startAccs = JSON::Value(accs.substr(6)).asInt();
       accsPos = rlxAccs.getDeleted();
-      while (accsPos < rlxAccs.getEndPos() && rlxAccs.getInt("time", accsPos) < startAccs){++accsPos;}
+      while (accsPos < rlxAccs.getEndPos() && rlxAccs.getInt(Util::StateAccsSchema::TIME, accsPos) < startAccs){++accsPos;}
     }else{
       uint64_t numAccs = JSON::Value(accs).asInt();
       if (accsPos <= numAccs){
@@ -184,10 +185,10 @@ void Controller::handleWebSocket(HTTP::Parser & H, Socket::Connection & C){
       sent = true;
       JSON::Value tmp;
       tmp[0u] = "log";
-      tmp[1u].append(rlxLog.getInt("time", logPos));
-      tmp[1u].append(rlxLog.getPointer("kind", logPos));
-      tmp[1u].append(rlxLog.getPointer("msg", logPos));
-      tmp[1u].append(rlxLog.getPointer("strm", logPos));
+      tmp[1u].append(rlxLog.getInt(Util::StateLogSchema::TIME, logPos));
+      tmp[1u].append(rlxLog.getPointer(Util::StateLogSchema::KIND, logPos));
+      tmp[1u].append(rlxLog.getPointer(Util::StateLogSchema::MSG, logPos));
+      tmp[1u].append(rlxLog.getPointer(Util::StateLogSchema::STRM, logPos));
       W.sendFrame(tmp.toString());
       logPos++;
     }
@@ -195,15 +196,15 @@ void Controller::handleWebSocket(HTTP::Parser & H, Socket::Connection & C){
       sent = true;
       JSON::Value tmp;
       tmp[0u] = "access";
-      tmp[1u].append(rlxAccs.getInt("time", accsPos));
-      tmp[1u].append(rlxAccs.getPointer("session", accsPos));
-      tmp[1u].append(rlxAccs.getPointer("stream", accsPos));
-      tmp[1u].append(rlxAccs.getPointer("connector", accsPos));
-      tmp[1u].append(rlxAccs.getPointer("host", accsPos));
-      tmp[1u].append(rlxAccs.getInt("duration", accsPos));
-      tmp[1u].append(rlxAccs.getInt("up", accsPos));
-      tmp[1u].append(rlxAccs.getInt("down", accsPos));
-      tmp[1u].append(rlxAccs.getPointer("tags", accsPos));
+      tmp[1u].append(rlxAccs.getInt(Util::StateAccsSchema::TIME, accsPos));
+      tmp[1u].append(rlxAccs.getPointer(Util::StateAccsSchema::SESSION, accsPos));
+      tmp[1u].append(rlxAccs.getPointer(Util::StateAccsSchema::STREAM, accsPos));
+      tmp[1u].append(rlxAccs.getPointer(Util::StateAccsSchema::CONNECTOR, accsPos));
+      tmp[1u].append(rlxAccs.getPointer(Util::StateAccsSchema::HOST, accsPos));
+      tmp[1u].append(rlxAccs.getInt(Util::StateAccsSchema::DURATION, accsPos));
+      tmp[1u].append(rlxAccs.getInt(Util::StateAccsSchema::UP, accsPos));
+      tmp[1u].append(rlxAccs.getInt(Util::StateAccsSchema::DOWN, accsPos));
+      tmp[1u].append(rlxAccs.getPointer(Util::StateAccsSchema::TAGS, accsPos));
       W.sendFrame(tmp.toString());
       accsPos++;
     }
@@ -214,7 +215,7 @@ void Controller::handleWebSocket(HTTP::Parser & H, Socket::Connection & C){
       uint64_t startPos = rlxStreams.getDeleted();
       uint64_t endPos = rlxStreams.getEndPos();
       for (uint64_t cPos = startPos; cPos < endPos; ++cPos){
-        std::string strm = rlxStreams.getPointer("stream", cPos);
+        std::string strm = rlxStreams.getPointer(Util::StateStreamsSchema::STREAM, cPos);
         strmRemove.erase(strm);
         streamStat tmpStat(rlxStreams, cPos);
         if (lastStrmStat[strm] != tmpStat){
@@ -293,6 +294,20 @@ int Controller::handleAPIConnection(Socket::Connection & conn){
           }
         }
       }
+      //Catch persistent access log queries
+      if (H.url == "/accesslog"){
+        if (!authorized){
+          H.Clean();
+          H.body = "Please login first or provide a valid token authentication.";
+          H.SetHeader("Server", "MistServer/" PACKAGE_VERSION);
+          H.SendResponse("403", "Not authorized", conn);
+          H.Clean();
+          continue;
+        }
+        handleAccessLogQuery(H, conn);
+        H.Clean();
+        continue;
+      }
       //Catch websocket requests
       if (H.url == "/ws"){
         if (!authorized){
@@ -350,16 +365,28 @@ int Controller::handleAPIConnection(Socket::Connection & conn){
       if (H.GetVar("jsonp") != ""){
         jsonp = H.GetVar("jsonp");
       }
+      //stream the response in chunks where possible, so large statistics never need to be buffered
+      bool chunked = (H.protocol == "HTTP/1.1");
       H.Clean();
       H.SetHeader("Content-Type", "text/javascript");
       H.setCORSHeaders();
-      if (jsonp == ""){
-        H.SetBody(Response.toString() + "\n\n");
+      if (chunked){
+        H.SetHeader("Transfer-Encoding", "chunked");
       }else{
-        H.SetBody(jsonp + "(" + Response.toString() + ");\n\n");
+        H.SetHeader("Connection", "close");
       }
       H.SendResponse("200", "OK", conn);
       H.Clean();
+      JSON::Writer W(conn, chunked);
+      if (jsonp != ""){W.raw(jsonp + "(");}
+      if (authorized){
+        writeAPIResponse(Request, Response, W);
+      }else{
+        W.value(Response);
+      }
+      W.raw(jsonp == "" ? "\n\n" : ");\n\n");
+      W.finish();
+      if (!chunked){break;}
     }//if HTTP request received
   }//while connected
   return 0;
@@ -384,7 +411,11 @@ void Controller::handleUDPAPI(void * np){
         Response["authorize"]["local"] = true;
         handleAPICommands(Request, Response);
         Response.removeMember("authorize");
-        uSock.SendNow(Response.toString());
+        std::string reply;
+        JSON::Writer W(reply);
+        writeAPIResponse(Request, Response, W);
+        W.finish();
+        uSock.SendNow(reply);
       }else{
         WARN_MSG("Invalid API command received over UDP: %s", uSock.data);
       }
@@ -419,6 +450,18 @@ static void removeDuplicateProtocols(){
   }
 }
 
+/// Writes a complete API response object to W: all members of Response, followed by any
+/// statistics requested in Request. The statistics are streamed straight from the session data
+/// instead of being added to Response by handleAPICommands.
+void Controller::writeAPIResponse(JSON::Value & Request, JSON::Value & Response, JSON::Writer & W){
+  W.beginObject();
+  jsonForEachConst(Response, it){
+    W.key(it.key()).value(*it);
+  }
+  writeStatistics(Request, W);
+  W.endObject();
+}
+
 void Controller::handleAPICommands(JSON::Value & Request, JSON::Value & Response){
   //Parse config and streams from the request.
   if (Request.isMember("config") && Request["config"].isObject()){
@@ -623,31 +666,6 @@ void Controller::handleAPICommands(JSON::Value & Request, JSON::Value & Response
       Controller::Storage["log"].null();
     }
   }
-  if (Request.isMember("clients")){
-    if (Request["clients"].isArray()){
-      for (unsigned int i = 0; i < Request["clients"].size(); ++i){
-        Controller::fillClients(Request["clients"][i], Response["clients"][i]);
-      }
-    }else{
-      Controller::fillClients(Request["clients"], Response["clients"]);
-    }
-  }
-  if (Request.isMember("totals")){
-    if (Request["totals"].isArray()){
-      for (unsigned int i = 0; i < Request["totals"].size(); ++i){
-        Controller::fillTotals(Request["totals"][i], Response["totals"][i]);
-      }
-    }else{
-      Controller::fillTotals(Request["totals"], Response["totals"]);
-    }
-  }
-  if (Request.isMember("active_streams")){
-    Controller::fillActive(Request["active_streams"], Response["active_streams"], true);
-  }
-  if (Request.isMember("stats_streams")){
-    Controller::fillActive(Request["stats_streams"], Response["stats_streams"]);
-  }
-
   if (Request.isMember("api_endpoint")){
     HTTP::URL url("http://localhost:4242");
     url.host = Util::listenInterface;
@@ -7,6 +7,7 @@ namespace Controller {
   bool authorize(JSON::Value & Request, JSON::Value & Response, Socket::Connection & conn);
   int handleAPIConnection(Socket::Connection & conn);
   void handleAPICommands(JSON::Value & Request, JSON::Value & Response);
+  void writeAPIResponse(JSON::Value & Request, JSON::Value & Response, JSON::Writer & W);
   void handleWebSocket(HTTP::Parser & H, Socket::Connection & C);
   void handleUDPAPI(void * np);
 }
@@ -0,0 +1,506 @@
+/// \file controller_apiloop.cpp
+/// Single-threaded, epoll based server for the controller HTTP API.
+///
+/// All API connections are multiplexed over one thread. Connections are kept alive and pipelined
+/// requests are answered in order, at most API_MAX_REQUESTS per connection per loop iteration so a
+/// single client cannot starve the others. Requests that only ask for the read-mostly data
+/// (clients, totals, active_streams and capabilities, with default parameters) are answered from
+/// an immutable snapshot, which is rebuilt on demand when it is older than API_SNAPSHOT_AGE.
+///
+/// Other requests run handleAPICommands on the loop thread while holding configMutex, so every
+/// command handled there must be quick: it may only touch in-memory state. Commands that touch the
+/// filesystem (browse and save), websocket requests and access log requests can take a long time,
+/// so those connections are handed off to a thread of their own.
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <map>
+#include <set>
+#include <mist/config.h>
+#include <mist/defines.h>
+#include <mist/http_parser.h>
+#include <mist/timing.h>
+#include <mist/tinythread.h>
+#include "controller_apiloop.h"
+#include "controller_api.h"
+#include "controller_storage.h"
+#include "controller_capabilities.h"
+#include "controller_statistics.h"
+#include "controller_accesslog.h"
+
+/// Maximum amount of unsent response data per connection before we stop parsing new requests.
+#define API_MAX_PENDING 4 * 1024 * 1024
+/// Maximum amount of pipelined requests answered per connection before serving other connections.
+#define API_MAX_REQUESTS 8
+/// Maximum age in milliseconds of the snapshot before a request causes it to be rebuilt.
+#define API_SNAPSHOT_AGE 1000
+
+namespace Controller {
+  /// Immutable, pre-serialized answers to the read-mostly API calls.
+  /// A snapshot is never modified once published; a new one is swapped in instead.
+  struct apiSnapshot {
+    std::string clients;
+    std::string totals;
+    std::string activeStreams;
+    std::string capabilities;
+    bool hasAccounts;
+    uint64_t built; ///< bootMS time at which the snapshot was built.
+    unsigned int refs;
+  };
+
+  /// State of a single API connection in the event loop.
+  class apiConn {
+    public:
+      apiConn(const Socket::Connection & c) : C(c){
+        authorized = false;
+        isLocal = false;
+        closeAfter = false;
+        logins = 0;
+        holdUntil = 0;
+        backlog = false;
+      }
+      Socket::Connection C;
+      HTTP::Parser H;
+      std::string out; ///< Response data not yet written to the socket.
+      bool authorized;
+      bool isLocal;
+      bool closeAfter; ///< Close the connection once all output has been written.
+      unsigned int logins;
+      uint64_t holdUntil; ///< Do not send or parse anything before this bootMS time.
+      bool backlog; ///< More requests may be buffered, revisit without waiting for socket events.
+  };
+
+  /// JSON::Writer destination that sends straight to the socket while nothing is queued for it,
+  /// and queues whatever the socket does not take right away.
+  class apiOutput : public Util::DataCallback {
+    public:
+      apiOutput(apiConn & a) : A(a){}
+      void dataCallback(const char * ptr, size_t size){
+        if (!A.holdUntil && A.C){
+          if (A.out.size()){
+            ssize_t r = send(A.C.getSocket(), A.out.data(), A.out.size(), MSG_NOSIGNAL);
+            if (r > 0){A.out.erase(0, r);}
+          }
+          if (!A.out.size()){
+            ssize_t r = send(A.C.getSocket(), ptr, size, MSG_NOSIGNAL);
+            if (r > 0){
+              ptr += r;
+              size -= r;
+            }
+          }
+        }
+        A.out.append(ptr, size);
+      }
+    private:
+      apiConn & A;
+  };
+
+  /// Connection and the already parsed request, for handing off to a thread.
+  struct apiHandoff {
+    Socket::Connection C;
+    HTTP::Parser H;
+    std::string out; ///< Responses to earlier requests, not yet written to the socket.
+    bool authorized;
+    bool isLocal;
+  };
+}
+
+static tthread::mutex snapMutex;
+static Controller::apiSnapshot * currSnap = 0;
+
+static Controller::apiSnapshot * acquireSnapshot(){
+  tthread::lock_guard<tthread::mutex> guard(snapMutex);
+  if (currSnap){++currSnap->refs;}
+  return currSnap;
+}
+
+static void releaseSnapshot(Controller::apiSnapshot * snap){
+  tthread::lock_guard<tthread::mutex> guard(snapMutex);
+  if (!--snap->refs){delete snap;}
+}
+
+/// Rebuilds the snapshot of read-mostly API data and publishes it.
+/// Must be called while holding neither configMutex nor statsMutex.
+void Controller::updateAPISnapshot(){
+  apiSnapshot * snap = new apiSnapshot;
+  snap->refs = 1;
+  snap->built = Util::bootMS();
+  JSON::Value req;
+  {
+    JSON::Writer W(snap->clients);
+    fillClients(req, W);
+  }
+  {
+    JSON::Writer W(snap->totals);
+    fillTotals(req, W);
+  }
+  {
+    JSON::Writer W(snap->activeStreams);
+    fillActive(req, W, true);
+  }
+  JSON::Value capa;
+  {
+    tthread::lock_guard<tthread::mutex> guard(configMutex);
+    capa = capabilities;
+    snap->hasAccounts = Storage["account"];
+  }
+  checkCapable(capa);
+  snap->capabilities = capa.toString();
+  apiSnapshot * old;
+  {
+    tthread::lock_guard<tthread::mutex> guard(snapMutex);
+    old = currSnap;
+    currSnap = snap;
+  }
+  if (old){releaseSnapshot(old);}
+}
+
+/// Returns true if the given request parameter equals the default parameter used for the snapshot.
+static bool isDefaultParam(const JSON::Value & v){
+  return !v.isArray() && (!v.isObject() || !v.size());
+}
+
+/// Answers an API request from the current snapshot, if possible.
+/// Only minimal requests from already authorized connections that exclusively ask for snapshot
+/// data qualify; everything else returns false and must be handled by handleAPICommands.
+bool Controller::answerFromSnapshot(const JSON::Value & Request, bool isLocal, std::string & reply){
+  if (!Request.isObject() || !Request.isMember("minimal")){return false;}
+  bool wanted = false;
+  jsonForEachConst(Request, it){
+    if (it.key() == "minimal" || it.key() == "authorize"){continue;}
+    if (it.key() == "capabilities"){
+      wanted = true;
+      continue;
+    }
+    if ((it.key() == "clients" || it.key() == "totals" || it.key() == "active_streams") && isDefaultParam(*it)){
+      wanted = true;
+      continue;
+    }
+    return false;
+  }
+  if (!wanted){return false;}
+  apiSnapshot * snap = acquireSnapshot();
+  if (!snap || Util::bootMS() - snap->built > API_SNAPSHOT_AGE){
+    //Only ever built here, so there is no cost while nobody asks for it
+    if (snap){releaseSnapshot(snap);}
+    updateAPISnapshot();
+    snap = acquireSnapshot();
+  }
+  if (!snap->hasAccounts){
+    releaseSnapshot(snap);
+    return false;
+  }
+  reply = "{\"authorize\":{";
+  if (isLocal){reply += "\"local\":true,";}
+  reply += "\"status\":\"OK\"}";
+  if (Request.isMember("active_streams")){reply += ",\"active_streams\":" + snap->activeStreams;}
+  if (Request.isMember("capabilities")){reply += ",\"capabilities\":" + snap->capabilities;}
+  if (Request.isMember("clients")){reply += ",\"clients\":" + snap->clients;}
+  if (Request.isMember("totals")){reply += ",\"totals\":" + snap->totals;}
+  reply += "}";
+  releaseSnapshot(snap);
+  return true;
+}
+
+static bool handleAPIRequest(Controller::apiConn & A, bool inThread);
+
+/// Serves a websocket, access log or slow command request that was handed off by the event loop,
+/// then keeps serving the connection in the classic blocking way until it closes.
+static void apiHandoffThread(void * p){
+  Controller::apiHandoff * h = (Controller::apiHandoff *)p;
+  h->C.setBlocking(true);
+  if (h->out.size()){h->C.SendNow(h->out);}
+  if (h->H.url == "/ws"){
+    Controller::handleWebSocket(h->H, h->C);
+  }else if (h->H.url == "/accesslog"){
+    Controller::handleAccessLogQuery(h->H, h->C);
+  }else{
+    Controller::apiConn A(h->C);
+    h->C.drop();
+    A.authorized = h->authorized;
+    A.isLocal = h->isLocal;
+    A.H = h->H;
+    handleAPIRequest(A, true);
+    //Answer the pipelined requests that were already received, as the blocking loop would wait for more first
+    while (A.C && !A.closeAfter && A.H.Read(A.C)){handleAPIRequest(A, true);}
+    A.C.SendNow(A.out);
+    if (!A.closeAfter){Controller::handleAPIConnection(A.C);}
+    A.C.close();
+    delete h;
+    return;
+  }
+  h->H.Clean();
+  Controller::handleAPIConnection(h->C);
+  h->C.close();
+  delete h;
+}
+
+/// Hands the connection off to a thread of its own, along with the request that is in A.H.
+static void handOffAPIConn(Controller::apiConn & A){
+  Controller::apiHandoff * h = new Controller::apiHandoff;
+  h->C = A.C;
+  h->H = A.H;
+  h->out.swap(A.out);
+  h->authorized = A.authorized;
+  h->isLocal = A.isLocal;
+  tthread::thread T(apiHandoffThread, (void *)h);
+  T.detach();
+}
+
+/// Sends a "not authorized" response over the given connection state.
+static void apiNotAuthorized(Controller::apiConn & A, const std::string & challenge){
+  A.H.Clean();
+  A.H.body = "Please login first or provide a valid token authentication.";
+  A.H.SetHeader("Server", "MistServer/" PACKAGE_VERSION);
+  if (challenge.size()){A.H.SetHeader("WWW-Authenticate", "json " + challenge);}
+  A.H.SetHeader("Content-Length", A.H.body.size());
+  A.out += A.H.BuildResponse("403", "Not authorized");
+  A.H.Clean();
+}
+
+/// Handles a single fully parsed request on the given connection.
+/// Requests that may take long are handed off to a thread, unless already running in one.
+/// Returns false if the connection was handed off and must no longer be used by the event loop.
+static bool handleAPIRequest(Controller::apiConn & A, bool inThread){
+  HTTP::Parser & H = A.H;
+  if (H.GetHeader("Connection") == "close" || (H.protocol == "HTTP/1.0" && H.GetHeader("Connection") != "keep-alive")){
+    A.closeAfter = true;
+  }
+  //Are we local and not forwarded? Instant-authorized.
+  if (!A.authorized && !H.hasHeader("X-Real-IP") && A.C.isLocal()){
+    MEDIUM_MSG("Local API access automatically authorized");
+    A.isLocal = true;
+    A.authorized = true;
+  }
+#ifdef NOAUTH
+  //If auth is disabled, always allow access.
+  A.authorized = true;
+#endif
+  if (!A.authorized && H.hasHeader("Authorization")){
+    std::string auth = H.GetHeader("Authorization");
+    if (auth.substr(0, 5) == "json "){
+      INFO_MSG("Checking auth header");
+      JSON::Value req;
+      req["authorize"] = JSON::fromString(auth.substr(5));
+      tthread::lock_guard<tthread::mutex> guard(Controller::configMutex);
+      if (Controller::Storage["account"]){
+        A.authorized = Controller::authorize(req, req, A.C);
+        if (!A.authorized){
+          apiNotAuthorized(A, req["authorize"].toString());
+          return true;
+        }
+      }
+    }
+  }
+  //Websocket and access log requests are long-running: give them a thread of their own
+  if (H.url == "/ws" || H.url == "/accesslog"){
+    if (!A.authorized){
+      apiNotAuthorized(A, "");
+      return true;
+    }
+    handOffAPIConn(A);
+    return false;
+  }
+  JSON::Value Request = JSON::fromString(H.GetVar("command"));
+  //Commands that touch the filesystem must not stall the event loop
+  if (!inThread && A.authorized && Request.isObject() && (Request.isMember("browse") || Request.isMember("save"))){
+    handOffAPIConn(A);
+    return false;
+  }
+  //invalid request? send the web interface, unless requested as "/api"
+  if (!Request.isObject() && H.url != "/api" && H.url != "/api2"){
+#include "server.html.h"
+    H.Clean();
+    H.SetHeader("Content-Type", "text/html");
+    H.SetHeader("X-Info", "To force an API response, request the file /api");
+    H.SetHeader("Server", "MistServer/" PACKAGE_VERSION);
+    H.SetHeader("Content-Length", server_html_len);
+    H.SetHeader("X-UA-Compatible", "IE=edge;chrome=1");
+    A.out += H.BuildResponse("200", "OK");
+    A.out.append((const char *)server_html, server_html_len);
+    H.Clean();
+    return true;
+  }
+  if (H.url == "/api2"){Request["minimal"] = true;}
+  //send the response, either normally or through JSONP callback.
+  std::string jsonp = "";
+  if (H.GetVar("callback") != ""){jsonp = H.GetVar("callback");}
+  if (H.GetVar("jsonp") != ""){jsonp = H.GetVar("jsonp");}
+  bool chunked = (H.protocol == "HTTP/1.1");
+  std::string reply;
+  if (A.authorized && Controller::answerFromSnapshot(Request, A.isLocal, reply)){
+    H.Clean();
+    H.SetHeader("Content-Type", "text/javascript");
+    H.setCORSHeaders();
+    if (jsonp == ""){
+      H.SetBody(reply + "\n\n");
+    }else{
+      H.SetBody(jsonp + "(" + reply + ");\n\n");
+    }
+    A.out += H.BuildResponse("200", "OK");
+    H.Clean();
+    return true;
+  }
+  JSON::Value Response;
+  {//lock the config mutex here - do not unlock until done processing
+    tthread::lock_guard<tthread::mutex> guard(Controller::configMutex);
+    //if already authorized, do not re-check for authorization
+    if (A.authorized && Controller::Storage["account"]){
+      Response["authorize"]["status"] = "OK";
+      if (A.isLocal){Response["authorize"]["local"] = true;}
+    }else{
+      A.authorized |= Controller::authorize(Request, Response, A.C);
+    }
+    if (A.authorized){
+      Controller::handleAPICommands(Request, Response);
+    }else{
+      //delay the answer by a second to prevent bruteforcing, without blocking other connections
+      A.holdUntil = Util::bootMS() + 1000;
+      if (++A.logins >= 4){A.closeAfter = true;}
+    }
+  }//config mutex lock
+  //stream the rest of the response, so large statistics never need to be built in memory
+  H.Clean();
+  H.SetHeader("Content-Type", "text/javascript");
+  H.setCORSHeaders();
+  if (chunked){
+    H.SetHeader("Transfer-Encoding", "chunked");
+  }else{
+    H.SetHeader("Connection", "close");
+    A.closeAfter = true;
+  }
+  A.out += H.BuildResponse("200", "OK");
+  H.Clean();
+  Controller::apiOutput out(A);
+  JSON::Writer W(out, chunked);
+  if (jsonp != ""){W.raw(jsonp + "(");}
+  if (A.authorized){
+    Controller::writeAPIResponse(Request, Response, W);
+  }else{
+    W.value(Response);
+  }
+  W.raw(jsonp == "" ? "\n\n" : ");\n\n");
+  W.finish();
+  return true;
+}
+
+/// Writes as much pending output as the socket will take without blocking.
+static void flushAPIConn(Controller::apiConn & A){
+  if (!A.out.size() || !A.C){return;}
+  if (A.holdUntil && Util::bootMS() < A.holdUntil){return;}
+  ssize_t r = send(A.C.getSocket(), A.out.data(), A.out.size(), MSG_NOSIGNAL);
+  if (r < 0){
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){A.C.close();}
+    return;
+  }
+  A.out.erase(0, r);
+}
+
+/// Parses and answers the complete requests buffered on the connection, in order.
+/// Answers at most API_MAX_REQUESTS of them, and sets A.backlog if there may be more.
+/// Returns false if the connection was handed off.
+static bool processAPIConn(Controller::apiConn & A){
+  uint64_t now = Util::bootMS();
+  if (A.holdUntil && now < A.holdUntil){return true;}
+  A.holdUntil = 0;
+  A.backlog = false;
+  size_t handled = 0;
+  while (A.C && !A.closeAfter && !A.holdUntil && A.out.size() < API_MAX_PENDING && A.H.Read(A.C)){
+    if (!handleAPIRequest(A, false)){return false;}
+    if (++handled >= API_MAX_REQUESTS){
+      A.backlog = true;
+      break;
+    }
+  }
+  flushAPIConn(A);
+  return true;
+}
+
+/// Updates the epoll registration of a connection: interested in writability only while output is pending.
+static void watchAPIConn(int epfd, Controller::apiConn & A){
+  struct epoll_event ev;
+  ev.events = EPOLLIN | (A.out.size() ? EPOLLOUT : 0);
+  ev.data.fd = A.C.getSocket();
+  epoll_ctl(epfd, EPOLL_CTL_MOD, ev.data.fd, &ev);
+}
+
+/// Runs the API event loop on the given listening socket until the controller shuts down.
+int Controller::handleAPIEventLoop(Socket::Server & server){
+  int epfd = epoll_create(64);
+  if (epfd < 0){
+    FAIL_MSG("Could not create epoll instance: %s", strerror(errno));
+    return 1;
+  }
+  server.setBlocking(false);
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.fd = server.getSocket();
+  epoll_ctl(epfd, EPOLL_CTL_ADD, ev.data.fd, &ev);
+  std::map<int, apiConn *> conns;
+  struct epoll_event events[64];
+  while (conf.is_active && server.connected()){
+    int timeout = 1000;
+    for (std::map<int, apiConn *>::iterator it = conns.begin(); it != conns.end(); ++it){
+      if (it->second->holdUntil && timeout > 100){timeout = 100;}
+      if (it->second->backlog){timeout = 0;}
+    }
+    int n = epoll_wait(epfd, events, 64, timeout);
+    if (n < 0 && errno != EINTR){
+      FAIL_MSG("Error while waiting for API events: %s", strerror(errno));
+      break;
+    }
+    std::set<int> touched;
+    for (int i = 0; i < n; ++i){
+      int fd = events[i].data.fd;
+      if (fd == server.getSocket()){
+        while (true){
+          Socket::Connection S = server.accept(true);
+          if (!S.connected()){break;}
+          apiConn * A = new apiConn(S);
+          S.drop();
+          ev.events = EPOLLIN;
+          ev.data.fd = A->C.getSocket();
+          epoll_ctl(epfd, EPOLL_CTL_ADD, ev.data.fd, &ev);
+          conns[ev.data.fd] = A;
+          HIGH_MSG("Accepted API connection on socket %d", ev.data.fd);
+        }
+        continue;
+      }
+      if (!conns.count(fd)){continue;}
+      apiConn & A = *conns[fd];
+      if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)){A.C.spool();}
+      touched.insert(fd);
+    }
+    //Connections with held back responses are revisited once the delay is over,
+    //and connections with unanswered pipelined requests right away
+    for (std::map<int, apiConn *>::iterator it = conns.begin(); it != conns.end(); ++it){
+      if (it->second->holdUntil || it->second->backlog){touched.insert(it->first);}
+    }
+    for (std::set<int>::iterator it = touched.begin(); it != touched.end(); ++it){
+      apiConn * A = conns[*it];
+      if (!processAPIConn(*A)){
+        //handed off to a thread, which now owns a duplicate of the socket
+        epoll_ctl(epfd, EPOLL_CTL_DEL, *it, 0);
+        A->C.drop();
+        delete A;
+        conns.erase(*it);
+        continue;
+      }
+      if (!A->C || (A->closeAfter && !A->out.size())){
+        epoll_ctl(epfd, EPOLL_CTL_DEL, *it, 0);
+        A->C.close();
+        delete A;
+        conns.erase(*it);
+        continue;
+      }
+      watchAPIConn(epfd, *A);
+    }
+  }
+  for (std::map<int, apiConn *>::iterator it = conns.begin(); it != conns.end(); ++it){
+    it->second->C.close();
+    delete it->second;
+  }
+  close(epfd);
+  return 0;
+}
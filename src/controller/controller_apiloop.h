@@ -0,0 +1,9 @@
+#pragma once
+#include <mist/socket.h>
+#include <mist/json.h>
+
+namespace Controller {
+  int handleAPIEventLoop(Socket::Server & server);
+  void updateAPISnapshot();
+  bool answerFromSnapshot(const JSON::Value & Request, bool isLocal, std::string & reply);
+}
@@ -1,5 +1,6 @@
 #include <cstdio>
 #include <list>
+#include <deque>
 #include <mist/config.h>
 #include <mist/shared_memory.h>
 #include <mist/dtsc.h>
@@ -147,7 +148,7 @@ void Controller::SharedMemStats(void * config){
           mustWipe.pop_front();
         }
       }
-      Util::RelAccX * strmStats = streamsAccessor();
+      streamsTable * strmStats = streamsAccessor();
       if (!strmStats || !strmStats->isReady()){strmStats = 0;}
       uint64_t strmPos = 0;
       if (strmStats){
@@ -170,12 +171,12 @@ void Controller::SharedMemStats(void * config){
           }
           if (strmStats){
             if (shiftWrites){
-              strmStats->setString("stream", it->first, strmPos);
+              strmStats->setString(Util::StateStreamsSchema::STREAM, it->first, strmPos);
             }
-            strmStats->setInt("status", it->second.status, strmPos);
-            strmStats->setInt("viewers", it->second.currViews, strmPos);
-            strmStats->setInt("inputs", it->second.currIns, strmPos);
-            strmStats->setInt("outputs", it->second.currOuts, strmPos);
+            strmStats->setInt(Util::StateStreamsSchema::STATUS, it->second.status, strmPos);
+            strmStats->setInt(Util::StateStreamsSchema::VIEWERS, it->second.currViews, strmPos);
+            strmStats->setInt(Util::StateStreamsSchema::INPUTS, it->second.currIns, strmPos);
+            strmStats->setInt(Util::StateStreamsSchema::OUTPUTS, it->second.currOuts, strmPos);
             ++strmPos;
           }
         }
@@ -205,21 +206,21 @@ void Controller::SharedMemStats(void * config){
 /// Gets a complete list of all streams currently in active state, with optional prefix matching
 std::set<std::string> Controller::getActiveStreams(const std::string & prefix){
   std::set<std::string> ret;
-  Util::RelAccX * strmStats = streamsAccessor();
+  streamsTable * strmStats = streamsAccessor();
   if (!strmStats || !strmStats->isReady()){return ret;}
   uint64_t endPos = strmStats->getEndPos();
   if (prefix.size()){
     for (uint64_t i = strmStats->getDeleted(); i < endPos; ++i){
-      if (strmStats->getInt("status", i) != STRMSTAT_READY){continue;}
-      const char * S = strmStats->getPointer("stream", i);
+      if (strmStats->getInt(Util::StateStreamsSchema::STATUS, i) != STRMSTAT_READY){continue;}
+      const char * S = strmStats->getPointer(Util::StateStreamsSchema::STREAM, i);
       if (!strncmp(S, prefix.data(), prefix.size())){
         ret.insert(S);
       }
     }
   }else{
     for (uint64_t i = strmStats->getDeleted(); i < endPos; ++i){
-      if (strmStats->getInt("status", i) != STRMSTAT_READY){continue;}
-      ret.insert(strmStats->getPointer("stream", i));
+      if (strmStats->getInt(Util::StateStreamsSchema::STATUS, i) != STRMSTAT_READY){continue;}
+      ret.insert(strmStats->getPointer(Util::StateStreamsSchema::STREAM, i));
     }
   }
   return ret;
@@ -729,6 +730,57 @@ bool Controller::hasViewers(std::string streamName){
   return false;
 }
 
+/// Writes the members for all statistics requests ("clients", "totals", "active_streams" and
+/// "stats_streams") in Request into the currently open object of W.
+void Controller::writeStatistics(JSON::Value & Request, JSON::Writer & W){
+  if (Request.isMember("clients")){
+    W.key("clients");
+    if (Request["clients"].isArray()){
+      W.beginArray();
+      for (unsigned int i = 0; i < Request["clients"].size(); ++i){
+        fillClients(Request["clients"][i], W);
+      }
+      W.endArray();
+    }else{
+      fillClients(Request["clients"], W);
+    }
+  }
+  if (Request.isMember("totals")){
+    W.key("totals");
+    if (Request["totals"].isArray()){
+      W.beginArray();
+      for (unsigned int i = 0; i < Request["totals"].size(); ++i){
+        fillTotals(Request["totals"][i], W);
+      }
+      W.endArray();
+    }else{
+      fillTotals(Request["totals"], W);
+    }
+  }
+  if (Request.isMember("active_streams")){
+    W.key("active_streams");
+    fillActive(Request["active_streams"], W, true);
+  }
+  if (Request.isMember("stats_streams")){
+    W.key("stats_streams");
+    fillActive(Request["stats_streams"], W);
+  }
+}
+
+/// The requested values of a single session, as copied by fillClients.
+struct clientRow {
+  std::string host;
+  std::string streamName;
+  std::string connector;
+  uint64_t conntime;
+  uint64_t position;
+  uint64_t down;
+  uint64_t up;
+  uint64_t downbps;
+  uint64_t upbps;
+  unsigned int crc;
+};
+
 /// This takes a "clients" request, and fills in the response data.
 /// 
 /// \api
@@ -764,8 +816,9 @@ bool Controller::hasViewers(std::string streamName){
 /// }
 /// ~~~~~~~~~~~~~~~
 /// In case of the second method, the response is an array in the same order as the requests.
-void Controller::fillClients(JSON::Value & req, JSON::Value & rep){
-  tthread::lock_guard<tthread::mutex> guard(statsMutex);
+/// Only the requested values are copied while holding statsMutex; the lock is released before
+/// anything is written to W, which may be a slow client socket.
+void Controller::fillClients(JSON::Value & req, JSON::Writer & W){
   //first, figure out the timestamp wanted
   uint64_t reqTime = 0;
   if (req.isMember("time")){
@@ -778,7 +831,8 @@ void Controller::fillClients(JSON::Value & req, JSON::Value & rep){
     reqTime += Util::epoch();
   }
   //at this point, reqTime is the absolute timestamp.
-  rep["time"] = reqTime; //fill the absolute timestamp
+  W.beginObject();
+  W.key("time").value((int64_t)reqTime); //fill the absolute timestamp
   
   unsigned int fields = 0;
   //next, figure out the fields wanted
@@ -812,44 +866,67 @@ void Controller::fillClients(JSON::Value & req, JSON::Value & rep){
     }
   }
   //output the selected fields
-  rep["fields"].null();
-  if (fields & STAT_CLI_HOST){rep["fields"].append("host");}
-  if (fields & STAT_CLI_STREAM){rep["fields"].append("stream");}
-  if (fields & STAT_CLI_PROTO){rep["fields"].append("protocol");}
-  if (fields & STAT_CLI_CONNTIME){rep["fields"].append("conntime");}
-  if (fields & STAT_CLI_POSITION){rep["fields"].append("position");}
-  if (fields & STAT_CLI_DOWN){rep["fields"].append("down");}
-  if (fields & STAT_CLI_UP){rep["fields"].append("up");}
-  if (fields & STAT_CLI_BPS_DOWN){rep["fields"].append("downbps");}
-  if (fields & STAT_CLI_BPS_UP){rep["fields"].append("upbps");}
-  if (fields & STAT_CLI_CRC){rep["fields"].append("crc");}
-  //output the data itself
-  rep["data"].null();
-  //loop over all sessions
-  if (sessions.size()){
+  W.key("fields").beginArray();
+  if (fields & STAT_CLI_HOST){W.value("host");}
+  if (fields & STAT_CLI_STREAM){W.value("stream");}
+  if (fields & STAT_CLI_PROTO){W.value("protocol");}
+  if (fields & STAT_CLI_CONNTIME){W.value("conntime");}
+  if (fields & STAT_CLI_POSITION){W.value("position");}
+  if (fields & STAT_CLI_DOWN){W.value("down");}
+  if (fields & STAT_CLI_UP){W.value("up");}
+  if (fields & STAT_CLI_BPS_DOWN){W.value("downbps");}
+  if (fields & STAT_CLI_BPS_UP){W.value("upbps");}
+  if (fields & STAT_CLI_CRC){W.value("crc");}
+  W.endArray();
+  //collect the data itself, keeping statsMutex only for as long as that takes
+  std::deque<clientRow> rows;
+  {
+    tthread::lock_guard<tthread::mutex> guard(statsMutex);
     for (std::map<sessIndex, statSession>::iterator it = sessions.begin(); it != sessions.end(); it++){
-      unsigned long long time = reqTime;
+      uint64_t time = reqTime;
       if (now && reqTime - it->second.getEnd() < 5){time = it->second.getEnd();}
       //data present and wanted? insert it!
       if ((it->second.getEnd() >= time && it->second.getStart() <= time) && (!streams.size() || streams.count(it->first.streamName)) && (!protos.size() || protos.count(it->first.connector))){
         if (it->second.hasDataFor(time)){
-          JSON::Value d;
-          if (fields & STAT_CLI_HOST){d.append(it->first.host);}
-          if (fields & STAT_CLI_STREAM){d.append(it->first.streamName);}
-          if (fields & STAT_CLI_PROTO){d.append(it->first.connector);}
-          if (fields & STAT_CLI_CONNTIME){d.append(it->second.getConnTime(time));}
-          if (fields & STAT_CLI_POSITION){d.append(it->second.getLastSecond(time));}
-          if (fields & STAT_CLI_DOWN){d.append(it->second.getDown(time));}
-          if (fields & STAT_CLI_UP){d.append(it->second.getUp(time));}
-          if (fields & STAT_CLI_BPS_DOWN){d.append(it->second.getBpsDown(time));}
-          if (fields & STAT_CLI_BPS_UP){d.append(it->second.getBpsUp(time));}
-          if (fields & STAT_CLI_CRC){d.append(it->first.crc);}
-          rep["data"].append(d);
+          rows.push_back(clientRow());
+          clientRow & R = rows.back();
+          if (fields & STAT_CLI_HOST){R.host = it->first.host;}
+          if (fields & STAT_CLI_STREAM){R.streamName = it->first.streamName;}
+          if (fields & STAT_CLI_PROTO){R.connector = it->first.connector;}
+          if (fields & STAT_CLI_CONNTIME){R.conntime = it->second.getConnTime(time);}
+          if (fields & STAT_CLI_POSITION){R.position = it->second.getLastSecond(time);}
+          if (fields & STAT_CLI_DOWN){R.down = it->second.getDown(time);}
+          if (fields & STAT_CLI_UP){R.up = it->second.getUp(time);}
+          if (fields & STAT_CLI_BPS_DOWN){R.downbps = it->second.getBpsDown(time);}
+          if (fields & STAT_CLI_BPS_UP){R.upbps = it->second.getBpsUp(time);}
+          R.crc = it->first.crc;
         }
       }
     }
   }
-  //all done! return is by reference, so no need to return anything here.
+  //output the data itself, or null if there is none
+  if (!rows.size()){
+    W.key("data").null();
+    W.endObject();
+    return;
+  }
+  W.key("data").beginArray();
+  for (std::deque<clientRow>::iterator it = rows.begin(); it != rows.end(); ++it){
+    W.beginArray();
+    if (fields & STAT_CLI_HOST){W.value(it->host);}
+    if (fields & STAT_CLI_STREAM){W.value(it->streamName);}
+    if (fields & STAT_CLI_PROTO){W.value(it->connector);}
+    if (fields & STAT_CLI_CONNTIME){W.value(it->conntime);}
+    if (fields & STAT_CLI_POSITION){W.value(it->position);}
+    if (fields & STAT_CLI_DOWN){W.value(it->down);}
+    if (fields & STAT_CLI_UP){W.value(it->up);}
+    if (fields & STAT_CLI_BPS_DOWN){W.value(it->downbps);}
+    if (fields & STAT_CLI_BPS_UP){W.value(it->upbps);}
+    if (fields & STAT_CLI_CRC){W.value((uint32_t)it->crc);}
+    W.endArray();
+  }
+  W.endArray();
+  W.endObject();
 }
 
 /// This takes a "active_streams" request, and fills in the response data.
@@ -888,7 +965,7 @@ void Controller::fillClients(JSON::Value & req, JSON::Value & rep){
 /// }
 /// ~~~~~~~~~~~~~~~
 /// All streams that any statistics data is available for are listed, and only those streams.
-void Controller::fillActive(JSON::Value & req, JSON::Value & rep, bool onlyNow){
+void Controller::fillActive(JSON::Value & req, JSON::Writer & W, bool onlyNow){
   //collect the data first
   std::set<std::string> streams;
   std::map<std::string, uint64_t> clients;
@@ -915,13 +992,21 @@ void Controller::fillActive(JSON::Value & req, JSON::Value & rep, bool onlyNow){
     }
   }
   //Good, now output what we found...
-  rep.null();
+  if (!streams.size()){
+    W.null();
+    return;
+  }
+  if (req.isArray()){
+    W.beginObject();
+  }else{
+    W.beginArray();
+  }
   for (std::set<std::string>::iterator it = streams.begin(); it != streams.end(); it++){
     if (req.isArray()){
-      rep[*it].null();
+      W.key(*it).beginArray();
       jsonForEach(req, j){
         if (j->asStringRef() == "clients"){
-          rep[*it].append(clients[*it]);
+          W.value(clients[*it]);
         }
         if (j->asStringRef() == "lastms"){
           char pageId[NAME_BUFFER_SIZE];
@@ -942,18 +1027,23 @@ void Controller::fillActive(JSON::Value & req, JSON::Value & rep, bool onlyNow){
                 lms = trcks.getIndice(i).getMember("lastms").asInt();
               }
             }
-            rep[*it].append(lms);
+            W.value(lms);
             metaLocker.post();
           }else{
-            rep[*it].append(-1);
+            W.value((int64_t)-1);
           }
         }
       }
+      W.endArray();
     }else{
-      rep.append(*it);
+      W.value(*it);
     }
   }
-  //all done! return is by reference, so no need to return anything here.
+  if (req.isArray()){
+    W.endObject();
+  }else{
+    W.endArray();
+  }
 }
 
 class totalsData {
@@ -983,8 +1073,8 @@ class totalsData {
 };
 
 /// This takes a "totals" request, and fills in the response data.
-void Controller::fillTotals(JSON::Value & req, JSON::Value & rep){
-  tthread::lock_guard<tthread::mutex> guard(statsMutex);
+/// The totals are aggregated while holding statsMutex, which is released before writing to W.
+void Controller::fillTotals(JSON::Value & req, JSON::Writer & W){
   //first, figure out the timestamps wanted
   long long int reqStart = 0;
   long long int reqEnd = 0;
@@ -1034,17 +1124,20 @@ void Controller::fillTotals(JSON::Value & req, JSON::Value & rep){
     }
   }
   //output the selected fields
-  rep["fields"].null();
-  if (fields & STAT_TOT_CLIENTS){rep["fields"].append("clients");}
-  if (fields & STAT_TOT_INPUTS){rep["fields"].append("inputs");}
-  if (fields & STAT_TOT_OUTPUTS){rep["fields"].append("outputs");}
-  if (fields & STAT_TOT_BPS_DOWN){rep["fields"].append("downbps");}
-  if (fields & STAT_TOT_BPS_UP){rep["fields"].append("upbps");}
+  W.beginObject();
+  W.key("fields").beginArray();
+  if (fields & STAT_TOT_CLIENTS){W.value("clients");}
+  if (fields & STAT_TOT_INPUTS){W.value("inputs");}
+  if (fields & STAT_TOT_OUTPUTS){W.value("outputs");}
+  if (fields & STAT_TOT_BPS_DOWN){W.value("downbps");}
+  if (fields & STAT_TOT_BPS_UP){W.value("upbps");}
+  W.endArray();
   //start data collection
   std::map<uint64_t, totalsData> totalsCount;
   //loop over all sessions
   /// \todo Make the interval configurable instead of 1 second
-  if (sessions.size()){
+  {
+    tthread::lock_guard<tthread::mutex> guard(statsMutex);
     for (std::map<sessIndex, statSession>::iterator it = sessions.begin(); it != sessions.end(); it++){
       //data present and wanted? insert it!
       if ((it->second.getEnd() >= (unsigned long long)reqStart || it->second.getStart() <= (unsigned long long)reqEnd) && (!streams.size() || streams.count(it->first.streamName)) && (!protos.size() || protos.count(it->first.connector))){
@@ -1059,46 +1152,47 @@ void Controller::fillTotals(JSON::Value & req, JSON::Value & rep){
   //output the data itself
   if (!totalsCount.size()){
     //Oh noes! No data. We'll just reply with a bunch of nulls.
-    rep["start"].null();
-    rep["end"].null();
-    rep["data"].null();
-    rep["interval"].null();
+    W.key("start").null();
+    W.key("end").null();
+    W.key("data").null();
+    W.key("interval").null();
+    W.endObject();
     return;
   }
   //yay! We have data!
-  rep["start"] = totalsCount.begin()->first;
-  rep["end"] = totalsCount.rbegin()->first;
-  rep["data"].null();
-  rep["interval"].null();
+  W.key("start").value(totalsCount.begin()->first);
+  W.key("end").value(totalsCount.rbegin()->first);
+  W.key("data").beginArray();
+  //intervals are collected as [count, seconds] pairs while the data is written
+  std::deque<std::pair<uint64_t, uint64_t> > intervals;
   uint64_t prevT = 0;
-  JSON::Value i;
   for (std::map<uint64_t, totalsData>::iterator it = totalsCount.begin(); it != totalsCount.end(); it++){
-    JSON::Value d;
-    if (fields & STAT_TOT_CLIENTS){d.append(it->second.clients);}
-    if (fields & STAT_TOT_INPUTS){d.append(it->second.inputs);}
-    if (fields & STAT_TOT_OUTPUTS){d.append(it->second.outputs);}
-    if (fields & STAT_TOT_BPS_DOWN){d.append(it->second.downbps);}
-    if (fields & STAT_TOT_BPS_UP){d.append(it->second.upbps);}
-    rep["data"].append(d);
+    W.beginArray();
+    if (fields & STAT_TOT_CLIENTS){W.value(it->second.clients);}
+    if (fields & STAT_TOT_INPUTS){W.value(it->second.inputs);}
+    if (fields & STAT_TOT_OUTPUTS){W.value(it->second.outputs);}
+    if (fields & STAT_TOT_BPS_DOWN){W.value(it->second.downbps);}
+    if (fields & STAT_TOT_BPS_UP){W.value(it->second.upbps);}
+    W.endArray();
     if (prevT){
-      if (i.size() < 2){
-        i.append(1u);
-        i.append(it->first - prevT);
+      if (intervals.size() && intervals.back().second == it->first - prevT){
+        intervals.back().first++;
       }else{
-        if (i[1u].asInt() != it->first - prevT){
-          rep["interval"].append(i);
-          i[0u] = 1u;
-          i[1u] = it->first - prevT;
-        }else{
-          i[0u] = i[0u].asInt() + 1;
-        }
+        intervals.push_back(std::pair<uint64_t, uint64_t>(1, it->first - prevT));
       }
     }
     prevT = it->first;
   }
-  if (i.size() > 1){
-    rep["interval"].append(i);
-    i.null();
+  W.endArray();
+  W.key("interval");
+  if (!intervals.size()){
+    W.null();
+  }else{
+    W.beginArray();
+    for (std::deque<std::pair<uint64_t, uint64_t> >::iterator it = intervals.begin(); it != intervals.end(); ++it){
+      W.beginArray().value(it->first).value(it->second).endArray();
+    }
+    W.endArray();
   }
-  //all done! return is by reference, so no need to return anything here.
+  W.endObject();
 }
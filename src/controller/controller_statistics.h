@@ -102,9 +102,10 @@ namespace Controller {
 
   std::set<std::string> getActiveStreams(const std::string & prefix = "");
   void parseStatistics(char * data, size_t len, unsigned int id);
-  void fillClients(JSON::Value & req, JSON::Value & rep);
-  void fillActive(JSON::Value & req, JSON::Value & rep, bool onlyNow = false);
-  void fillTotals(JSON::Value & req, JSON::Value & rep);
+  void fillClients(JSON::Value & req, JSON::Writer & W);
+  void fillActive(JSON::Value & req, JSON::Writer & W, bool onlyNow = false);
+  void fillTotals(JSON::Value & req, JSON::Writer & W);
+  void writeStatistics(JSON::Value & Request, JSON::Writer & W);
   void SharedMemStats(void * config);
   bool hasViewers(std::string streamName);
 }
@@ -9,6 +9,7 @@
 #include <sys/stat.h>
 #include "controller_storage.h"
 #include "controller_capabilities.h"
+#include "controller_accesslog.h"
 
 ///\brief Holds everything unique to the controller.
 namespace Controller {
@@ -26,21 +27,21 @@ namespace Controller {
   uint32_t maxAccsRecs = 0;
   uint64_t firstLog = 0;
   IPC::sharedPage * shmLogs = 0;
-  Util::RelAccX * rlxLogs = 0;
+  logTable * rlxLogs = 0;
   IPC::sharedPage * shmAccs = 0;
-  Util::RelAccX * rlxAccs = 0;
+  accsTable * rlxAccs = 0;
   IPC::sharedPage * shmStrm = 0;
-  Util::RelAccX * rlxStrm = 0;
+  streamsTable * rlxStrm = 0;
 
-  Util::RelAccX * logAccessor(){
+  logTable * logAccessor(){
     return rlxLogs;
   }
 
-  Util::RelAccX * accesslogAccessor(){
+  accsTable * accesslogAccessor(){
     return rlxAccs;
   }
 
-  Util::RelAccX * streamsAccessor(){
+  streamsTable * streamsAccessor(){
     return rlxStrm;
   }
 
@@ -65,10 +66,10 @@ namespace Controller {
         }
         rlxLogs->setRCount(logCounter > maxLogsRecs ? maxLogsRecs : logCounter);
         rlxLogs->setDeleted(logCounter > rlxLogs->getRCount() ? logCounter - rlxLogs->getRCount() : firstLog);
-        rlxLogs->setInt("time", logTime, logCounter-1);
-        rlxLogs->setString("kind", kind, logCounter-1);
-        rlxLogs->setString("msg", message, logCounter-1);
-        rlxLogs->setString("strm", stream, logCounter-1);
+        rlxLogs->setInt(Util::StateLogSchema::TIME, logTime, logCounter-1);
+        rlxLogs->setString(Util::StateLogSchema::KIND, kind, logCounter-1);
+        rlxLogs->setString(Util::StateLogSchema::MSG, message, logCounter-1);
+        rlxLogs->setString(Util::StateLogSchema::STRM, stream, logCounter-1);
         rlxLogs->setEndPos(logCounter);
       }
     }else{
@@ -81,17 +82,30 @@ namespace Controller {
       uint64_t newEndPos = rlxAccs->getEndPos();
       rlxAccs->setRCount(newEndPos+1 > maxLogsRecs ? maxAccsRecs : newEndPos+1);
       rlxAccs->setDeleted(newEndPos + 1 > maxAccsRecs ? newEndPos + 1 - maxAccsRecs : 0);
-      rlxAccs->setInt("time", Util::epoch(), newEndPos);
-      rlxAccs->setString("session", sessId, newEndPos);
-      rlxAccs->setString("stream", strm, newEndPos);
-      rlxAccs->setString("connector", conn, newEndPos);
-      rlxAccs->setString("host", host, newEndPos);
-      rlxAccs->setInt("duration", duration, newEndPos);
-      rlxAccs->setInt("up", up, newEndPos);
-      rlxAccs->setInt("down", down, newEndPos);
-      rlxAccs->setString("tags", tags, newEndPos);
+      rlxAccs->setInt(Util::StateAccsSchema::TIME, Util::epoch(), newEndPos);
+      rlxAccs->setString(Util::StateAccsSchema::SESSION, sessId, newEndPos);
+      rlxAccs->setString(Util::StateAccsSchema::STREAM, strm, newEndPos);
+      rlxAccs->setString(Util::StateAccsSchema::CONNECTOR, conn, newEndPos);
+      rlxAccs->setString(Util::StateAccsSchema::HOST, host, newEndPos);
+      rlxAccs->setInt(Util::StateAccsSchema::DURATION, duration, newEndPos);
+      rlxAccs->setInt(Util::StateAccsSchema::UP, up, newEndPos);
+      rlxAccs->setInt(Util::StateAccsSchema::DOWN, down, newEndPos);
+      rlxAccs->setString(Util::StateAccsSchema::TAGS, tags, newEndPos);
       rlxAccs->setEndPos(newEndPos + 1);
     }
+    if (accessLogEnabled()){
+      accessRecord rec;
+      rec.time = Util::epoch();
+      rec.session = sessId;
+      rec.stream = strm;
+      rec.connector = conn;
+      rec.host = host;
+      rec.duration = duration;
+      rec.up = up;
+      rec.down = down;
+      rec.tags = tags;
+      accessLogAppend(rec);
+    }
   }
 
   ///\brief Write contents to Filename
@@ -112,15 +126,10 @@ namespace Controller {
       FAIL_MSG("Could not open memory page for logs buffer");
       return;
     }
-    rlxLogs = new Util::RelAccX(shmLogs->mapped, false);
-    if (rlxLogs->isReady()){
+    bool logsExisted = Util::RelAccX(shmLogs->mapped, false).isReady();
+    rlxLogs = new logTable(shmLogs->mapped, false, true);
+    if (logsExisted){
       logCounter = rlxLogs->getEndPos();
-    }else{
-      rlxLogs->addField("time", RAX_64UINT);
-      rlxLogs->addField("kind", RAX_32STRING);
-      rlxLogs->addField("msg", RAX_512STRING);
-      rlxLogs->addField("strm", RAX_128STRING);
-      rlxLogs->setReady();
     }
     maxLogsRecs = (1024*1024 - rlxLogs->getOffset()) / rlxLogs->getRSize();
 
@@ -129,19 +138,7 @@ namespace Controller {
       FAIL_MSG("Could not open memory page for access logs buffer");
       return;
     }
-    rlxAccs = new Util::RelAccX(shmAccs->mapped, false);
-    if (!rlxAccs->isReady()){
-      rlxAccs->addField("time", RAX_64UINT);
-      rlxAccs->addField("session", RAX_32STRING);
-      rlxAccs->addField("stream", RAX_128STRING);
-      rlxAccs->addField("connector", RAX_32STRING);
-      rlxAccs->addField("host", RAX_64STRING);
-      rlxAccs->addField("duration", RAX_32UINT);
-      rlxAccs->addField("up", RAX_64UINT);
-      rlxAccs->addField("down", RAX_64UINT);
-      rlxAccs->addField("tags", RAX_256STRING);
-      rlxAccs->setReady();
-    }
+    rlxAccs = new accsTable(shmAccs->mapped, false, true);
     maxAccsRecs = (1024*1024 - rlxAccs->getOffset()) / rlxAccs->getRSize();
 
     shmStrm = new IPC::sharedPage(SHM_STATE_STREAMS, 1024*1024, true);//max 1M of stream data
@@ -149,15 +146,7 @@ namespace Controller {
       FAIL_MSG("Could not open memory page for stream data");
       return;
     }
-    rlxStrm = new Util::RelAccX(shmStrm->mapped, false);
-    if (!rlxStrm->isReady()){
-      rlxStrm->addField("stream", RAX_128STRING);
-      rlxStrm->addField("status", RAX_UINT, 1);
-      rlxStrm->addField("viewers", RAX_64UINT);
-      rlxStrm->addField("inputs", RAX_64UINT);
-      rlxStrm->addField("outputs", RAX_64UINT);
-      rlxStrm->setReady();
-    }
+    rlxStrm = new streamsTable(shmStrm->mapped, false, true);
     rlxStrm->setRCount((1024*1024 - rlxStrm->getOffset()) / rlxStrm->getRSize());
   }
 
@@ -175,19 +164,19 @@ namespace Controller {
       shmAccs->master = false;
       shmStrm->master = false;
     }
-    Util::RelAccX * tmp = rlxLogs;
+    logTable * tmpLogs = rlxLogs;
     rlxLogs = 0;
-    delete tmp;
+    delete tmpLogs;
     delete shmLogs;
     shmLogs = 0;
-    tmp = rlxAccs;
+    accsTable * tmpAccs = rlxAccs;
     rlxAccs = 0;
-    delete tmp;
+    delete tmpAccs;
     delete shmAccs;
     shmAccs = 0;
-    tmp = rlxStrm;
+    streamsTable * tmpStrm = rlxStrm;
     rlxStrm = 0;
-    delete tmp;
+    delete tmpStrm;
     delete shmStrm;
     shmStrm = 0;
   }
@@ -15,9 +15,12 @@ namespace Controller {
   extern bool isColorized;///< True if we colorize the output
   extern uint64_t logCounter; ///<Count of logged messages since boot
   
-  Util::RelAccX * logAccessor();
-  Util::RelAccX * accesslogAccessor();
-  Util::RelAccX * streamsAccessor();
+  typedef Util::RelAccXTable<Util::StateLogSchema> logTable;
+  typedef Util::RelAccXTable<Util::StateAccsSchema> accsTable;
+  typedef Util::RelAccXTable<Util::StateStreamsSchema> streamsTable;
+  logTable * logAccessor();
+  accsTable * accesslogAccessor();
+  streamsTable * streamsAccessor();
 
   /// Store and print a log message.
   void Log(const std::string & kind, const std::string & message, const std::string & stream = "", bool noWriteToLog = false);
@@ -5,6 +5,7 @@
 #include <mist/stream.h>
 #include <mist/defines.h>
 #include <mist/procs.h>
+#include <mist/tinythread.h>
 #include <sys/wait.h>
 #include "input.h"
 #include <sstream>
@@ -26,7 +27,7 @@ namespace Mist {
   }
   
   void Input::callbackWrapper(char * data, size_t len, unsigned int id){    
-    singleton->userCallback(data, 30, id);//call the userCallback for this input
+    singleton->userCallback(data, len, id);//call the userCallback for this input
   }
   
   Input::Input(Util::Config * cfg) : InOutBase() {
@@ -57,6 +58,12 @@ namespace Mist {
     option["long"] = "stream";
     option["help"] = "The name of the stream that this connector will provide in player mode";
     config->addOption("streamname", option);
+    option.null();
+    option["long"] = "headeronly";
+    option["short"] = "I";
+    option["help"] = "Generate the header file for the input file if it is missing or outdated, then exit";
+    option["value"].append(0);
+    config->addOption("headeronly", option);
     
     capa["optional"]["debug"]["name"] = "debug";
     capa["optional"]["debug"]["help"] = "The debug level at which messages need to be printed.";
@@ -105,7 +112,8 @@ namespace Mist {
 
     INFO_MSG("Booting input for stream %s", streamName.c_str());
 
-    if (!checkArguments()) {
+    //Generating just the header needs neither a stream name nor an output
+    if (!config->getBool("headeronly") && !checkArguments()) {
       FAIL_MSG("Setup failed - exiting");
       return 0;
     }
@@ -242,6 +250,7 @@ namespace Mist {
         DEBUG_MSG(DLVL_DEVEL, "Read header for '%s' in %llums", streamName.c_str(), timer);
       }
     }
+    if (config->getBool("headeronly")){return 0;}
     if (myMeta.vod){
       parseHeader();
       MEDIUM_MSG("Header parsed, %lu tracks", myMeta.tracks.size());
@@ -319,6 +328,15 @@ namespace Mist {
 
   /// The main loop for inputs in stream serving mode.
   void Input::serve(){
+    serveStart();
+    while (serveStep()){
+      serveWait();
+    }
+    serveStop();
+  }
+
+  /// Sets up stream serving: opens the user page and the request channels and marks the stream ready.
+  void Input::serveStart(){
     if (!isBuffer){
       for (std::map<unsigned int,DTSC::Track>::iterator it = myMeta.tracks.begin(); it != myMeta.tracks.end(); it++){
         bufferFrame(it->first, 1);
@@ -329,10 +347,26 @@ namespace Mist {
     userPage.init(userPageName, PLAY_EX_SIZE, true);
     if (streamStatus){streamStatus.mapped[0] = STRMSTAT_READY;}
 
+    //outputs post page requests here, so they can be handled right away instead of on the next user page poll
+    if (!isBuffer){pageReqs.init(streamName, true);}
+    //pushing processes negotiate their tracks here instead of through the user page
+    if (isBuffer){trackNegs.init(streamName, true);}
+
     INFO_MSG("Input for stream %s started", streamName.c_str());
     activityCounter = Util::bootSecs();
-    //main serve loop
-    while (keepRunning()) {
+    nextUserPoll = 0;
+  }
+
+  /// Runs a single iteration of the serve loop: handles posted requests, and polls the user page
+  /// if it is time to. Returns false, without doing anything, once the input should stop serving.
+  bool Input::serveStep(){
+    if (!keepRunning()){
+      return false;
+    }
+    handlePageRequests();
+    if (handleTrackNegotiations()){nextUserPoll = 0;}
+    if (Util::bootMS() >= nextUserPoll){
+      nextUserPoll = Util::bootMS() + INPUT_USER_INTERVAL;
       //load pages for connected clients on request
       //through the callbackWrapper function
       userPage.parseEach(callbackWrapper);
@@ -346,11 +380,27 @@ namespace Mist {
         }
       }
       INSANE_MSG("Connected: %d users, %d total", userPage.connectedUsers, userPage.amount);
-      //if not shutting down, wait 1 second before looping
-      if (config->is_active){
-        Util::wait(INPUT_USER_INTERVAL);
+    }
+    return true;
+  }
+
+  /// If not shutting down, waits until the next user page poll, or until a page request or negotiation comes in.
+  void Input::serveWait(){
+    if (config->is_active){
+      uint64_t now = Util::bootMS();
+      if (nextUserPoll > now){
+        if (isBuffer){
+          //pushers also signal here when they need the buffer to look at the user page right away
+          if (trackNegs.waitRequest(nextUserPoll - now)){nextUserPoll = 0;}
+        }else{
+          pageReqs.waitRequest(nextUserPoll - now);
+        }
       }
     }
+  }
+
+  /// Stops serving the stream: finishes the input and disconnects all users.
+  void Input::serveStop(){
     if (streamStatus){streamStatus.mapped[0] = STRMSTAT_SHUTDOWN;}
     config->is_active = false;
     finish();
@@ -360,6 +410,20 @@ namespace Mist {
     //end player functionality
   }
 
+  /// Buffers the pages for all requests posted to the page request queue, then signals the
+  /// requesting outputs that they can look for their pages.
+  void Input::handlePageRequests(){
+    uint32_t track, key;
+    bool handled = false;
+    while (pageReqs.get(track, key)){
+      handled = true;
+      if (!myMeta.tracks.count(track)){continue;}
+      HIGH_MSG("Page request for track %" PRIu32 ", key %" PRIu32, track, key);
+      bufferFrame(track, key);
+    }
+    if (handled){pageReqs.markCompleted();}
+  }
+
   /// This function checks if an input in serve mode should keep running or not.
   /// The default implementation checks for interruption by signals and otherwise waits until a
   /// save amount of time has passed before shutting down.
@@ -742,9 +806,58 @@ namespace Mist {
       INFO_MSG("Updating wrong version header file from version %llu to %llu", tmpdtsh.getMeta().version, DTSH_VERSION);
       return false;
     }
+    //Without key sizes, parseHeader would have to read the whole file again on every start
+    for (std::map<unsigned int, DTSC::Track>::const_iterator it = tmpdtsh.getMeta().tracks.begin(); it != tmpdtsh.getMeta().tracks.end(); ++it){
+      if (it->second.keys.size() && !it->second.keySizes.size()){
+        INFO_MSG("Header file has no key sizes for track %u, regenerating it", it->first);
+        return false;
+      }
+    }
     myMeta = tmpdtsh.getMeta();
     return true;
   }
 
+  /// Shared state of the threads started by parseHeaderChunks.
+  struct headerChunkJob{
+    Input * input;
+    size_t chunks;
+    volatile size_t next;
+  };
+
+  /// Calls parseHeaderChunk for chunks of the job until none are left.
+  void Input::headerChunkThread(void * job){
+    headerChunkJob * J = (headerChunkJob *)job;
+    size_t chunk;
+    while ((chunk = __sync_fetch_and_add(&(J->next), 1)) < J->chunks){
+      J->input->parseHeaderChunk(chunk);
+    }
+  }
+
+  /// Calls parseHeaderChunk for chunk numbers 0 up to (but not including) chunks, on as many threads
+  /// as there are processors (up to HEADER_MAX_THREADS), and returns once all of them are done.
+  /// parseHeaderChunk must only read shared state, and only write to the chunk it was called for.
+  void Input::parseHeaderChunks(size_t chunks){
+    headerChunkJob job;
+    job.input = this;
+    job.chunks = chunks;
+    job.next = 0;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads = (cpus > 1) ? cpus : 1;
+    if (threads > HEADER_MAX_THREADS){threads = HEADER_MAX_THREADS;}
+    if (threads > chunks){threads = chunks;}
+    MEDIUM_MSG("Parsing %lu chunks on %lu threads", (unsigned long)chunks, (unsigned long)threads);
+    //The calling thread works along with the others
+    std::deque<tthread::thread *> workers;
+    for (size_t i = 1; i < threads; ++i){
+      workers.push_back(new tthread::thread(headerChunkThread, (void *)&job));
+    }
+    headerChunkThread((void *)&job);
+    while (workers.size()){
+      workers.front()->join();
+      delete workers.front();
+      workers.pop_front();
+    }
+  }
+
 }
 
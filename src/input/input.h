@@ -53,12 +53,21 @@ namespace Mist {
       virtual void userCallback(char * data, size_t len, unsigned int id);
       virtual void convert();
       virtual void serve();
+      void serveStart();
+      bool serveStep();
+      void serveWait();
+      void serveStop();
       virtual void stream();
       virtual std::string streamMainLoop();
       bool isAlwaysOn();
 
       virtual void parseHeader();
+      virtual void parseHeaderChunk(size_t chunk){}
+      void parseHeaderChunks(size_t chunks);
+      static void headerChunkThread(void * job);
       bool bufferFrame(unsigned int track, unsigned int keyNum);
+      void handlePageRequests();
+      virtual bool handleTrackNegotiations(){return false;}
 
       unsigned int packTime;///Media-timestamp of the last packet.
       int lastActive;///Timestamp of the last time we received or sent something.
@@ -68,6 +77,7 @@ namespace Mist {
 
       bool isBuffer;
       uint64_t activityCounter;
+      uint64_t nextUserPoll;///< Boot time in ms of the next user page poll while serving
 
       JSON::Value capa;
       
@@ -76,6 +86,8 @@ namespace Mist {
       //Create server for user pages
       IPC::sharedServer userPage;
       IPC::sharedPage streamStatus;
+      IPC::pageRequests pageReqs;///< Queue of page requests posted by outputs
+      IPC::trackNegotiation trackNegs;///< Track negotiations posted by pushing processes, buffer only
 
       std::map<unsigned int, std::map<unsigned int, unsigned int> > pageCounter;
 
@@ -1,5 +1,7 @@
 #include <fcntl.h>
+#include <signal.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 
 #include <iostream>
 #include <cstring>
@@ -7,9 +9,13 @@
 #include <cstdlib>
 #include <cstdio>
 #include <string>
+#include <vector>
+#include <algorithm>
 #include <mist/stream.h>
 #include <mist/defines.h>
 #include <mist/bitfields.h>
+#include <mist/procs.h>
+#include <mist/cmaf.h>
 
 #include "input_buffer.h"
 
@@ -17,9 +23,15 @@
 #define TIMEOUTMULTIPLIER 2
 #endif
 
+///Longest time in ms the buffer host sleeps between looking at the negotiation channels of its streams
+#ifndef BUFFER_HOST_TICK
+#define BUFFER_HOST_TICK 10
+#endif
+
 namespace Mist {
   inputBuffer::inputBuffer(Util::Config * cfg) : Input(cfg) {
     liveMeta = 0;
+    manifestState = 0;
     capa["name"] = "Buffer";
     JSON::Value option;
     option["arg"] = "integer";
@@ -51,6 +63,13 @@ namespace Mist {
     capa["optional"]["resume"]["default"] = 0;
     option.null();
 
+    option["long"] = "host";
+    option["short"] = "H";
+    option["help"] = "Run as buffer host: serve the live streams of all buffer processes started after this one from this single process";
+    option["value"].append(0);
+    config->addOption("host", option);
+    option.null();
+
     capa["source_match"] = "push://*";
     capa["non-provider"] = true;//Indicates we don't provide data, only collect it
     capa["priority"] = 9;
@@ -63,6 +82,7 @@ namespace Mist {
     bufferTime = 50000;
     cutTime = 0;
     hasPush = false;
+    everHadPush = false;
     resumeMode = false;
   }
 
@@ -138,6 +158,24 @@ namespace Mist {
       IPC::sharedPage erasePage(pageName, 1024, false, false);
       erasePage.master = true;
     }
+    //Delete any left over temporary track metadata pages of the negotiation channel.
+    for (uint32_t i = 0; i < TRACK_NEG_RECORDS; ++i){
+      snprintf(pageName, NAME_BUFFER_SIZE, SHM_TRACK_META, streamName.c_str(), (unsigned long)IPC::trackNegotiation::tempTrack(i));
+      IPC::sharedPage erasePage(pageName, 1024, false, false);
+      erasePage.master = true;
+    }
+    {
+      //Delete the negotiation channel itself.
+      snprintf(pageName, NAME_BUFFER_SIZE, SHM_TRACK_NEGOTIATION, streamName.c_str());
+      IPC::sharedPage erasePage(pageName, 1024, false, false);
+      erasePage.master = true;
+    }
+    {
+      //Delete the manifest cache.
+      snprintf(pageName, NAME_BUFFER_SIZE, SHM_MANIFESTS, streamName.c_str());
+      IPC::sharedPage erasePage(pageName, 1024, false, false);
+      erasePage.master = true;
+    }
     //Delete most if not all track indexes and data pages.
     for (long unsigned i = 1; i <= 24; ++i){
       snprintf(pageName, NAME_BUFFER_SIZE, SHM_TRACK_INDEX, streamName.c_str(), i);
@@ -154,6 +192,12 @@ namespace Mist {
           snprintf(pageName, NAME_BUFFER_SIZE, SHM_TRACK_DATA, streamName.c_str(), i, keyNum);
           IPC::sharedPage erasePage(pageName, 1024, false, false);
           erasePage.master = true;
+          //Delete the CMAF segments outputs made of the keys on this page, as eraseSegments would have
+          unsigned long firstKey = keyNum ? keyNum : 1;
+          unsigned long keyAmount = Bit::btohl(tmpOffset + 4);
+          for (unsigned long k = firstKey; k < firstKey + keyAmount; ++k){
+            CMAF::segmentPage::erase(streamName, i, k);
+          }
         }
       }
 
@@ -222,74 +266,129 @@ namespace Mist {
     liveMeta->post();
     liveMeta->post();
     liveMeta->post();
+
+    //Playlists and bootstraps only change when keys or tracks come or go.
+    //Outdate the cached ones when that happens, after the new metadata is on the page.
+    uint64_t state = 0;
+    for (std::map<unsigned int, DTSC::Track>::iterator it = myMeta.tracks.begin(); it != myMeta.tracks.end(); it++) {
+      state = state * 31 + it->first;
+      if (it->second.keys.size()){
+        state = state * 31 + it->second.keys.begin()->getNumber();
+        state = state * 31 + it->second.keys.rbegin()->getNumber();
+      }
+    }
+    if (!manifests){manifests.init(streamName, true);}
+    if (state != manifestState){
+      manifestState = state;
+      manifests.setVersion(manifests.version() + 1);
+    }
   }
 
-  ///Checks if removing a key from this track is allowed/safe, and if so, removes it.
-  ///Returns true if a key was actually removed, false otherwise
-  ///Aborts if any of the following conditions are true (while active):
-  /// * no keys present
+  ///Returns how many of the first count keys of this track can safely be removed, while active.
+  ///Removal stops at the first key for which any of the following would be true, checked as if
+  ///all keys before it were already removed:
   /// * not at least 4 whole fragments present
   /// * first fragment hasn't been at least lastms-firstms ms in buffer
   /// * less than 8 times the biggest fragment duration is buffered
-  /// If a key was deleted and the first buffered data page is no longer used, it is deleted also.
-  bool inputBuffer::removeKey(unsigned int tid) {
-    DTSC::Track & Trk = myMeta.tracks[tid];
-    //If this track is empty, abort
-    if (!Trk.keys.size()) {
-      return false;
+  size_t inputBuffer::safeTrimCount(DTSC::Track & Trk, size_t count){
+    size_t fragCount = Trk.fragments.size();
+    if (fragCount < 5){
+      return 0;
     }
-    //the following checks only run if we're not shutting down
-    if (config->is_active){
+    unsigned long firstKey = Trk.keys[0].getNumber();
+    //The end is the last fragment's begin
+    unsigned long endKey = Trk.fragments.rbegin()->getNumber() - firstKey;
+    uint64_t fragEnd = (endKey < Trk.keys.size()) ? Trk.keys[endKey].getTime() : 0;
+    //Longest fragment duration from every fragment on, so the target duration is known after each removal
+    std::vector<uint32_t> biggest(fragCount + 1, 0);
+    for (size_t i = fragCount; i > 0; --i){
+      biggest[i - 1] = std::max(biggest[i], (uint32_t)Trk.fragments[i - 1].getDuration());
+    }
+    size_t frag = 0;
+    for (size_t i = 0; i < count; ++i){
+      //Skip the fragments that removing the keys before this one would have removed
+      while (frag < fragCount && Trk.fragments[frag].getNumber() < Trk.keys[i].getNumber()){++frag;}
       //Make sure we have at least 4 whole fragments at all times,
-      if (Trk.fragments.size() < 5) {
-        return false;
+      if (fragCount - frag < 5){
+        return i;
       }
       //ensure we have each fragment buffered for at least the whole bufferTime
-      if (!Trk.secsSinceFirstFragmentInsert() || (Trk.lastms - Trk.firstms) < bufferTime){
-        return false;
+      uint64_t firstms = i ? Trk.keys[i].getTime() : Trk.firstms;
+      if (!Trk.secsSinceFragmentInsert(frag) || (Trk.lastms - firstms) < bufferTime){
+        return i;
       }
-      if (Trk.fragments.size() > 2){
-        ///Make sure we have at least 8X the target duration.
-        //The target duration is the biggest fragment, rounded up to whole seconds.
-        uint32_t targetDuration = (Trk.biggestFragment() / 1000 + 1) * 1000;
-        //The start is the third fragment's begin
-        uint32_t fragStart = Trk.getKey((++(++Trk.fragments.begin()))->getNumber()).getTime();
-        //The end is the last fragment's begin
-        uint32_t fragEnd = Trk.getKey(Trk.fragments.rbegin()->getNumber()).getTime();
-        if ((fragEnd - fragStart) < targetDuration * 8){
-          return false;
-        }
+      ///Make sure we have at least 8X the target duration.
+      //The target duration is the biggest fragment, rounded up to whole seconds.
+      uint32_t targetDuration = (biggest[frag] / 1000 + 1) * 1000;
+      //The start is the third fragment's begin
+      unsigned long startKey = Trk.fragments[frag + 2].getNumber() - firstKey;
+      uint64_t fragStart = (startKey < Trk.keys.size()) ? Trk.keys[startKey].getTime() : 0;
+      if ((uint32_t)(fragEnd - fragStart) < targetDuration * 8){
+        return i;
       }
     }
-    //Alright, everything looks good, let's delete the key and possibly also fragment
-    Trk.removeFirstKey();
-    //if there is more than one page buffered for this track...
-    if (bufferLocations[tid].size() > 1) {
-      //Check if the first key starts on the second page or higher
-      if (Trk.keys[0].getNumber() >= (++(bufferLocations[tid].begin()))->first || !config->is_active){
-        //If so, we can delete the first page entirely
-        HIGH_MSG("Erasing track %d, keys %lu-%lu from buffer", tid, bufferLocations[tid].begin()->first, bufferLocations[tid].begin()->first + bufferLocations[tid].begin()->second.keyNum - 1);
-        bufferRemove(tid, bufferLocations[tid].begin()->first);
-
-        nProxy.curPageNum.erase(tid);
-        char thisPageName[NAME_BUFFER_SIZE];
-        snprintf(thisPageName, NAME_BUFFER_SIZE, SHM_TRACK_DATA, config->getString("streamname").c_str(), (unsigned long)tid, bufferLocations[tid].begin()->first);
-        nProxy.curPage[tid].init(thisPageName, 20971520);
-        nProxy.curPage[tid].master = true;
-        nProxy.curPage.erase(tid);
+    return count;
+  }
 
-        bufferLocations[tid].erase(bufferLocations[tid].begin());
-      } else {
-        VERYHIGH_MSG("%lu still on first page (%lu - %lu)", myMeta.tracks[tid].keys[0].getNumber(), bufferLocations[tid].begin()->first, bufferLocations[tid].begin()->first + bufferLocations[tid].begin()->second.keyNum - 1);
+  ///Removes all keys from the start of the track that lie before the cut time or fell out of the
+  ///buffer window, as far as safeTrimCount allows while active, all in one go.
+  ///Data pages that no longer hold any buffered key are deleted right after, also in one go.
+  ///Returns true if any keys were removed.
+  bool inputBuffer::trimTrack(unsigned long tid){
+    DTSC::Track & Trk = myMeta.tracks[tid];
+    //Both cut off and expired keys are always a run at the start of the track
+    size_t count = 0;
+    while (Trk.keys.size() - count > 1 && (Trk.keys[count].getTime() < cutTime || (Trk.lastms - Trk.keys[count + 1].getTime()) > bufferTime)){
+      ++count;
+    }
+    if (!count){
+      return false;
+    }
+    if (config->is_active){
+      //If the safety checks held back the previous trim, they can only pass again once new data came in
+      if (trimWatermark.count(tid) && trimWatermark[tid] == Trk.lastms){
+        return false;
       }
+      count = safeTrimCount(Trk, count);
+      if (!count){
+        trimWatermark[tid] = Trk.lastms;
+        return false;
+      }
+    }
+    trimWatermark.erase(tid);
+    eraseSegments(tid, count);
+    Trk.removeFirstKeys(count);
+    std::map<unsigned long, DTSCPageData> & locations = bufferLocations[tid];
+    //Delete every page before the one the first key now starts on
+    while (locations.size() > 1 && (Trk.keys[0].getNumber() >= (++(locations.begin()))->first || !config->is_active)){
+      HIGH_MSG("Erasing track %lu, keys %lu-%lu from buffer", tid, locations.begin()->first, locations.begin()->first + locations.begin()->second.keyNum - 1);
+      bufferRemove(tid, locations.begin()->first);
+      nProxy.curPageNum.erase(tid);
+      char thisPageName[NAME_BUFFER_SIZE];
+      snprintf(thisPageName, NAME_BUFFER_SIZE, SHM_TRACK_DATA, config->getString("streamname").c_str(), tid, locations.begin()->first);
+      nProxy.curPage[tid].init(thisPageName, 20971520);
+      nProxy.curPage[tid].master = true;
+      nProxy.curPage.erase(tid);
+      locations.erase(locations.begin());
     }
     return true;
   }
 
+  /// Removes the shared CMAF segments outputs may have made of the first count keys of a track.
+  void inputBuffer::eraseSegments(unsigned long tid, size_t count){
+    DTSC::Track & Trk = myMeta.tracks[tid];
+    for (size_t i = 0; i < count && i < Trk.keys.size(); ++i){
+      CMAF::segmentPage::erase(streamName, tid, Trk.keys[i].getNumber());
+    }
+  }
+
   void inputBuffer::eraseTrackDataPages(unsigned long tid){
     if (!bufferLocations.count(tid)){
       return;
     }
+    if (myMeta.tracks.count(tid)){
+      eraseSegments(tid, myMeta.tracks[tid].keys.size());
+    }
     for (std::map<unsigned long, DTSCPageData>::iterator it = bufferLocations[tid].begin(); it != bufferLocations[tid].end(); it++){
       char thisPageName[NAME_BUFFER_SIZE];
       snprintf(thisPageName, NAME_BUFFER_SIZE, SHM_TRACK_DATA, config->getString("streamname").c_str(), tid, it->first);
@@ -318,77 +417,83 @@ namespace Mist {
 
   void inputBuffer::removeUnused() {
     //first remove all tracks that have not been updated for too long
-    bool changed = true;
-    while (changed) {
-      changed = false;
-      long long unsigned int time = Util::bootSecs();
-      long long unsigned int compareFirst = 0xFFFFFFFFFFFFFFFFull;
-      long long unsigned int compareLast = 0;
-      std::set<std::string> activeTypes;
-      //for tracks that were updated in the last 5 seconds, get the first and last ms edges.
-      for (std::map<unsigned int, DTSC::Track>::iterator it2 = myMeta.tracks.begin(); it2 != myMeta.tracks.end(); it2++) {
-        if ((time - lastUpdated[it2->first]) > 5) {
-          continue;
-        }
-        activeTypes.insert(it2->second.type);
-        if (it2->second.lastms > compareLast) {
-          compareLast = it2->second.lastms;
-        }
-        if (it2->second.firstms < compareFirst) {
-          compareFirst = it2->second.firstms;
-        }
+    long long unsigned int time = Util::bootSecs();
+    //tracks not updated for an entire buffer duration are erased regardless of the other tracks
+    std::set<unsigned int> expired;
+    for (std::map<unsigned int, DTSC::Track>::iterator it = myMeta.tracks.begin(); it != myMeta.tracks.end(); it++) {
+      if ((long long int)(time - lastUpdated[it->first]) > (long long int)(bufferTime / 1000)) {
+        expired.insert(it->first);
       }
-      for (std::map<unsigned int, DTSC::Track>::iterator it = myMeta.tracks.begin(); it != myMeta.tracks.end(); it++) {
-        //if not updated for an entire buffer duration, or last updated track and this track differ by an entire buffer duration, erase the track.
-        if ((long long int)(time - lastUpdated[it->first]) > (long long int)(bufferTime / 1000) ||
-            (compareLast && activeTypes.count(it->second.type) && (long long int)(time - lastUpdated[it->first]) > 5 && (
-            (compareLast < it->second.firstms && (long long int)(it->second.firstms - compareLast) > bufferTime)
-            ||
-            (compareFirst > it->second.lastms && (long long int)(compareFirst - it->second.lastms) > bufferTime)
-          ))
-        ){
-          unsigned int tid = it->first;
-          //erase this track
-          if ((long long int)(time - lastUpdated[it->first]) > (long long int)(bufferTime / 1000)){
-            WARN_MSG("Erasing %s track %d (%s/%s) because not updated for %ds (> %ds)", streamName.c_str(), it->first, it->second.type.c_str(), it->second.codec.c_str(), (long long int)(time - lastUpdated[it->first]), (long long int)(bufferTime / 1000));
-          }else{
-            WARN_MSG("Erasing %s inactive track %u (%s/%s) because it was inactive for 5+ seconds and contains data (%us - %us), while active tracks are (%us - %us), which is more than %us seconds apart.", streamName.c_str(), it->first, it->second.type.c_str(), it->second.codec.c_str(), it->second.firstms / 1000, it->second.lastms / 1000, compareFirst / 1000, compareLast / 1000, bufferTime / 1000);
-          }
-          lastUpdated.erase(tid);
-          /// \todo Consider replacing with eraseTrackDataPages(it->first)?
-          while (bufferLocations[tid].size()){
-            char thisPageName[NAME_BUFFER_SIZE];
-            snprintf(thisPageName, NAME_BUFFER_SIZE, SHM_TRACK_DATA, config->getString("streamname").c_str(), (unsigned long)tid, bufferLocations[tid].begin()->first);
-            nProxy.curPage[tid].init(thisPageName, 20971520);
-            nProxy.curPage[tid].master = true;
-            nProxy.curPage.erase(tid);
-            bufferLocations[tid].erase(bufferLocations[tid].begin());
-          }
-          if (pushLocation.count(it->first)){
-            // \todo Debugger says this is null sometimes. It shouldn't be. Figure out why!
-            // For now, this if will prevent crashes in these cases.
-            if (pushLocation[it->first]){
-              //Reset the userpage, to allow repushing from TS
-              IPC::userConnection userConn(pushLocation[it->first]);
-              for (int i = 0; i < SIMUL_TRACKS; i++) {
-                if (userConn.getTrackId(i) == it->first) {
-                  userConn.setTrackId(i, 0);
-                  userConn.setKeynum(i, 0);
-                  break;
-                }
-              }
+    }
+    long long unsigned int compareFirst = 0xFFFFFFFFFFFFFFFFull;
+    long long unsigned int compareLast = 0;
+    std::set<std::string> activeTypes;
+    //for tracks that were updated in the last 5 seconds and stay, get the first and last ms edges.
+    for (std::map<unsigned int, DTSC::Track>::iterator it2 = myMeta.tracks.begin(); it2 != myMeta.tracks.end(); it2++) {
+      if ((time - lastUpdated[it2->first]) > 5 || expired.count(it2->first)) {
+        continue;
+      }
+      activeTypes.insert(it2->second.type);
+      if (it2->second.lastms > compareLast) {
+        compareLast = it2->second.lastms;
+      }
+      if (it2->second.firstms < compareFirst) {
+        compareFirst = it2->second.firstms;
+      }
+    }
+    //Only tracks that are erased anyway can differ from the edges, so one pass decides on all of them.
+    std::set<unsigned int> toErase;
+    for (std::map<unsigned int, DTSC::Track>::iterator it = myMeta.tracks.begin(); it != myMeta.tracks.end(); it++) {
+      //if not updated for an entire buffer duration, or last updated track and this track differ by an entire buffer duration, erase the track.
+      if (expired.count(it->first)){
+        WARN_MSG("Erasing %s track %d (%s/%s) because not updated for %ds (> %ds)", streamName.c_str(), it->first, it->second.type.c_str(), it->second.codec.c_str(), (long long int)(time - lastUpdated[it->first]), (long long int)(bufferTime / 1000));
+        toErase.insert(it->first);
+      }else if (compareLast && activeTypes.count(it->second.type) && (long long int)(time - lastUpdated[it->first]) > 5 && (
+          (compareLast < it->second.firstms && (long long int)(it->second.firstms - compareLast) > bufferTime)
+          ||
+          (compareFirst > it->second.lastms && (long long int)(compareFirst - it->second.lastms) > bufferTime)
+        )){
+        WARN_MSG("Erasing %s inactive track %u (%s/%s) because it was inactive for 5+ seconds and contains data (%us - %us), while active tracks are (%us - %us), which is more than %us seconds apart.", streamName.c_str(), it->first, it->second.type.c_str(), it->second.codec.c_str(), it->second.firstms / 1000, it->second.lastms / 1000, compareFirst / 1000, compareLast / 1000, bufferTime / 1000);
+        toErase.insert(it->first);
+      }
+    }
+    for (std::set<unsigned int>::iterator it = toErase.begin(); it != toErase.end(); ++it){
+      unsigned int tid = *it;
+      //erase this track
+      lastUpdated.erase(tid);
+      trimWatermark.erase(tid);
+      /// \todo Consider replacing with eraseTrackDataPages(tid)?
+      while (bufferLocations[tid].size()){
+        char thisPageName[NAME_BUFFER_SIZE];
+        snprintf(thisPageName, NAME_BUFFER_SIZE, SHM_TRACK_DATA, config->getString("streamname").c_str(), (unsigned long)tid, bufferLocations[tid].begin()->first);
+        nProxy.curPage[tid].init(thisPageName, 20971520);
+        nProxy.curPage[tid].master = true;
+        nProxy.curPage.erase(tid);
+        bufferLocations[tid].erase(bufferLocations[tid].begin());
+      }
+      if (pushLocation.count(tid)){
+        // \todo Debugger says this is null sometimes. It shouldn't be. Figure out why!
+        // For now, this if will prevent crashes in these cases.
+        if (pushLocation[tid]){
+          //Reset the userpage, to allow repushing from TS
+          IPC::userConnection userConn(pushLocation[tid]);
+          for (int i = 0; i < SIMUL_TRACKS; i++) {
+            if (userConn.getTrackId(i) == tid) {
+              userConn.setTrackId(i, 0);
+              userConn.setKeynum(i, 0);
+              break;
             }
-            pushLocation.erase(it->first);
           }
-          nProxy.curPageNum.erase(it->first);
-          nProxy.metaPages[it->first].master = true;
-          nProxy.metaPages.erase(it->first);
-          activeTracks.erase(it->first);
-          myMeta.tracks.erase(it->first);
-          changed = true;
-          break;
         }
+        pushLocation.erase(tid);
       }
+      pushPids.erase(tid);
+      nProxy.curPageNum.erase(tid);
+      nProxy.metaPages[tid].master = true;
+      nProxy.metaPages.erase(tid);
+      activeTracks.erase(tid);
+      eraseSegments(tid, myMeta.tracks[tid].keys.size());
+      myMeta.tracks.erase(tid);
     }
     //find the earliest video keyframe stored
     unsigned int firstVideo = 1;
@@ -407,25 +512,14 @@ namespace Mist {
           continue;
         }
       }
-      //Buffer cutting
-      while (it->second.keys.size() > 1 && it->second.keys[0].getTime() < cutTime) {
-        if (!removeKey(it->first)) {
-          break;
-        }
-      }
-      //Buffer size management
+      //Buffer cutting and size management
       /// \TODO Make sure data has been in the buffer for at least bufferTime after it goes in
-      while (it->second.keys.size() > 1 && (it->second.lastms - it->second.keys[1].getTime()) > bufferTime) {
-        if (!removeKey(it->first)) {
-          break;
-        }
-      }
+      trimTrack(it->first);
     }
     updateMeta();
     if (config->is_active){
       if (streamStatus){streamStatus.mapped[0] = hasPush ? STRMSTAT_READY : STRMSTAT_WAIT;}
     }
-    static bool everHadPush = false;
     if (hasPush) {
       hasPush = false;
       everHadPush = true;
@@ -437,11 +531,173 @@ namespace Mist {
     }
   }
 
+  /// Reads the metadata a pushing process wrote to a temporary track metadata page.
+  /// The DTSC header on the page is decoded in place, without building a JSON::Value first.
+  /// Leaves trackMeta empty if the page does not hold a complete header (yet).
+  static void readTrackMeta(IPC::sharedPage & page, DTSC::Meta & trackMeta){
+    if (!page.mapped || page.len < 8){return;}
+    unsigned int len = ntohl(((int *)page.mapped)[1]) + 8;
+    if (len > (uint64_t)page.len){return;}
+    DTSC::Packet tmpMeta(page.mapped, len, true);
+    if (tmpMeta.getVersion() != DTSC::DTSC_HEAD){return;}
+    trackMeta.reinit(tmpMeta);
+  }
+
+  /// Stops handling a track that was pushed by a user that went away, erasing its data.
+  void inputBuffer::endPush(unsigned long tid){
+    pushLocation.erase(tid);
+    pushPids.erase(tid);
+    trimWatermark.erase(tid);
+    if (negotiatingTracks.count(tid)) {
+      negotiatingTracks.erase(tid);
+    }
+    if (activeTracks.count(tid)) {
+      updateMeta();
+      eraseTrackDataPages(tid);
+      activeTracks.erase(tid);
+      bufferLocations.erase(tid);
+    }
+    nProxy.metaPages[tid].master = true;
+    nProxy.metaPages.erase(tid);
+  }
+
+  /// Decides which final track a negotiated temporary track is pushed into, and registers it as an
+  /// active pushed track, inserting its metadata if needed.
+  /// \param newTrack The metadata the pushing process wrote for the temporary track.
+  /// \param tempId The temporary track id the track was negotiated under.
+  /// \param pushedFrom The user page element of the pushing process, if known.
+  /// \param id The user or process the track comes from, for logging.
+  /// \returns The final track number.
+  unsigned long inputBuffer::acceptTrack(DTSC::Track & newTrack, unsigned long tempId, char * pushedFrom, unsigned int id){
+    std::string trackIdentifier = newTrack.getIdentifier();
+    DEBUG_MSG(DLVL_HIGH, "Attempting colision detection for track %s", trackIdentifier.c_str());
+    //Get the identifier for the track, and attempt colission detection.
+    int collidesWith = -1;
+    for (std::map<unsigned int, DTSC::Track>::iterator it = myMeta.tracks.begin(); it != myMeta.tracks.end(); it++) {
+      //If the identifier of an existing track and the current track match, assume the are the same track and reject the negotiated one.
+      ///\todo Maybe switch to a new form of detecting collisions, especially with regards to multiple audio languages and camera angles.
+      if (it->second.getIdentifier() == trackIdentifier) {
+        collidesWith = it->first;
+        break;
+      }
+    }
+
+    //Check if the track collides, and whether the track it collides with is active.
+    if (collidesWith != -1 && activeTracks.count(collidesWith)) { /*LTS*/
+      //Print a warning message and set the state of the track to rejected.
+      WARN_MSG("Collision of temporary track %lu with existing track %d detected. Handling as a new valid track.", tempId, collidesWith);
+      collidesWith = -1;
+    }
+    uint64_t finalMap = collidesWith;
+    if (finalMap == -1) {
+      //No collision has been detected, assign a new final number
+      finalMap = (myMeta.tracks.size() ? myMeta.tracks.rbegin()->first : 0) + 1;
+      DEBUG_MSG(DLVL_DEVEL, "No colision detected for temporary track %lu from user %u, assigning final track number %lu", tempId, id, finalMap);
+    }
+    //Resume either if we have more than 1 keyframe on the replacement track (assume it was already pushing before the track "dissapeared")
+    //or if the firstms of the replacement track is later than the lastms on the existing track
+    if (!myMeta.tracks.count(finalMap) || newTrack.keys.size() > 1 || newTrack.firstms >= myMeta.tracks[finalMap].lastms) {
+      if (myMeta.tracks.count(finalMap) && myMeta.tracks[finalMap].lastms > 0) {
+        INFO_MSG("Resume of track %lu detected, coming from temporary track %lu of user %u", finalMap, tempId, id);
+      } else {
+        INFO_MSG("New track detected, assigned track id %lu, coming from temporary track %lu of user %u", finalMap, tempId, id);
+      }
+    } else {
+      //Otherwise replace existing track
+      INFO_MSG("Replacement of track %lu detected, coming from temporary track %lu of user %u", finalMap, tempId, id);
+      myMeta.tracks.erase(finalMap);
+      //Set master to true before erasing the page, because we are responsible for cleaning up unused pages
+      updateMeta();
+      eraseTrackDataPages(tempId);
+      nProxy.metaPages[finalMap].master = true;
+      nProxy.metaPages.erase(finalMap);
+      bufferLocations.erase(finalMap);
+    }
+
+    //Register the new track as an active track.
+    activeTracks.insert(finalMap);
+    //Register the time of registration as initial value for the lastUpdated field, plus an extra 5 seconds just to be sure.
+    lastUpdated[finalMap] = Util::bootSecs() + 5;
+    //Register the user thats is pushing this element
+    pushLocation[finalMap] = pushedFrom;
+    //Initialize the metadata for this track if it was not in place yet.
+    if (!myMeta.tracks.count(finalMap)) {
+      DEBUG_MSG(DLVL_MEDIUM, "Inserting metadata for track number %d", finalMap);
+      myMeta.tracks[finalMap] = newTrack;
+      myMeta.tracks[finalMap].firstms = 0;
+      myMeta.tracks[finalMap].lastms = 0;
+      myMeta.tracks[finalMap].trackID = finalMap;
+    }
+    //Update the metadata to reflect all changes
+    updateMeta();
+    return finalMap;
+  }
+
+  /// Answers all track negotiations posted to the negotiation channel.
+  /// Returns true if any were handled, so the user page gets looked at right away.
+  bool inputBuffer::handleTrackNegotiations(){
+    uint32_t record, seq, pid, track;
+    bool handled = false;
+    while (trackNegs.get(record, seq, pid, track)){
+      handled = true;
+      unsigned long tempId = IPC::trackNegotiation::tempTrack(record);
+      char tempMetaName[NAME_BUFFER_SIZE];
+      snprintf(tempMetaName, NAME_BUFFER_SIZE, SHM_TRACK_META, config->getString("streamname").c_str(), tempId);
+      IPC::sharedPage tMeta(tempMetaName, 8388608, false, false);
+      //We are responsible for cleaning up the temporary metadata page
+      tMeta.master = true;
+      DTSC::Meta trackMeta;
+      readTrackMeta(tMeta, trackMeta);
+      //Remove the page before answering, as the record and its page name are reused right after
+      tMeta.close();
+      if (!config->is_active || !trackMeta.tracks.count(tempId)){
+        WARN_MSG("Declining track %" PRIu32 " of process %" PRIu32 ": no valid metadata", track, pid);
+        trackNegs.respond(record, seq, false);
+        continue;
+      }
+      unsigned long finalMap = acceptTrack(trackMeta.tracks[tempId], tempId, 0, pid);
+      //The pushing process is matched to its user page element by PID on the next user page poll
+      pushPids[finalMap] = pid;
+      uint32_t firstKey = 0;
+      if (myMeta.tracks[finalMap].keys.size()){
+        firstKey = myMeta.tracks[finalMap].keys.rbegin()->getNumber();
+      }
+      trackNegs.respond(record, seq, true, finalMap, firstKey);
+    }
+    return handled;
+  }
+
   void inputBuffer::userCallback(char * data, size_t len, unsigned int id) {
     //Static variable keeping track of the next temporary mapping to use for a track.
     static int nextTempId = 1001;
     //Get the counter of this user
-    char counter = (*(data - 1));
+    char counter = (*(data - 1)) & 0x7F;
+    //Tracks negotiated through the negotiation channel are not listed on the user page, but are
+    //pushed by whichever user runs under the PID the pushing process negotiated with.
+    if (pushPids.size()){
+      uint32_t pid = *((uint32_t *)(data + len - 4));
+      for (std::map<unsigned long, uint32_t>::iterator it = pushPids.begin(); it != pushPids.end();){
+        unsigned long tid = (it++)->first;
+        if (pushPids[tid] != pid){continue;}
+        if (counter == 126 || counter == 127){
+          endPush(tid);
+          continue;
+        }
+        pushLocation[tid] = data;
+        if (!activeTracks.count(tid)){continue;}
+        //Open the track index page if we dont have it open yet
+        if (!nProxy.metaPages.count(tid) || !nProxy.metaPages[tid].mapped) {
+          char firstPage[NAME_BUFFER_SIZE];
+          snprintf(firstPage, NAME_BUFFER_SIZE, SHM_TRACK_INDEX, config->getString("streamname").c_str(), tid);
+          nProxy.metaPages[tid].init(firstPage, SHM_TRACK_INDEX_SIZE, false, false);
+        }
+        if (nProxy.metaPages[tid].mapped) {
+          //Update the metadata for this track
+          updateTrackMeta(tid);
+          hasPush = true;
+        }
+      }
+    }
     //Each user can have at maximum SIMUL_TRACKS elements in their userpage.
     IPC::userConnection userConn(data);
     for (int index = 0; index < SIMUL_TRACKS; index++) {
@@ -460,18 +716,7 @@ namespace Mist {
       if (pushLocation[value] == data) {
         //Check for timeouts, and erase the track if necessary
         if (counter == 126 || counter == 127){
-          pushLocation.erase(value);
-          if (negotiatingTracks.count(value)) {
-            negotiatingTracks.erase(value);
-          }
-          if (activeTracks.count(value)) {
-            updateMeta();
-            eraseTrackDataPages(value);
-            activeTracks.erase(value);
-            bufferLocations.erase(value);
-          }
-          nProxy.metaPages[value].master = true;
-          nProxy.metaPages.erase(value);
+          endPush(value);
           continue;
         }
       }
@@ -503,21 +748,11 @@ namespace Mist {
             if (!nProxy.metaPages[finalMap]){continue;}//abort for now if page doesn't exist yet
 
             //The pages exist, now we try to read in the metadata of the track
-
-            //Store the size of the dtsc packet to read.
-            unsigned int len = ntohl(((int *)tMeta.mapped)[1]);
-            //Temporary variable, won't be used again
-            unsigned int tempForReadingMeta = 0;
-            //Read in the metadata through a temporary JSON object
-            ///\todo Optimize this part. Find a way to not have to store the metadata in JSON first, but read it from the page immediately
-            JSON::Value tempJSONForMeta;
-            JSON::fromDTMI((const char *)tMeta.mapped + 8, len, tempForReadingMeta, tempJSONForMeta);
-            
+            DTSC::Meta trackMeta;
+            readTrackMeta(tMeta, trackMeta);
+            if (!trackMeta.tracks.size()){continue;}//abort for now if the metadata isn't readable yet
             tMeta.master = true;
 
-            //Construct a metadata object for the current track
-            DTSC::Meta trackMeta(tempJSONForMeta);
-
             myMeta.tracks[finalMap] = trackMeta.tracks.begin()->second;
             myMeta.tracks[finalMap].firstms = 0;
             myMeta.tracks[finalMap].lastms = 0;
@@ -570,16 +805,9 @@ namespace Mist {
 
         //The page exist, now we try to read in the metadata of the track
 
-        //Store the size of the dtsc packet to read.
-        unsigned int len = ntohl(((int *)nProxy.metaPages[value].mapped)[1]);
-        //Temporary variable, won't be used again
-        unsigned int tempForReadingMeta = 0;
-        //Read in the metadata through a temporary JSON object
-        ///\todo Optimize this part. Find a way to not have to store the metadata in JSON first, but read it from the page immediately
-        JSON::Value tempJSONForMeta;
-        JSON::fromDTMI((const char *)nProxy.metaPages[value].mapped + 8, len, tempForReadingMeta, tempJSONForMeta);
-        //Construct a metadata object for the current track
-        DTSC::Meta trackMeta(tempJSONForMeta);
+        //Read the metadata for the current track straight from the page
+        DTSC::Meta trackMeta;
+        readTrackMeta(nProxy.metaPages[value], trackMeta);
         //If the track metadata does not contain the negotiated track, assume the metadata is currently being written, and skip the element for now. It will be instantiated in the next call.
         if (!trackMeta.tracks.count(value)) {
           //remove the negotiation if it has timed out
@@ -593,72 +821,13 @@ namespace Mist {
           continue;
         }
 
-        std::string trackIdentifier = trackMeta.tracks.find(value)->second.getIdentifier();
-        DEBUG_MSG(DLVL_HIGH, "Attempting colision detection for track %s", trackIdentifier.c_str());
-        //Get the identifier for the track, and attempt colission detection.
-        int collidesWith = -1;
-        for (std::map<unsigned int, DTSC::Track>::iterator it = myMeta.tracks.begin(); it != myMeta.tracks.end(); it++) {
-          //If the identifier of an existing track and the current track match, assume the are the same track and reject the negotiated one.
-          ///\todo Maybe switch to a new form of detecting collisions, especially with regards to multiple audio languages and camera angles.
-          if (it->second.getIdentifier() == trackIdentifier) {
-            collidesWith = it->first;
-            break;
-          }
-        }
         //Remove the "negotiate" status in either case
         negotiatingTracks.erase(value);
         //Set master to true before erasing the page, because we are responsible for cleaning up unused pages
         nProxy.metaPages[value].master = true;
         nProxy.metaPages.erase(value);
 
-        //Check if the track collides, and whether the track it collides with is active.
-        if (collidesWith != -1 && activeTracks.count(collidesWith)) { /*LTS*/
-          //Print a warning message and set the state of the track to rejected.
-          WARN_MSG("Collision of temporary track %lu with existing track %d detected. Handling as a new valid track.", value, collidesWith);
-          collidesWith = -1;
-        }
-        uint64_t finalMap = collidesWith;
-        if (finalMap == -1) {
-          //No collision has been detected, assign a new final number
-          finalMap = (myMeta.tracks.size() ? myMeta.tracks.rbegin()->first : 0) + 1;
-          DEBUG_MSG(DLVL_DEVEL, "No colision detected for temporary track %lu from user %u, assigning final track number %lu", value, id, finalMap);
-        }
-        //Resume either if we have more than 1 keyframe on the replacement track (assume it was already pushing before the track "dissapeared")
-        //or if the firstms of the replacement track is later than the lastms on the existing track
-        if (!myMeta.tracks.count(finalMap) || trackMeta.tracks.find(value)->second.keys.size() > 1 || trackMeta.tracks.find(value)->second.firstms >= myMeta.tracks[finalMap].lastms) {
-          if (myMeta.tracks.count(finalMap) && myMeta.tracks[finalMap].lastms > 0) {
-            INFO_MSG("Resume of track %lu detected, coming from temporary track %lu of user %u", finalMap, value, id);
-          } else {
-            INFO_MSG("New track detected, assigned track id %lu, coming from temporary track %lu of user %u", finalMap, value, id);
-          }
-        } else {
-          //Otherwise replace existing track
-          INFO_MSG("Replacement of track %lu detected, coming from temporary track %lu of user %u", finalMap, value, id);
-          myMeta.tracks.erase(finalMap);
-          //Set master to true before erasing the page, because we are responsible for cleaning up unused pages
-          updateMeta();
-          eraseTrackDataPages(value);
-          nProxy.metaPages[finalMap].master = true;
-          nProxy.metaPages.erase(finalMap);
-          bufferLocations.erase(finalMap);
-        }
-
-        //Register the new track as an active track.
-        activeTracks.insert(finalMap);
-        //Register the time of registration as initial value for the lastUpdated field, plus an extra 5 seconds just to be sure.
-        lastUpdated[finalMap] = Util::bootSecs() + 5;
-        //Register the user thats is pushing this element
-        pushLocation[finalMap] = data;
-        //Initialize the metadata for this track if it was not in place yet.
-        if (!myMeta.tracks.count(finalMap)) {
-          DEBUG_MSG(DLVL_MEDIUM, "Inserting metadata for track number %d", finalMap);
-          myMeta.tracks[finalMap] = trackMeta.tracks.begin()->second;
-          myMeta.tracks[finalMap].firstms = 0;
-          myMeta.tracks[finalMap].lastms = 0;
-          myMeta.tracks[finalMap].trackID = finalMap;
-        }
-        //Update the metadata to reflect all changes
-        updateMeta();
+        unsigned long finalMap = acceptTrack(trackMeta.tracks.find(value)->second, value, data, id);
         //Write the final mapped track number and keyframe number to the user page element
         //This is used to resume pushing as well as pushing new tracks
         userConn.setTrackId(index, finalMap);
@@ -823,5 +992,305 @@ namespace Mist {
     return true;
   }
 
-}
+  /// A live stream served by the buffer host process.
+  struct hostedBuffer{
+    uint32_t record;///< Record of the buffer host table the stream was handed over in
+    Util::Config * config;
+    inputBuffer * buffer;
+    IPC::semaphore playerLock;
+    bool isActive;///< Util::Config::is_active of this stream, kept while other streams run
+    //The values of the shared statics belonging to the host, kept while this stream runs
+    Util::Config * hostConfig;
+    Input * hostSingleton;
+    std::string hostStreamName;
+    bool hostActive;
+    sigset_t hostMask;
+  };
+
+  /// Boots the buffer. With --host, this process becomes the buffer host, serving the streams of
+  /// all buffer processes started after it. Otherwise the stream is handed over to the buffer host
+  /// if one is running, and only served by this process if there is none or the hand-over fails.
+  int inputBuffer::boot(int argc, char * argv[]){
+    if (!config->parseArgs(argc, argv)){return 1;}
+    if (config->getBool("host")){return hostAngel(argv[0]);}
+    std::string strName = config->getString("streamname");
+    if (!config->getBool("json") && strName.size()){
+      IPC::bufferHost host;
+      if (host.init(false) && host.hostAlive()){
+        std::string args;
+        for (int i = 1; i < argc; ++i){args.append(argv[i], strlen(argv[i]) + 1);}
+        int32_t record = host.post(args);
+        if (record >= 0){
+          int result = 0;
+          while (!result){result = host.waitStarted(record, 10000);}
+          if (result > 0){
+            INFO_MSG("Stream %s handed over to the buffer host", strName.c_str());
+            return 0;
+          }
+        }
+        WARN_MSG("Buffer host did not take over stream %s, buffering it in this process", strName.c_str());
+      }
+    }
+    optind = 1;
+    return Input::boot(argc, argv);
+  }
 
+  /// Runs the buffer host in a child process, restarting it when it crashes.
+  /// The streams a crashed host was serving are cleaned up, so they can be started again.
+  int inputBuffer::hostAngel(char * argv0){
+    config->activate();
+#if DEBUG < DLVL_DEVEL
+    uint64_t reTimer = 0;
+#endif
+    while (config->is_active){
+      pid_t pid = fork();
+      if (pid == 0){return hostLoop(argv0);}
+      if (pid == -1){
+        FAIL_MSG("Unable to spawn buffer host process");
+        return 2;
+      }
+      int status;
+      while (waitpid(pid, &status, 0) != pid && errno == EINTR){
+        if (!config->is_active){
+          INFO_MSG("Shutting down buffer host because of signal interrupt...");
+          Util::Procs::Stop(pid);
+        }
+        continue;
+      }
+      if (WIFEXITED(status) && (WEXITSTATUS(status) == 0)){
+        INFO_MSG("Buffer host shut down cleanly");
+        break;
+      }
+      WARN_MSG("Buffer host uncleanly shut down! Cleaning up the streams it was serving...");
+      hostCrashCleanup(argv0);
+#if DEBUG >= DLVL_DEVEL
+      WARN_MSG("Aborting buffer host restart; this is a development build.");
+      break;
+#else
+      Util::wait(reTimer);
+      reTimer += 1000;
+#endif
+    }
+    HIGH_MSG("Buffer host angel process exiting");
+    return 0;
+  }
+
+  /// The buffer host main loop. Takes in streams handed over through the buffer host table and
+  /// serves them all from this process, running the serve loop of each stream when it is due or
+  /// when its negotiation channel was signalled.
+  int inputBuffer::hostLoop(char * argv0){
+    IPC::bufferHost host;
+    if (!host.init(true)){
+      FAIL_MSG("Could not create the buffer host table");
+      return 1;
+    }
+    host.setHost(getpid());
+    INFO_MSG("Buffer host ready");
+    std::map<uint32_t, hostedBuffer *> streams;
+    while (Util::Config::is_active){
+      uint32_t record;
+      std::string args;
+      while (host.get(record, args)){
+        hostedBuffer * H = loadHosted(record, args, argv0);
+        bool started = false;
+        if (H){
+          enterHosted(*H);
+          started = startHosted(*H);
+          leaveHosted(*H);
+        }
+        if (!started){
+          if (H){
+            enterHosted(*H);
+            delete H->buffer;
+            leaveHosted(*H);
+            delete H->config;
+            delete H;
+          }
+          host.started(record, false);
+          continue;
+        }
+        streams[record] = H;
+        host.started(record, true);
+      }
+
+      uint64_t now = Util::bootMS();
+      uint64_t nextWake = now + BUFFER_HOST_TICK;
+      std::map<uint32_t, hostedBuffer *>::iterator it = streams.begin();
+      while (it != streams.end()){
+        hostedBuffer & H = *(it->second);
+        if (H.buffer->trackNegs.pending()){H.buffer->nextUserPoll = 0;}
+        if (H.buffer->nextUserPoll <= now){
+          enterHosted(H);
+          bool keep = H.buffer->serveStep();
+          if (!keep){stopHosted(H);}
+          leaveHosted(H);
+          if (!keep){
+            streams.erase(it++);
+            host.release(H.record);
+            delete H.config;
+            delete &H;
+            continue;
+          }
+        }
+        if (H.buffer->nextUserPoll < nextWake){nextWake = H.buffer->nextUserPoll;}
+        ++it;
+      }
+      now = Util::bootMS();
+      if (nextWake > now){host.waitRequest(nextWake - now);}
+    }
+
+    INFO_MSG("Buffer host shutting down, stopping %zu streams", streams.size());
+    for (std::map<uint32_t, hostedBuffer *>::iterator it = streams.begin(); it != streams.end(); ++it){
+      hostedBuffer & H = *(it->second);
+      enterHosted(H);
+      Util::Config::is_active = false;
+      stopHosted(H);
+      leaveHosted(H);
+      host.release(H.record);
+      delete H.config;
+      delete &H;
+    }
+    host.setHost(0);
+    return 0;
+  }
+
+  /// Cleans up the streams a crashed buffer host was serving, as the angel of a buffer process
+  /// would for its own stream.
+  void inputBuffer::hostCrashCleanup(char * argv0){
+    IPC::bufferHost host;
+    if (!host.init(false)){return;}
+    std::string args;
+    for (uint32_t i = 0; i < BUFFER_HOST_STREAMS; ++i){
+      if (!host.running(i, args)){continue;}
+      hostedBuffer * H = loadHosted(i, args, argv0);
+      if (H){
+        enterHosted(*H);
+        H->buffer->onCrash();
+        char pageName[NAME_BUFFER_SIZE];
+        snprintf(pageName, NAME_BUFFER_SIZE, SEM_INPUT, H->buffer->streamName.c_str());
+        H->playerLock.open(pageName, O_CREAT | O_RDWR, ACCESSPERMS, 1);
+        H->playerLock.unlink();
+        snprintf(pageName, NAME_BUFFER_SIZE, SHM_STREAM_STATE, H->buffer->streamName.c_str());
+        H->buffer->streamStatus.init(pageName, 1, true, false);
+        H->buffer->streamStatus.close();
+        delete H->buffer;
+        leaveHosted(*H);
+        delete H->config;
+        delete H;
+      }
+      host.release(i);
+    }
+  }
+
+  /// Creates the configuration and buffer for a stream handed over to the host, parsing the
+  /// arguments the buffer process was started with. Returns null if they don't parse.
+  hostedBuffer * inputBuffer::loadHosted(uint32_t record, const std::string & args, char * argv0){
+    std::string argData = args;
+    if (!argData.size() || argData[argData.size() - 1]){argData += (char)0;}
+    std::vector<char *> argVec;
+    argVec.push_back(argv0);
+    for (size_t i = 0; i < argData.size(); i += strlen(&argData[i]) + 1){argVec.push_back(&argData[i]);}
+    argVec.push_back(0);
+    int argc = argVec.size() - 1;
+    char ** argv = &argVec[0];
+
+    hostedBuffer * H = new hostedBuffer;
+    H->record = record;
+    H->isActive = true;
+    //Constructing an input takes over the shared statics; give them back to the host
+    Util::Config * hostConfig = Input::config;
+    Input * hostSingleton = Input::singleton;
+    uint32_t hostDebug = Util::Config::printDebugLevel;
+    H->config = new Util::Config(argv0);
+    H->buffer = new inputBuffer(H->config);
+    Input::config = hostConfig;
+    Input::singleton = hostSingleton;
+    optind = 1;
+    bool parsed = H->config->parseArgs(argc, argv);
+    Util::Config::printDebugLevel = hostDebug;
+    H->buffer->streamName = H->buffer->nProxy.streamName = H->config->getString("streamname");
+    if (!parsed || !H->buffer->streamName.size()){
+      FAIL_MSG("Could not parse the arguments of handed over stream %s", H->buffer->streamName.c_str());
+      enterHosted(*H);
+      delete H->buffer;
+      leaveHosted(*H);
+      delete H->config;
+      delete H;
+      return 0;
+    }
+    return H;
+  }
+
+  /// Locks and starts serving a stream handed over to the host, like Input::boot and Input::run do
+  /// for a stream buffered in its own process. Returns false if the stream could not be started.
+  bool inputBuffer::startHosted(hostedBuffer & H){
+    inputBuffer & B = *H.buffer;
+    INFO_MSG("Buffer host taking over stream %s", B.streamName.c_str());
+    if (!B.checkArguments()){
+      FAIL_MSG("Setup failed");
+      return false;
+    }
+    char pageName[NAME_BUFFER_SIZE];
+    snprintf(pageName, NAME_BUFFER_SIZE, SEM_INPUT, B.streamName.c_str());
+    H.playerLock.open(pageName, O_CREAT | O_RDWR, ACCESSPERMS, 1);
+    if (!H.playerLock.tryWait()){
+      INFO_MSG("A player for stream %s is already running", B.streamName.c_str());
+      H.playerLock.close();
+      return false;
+    }
+    snprintf(pageName, NAME_BUFFER_SIZE, SHM_STREAM_STATE, B.streamName.c_str());
+    B.streamStatus.init(pageName, 1, true, false);
+    if (B.streamStatus){B.streamStatus.mapped[0] = STRMSTAT_INIT;}
+    if (!B.preRun()){
+      B.streamStatus.close();
+      H.playerLock.unlink();
+      return false;
+    }
+    B.myMeta.sourceURI = H.config->getString("input");
+    if (B.streamStatus){B.streamStatus.mapped[0] = STRMSTAT_BOOT;}
+    B.serveStart();
+    return true;
+  }
+
+  /// Stops serving a hosted stream and frees its buffer, unlocking the stream for other inputs.
+  /// Must be called between enterHosted and leaveHosted.
+  void inputBuffer::stopHosted(hostedBuffer & H){
+    H.buffer->serveStop();
+    H.playerLock.unlink();
+    H.buffer->streamStatus.close();
+    INFO_MSG("Buffer host no longer serving stream %s", H.buffer->streamName.c_str());
+    delete H.buffer;
+    H.buffer = 0;
+  }
+
+  /// Makes the shared statics belong to the given hosted stream, so its buffer can run as if it
+  /// were alone in its process. Shutdown signals are held off until leaveHosted, so they always
+  /// reach the is_active of the host itself.
+  void inputBuffer::enterHosted(hostedBuffer & H){
+    sigset_t shutdownSignals;
+    sigemptyset(&shutdownSignals);
+    sigaddset(&shutdownSignals, SIGINT);
+    sigaddset(&shutdownSignals, SIGHUP);
+    sigaddset(&shutdownSignals, SIGTERM);
+    sigprocmask(SIG_BLOCK, &shutdownSignals, &H.hostMask);
+    H.hostConfig = Input::config;
+    H.hostSingleton = Input::singleton;
+    H.hostStreamName = Util::Config::streamName;
+    H.hostActive = Util::Config::is_active;
+    Input::config = H.config;
+    Input::singleton = H.buffer;
+    Util::Config::streamName = H.buffer->streamName;
+    Util::Config::is_active = H.isActive;
+  }
+
+  /// Gives the shared statics back to the host, see enterHosted.
+  void inputBuffer::leaveHosted(hostedBuffer & H){
+    H.isActive = Util::Config::is_active;
+    Input::config = H.hostConfig;
+    Input::singleton = H.hostSingleton;
+    Util::Config::streamName = H.hostStreamName;
+    Util::Config::is_active = H.hostActive;
+    sigprocmask(SIG_SETMASK, &H.hostMask, 0);
+  }
+
+}
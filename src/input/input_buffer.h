@@ -3,16 +3,29 @@
 #include <mist/shared_memory.h>
 
 namespace Mist {
+  struct hostedBuffer;
+
   class inputBuffer : public Input {
     public:
       inputBuffer(Util::Config * cfg);
       ~inputBuffer();
+      int boot(int argc, char * argv[]);
       void onCrash();
     private:
       unsigned int bufferTime;
       unsigned int cutTime;
       bool hasPush;
+      bool everHadPush;
       bool resumeMode;
+      //Buffer host mode
+      int hostAngel(char * argv0);
+      static int hostLoop(char * argv0);
+      static void hostCrashCleanup(char * argv0);
+      static hostedBuffer * loadHosted(uint32_t record, const std::string & args, char * argv0);
+      static bool startHosted(hostedBuffer & H);
+      static void stopHosted(hostedBuffer & H);
+      static void enterHosted(hostedBuffer & H);
+      static void leaveHosted(hostedBuffer & H);
       IPC::semaphore * liveMeta;
     protected:
       //Private Functions
@@ -26,21 +39,34 @@ namespace Mist {
       void updateMetaFromPage(unsigned long tNum, unsigned long pageNum);
       void seek(int seekTime){}
       void trackSelect(std::string trackSpec){}
-      bool removeKey(unsigned int tid);
+      size_t safeTrimCount(DTSC::Track & Trk, size_t count);
+      bool trimTrack(unsigned long tid);
       void removeUnused();
       void eraseTrackDataPages(unsigned long tid);
+      void eraseSegments(unsigned long tid, size_t count);
       void finish();
       void userCallback(char * data, size_t len, unsigned int id);
+      bool handleTrackNegotiations();
+      unsigned long acceptTrack(DTSC::Track & newTrack, unsigned long tempId, char * pushedFrom, unsigned int id);
+      void endPush(unsigned long tid);
       std::set<unsigned long> negotiatingTracks;
       std::set<unsigned long> activeTracks;
       std::map<unsigned long, unsigned long long> lastUpdated;
+      ///Per track, the lastms at which trimming was last held back by the safety checks
+      std::map<unsigned long, uint64_t> trimWatermark;
       std::map<unsigned long, unsigned long long> negotiationTimeout;
       ///Maps trackid to a pagenum->pageData map
       std::map<unsigned long, std::map<unsigned long, DTSCPageData> > bufferLocations;
       std::map<unsigned long, char *> pushLocation;
+      ///Maps tracks negotiated through the negotiation channel to the PID of the process pushing them
+      std::map<unsigned long, uint32_t> pushPids;
       inputBuffer * singleton;
       //This is used for an ugly fix to prevent metadata from disappearing in some cases.
       std::map<unsigned long, std::string> initData;
+      ///Manifests generated by the outputs, outdated whenever the keys or tracks change
+      IPC::manifestCache manifests;
+      ///Hash of the key ranges and track ids, compared on every metadata update to detect such changes
+      uint64_t manifestState;
   };
 }
 
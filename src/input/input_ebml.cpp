@@ -2,6 +2,9 @@
 #include <mist/defines.h>
 #include <mist/ebml.h>
 #include <mist/bitfields.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 
 namespace Mist{
 
@@ -39,6 +42,11 @@ namespace Mist{
     lastClusterTime = 0;
     bufferedPacks = 0;
     wantBlocks = true;
+    inFile = 0;
+    fileData = 0;
+    fileSize = 0;
+    filePos = 0;
+    element = 0;
   }
 
   std::string ASStoSRT(const char * ptr, uint32_t len){
@@ -94,15 +102,83 @@ namespace Mist{
   bool InputEBML::preRun(){
     if (config->getString("input") == "-"){
       inFile = stdin;
-    }else{
-      // open File
-      inFile = fopen(config->getString("input").c_str(), "r");
-      if (!inFile){return false;}
+      return true;
+    }
+    //Files are mapped as a whole, elements are parsed straight from the mapping
+    int handle = open(config->getString("input").c_str(), O_RDONLY);
+    if (handle == -1){return false;}
+    struct stat statData;
+    if (fstat(handle, &statData) == -1){
+      close(handle);
+      return false;
+    }
+    fileSize = statData.st_size;
+    if (!fileSize){
+      close(handle);
+      FAIL_MSG("Input file %s is empty", config->getString("input").c_str());
+      return false;
+    }
+    fileData = (char *)mmap(0, fileSize, PROT_READ, MAP_SHARED, handle, 0);
+    close(handle);
+    if (fileData == MAP_FAILED){
+      FAIL_MSG("Memory-mapping %s failed: %s", config->getString("input").c_str(), strerror(errno));
+      fileData = 0;
+      return false;
+    }
+    filePos = 0;
+    return true;
+  }
+
+  /// Points elem at the element of the mapped file at position pos, and moves pos past it.
+  /// Master elements are entered rather than skipped, except for the ones that never hold anything
+  /// we use: those are skipped as a whole when their size is known.
+  /// Only reads the mapping, so it is safe to call from several threads at once.
+  bool InputEBML::mapElement(uint64_t & pos, const char *& elem, bool & minimal) const{
+    if (pos >= fileSize){return false;}
+    const char * p = fileData + pos;
+    uint64_t avail = fileSize - pos;
+    minimal = true;
+    uint64_t needed = EBML::Element::needBytes(p, avail, minimal);
+    // Make sure TrackEntry types are read whole
+    if (needed <= avail && EBML::Element(p).getID() == EBML::EID_TRACKENTRY){
+      minimal = false;
+      needed = EBML::Element::needBytes(p, avail, minimal);
+    }
+    if (needed > avail){
+      FAIL_MSG("Could not read more data! (have %" PRIu64 ", need %" PRIu64 ")", avail, needed);
+      pos = fileSize;
+      return false;
+    }
+    elem = p;
+    pos += needed;
+    EBML::Element E(p, minimal);
+    switch (E.getID()){
+      case EBML::EID_CUES:
+      case EBML::EID_TAGS:
+      case EBML::EID_CHAPTERS:
+      case EBML::EID_ATTACHMENTS:{
+        uint64_t payload = E.getPayloadLen();
+        if (payload != 0xFFFFFFFFFFFFFFFFull && payload <= fileSize - pos){pos += payload;}
+      }break;
+      default: break;
     }
     return true;
   }
 
   bool InputEBML::readElement(){
+    if (fileData){
+      if (!mapElement(filePos, element, readingMinimal)){return false;}
+      EBML::Element E(element);
+      if (E.getID() == EBML::EID_CLUSTER){
+        lastClusterBPos = filePos;
+        DONTEVEN_MSG("Found a cluster at position %" PRIu64, lastClusterBPos);
+      }
+      if (E.getID() == EBML::EID_TIMECODE){
+        lastClusterTime = E.getValUInt();
+        DONTEVEN_MSG("Cluster time %" PRIu64 " ms", lastClusterTime);
+      }
+      return true;
+    }
     ptr.size() = 0;
     readingMinimal = true;
     uint32_t needed = EBML::Element::needBytes(ptr, ptr.size(), readingMinimal);
@@ -125,6 +201,7 @@ namespace Mist{
         }
       }
     }
+    element = ptr;
     EBML::Element E(ptr);
     if (E.getID() == EBML::EID_CLUSTER){
       if (inFile == stdin){
@@ -162,12 +239,12 @@ namespace Mist{
   }
 
   bool InputEBML::readHeader(){
-    if (!inFile){return false;}
+    if (!inFile && !fileData){return false;}
     // Create header file from file
     uint64_t bench = Util::getMicros();
 
     while (readElement()){
-      EBML::Element E(ptr, readingMinimal);
+      EBML::Element E(element, readingMinimal);
       if (E.getID() == EBML::EID_TRACKENTRY){
         EBML::Element tmpElem = E.findChild(EBML::EID_TRACKNUMBER);
         if (!tmpElem){
@@ -339,57 +416,18 @@ namespace Mist{
       }
       //Live streams stop parsing the header as soon as the first Cluster is encountered
       if (E.getID() == EBML::EID_CLUSTER && !needsLock()){return true;}
+      //Mapped files are split up at cluster boundaries and parsed on several threads, if possible
+      if (E.getID() == EBML::EID_CLUSTER && fileData && listChunks(element - fileData)){
+        parseHeaderChunks(headerChunks.size());
+        for (std::deque<headerChunk>::iterator it = headerChunks.begin(); it != headerChunks.end(); ++it){
+          applyBlocks(*it);
+        }
+        headerChunks.clear();
+        break;
+      }
       if (E.getType() == EBML::ELEM_BLOCK){
-        EBML::Block B(ptr);
-        uint64_t tNum = B.getTrackNum();
-        uint64_t newTime = lastClusterTime + B.getTimecode();
-        trackPredictor &TP = packBuf[tNum];
-        DTSC::Track &Trk = myMeta.tracks[tNum];
-        bool isVideo = (Trk.type == "video");
-        bool isAudio = (Trk.type == "audio");
-        bool isASS = (Trk.codec == "subtitle" && Trk.init.size());
-        //If this is a new video keyframe, flush the corresponding trackPredictor
-        if (isVideo && B.isKeyframe()){
-          while (TP.hasPackets(true)){
-            packetData &C = TP.getPacketData(true);
-            myMeta.update(C.time, C.offset, C.track, C.dsize, C.bpos, C.key);
-            TP.remove();
-          }
-          TP.flush();
-        }
-        for (uint64_t frameNo = 0; frameNo < B.getFrameCount(); ++frameNo){
-          if (frameNo){
-            if (Trk.codec == "AAC"){
-              newTime += (1000000 / Trk.rate)/timeScale;//assume ~1000 samples per frame
-            } else if (Trk.codec == "MP3"){
-              newTime += (1152000 / Trk.rate)/timeScale;//1152 samples per frame
-            } else if (Trk.codec == "DTS"){
-              //Assume 512 samples per frame (DVD default)
-              //actual amount can be calculated from data, but data
-              //is not available during header generation...
-              //See: http://www.stnsoft.com/DVD/dtshdr.html
-              newTime += (512000 / Trk.rate)/timeScale;
-            }else{
-              newTime += 1/timeScale;
-              ERROR_MSG("Unknown frame duration for codec %s - timestamps WILL be wrong!", Trk.codec.c_str());
-            }
-          }
-          uint32_t frameSize = B.getFrameSize(frameNo);
-          if (isASS){
-            char * ptr = (char *)B.getFrameData(frameNo);
-            std::string assStr = ASStoSRT(ptr, frameSize);
-            frameSize = assStr.size();
-          }
-          if (frameSize){
-            TP.add(newTime*timeScale, 0, tNum, frameSize, lastClusterBPos,
-                 B.isKeyframe() && !isAudio, isVideo);
-          }
-        }
-        while (TP.hasPackets()){
-          packetData &C = TP.getPacketData(isVideo);
-          myMeta.update(C.time, C.offset, C.track, C.dsize, C.bpos, C.key);
-          TP.remove();
-        }
+        readBlock(EBML::Block(element), lastClusterTime, lastClusterBPos, blockBuf);
+        applyBlocks(blockBuf);
       }
     }
 
@@ -420,6 +458,144 @@ namespace Mist{
     return true;
   }
 
+  /// Splits the file from the cluster at pos onwards into headerChunks of about HEADER_CHUNK_SIZE bytes.
+  /// Only the headers of the clusters (and whatever is in between them) are read to do so.
+  /// Returns false if the file cannot be split, because an element has an unknown size, or if it is
+  /// too small to be worth splitting.
+  bool InputEBML::listChunks(uint64_t pos){
+    headerChunks.clear();
+    uint64_t chunkStart = pos;
+    while (pos < fileSize){
+      uint64_t avail = fileSize - pos;
+      //A truncated last element ends the file; the chunk containing it reports it
+      if (EBML::Element::needBytes(fileData + pos, avail, true) > avail){break;}
+      EBML::Element E(fileData + pos, true);
+      uint64_t payload = E.getPayloadLen();
+      if (payload == 0xFFFFFFFFFFFFFFFFull || E.getID() == EBML::EID_SEGMENT || E.getID() == EBML::EID_EBML){
+        headerChunks.clear();
+        return false;
+      }
+      pos += E.getHeaderLen();
+      pos = (payload > fileSize - pos) ? fileSize : pos + payload;
+      if (pos - chunkStart >= HEADER_CHUNK_SIZE){
+        headerChunk C;
+        C.start = chunkStart;
+        C.end = pos;
+        headerChunks.push_back(C);
+        chunkStart = pos;
+      }
+    }
+    if (chunkStart < fileSize){
+      headerChunk C;
+      C.start = chunkStart;
+      C.end = fileSize;
+      headerChunks.push_back(C);
+    }
+    if (headerChunks.size() < 2){
+      headerChunks.clear();
+      return false;
+    }
+    return true;
+  }
+
+  /// Reads the blocks of a single chunk of clusters. Called from several threads at once.
+  void InputEBML::parseHeaderChunk(size_t chunk){
+    headerChunk & C = headerChunks[chunk];
+    uint64_t pos = C.start;
+    uint64_t clusterPos = 0;
+    uint64_t clusterTime = 0;
+    const char * elem = 0;
+    bool minimal = true;
+    while (pos < C.end && mapElement(pos, elem, minimal)){
+      EBML::Element E(elem, minimal);
+      if (E.getID() == EBML::EID_CLUSTER){clusterPos = pos;}
+      if (E.getID() == EBML::EID_TIMECODE){clusterTime = E.getValUInt();}
+      if (E.getType() == EBML::ELEM_BLOCK){readBlock(EBML::Block(elem), clusterTime, clusterPos, C);}
+    }
+  }
+
+  /// Adds the block and the times and sizes of its frames to C.
+  /// Only reads the track metadata, so it is safe to call from several threads at once.
+  void InputEBML::readBlock(const EBML::Block & B, uint64_t clusterTime, uint64_t bpos, headerChunk & C) const{
+    headerBlock H;
+    H.track = B.getTrackNum();
+    H.bpos = bpos;
+    H.frames = 0;
+    H.keyframe = B.isKeyframe();
+    std::string codec;
+    int rate = 0;
+    bool isASS = false;
+    std::map<unsigned int, DTSC::Track>::const_iterator Trk = myMeta.tracks.find(H.track);
+    if (Trk != myMeta.tracks.end()){
+      codec = Trk->second.codec;
+      rate = Trk->second.rate;
+      isASS = (codec == "subtitle" && Trk->second.init.size());
+    }
+    uint64_t newTime = clusterTime + B.getTimecode();
+    for (uint64_t frameNo = 0; frameNo < B.getFrameCount(); ++frameNo){
+      if (frameNo){
+        if (codec == "AAC"){
+          newTime += (1000000 / rate)/timeScale;//assume ~1000 samples per frame
+        } else if (codec == "MP3"){
+          newTime += (1152000 / rate)/timeScale;//1152 samples per frame
+        } else if (codec == "DTS"){
+          //Assume 512 samples per frame (DVD default)
+          //actual amount can be calculated from data, but data
+          //is not available during header generation...
+          //See: http://www.stnsoft.com/DVD/dtshdr.html
+          newTime += (512000 / rate)/timeScale;
+        }else{
+          newTime += 1/timeScale;
+          ERROR_MSG("Unknown frame duration for codec %s - timestamps WILL be wrong!", codec.c_str());
+        }
+      }
+      uint32_t frameSize = B.getFrameSize(frameNo);
+      if (isASS){
+        std::string assStr = ASStoSRT(B.getFrameData(frameNo), frameSize);
+        frameSize = assStr.size();
+      }
+      if (frameSize){
+        headerFrame F;
+        F.time = newTime*timeScale;
+        F.size = frameSize;
+        C.frames.push_back(F);
+        ++H.frames;
+      }
+    }
+    C.blocks.push_back(H);
+  }
+
+  /// Feeds the blocks in C through the track predictors into the metadata, in order, and empties C.
+  void InputEBML::applyBlocks(headerChunk & C){
+    std::deque<headerFrame>::iterator F = C.frames.begin();
+    for (std::deque<headerBlock>::iterator it = C.blocks.begin(); it != C.blocks.end(); ++it){
+      uint64_t tNum = it->track;
+      trackPredictor &TP = packBuf[tNum];
+      DTSC::Track &Trk = myMeta.tracks[tNum];
+      bool isVideo = (Trk.type == "video");
+      bool isAudio = (Trk.type == "audio");
+      //If this is a new video keyframe, flush the corresponding trackPredictor
+      if (isVideo && it->keyframe){
+        while (TP.hasPackets(true)){
+          packetData &P = TP.getPacketData(true);
+          myMeta.update(P.time, P.offset, P.track, P.dsize, P.bpos, P.key);
+          TP.remove();
+        }
+        TP.flush();
+      }
+      for (uint32_t i = 0; i < it->frames; ++i, ++F){
+        TP.add(F->time, 0, tNum, F->size, it->bpos, it->keyframe && !isAudio, isVideo);
+      }
+      while (TP.hasPackets()){
+        packetData &P = TP.getPacketData(isVideo);
+        myMeta.update(P.time, P.offset, P.track, P.dsize, P.bpos, P.key);
+        TP.remove();
+      }
+    }
+    C.blocks.clear();
+    C.frames.clear();
+  }
+
   void InputEBML::fillPacket(packetData &C){
     if (swapEndianness.count(C.track)){
       switch (myMeta.tracks[C.track].size){
@@ -495,10 +671,10 @@ namespace Mist{
           thisPacket.null();
           return;
         }
-        B = EBML::Block(ptr);
+        B = EBML::Block(element);
       }while (!B || B.getType() != EBML::ELEM_BLOCK || !selectedTracks.count(B.getTrackNum()));
     }else{
-      B = EBML::Block(ptr);
+      B = EBML::Block(element);
     }
 
     uint64_t tNum = B.getTrackNum();
@@ -544,11 +720,12 @@ namespace Mist{
       }
       uint32_t frameSize = B.getFrameSize(frameNo);
       if (frameSize){
-        char * ptr = (char *)B.getFrameData(frameNo);
+        const char * ptr = B.getFrameData(frameNo);
+        std::string assStr;
         if (isASS){
-          std::string assStr = ASStoSRT(ptr, frameSize);
+          assStr = ASStoSRT(ptr, frameSize);
           frameSize = assStr.size();
-          memcpy(ptr, assStr.data(), frameSize);
+          ptr = assStr.data();
         }
         if (frameSize){
           TP.add(newTime*timeScale, 0, tNum, frameSize, lastClusterBPos,
@@ -582,7 +759,13 @@ namespace Mist{
       if (Trk.keys[i].getTime() > seekTime){break;}
       seekPos = Trk.keys[i].getBpos();
     }
-    Util::fseek(inFile, seekPos, SEEK_SET);
+    //Key positions point just past the cluster header, so the cluster itself is not read again
+    lastClusterBPos = seekPos;
+    if (fileData){
+      filePos = seekPos;
+    }else{
+      Util::fseek(inFile, seekPos, SEEK_SET);
+    }
   }
 
   ///Flushes all trackPredictors without deleting permanent data from them.
@@ -1,6 +1,7 @@
 #pragma once
 #include "input.h"
 #include <mist/util.h>
+#include <mist/ebml.h>
 
 namespace Mist{
 
@@ -145,6 +146,29 @@ namespace Mist{
 
   };
 
+  /// A block found while generating the header.
+  /// Its frames are the next `frames` entries in the frames of the headerChunk it belongs to.
+  struct headerBlock{
+    uint64_t track;
+    uint64_t bpos;
+    uint32_t frames;
+    bool keyframe;
+  };
+
+  /// Time and size of a single frame found while generating the header.
+  struct headerFrame{
+    uint64_t time;
+    uint32_t size;
+  };
+
+  /// A range of clusters in the file, and the blocks read from it.
+  struct headerChunk{
+    uint64_t start;
+    uint64_t end;
+    std::deque<headerBlock> blocks;
+    std::deque<headerFrame> frames;
+  };
+
   class InputEBML : public Input{
   public:
     InputEBML(Util::Config *cfg);
@@ -155,17 +179,28 @@ namespace Mist{
     bool preRun();
     bool readHeader();
     bool readElement();
+    bool mapElement(uint64_t & pos, const char *& elem, bool & minimal) const;
+    bool listChunks(uint64_t pos);
+    void parseHeaderChunk(size_t chunk);
+    void readBlock(const EBML::Block & B, uint64_t clusterTime, uint64_t bpos, headerChunk & C) const;
+    void applyBlocks(headerChunk & C);
     void getNext(bool smart = true);
     void seek(int seekTime);
     void clearPredictors();
     FILE *inFile;
     Util::ResizeablePointer ptr;
+    char * fileData;///< The whole file, memory-mapped, or null when reading from standard input
+    uint64_t fileSize;
+    uint64_t filePos;///< Read position inside fileData
+    const char * element;///< The element last read by readElement, in either ptr or fileData
     bool readingMinimal;
     uint64_t lastClusterBPos;
     uint64_t lastClusterTime;
     uint64_t bufferedPacks;
     std::map<uint64_t, trackPredictor> packBuf;
     std::set<uint64_t> swapEndianness;
+    std::deque<headerChunk> headerChunks;///< Chunks of the file, while generating the header on several threads
+    headerChunk blockBuf;///< The block being added, while generating the header on a single thread
     bool readExistingHeader();
     void parseStreamHeader(){
       readHeader();
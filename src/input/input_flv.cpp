@@ -5,10 +5,14 @@
 #include <cstdlib>
 #include <cstdio>
 #include <string>
+#include <algorithm>
 #include <sys/types.h>//for stat
 #include <sys/stat.h>//for stat
 #include <unistd.h>//for stat
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <mist/util.h>
+#include <mist/bitfields.h>
 #include <mist/stream.h>
 #include <mist/defines.h>
 
@@ -25,6 +29,8 @@ namespace Mist {
     capa["codecs"][0u][0u].append("VP6");
     capa["codecs"][0u][1u].append("AAC");
     capa["codecs"][0u][1u].append("MP3");
+    fileData = 0;
+    fileSize = 0;
   }
 
   bool inputFLV::checkArguments() {
@@ -47,15 +53,24 @@ namespace Mist {
   }
     
   bool inputFLV::preRun() {
-    //open File
-    inFile = fopen(config->getString("input").c_str(), "r");
-    if (!inFile) {
+    //open and map the whole file, tags are parsed straight from the mapping
+    int handle = open(config->getString("input").c_str(), O_RDONLY);
+    if (handle == -1) {
       return false;
     }
     struct stat statData;
-    lastModTime = 0;
-    if (stat(config->getString("input").c_str(), &statData) != -1){
-      lastModTime = statData.st_mtime;
+    if (fstat(handle, &statData) == -1){
+      close(handle);
+      return false;
+    }
+    lastModTime = statData.st_mtime;
+    fileSize = statData.st_size;
+    fileData = (char *)mmap(0, fileSize, PROT_READ, MAP_SHARED, handle, 0);
+    close(handle);
+    if (fileData == MAP_FAILED){
+      FAIL_MSG("Memory-mapping %s failed: %s", config->getString("input").c_str(), strerror(errno));
+      fileData = 0;
+      return false;
     }
     return true;
   }
@@ -77,65 +92,117 @@ namespace Mist {
   }
 
   bool inputFLV::readHeader() {
-    if (!inFile){return false;}
+    if (!fileData){return false;}
     //Create header file from FLV data
-    Util::fseek(inFile, 13, SEEK_SET);
     AMF::Object amf_storage;
-    long long int lastBytePos = 13;
+    tagIndex.clear();
+    uint64_t lastBytePos = 13;
     uint64_t bench = Util::getMicros();
-    while (!feof(inFile) && !FLV::Parse_Error){
-      if (tmpTag.FileLoader(inFile)){
-        tmpTag.toMeta(myMeta, amf_storage);
-        if (!tmpTag.getDataLen()){continue;}
-        if (tmpTag.needsInitData() && tmpTag.isInitData()){continue;}
-        myMeta.update(tmpTag.tagTime(), tmpTag.offset(), tmpTag.getTrackID(), tmpTag.getDataLen(), lastBytePos, tmpTag.isKeyframe);
-        lastBytePos = Util::ftell(inFile);
-      }
+    while (!FLV::Parse_Error){
+      uint64_t tagPos = lastBytePos;
+      if (!tmpTag.MemView(fileData, fileSize, lastBytePos)){break;}
+      tmpTag.toMeta(myMeta, amf_storage);
+      if (!tmpTag.getDataLen()){continue;}
+      if (tmpTag.needsInitData() && tmpTag.isInitData()){continue;}
+      myMeta.update(tmpTag.tagTime(), tmpTag.offset(), tmpTag.getTrackID(), tmpTag.getDataLen(), tagPos, tmpTag.isKeyframe);
+      tagIndex[tmpTag.getTrackID()].push_back(tagPos);
     }
     bench = Util::getMicros(bench);
-    INFO_MSG("Header generated in %llu ms: @%lld, %s, %s", bench/1000, lastBytePos, myMeta.vod?"VoD":"NOVoD", myMeta.live?"Live":"NOLive");
+    INFO_MSG("Header generated in %llu ms: @%" PRIu64 ", %s, %s", bench/1000, lastBytePos, myMeta.vod?"VoD":"NOVoD", myMeta.live?"Live":"NOLive");
     if (FLV::Parse_Error){
       tmpTag = FLV::Tag();
       FLV::Parse_Error = false;
-      ERROR_MSG("Stopping at FLV parse error @%lld: %s", lastBytePos, FLV::Error_Str.c_str());
+      ERROR_MSG("Stopping at FLV parse error @%" PRIu64 ": %s", lastBytePos, FLV::Error_Str.c_str());
     }
+    storeTagIndex();
     myMeta.toFile(config->getString("input") + ".dtsh");
-    Util::fseek(inFile, 13, SEEK_SET);
+    //The index is only needed in the header file, we keep our own decoded copy
+    myMeta.inputLocalVars.removeMember("tagindex");
+    tagCursor.clear();
+    return true;
+  }
+
+  /// Uses an existing header only if it holds a tag index, regenerating it otherwise.
+  bool inputFLV::readExistingHeader(){
+    if (!Input::readExistingHeader()){return false;}
+    if (!loadTagIndex()){
+      INFO_MSG("Header file has no tag index, regenerating it");
+      myMeta = DTSC::Meta();
+      return false;
+    }
+    myMeta.inputLocalVars.removeMember("tagindex");
+    return true;
+  }
+
+  /// Stores the tag index in the header.
+  /// Per track, it holds the 32-bit track ID, the 32-bit amount of tags and their 64-bit file positions.
+  void inputFLV::storeTagIndex(){
+    size_t total = 0;
+    for (std::map<unsigned long, std::vector<uint64_t> >::iterator it = tagIndex.begin(); it != tagIndex.end(); ++it){
+      total += 8 + it->second.size() * 8;
+    }
+    std::string index(total, '\0');
+    char * p = (char *)index.data();
+    for (std::map<unsigned long, std::vector<uint64_t> >::iterator it = tagIndex.begin(); it != tagIndex.end(); ++it){
+      Bit::htobl(p, it->first);
+      Bit::htobl(p + 4, it->second.size());
+      p += 8;
+      for (size_t i = 0; i < it->second.size(); ++i){
+        Bit::htobll(p, it->second[i]);
+        p += 8;
+      }
+    }
+    myMeta.inputLocalVars["tagindex"] = index;
+  }
+
+  /// Loads the tag index from the header. Returns false if the header has none.
+  bool inputFLV::loadTagIndex(){
+    if (!myMeta.inputLocalVars.isMember("tagindex")){return false;}
+    tagIndex.clear();
+    tagCursor.clear();
+    const std::string & index = myMeta.inputLocalVars["tagindex"].asStringRef();
+    size_t pos = 0;
+    while (pos + 8 <= index.size()){
+      std::vector<uint64_t> & trackIndex = tagIndex[Bit::btohl(index.data() + pos)];
+      size_t count = Bit::btohl(index.data() + pos + 4);
+      pos += 8;
+      if (pos + count * 8 > index.size()){return false;}
+      trackIndex.resize(count);
+      for (size_t i = 0; i < count; ++i){
+        trackIndex[i] = Bit::btohll(index.data() + pos);
+        pos += 8;
+      }
+    }
     return true;
   }
-  
+
+  /// Reads the next tag of any of the selected tracks, jumping straight to it through the tag index.
   void inputFLV::getNext(bool smart) {
-    long long int lastBytePos = Util::ftell(inFile);
-    if (selectedTracks.size() == 1){
-      uint8_t targetTag = 0x08;
-      if (selectedTracks.count(1)){targetTag = 0x09;}
-      if (selectedTracks.count(3)){targetTag = 0x12;}
-      FLV::seekToTagType(inFile, targetTag);
-    }
-    while (!feof(inFile) && !FLV::Parse_Error){
-      if (tmpTag.FileLoader(inFile)){
-        if ( !selectedTracks.count(tmpTag.getTrackID())){
-          lastBytePos = Util::ftell(inFile);
-          continue;
-        }
-        break;
+    //The next tag is the earliest one in the file of all the selected tracks
+    unsigned long nextTrack = 0;
+    uint64_t tagPos = fileSize;
+    for (std::set<unsigned long>::iterator it = selectedTracks.begin(); it != selectedTracks.end(); ++it){
+      std::map<unsigned long, std::vector<uint64_t> >::iterator idx = tagIndex.find(*it);
+      if (idx == tagIndex.end()){continue;}
+      size_t cursor = tagCursor[*it];
+      if (cursor < idx->second.size() && idx->second[cursor] < tagPos){
+        tagPos = idx->second[cursor];
+        nextTrack = *it;
       }
     }
-    if (feof(inFile)){
+    if (!nextTrack){
       thisPacket.null();
       return;
     }
-    if (FLV::Parse_Error){
+    ++tagCursor[nextTrack];
+    uint64_t readPos = tagPos;
+    if (!tmpTag.MemView(fileData, fileSize, readPos)){
       FLV::Parse_Error = false;
-      tmpTag = FLV::Tag();
-      FAIL_MSG("FLV error @ %lld: %s", lastBytePos, FLV::Error_Str.c_str());
+      FAIL_MSG("FLV error @ %" PRIu64 ": %s", tagPos, FLV::Error_Str.c_str());
       thisPacket.null();
       return;
     }
-    if (!tmpTag.getDataLen() || (tmpTag.needsInitData() && tmpTag.isInitData())){
-      return getNext();
-    }
-    thisPacket.genericFill(tmpTag.tagTime(), tmpTag.offset(), tmpTag.getTrackID(), tmpTag.getData(), tmpTag.getDataLen(), lastBytePos, tmpTag.isKeyframe); //init packet from tmpTags data
+    thisPacket.genericFill(tmpTag.tagTime(), tmpTag.offset(), tmpTag.getTrackID(), tmpTag.getData(), tmpTag.getDataLen(), tagPos, tmpTag.isKeyframe); //init packet from tmpTags data
 
     DTSC::Track & trk = myMeta.tracks[tmpTag.getTrackID()];
     if (trk.codec == "PCM" && trk.size == 16){
@@ -154,14 +221,26 @@ namespace Mist {
     //We will seek to the corresponding keyframe of the video track if selected, otherwise audio keyframe.
     //Flv files are never multi-track, so track 1 is video, track 2 is audio.
     int trackSeek = (selectedTracks.count(1) ? 1 : 2);
-    uint64_t seekPos = myMeta.tracks[trackSeek].keys[0].getBpos();
-    for (unsigned int i = 0; i < myMeta.tracks[trackSeek].keys.size(); i++){
-      if (myMeta.tracks[trackSeek].keys[i].getTime() > seekTime){
-        break;
+    std::deque<DTSC::Key> & keys = myMeta.tracks[trackSeek].keys;
+    uint64_t seekPos = 0;
+    if (keys.size()){
+      //binary search for the last key at or before seekTime, or the first key if there is none
+      size_t low = 0;
+      size_t high = keys.size();
+      while (high - low > 1){
+        size_t mid = low + (high - low) / 2;
+        if (keys[mid].getTime() > (uint64_t)seekTime){
+          high = mid;
+        }else{
+          low = mid;
+        }
       }
-      seekPos = myMeta.tracks[trackSeek].keys[i].getBpos();
+      seekPos = keys[low].getBpos();
+    }
+    //Continue every track from its first tag at or after that position
+    for (std::map<unsigned long, std::vector<uint64_t> >::iterator it = tagIndex.begin(); it != tagIndex.end(); ++it){
+      tagCursor[it->first] = std::lower_bound(it->second.begin(), it->second.end(), seekPos) - it->second.begin();
     }
-    Util::fseek(inFile, seekPos, SEEK_SET);
   }
 
   void inputFLV::trackSelect(std::string trackSpec) {
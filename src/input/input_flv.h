@@ -1,6 +1,7 @@
 #include "input.h"
 #include <mist/dtsc.h>
 #include <mist/flv_tag.h>
+#include <vector>
 
 namespace Mist {
   class inputFLV : public Input {
@@ -15,9 +16,17 @@ namespace Mist {
       void seek(int seekTime);
       void trackSelect(std::string trackSpec);
       bool keepRunning();
+      bool readExistingHeader();
+      void storeTagIndex();
+      bool loadTagIndex();
       FLV::Tag tmpTag;
       uint64_t lastModTime;
-      FILE * inFile;
+      char * fileData;///< The whole file, memory-mapped
+      uint64_t fileSize;
+      ///Per track, the file position of every tag that is a packet of that track
+      std::map<unsigned long, std::vector<uint64_t> > tagIndex;
+      ///Per track, the index in tagIndex of the next tag to read
+      std::map<unsigned long, size_t> tagCursor;
   };
 }
 
@@ -228,6 +228,10 @@ namespace Mist {
         INFO_MSG("missing track: %lu", it->first);
       }
     }
+    //Unlike EBML, this pass is not split over threads through parseHeaderChunks: getNext adds up
+    //the durations of all previous packets to time vorbis and opus packets, so a chunk in the middle
+    //of the file cannot be timed without reading everything before it. The header does get key
+    //sizes here, as every packet goes through myMeta.update.
     getNext();
     while (thisPacket){
       myMeta.update(thisPacket);
@@ -51,6 +51,10 @@ namespace Mist {
     curPageNum.clear();
     curPage.clear();
     negTimer = 0;
+    for (std::map<unsigned long, uint32_t>::iterator it = negRecords.begin(); it != negRecords.end(); ++it){
+      trackNeg.release(it->second);
+    }
+    negRecords.clear();
     userClient.finish();
   }
 
@@ -443,6 +447,19 @@ namespace Mist {
     }
   }
 
+  ///Returns the size to allocate for a new live data page of the given track.
+  ///
+  ///Pages flip after FLIP_TARGET_DURATION, so a page needs room for about that much data.
+  ///Twice the peak rate leaves headroom for bitrate swings; the result is rounded up to whole huge pages.
+  ///Tracks with an unknown rate get the default size.
+  static uint64_t liveDataPageSize(const DTSC::Track & trk){
+    uint64_t rate = std::max(trk.bps, trk.max_bps);
+    if (!rate){return DEFAULT_DATA_PAGE_SIZE;}
+    uint64_t size = rate * (FLIP_TARGET_DURATION / 1000) * 2;
+    size = ((size + SHM_HUGEPAGE_SIZE - 1) / SHM_HUGEPAGE_SIZE) * SHM_HUGEPAGE_SIZE;
+    return std::max((uint64_t)MIN_DATA_PAGE_SIZE, std::min(size, (uint64_t)DEFAULT_DATA_PAGE_SIZE));
+  }
+
   void negotiationProxy::bufferSinglePacket(const DTSC::Packet & packet, DTSC::Meta & myMeta){
     //Store the trackid for easier access
     unsigned long tid = packet.getTrackId();
@@ -480,18 +497,18 @@ namespace Mist {
       //If there is no page, create it
       if (!pagesByTrack.count(tid) || pagesByTrack[tid].size() == 0) {
         nextPageNum = 1;
-        pagesByTrack[tid][1].dataSize = DEFAULT_DATA_PAGE_SIZE;//Initialize op 25mb
+        pagesByTrack[tid][1].dataSize = liveDataPageSize(myMeta.tracks[tid]);
         pagesByTrack[tid][1].pageNum = 1;
         pagesByTrack[tid][1].firstTime = packet.getTime();
       }
       //Take the last allocated page
       std::map<unsigned long, DTSCPageData>::reverse_iterator tmpIt = pagesByTrack[tid].rbegin();
-      //Compare on 8 mb boundary
-      if (tmpIt->second.curOffset > FLIP_DATA_PAGE_SIZE || packet.getTime() - tmpIt->second.firstTime > FLIP_TARGET_DURATION) { 
+      //Compare on 8 mb boundary, or flip early when a smaller page is three quarters full
+      if (tmpIt->second.curOffset > FLIP_DATA_PAGE_SIZE || tmpIt->second.curOffset > tmpIt->second.dataSize / 4 * 3 || packet.getTime() - tmpIt->second.firstTime > FLIP_TARGET_DURATION) { 
         //Create the book keeping data for the new page
         nextPageNum = tmpIt->second.pageNum + tmpIt->second.keyNum;
         HIGH_MSG("We should go to next page now, transition from %lu to %d", tmpIt->second.pageNum, nextPageNum);
-        pagesByTrack[tid][nextPageNum].dataSize = DEFAULT_DATA_PAGE_SIZE;
+        pagesByTrack[tid][nextPageNum].dataSize = liveDataPageSize(myMeta.tracks[tid]);
         pagesByTrack[tid][nextPageNum].pageNum = nextPageNum;
         pagesByTrack[tid][nextPageNum].firstTime = packet.getTime();
       }
@@ -549,6 +566,90 @@ namespace Mist {
     }
   }
 
+  #if defined(__CYGWIN__) || defined(_WIN32)
+  static std::map<unsigned long, std::string> preservedTempMetas;
+  #endif
+
+  /// Negotiates a track through the negotiation channel of the buffer.
+  /// Posts the request if the track has no record yet, otherwise checks for the answer.
+  /// Returns false if the channel cannot be used, in which case the user page is used instead.
+  bool negotiationProxy::negotiateOverChannel(unsigned long tid, DTSC::Meta & myMeta) {
+    if (!negRecords.count(tid)) {
+      if (!trackNeg) {
+        return false;
+      }
+      if (!myMeta.tracks[tid].type.size() || !myMeta.tracks[tid].codec.size()){
+        FAIL_MSG("Negotiating a track without metadata. This is a serious issue, please report this to the developers.");
+        BACKTRACE;
+      }
+      int32_t record = trackNeg.claim();
+      if (record < 0) {
+        return false;
+      }
+      unsigned long tempTid = IPC::trackNegotiation::tempTrack(record);
+      char pageName[NAME_BUFFER_SIZE];
+      snprintf(pageName, NAME_BUFFER_SIZE, SHM_TRACK_META, streamName.c_str(), tempTid);
+      IPC::sharedPage tmpPage(pageName, 8 * 1024 * 1024, true);
+      //Not removing the page when we're done with it, the buffer cleans it up
+      tmpPage.master = false;
+      DTSC::Meta tmpMeta;
+      tmpMeta.tracks[tempTid] = myMeta.tracks[tid];
+      tmpMeta.tracks[tempTid].trackID = tempTid;
+      if (!tmpPage.mapped || tmpMeta.getSendLen() > (uint64_t)tmpPage.len) {
+        FAIL_MSG("Could not write temporary metadata for incoming track %lu", tid);
+        tmpPage.master = true;
+        trackNeg.release(record);
+        return false;
+      }
+      tmpMeta.writeTo(tmpPage.mapped);
+      #if defined(__CYGWIN__) || defined(_WIN32)
+      IPC::preservePage(pageName);
+      preservedTempMetas[tid] = pageName;
+      #endif
+      INFO_MSG("Starting negotiation for incoming track %lu, as temporary track %lu", tid, tempTid);
+      negRecords[tid] = record;
+      trackState[tid] = FILL_NEG;
+      trackMap[tid] = tempTid;
+      trackNeg.request(record, getpid(), tid);
+      //The buffer is woken up by the request, so the answer is usually there right away
+      trackNeg.waitAnswer(record, 100);
+    }
+    uint32_t record = negRecords[tid];
+    uint32_t finalTid = 0;
+    uint32_t firstKey = 0;
+    int result = trackNeg.answer(record, finalTid, firstKey);
+    if (!result) {
+      negTimer++;
+      return true;
+    }
+    trackNeg.release(record);
+    negRecords.erase(tid);
+    #if defined(__CYGWIN__) || defined(_WIN32)
+    IPC::releasePage(preservedTempMetas[tid]);
+    preservedTempMetas.erase(tid);
+    #endif
+    if (result < 0) {
+      WARN_MSG("Buffer has declined incoming track %lu", tid);
+      trackState[tid] = FILL_DEC;
+      trackMap.erase(tid);
+      return true;
+    }
+    negTimer = 0;
+    MEDIUM_MSG("Buffer says %s:%lu should start writing on track %" PRIu32 ", key %" PRIu32, streamName.c_str(), tid, finalTid, firstKey);
+    trackMap[tid] = finalTid;
+    if (myMeta.tracks.count(finalTid) && myMeta.tracks[finalTid].lastms){
+      myMeta.tracks[finalTid].lastms = 0;
+    }
+    trackState[tid] = FILL_ACC;
+    char pageName[NAME_BUFFER_SIZE];
+    snprintf(pageName, NAME_BUFFER_SIZE, SHM_TRACK_INDEX, streamName.c_str(), (unsigned long)finalTid);
+    metaPages[tid].init(pageName, SHM_TRACK_INDEX_SIZE, true);
+    metaPages[tid].master = false;
+    //Have the buffer look at its users right away, so it picks up the new track index
+    trackNeg.notify();
+    return true;
+  }
+
   void negotiationProxy::continueNegotiate(unsigned long tid, DTSC::Meta & myMeta, bool quickNegotiate) {
     if (!tid) {
       return;
@@ -570,6 +671,23 @@ namespace Mist {
     if (trackState.count(tid) && (trackState[tid] == FILL_DEC || trackState[tid] == FILL_ACC)) {
       return;
     }
+    //Get the data from the userPage
+    if (!userClient.getData()){
+      char userPageName[100];
+      sprintf(userPageName, SHM_USERS, streamName.c_str());
+      userClient = IPC::sharedClient(userPageName, PLAY_EX_SIZE, true);
+    }
+    char * tmp = userClient.getData();
+    if (!tmp) {
+      DEBUG_MSG(DLVL_FAIL, "Failed to negotiate for incoming track %lu, there does not seem to be a connection with the buffer", tid);
+      return;
+    }
+    //Negotiate through the negotiation channel of the buffer if it offers one, so we are neither
+    //limited to the slots on the user page nor have to wait for the buffer to poll them
+    if (!quickNegotiate && (!trackState.count(tid) || negRecords.count(tid))){
+      if (!trackNeg){trackNeg.init(streamName, false);}
+      if (negotiateOverChannel(tid, myMeta)){return;}
+    }
     if (!trackOffset.count(tid)) {
       if (trackOffset.size() > SIMUL_TRACKS) {
         WARN_MSG("Trackoffset too high");
@@ -591,20 +709,6 @@ namespace Mist {
       }
     }
     //Now we either returned or the track has an offset for the user page.
-    //Get the data from the userPage
-    if (!userClient.getData()){
-      char userPageName[100];
-      sprintf(userPageName, SHM_USERS, streamName.c_str());
-      userClient = IPC::sharedClient(userPageName, PLAY_EX_SIZE, true);
-    }
-    char * tmp = userClient.getData();
-    if (!tmp) {
-      DEBUG_MSG(DLVL_FAIL, "Failed to negotiate for incoming track %lu, there does not seem to be a connection with the buffer", tid);
-      return;
-    }
-    #if defined(__CYGWIN__) || defined(_WIN32)
-    static std::map<unsigned long, std::string> preservedTempMetas;
-    #endif
     unsigned long offset = 6 * trackOffset[tid];
     //If we have a new track to negotiate
     if (!trackState.count(tid)) {
@@ -628,9 +732,11 @@ namespace Mist {
         DTSC::Meta tmpMeta;
         tmpMeta.tracks[finalTid] = myMeta.tracks[tid];
         tmpMeta.tracks[finalTid].trackID = finalTid;
-        JSON::Value tmpVal = tmpMeta.toJSON();
-        std::string tmpStr = tmpVal.toNetPacked();
-        memcpy(metaPages[tid].mapped, tmpStr.data(), tmpStr.size());
+        if (tmpMeta.getSendLen() > (uint64_t)metaPages[tid].len){
+          FAIL_MSG("Metadata for incoming track %lu does not fit its negotiation page", tid);
+        }else{
+          tmpMeta.writeTo(metaPages[tid].mapped);
+        }
 
         #if defined(__CYGWIN__) || defined(_WIN32)
         IPC::preservePage(pageName);
@@ -671,13 +777,15 @@ namespace Mist {
           DTSC::Meta tmpMeta;
           tmpMeta.tracks[newTid] = myMeta.tracks[tid];
           tmpMeta.tracks[newTid].trackID = newTid;
-          JSON::Value tmpVal = tmpMeta.toJSON();
           if (!myMeta.tracks[tid].type.size() || !myMeta.tracks[tid].codec.size()){
             FAIL_MSG("Negotiating a track without metadata. This is a serious issue, please report this to the developers.");
             BACKTRACE;
           }
-          std::string tmpStr = tmpVal.toNetPacked();
-          memcpy(metaPages[tid].mapped, tmpStr.data(), tmpStr.size());
+          if (tmpMeta.getSendLen() > (uint64_t)metaPages[tid].len){
+            FAIL_MSG("Metadata for incoming track %lu does not fit its negotiation page", tid);
+          }else{
+            tmpMeta.writeTo(metaPages[tid].mapped);
+          }
           HIGH_MSG("Temporary metadata written for incoming track %lu, handling as track %lu", tid, newTid);
           //Not actually removing the page, because we set master to false
           #if defined(__CYGWIN__) || defined(_WIN32)
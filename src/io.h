@@ -52,11 +52,14 @@ namespace Mist {
       std::map<unsigned long, std::deque<DTSC::Packet> > preBuffer;///< For each track, holds to-be-buffered packets.
 
       IPC::sharedClient userClient;///< Shared memory used for connection to Mixer process.
+      IPC::trackNegotiation trackNeg;///< Channel for negotiating tracks with the buffer, if it offers one.
+      std::map<unsigned long, uint32_t> negRecords;///< Negotiation channel record held per track that is being negotiated through it.
 
       std::string streamName;///< Name of the stream to connect to
 
       void continueNegotiate(unsigned long tid, DTSC::Meta & myMeta, bool quickNegotiate = false);
       void continueNegotiate(DTSC::Meta & myMeta);
+      bool negotiateOverChannel(unsigned long tid, DTSC::Meta & myMeta);
 
       uint32_t negTimer; ///< How long we've been negotiating, in packets.
   };
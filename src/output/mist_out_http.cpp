@@ -0,0 +1,133 @@
+/// \file mist_out_http.cpp
+/// Main for the combined HTTP output.
+///
+/// All HTTP-based outputs are linked into this binary. When a request on a connection is meant
+/// for another output, that output takes over the connection in-process instead of through
+/// execv, so keep-alive connections that switch between protocols never pay for an exec.
+/// Outputs that are not linked in are still started as separate processes.
+
+// Every output header ends in a "mistOut" typedef; rename it per header so they can coexist.
+#define mistOut mistOutOGG
+#include "output_progressive_ogg.h"
+#undef mistOut
+#define mistOut mistOutFLV
+#include "output_progressive_flv.h"
+#undef mistOut
+#define mistOut mistOutMP4
+#include "output_progressive_mp4.h"
+#undef mistOut
+#define mistOut mistOutMP3
+#include "output_progressive_mp3.h"
+#undef mistOut
+#define mistOut mistOutHSS
+#include "output_hss.h"
+#undef mistOut
+#define mistOut mistOutHDS
+#include "output_hds.h"
+#undef mistOut
+#define mistOut mistOutSRT
+#include "output_srt.h"
+#undef mistOut
+#define mistOut mistOutJSON
+#include "output_json.h"
+#undef mistOut
+#define mistOut mistOutHTTPTS
+#include "output_httpts.h"
+#undef mistOut
+#define mistOut mistOutHLS
+#include "output_hls.h"
+#undef mistOut
+#define mistOut mistOutEBML
+#include "output_ebml.h"
+#undef mistOut
+#define mistOut mistOutCMAF
+#include "output_cmaf.h"
+#undef mistOut
+#include "output_http_internal.h"
+#include <mist/config.h>
+#include <mist/socket.h>
+#include <mist/defines.h>
+#include <mist/util.h>
+
+template <class T> Mist::HTTPOutput * createOutput(Socket::Connection & S){
+  return new T(S);
+}
+
+/// Initializes an output class on the given config and registers it as linked in.
+template <class T> void linkOutput(Util::Config & conf){
+  Mist::Output::capa.null();
+  T::init(&conf);
+  Mist::HTTPOutput::linkHandler(Mist::Output::capa["name"].asStringRef(), createOutput<T>);
+}
+
+/// Runs outputs on the connection until one of them finishes without handing it off.
+int spawnForked(Socket::Connection & S){
+  std::string handler = "HTTP";
+  int ret = 0;
+  while (handler.size() && S){
+    Mist::HTTPOutput * tmp = Mist::HTTPOutput::createHandler(handler, S);
+    if (!tmp){
+      FAIL_MSG("Handler %s is not linked in", handler.c_str());
+      S.close();
+      return 1;
+    }
+    ret = tmp->run();
+    handler = tmp->handOffTarget();
+    delete tmp;
+  }
+  return ret;
+}
+
+void handleUSR1(int signum, siginfo_t *sigInfo, void *ignore){
+  HIGH_MSG("USR1 received - triggering rolling restart");
+  Util::Config::is_restarting = true;
+  Util::Config::is_active = false;
+}
+
+int main(int argc, char * argv[]) {
+  Util::redirectLogsIfNeeded();
+  Util::Config conf(argv[0]);
+  linkOutput<Mist::OutProgressiveOGG>(conf);
+  linkOutput<Mist::OutProgressiveFLV>(conf);
+  linkOutput<Mist::OutProgressiveMP4>(conf);
+  linkOutput<Mist::OutProgressiveMP3>(conf);
+  linkOutput<Mist::OutHSS>(conf);
+  linkOutput<Mist::OutHDS>(conf);
+  linkOutput<Mist::OutProgressiveSRT>(conf);
+  linkOutput<Mist::OutJSON>(conf);
+  linkOutput<Mist::OutHTTPTS>(conf);
+  linkOutput<Mist::OutHLS>(conf);
+  linkOutput<Mist::OutEBML>(conf);
+  linkOutput<Mist::OutCMAF>(conf);
+  //the HTTP handler goes last, so its options and capabilities are the ones this binary reports
+  linkOutput<Mist::OutHTTP>(conf);
+  if (conf.parseArgs(argc, argv)) {
+    if (conf.getBool("json")) {
+      mistOut::capa["version"] = PACKAGE_VERSION;
+      std::cout << mistOut::capa.toString() << std::endl;
+      return -1;
+    }
+    conf.activate();
+    if (mistOut::listenMode()){
+      {
+        struct sigaction new_action;
+        new_action.sa_sigaction = handleUSR1;
+        sigemptyset(&new_action.sa_mask);
+        new_action.sa_flags = 0;
+        sigaction(SIGUSR1, &new_action, NULL);
+      }
+      //compile the url table once, so forked connections inherit it
+      Mist::HTTPOutput::loadUrlRules();
+      mistOut::listener(conf, spawnForked);
+      if (conf.is_restarting && Socket::checkTrueSocket(0)){
+        INFO_MSG("Reloading input while re-using server socket");
+        execvp(argv[0], argv);
+        FAIL_MSG("Error reloading: %s", strerror(errno));
+      }
+    }else{
+      Socket::Connection S(fileno(stdout),fileno(stdin) );
+      return spawnForked(S);
+    }
+  }
+  return 0;
+}
@@ -19,6 +19,9 @@ namespace Mist{
   JSON::Value Output::capa = JSON::Value();
   Util::Config * Output::config = NULL;
 
+  /// Value of an unsigned long page number when pageNumForKey found no page (returned -1).
+  static const unsigned long NO_PAGE = (unsigned long)-1;
+
   int getDTSCLen(char * mapped, long long int offset){
     return Bit::btohl(mapped + offset + 4);
   }
@@ -76,6 +79,7 @@ namespace Mist{
       DEBUG_MSG(DLVL_WARN, "Warning: MistOut created with closed socket!");
     }
     sentHeader = false;
+    handedOff = false;
     
     //If we have a streamname option, set internal streamname to that option
     if (!streamName.size() && config->hasOption("streamname")){
@@ -611,19 +615,33 @@ namespace Mist{
       return;
     }
     VERYHIGH_MSG("Loading track %lu, containing key %lld", trackId, keyNum);
-    unsigned int timeout = 0;
     unsigned long pageNum = pageNumForKey(trackId, keyNum);
-    while (keepGoing() && pageNum == -1){
-      if (!timeout){
-        HIGH_MSG("Requesting page with key %lu:%lld", trackId, keyNum);
-      }
-      ++timeout;
+    uint32_t reqDone = 0;
+    if (pageNum == NO_PAGE){
+      HIGH_MSG("Requesting page with key %lu:%lld", trackId, keyNum);
+    }
+    if (pageNum == NO_PAGE && myMeta.vod){
+      //Post the request straight to the input, which wakes up for it immediately
+      if (!pageReqs){pageReqs.init(streamName, false);}
+      reqDone = pageReqs.completed();
+      pageReqs.post(trackId, keyNum);
+    }
+    uint64_t waitStart = Util::bootMS();
+    bool reconnected = false;
+    while (keepGoing() && pageNum == NO_PAGE){
+      uint64_t waited = Util::bootMS() - waitStart;
       //if we've been waiting for this page for 3 seconds, reconnect to the stream - something might be going wrong...
-      if (timeout == 30){
+      if (waited >= 3000 && !reconnected){
+        reconnected = true;
         DEVEL_MSG("Loading is taking longer than usual, reconnecting to stream %s...", streamName.c_str());
         reconnect();
+        if (myMeta.vod){
+          pageReqs.init(streamName, false);
+          reqDone = pageReqs.completed();
+          pageReqs.post(trackId, keyNum);
+        }
       }
-      if (timeout > 100){
+      if (waited > 10000){
         FAIL_MSG("Timeout while waiting for requested page %lld for track %lu. Aborting.", keyNum, trackId);
         nProxy.curPage.erase(trackId);
         currKeyOpen.erase(trackId);
@@ -635,7 +653,12 @@ namespace Mist{
         nxtKeyNum[trackId] = 0;
       }
       stats(true);
-      playbackSleep(100);
+      if (pageReqs){
+        //wakes up as soon as the input handled a request, or after 100ms if it did not
+        if (pageReqs.waitCompleted(reqDone, 100)){reqDone = pageReqs.completed();}
+      }else{
+        playbackSleep(100);
+      }
       pageNum = pageNumForKey(trackId, keyNum);
     }
     
@@ -985,6 +1008,10 @@ namespace Mist{
       stats();
     }
     MEDIUM_MSG("MistOut client handler shutting down: %s, %s, %s", myConn.connected() ? "conn_active" : "conn_closed", wantRequest ? "want_request" : "no_want_request", parseData ? "parsing_data" : "not_parsing_data");
+    if (handedOff){
+      //another output in this process takes over the connection from here
+      return 0;
+    }
     onFinish();
     
     stats(true);
@@ -101,6 +101,7 @@ namespace Mist {
       virtual bool hasSessionIDs(){return false;}
 
       IPC::sharedClient statsPage;///< Shared memory used for statistics reporting.
+      IPC::pageRequests pageReqs;///< Queue for posting page requests directly to a VoD input.
       bool isBlocking;///< If true, indicates that myConn is blocking.
       uint32_t crc;///< Checksum, if any, for usage in the stats.
       unsigned int getKeyForTime(long unsigned int trackId, long long timeStamp);
@@ -117,6 +118,7 @@ namespace Mist {
       bool parseData;///< If true, triggers initalization if not already done, sending of header, sending of packets.
       bool isInitialized;///< If false, triggers initialization if parseData is true.
       bool sentHeader;///< If false, triggers sendHeader if parseData is true.
+      bool handedOff;///< If true, myConn was passed on to another output in this process and must be left open.
 
       std::map<int,DTSCPageData> bookKeeping;
       virtual bool isPushing(){return pushing;};
@@ -0,0 +1,421 @@
+#include "output_cmaf.h"
+#include <mist/defines.h>
+#include <mist/stream.h>
+#include <mist/timing.h>
+#include <iomanip>
+
+namespace Mist{
+  OutCMAF::OutCMAF(Socket::Connection &conn) : HTTPOutput(conn){
+    realTime = 0;
+    storing = false;
+    segTrack = 0;
+    segKey = 0;
+    segStart = 0;
+    segEnd = 0;
+    segWritten = 0;
+    segSent = 0;
+    chunkNum = 0;
+    chunkStart = 0;
+    lastTime = 0;
+  }
+
+  OutCMAF::~OutCMAF(){
+    //let another process finish the segment we were writing, if any
+    segment.drop();
+  }
+
+  void OutCMAF::init(Util::Config *cfg){
+    HTTPOutput::init(cfg);
+    capa["name"] = "CMAF";
+    capa["friendly"] = "CMAF over HTTP (fMP4 HLS and DASH)";
+    capa["desc"] = "Low-latency segmented streaming in CMAF (fMP4-based) format over HTTP, with both HLS and DASH manifests";
+    capa["url_rel"] = "/cmaf/$/index.m3u8";
+    capa["url_prefix"] = "/cmaf/$/";
+    capa["codecs"][0u][0u].append("+H264");
+    capa["codecs"][0u][1u].append("+AAC");
+    capa["methods"][0u]["handler"] = "http";
+    capa["methods"][0u]["type"] = "html5/application/vnd.apple.mpegurl;version=7";
+    capa["methods"][0u]["url_rel"] = "/cmaf/$/index.m3u8";
+    capa["methods"][0u]["priority"] = 8;
+    capa["methods"][1u]["handler"] = "http";
+    capa["methods"][1u]["type"] = "dash/video/mp4";
+    capa["methods"][1u]["url_rel"] = "/cmaf/$/index.mpd";
+    capa["methods"][1u]["priority"] = 8;
+  }
+
+  /// Returns true if the track exists and can be sent as CMAF.
+  bool OutCMAF::isCMAFTrack(unsigned long tid){
+    if (!myMeta.tracks.count(tid)){return false;}
+    const std::string & codec = myMeta.tracks[tid].codec;
+    return (codec == "H264" || codec == "AAC");
+  }
+
+  ///\brief Builds the HLS master playlist: one variant per video track, audio tracks as renditions.
+  std::string OutCMAF::hlsIndex(){
+    std::stringstream result;
+    result << "#EXTM3U\r\n#EXT-X-VERSION:7\r\n#EXT-X-INDEPENDENT-SEGMENTS\r\n";
+    unsigned long audioId = 0;
+    bool hasVideo = false;
+    for (std::map<unsigned int, DTSC::Track>::iterator it = myMeta.tracks.begin(); it != myMeta.tracks.end(); ++it){
+      if (!isCMAFTrack(it->first)){continue;}
+      if (it->second.type == "video"){hasVideo = true;}
+      if (it->second.type != "audio"){continue;}
+      std::string lang = (it->second.lang.size() && it->second.lang != "und") ? it->second.lang : "";
+      result << "#EXT-X-MEDIA:TYPE=AUDIO,GROUP-ID=\"audio\",NAME=\"" << (lang.size() ? lang : it->second.getIdentifier()) << "\"";
+      if (lang.size()){result << ",LANGUAGE=\"" << lang << "\"";}
+      result << ",AUTOSELECT=YES,DEFAULT=" << (audioId ? "NO" : "YES") << ",URI=\"" << it->first << "/index.m3u8\"\r\n";
+      if (!audioId){audioId = it->first;}
+    }
+    for (std::map<unsigned int, DTSC::Track>::iterator it = myMeta.tracks.begin(); it != myMeta.tracks.end(); ++it){
+      if (!isCMAFTrack(it->first)){continue;}
+      //without video, the first audio track is the only variant
+      if (hasVideo ? (it->second.type != "video") : (it->first != audioId)){continue;}
+      unsigned int bWidth = it->second.bps;
+      if (audioId && it->first != audioId){bWidth += myMeta.tracks[audioId].bps;}
+      result << "#EXT-X-STREAM-INF:BANDWIDTH=" << (bWidth < 5 ? 5 : bWidth) * 8;
+      if (it->second.type == "video"){
+        result << ",RESOLUTION=" << it->second.width << "x" << it->second.height;
+        if (it->second.fpks){result << ",FRAME-RATE=" << (float)it->second.fpks / 1000;}
+      }
+      result << ",CODECS=\"" << Util::codecString(it->second.codec, it->second.init);
+      if (audioId && it->first != audioId){
+        result << "," << Util::codecString(myMeta.tracks[audioId].codec, myMeta.tracks[audioId].init) << "\",AUDIO=\"audio";
+      }
+      result << "\"\r\n" << it->first << "/index.m3u8\r\n";
+    }
+    HIGH_MSG("Sending this index: %s", result.str().c_str());
+    return result.str();
+  }
+
+  ///\brief Builds the HLS media playlist of a single track, with one segment per key.
+  ///The segment that is still being written is announced as prefetch segment, so players can
+  ///start receiving its chunks right away.
+  std::string OutCMAF::hlsIndex(unsigned long tid){
+    DTSC::Track & Trk = myMeta.tracks[tid];
+    std::stringstream lines;
+    uint64_t targetDur = 0;
+    for (std::deque<DTSC::Key>::iterator it = Trk.keys.begin(); it != Trk.keys.end(); ++it){
+      uint64_t len = it->getLength();
+      if (!len && !myMeta.live){len = Trk.lastms - it->getTime();}
+      if (!len){
+        lines << "#EXT-X-PREFETCH:" << it->getNumber() << ".m4s\r\n";
+        continue;
+      }
+      if (len > targetDur){targetDur = len;}
+      lines << "#EXTINF:" << std::fixed << std::setprecision(3) << (double)len / 1000 << ",\r\n" << it->getNumber() << ".m4s\r\n";
+    }
+    std::stringstream result;
+    result << "#EXTM3U\r\n#EXT-X-VERSION:7\r\n#EXT-X-TARGETDURATION:" << (targetDur / 1000) + 1 << "\r\n";
+    result << "#EXT-X-MEDIA-SEQUENCE:" << (Trk.keys.size() ? Trk.keys.front().getNumber() : 0) << "\r\n";
+    result << "#EXT-X-MAP:URI=\"init.mp4\"\r\n";
+    result << lines.str();
+    if (!myMeta.live){result << "#EXT-X-ENDLIST\r\n";}
+    HIGH_MSG("Sending this index: %s", result.str().c_str());
+    return result.str();
+  }
+
+  ///\brief Builds the DASH manifest, with one adaptation set per track.
+  ///Live segments are announced as available as soon as they start, since they are sent in chunks.
+  std::string OutCMAF::dashIndex(){
+    uint64_t firstms = 0xFFFFFFFFFFFFFFFFull;
+    uint64_t lastms = 0;
+    uint64_t maxKey = 0;
+    for (std::map<unsigned int, DTSC::Track>::iterator it = myMeta.tracks.begin(); it != myMeta.tracks.end(); ++it){
+      if (!isCMAFTrack(it->first)){continue;}
+      if (it->second.firstms < firstms){firstms = it->second.firstms;}
+      if (it->second.lastms > lastms){lastms = it->second.lastms;}
+      for (std::deque<DTSC::Key>::iterator k = it->second.keys.begin(); k != it->second.keys.end(); ++k){
+        if (k->getLength() > maxKey){maxKey = k->getLength();}
+      }
+    }
+    if (firstms > lastms){firstms = lastms;}
+    std::stringstream r;
+    r << std::fixed << std::setprecision(3);
+    r << "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n";
+    r << "<MPD xmlns=\"urn:mpeg:dash:schema:mpd:2011\" profiles=\"urn:mpeg:dash:profile:isoff-live:2011,urn:mpeg:dash:profile:cmaf:2019\" ";
+    r << "minBufferTime=\"PT" << (double)(maxKey ? maxKey : 2000) / 1000 << "S\" maxSegmentDuration=\"PT" << (double)maxKey / 1000 << "S\" ";
+    if (myMeta.live){
+      uint64_t now = Util::epoch();
+      r << "type=\"dynamic\" availabilityStartTime=\"" << Util::getUTCString(now - lastms / 1000) << "Z\" publishTime=\"" << Util::getUTCString(now) << "Z\" ";
+      r << "minimumUpdatePeriod=\"PT2S\" timeShiftBufferDepth=\"PT" << (double)(lastms - firstms) / 1000 << "S\">\n";
+    }else{
+      r << "type=\"static\" mediaPresentationDuration=\"PT" << (double)(lastms - firstms) / 1000 << "S\">\n";
+    }
+    r << "<Period id=\"0\" start=\"PT0S\">\n";
+    for (std::map<unsigned int, DTSC::Track>::iterator it = myMeta.tracks.begin(); it != myMeta.tracks.end(); ++it){
+      if (!isCMAFTrack(it->first) || !it->second.keys.size()){continue;}
+      DTSC::Track & Trk = it->second;
+      bool isVideo = (Trk.type == "video");
+      r << "<AdaptationSet id=\"" << it->first << "\" contentType=\"" << Trk.type << "\" mimeType=\"" << Trk.type << "/mp4\" segmentAlignment=\"true\" startWithSAP=\"1\"";
+      if (Trk.lang.size() && Trk.lang != "und"){r << " lang=\"" << Trk.lang << "\"";}
+      r << ">\n<Representation id=\"" << it->first << "\" bandwidth=\"" << Trk.bps * 8 << "\" codecs=\"" << Util::codecString(Trk.codec, Trk.init) << "\"";
+      if (isVideo){
+        r << " width=\"" << Trk.width << "\" height=\"" << Trk.height << "\"";
+        if (Trk.fpks){r << " frameRate=\"" << Trk.fpks << "/1000\"";}
+        r << ">\n";
+      }else{
+        r << " audioSamplingRate=\"" << Trk.rate << "\">\n";
+        r << "<AudioChannelConfiguration schemeIdUri=\"urn:mpeg:dash:23003:3:audio_channel_configuration:2011\" value=\"" << Trk.channels << "\"/>\n";
+      }
+      r << "<SegmentTemplate timescale=\"1000\" initialization=\"$RepresentationID$/init.mp4\" media=\"$RepresentationID$/$Number$.m4s\" startNumber=\"" << Trk.keys.front().getNumber() << "\"";
+      if (myMeta.live && maxKey > CMAF_CHUNK_DURATION){
+        r << " availabilityTimeOffset=\"" << (double)(maxKey - CMAF_CHUNK_DURATION) / 1000 << "\" availabilityTimeComplete=\"false\"";
+      }
+      r << ">\n<SegmentTimeline>\n";
+      //consecutive keys of equal length are written as a single repeated entry
+      uint64_t runLen = 0;
+      unsigned int repeats = 0;
+      for (std::deque<DTSC::Key>::iterator k = Trk.keys.begin(); k != Trk.keys.end(); ++k){
+        uint64_t len = k->getLength();
+        if (!len && !myMeta.live){len = Trk.lastms - k->getTime();}
+        if (!len){break;}
+        if (runLen && len == runLen){
+          ++repeats;
+          continue;
+        }
+        if (runLen){
+          if (repeats){r << " r=\"" << repeats << "\"";}
+          r << "/>\n";
+        }
+        r << "<S";
+        if (k == Trk.keys.begin()){r << " t=\"" << k->getTime() << "\"";}
+        r << " d=\"" << len << "\"";
+        runLen = len;
+        repeats = 0;
+      }
+      if (runLen){
+        if (repeats){r << " r=\"" << repeats << "\"";}
+        r << "/>\n";
+      }
+      r << "</SegmentTimeline>\n</SegmentTemplate>\n</Representation>\n</AdaptationSet>\n";
+    }
+    r << "</Period>\n";
+    if (myMeta.live){
+      r << "<UTCTiming schemeIdUri=\"urn:mpeg:dash:utc:direct:2014\" value=\"" << Util::getUTCString() << "Z\"/>\n";
+    }
+    r << "</MPD>\n";
+    HIGH_MSG("Sending this manifest: %s", r.str().c_str());
+    return r.str();
+  }
+
+  void OutCMAF::onHTTP(){
+    std::string method = H.method;
+    initialize();
+    //the part of the url after the stream name
+    std::string request = H.url.substr(std::min(H.url.size(), H.url.find("/", 6) + 1));
+    if (request.find('?') != std::string::npos){request.erase(request.find('?'));}
+
+    if (request == "index.m3u8" || request == "index.mpd" || request.find("/index.m3u8") != std::string::npos){
+      bool isDash = (request == "index.mpd");
+      unsigned long tid = (request == "index.m3u8" || isDash) ? 0 : atol(request.c_str());
+      H.Clean();
+      H.SetHeader("Content-Type", isDash ? "application/dash+xml" : "application/vnd.apple.mpegurl");
+      H.SetHeader("Cache-Control", "no-cache");
+      H.setCORSHeaders();
+      if (!myMeta.tracks.size() || (tid && !isCMAFTrack(tid))){
+        H.SendResponse("404", "Not online or found", myConn);
+        H.Clean();
+        return;
+      }
+      if (method == "OPTIONS" || method == "HEAD"){
+        H.SendResponse("200", "OK", myConn);
+        H.Clean();
+        return;
+      }
+      H.SetBody(isDash ? dashIndex() : (tid ? hlsIndex(tid) : hlsIndex()));
+      H.SendResponse("200", "OK", myConn);
+      H.Clean();
+      return;
+    }
+
+    unsigned long tid = 0;
+    unsigned long keyNum = 0;
+    bool isInit = (sscanf(request.c_str(), "%lu/init.mp4", &tid) == 1 && request.find("/init.mp4") != std::string::npos);
+    if (!isInit && sscanf(request.c_str(), "%lu/%lu.m4s", &tid, &keyNum) != 2){
+      H.Clean();
+      H.setCORSHeaders();
+      H.SetBody("The CMAF URL wasn't understood - what did you want, exactly?\n");
+      H.SendResponse("404", "URL mismatch", myConn);
+      H.Clean();
+      return;
+    }
+    H.Clean();
+    H.SetHeader("Content-Type", "video/mp4");
+    H.setCORSHeaders();
+    if (!isCMAFTrack(tid)){
+      H.SendResponse("404", "Track not found", myConn);
+      H.Clean();
+      return;
+    }
+    if (method == "OPTIONS" || method == "HEAD"){
+      H.SendResponse("200", "OK", myConn);
+      H.Clean();
+      return;
+    }
+    if (isInit){
+      H.SetBody(CMAF::trackHeader(myMeta.tracks[tid]));
+      H.SendResponse("200", "OK", myConn);
+      H.Clean();
+      return;
+    }
+    sendSegment(tid, keyNum);
+  }
+
+  /// Starts sending a segment: from the shared store if another process is writing it, otherwise
+  /// by generating it from the packets of the key.
+  void OutCMAF::sendSegment(unsigned long tid, unsigned long keyNum){
+    //DASH clients may ask for the next segment right before it starts, give it a moment to appear
+    unsigned int timeout = 0;
+    while (myMeta.live && myMeta.tracks[tid].keys.size() && keyNum == myMeta.tracks[tid].keys.back().getNumber() + 1 && ++timeout < 50 && keepGoing()){
+      Util::sleep(100);
+      stats();
+      updateMeta();
+    }
+    DTSC::Track & Trk = myMeta.tracks[tid];
+    if (!Trk.keys.size() || keyNum < Trk.keys.front().getNumber() || keyNum > Trk.keys.back().getNumber()){
+      H.SetBody("The requested segment is not available.\n");
+      H.SendResponse("404", "Segment out of range", myConn);
+      H.Clean();
+      return;
+    }
+    DTSC::Key & key = Trk.keys[keyNum - Trk.keys.front().getNumber()];
+    segTrack = tid;
+    segKey = keyNum;
+    segStart = key.getTime();
+    segEnd = key.getLength() ? segStart + key.getLength() : 0;
+    segWritten = 0;
+    segSent = 0;
+    H.StartResponse(H, myConn);
+    storing = (myMeta.live && segment.open(streamName, tid, keyNum));
+    if (!storing){
+      startWriting();
+      return;
+    }
+    sendStored();
+  }
+
+  /// Sends the current segment from its shared page, until it is complete or we have to take over writing it.
+  void OutCMAF::sendStored(){
+    while (keepGoing()){
+      uint64_t avail = segment.available();
+      if (avail > segSent){
+        H.Chunkify(segment.data() + segSent, avail - segSent, myConn);
+        segSent = avail;
+        continue;
+      }
+      if (segment.isDone()){
+        H.Chunkify("", 0, myConn);
+        H.Clean();
+        return;
+      }
+      if (segment.claim()){
+        if (segSent){INFO_MSG("Taking over writing of segment %lu of track %lu", segKey, segTrack);}
+        startWriting();
+        return;
+      }
+      //Writers wake us up on every write; the timeout notices writers that died without a word
+      segment.wait(segSent, 1000);
+      stats();
+    }
+  }
+
+  /// Starts generating the current segment from the packets of its key.
+  void OutCMAF::startWriting(){
+    selectedTracks.clear();
+    selectedTracks.insert(segTrack);
+    segWritten = 0;
+    chunkNum = 0;
+    samples.clear();
+    chunkData.clear();
+    seek(segStart);
+    parseData = true;
+    wantRequest = false;
+  }
+
+  /// Appends data to the current segment: into the shared page when storing, and to the client
+  /// for the part it did not receive yet.
+  void OutCMAF::writeSegment(const char * data, size_t len){
+    if (storing && !segment.write(segWritten, data, len)){
+      //the segment does not fit, finish it as far as it got and serve the rest to this client only
+      segment.finish();
+      storing = false;
+    }
+    segWritten += len;
+    if (segWritten > segSent){
+      size_t skip = (segSent > segWritten - len) ? (segSent - (segWritten - len)) : 0;
+      H.Chunkify(data + skip, len - skip, myConn);
+      segSent = segWritten;
+    }
+  }
+
+  /// Writes all samples collected so far as a single chunk.
+  void OutCMAF::flushChunk(){
+    if (!samples.size()){return;}
+    std::string header;
+    //sequence numbers increase over the whole track, assuming less than 1024 chunks per key
+    CMAF::chunkHeader(header, myMeta.tracks[segTrack], segKey * 1024 + chunkNum++, chunkStart, samples, chunkData.size());
+    writeSegment(header.data(), header.size());
+    writeSegment(chunkData.data(), chunkData.size());
+    samples.clear();
+    chunkData.clear();
+  }
+
+  /// Completes the current segment and waits for the next request.
+  void OutCMAF::endSegment(){
+    flushChunk();
+    if (storing){
+      segment.finish();
+      segment.drop();
+      //the key may have been removed from the buffer while we were writing it, along with its page
+      updateMeta();
+      DTSC::Track & Trk = myMeta.tracks[segTrack];
+      if (!Trk.keys.size() || Trk.keys.front().getNumber() > segKey){
+        CMAF::segmentPage::erase(streamName, segTrack, segKey);
+      }
+    }
+    storing = false;
+    stop();
+    wantRequest = true;
+    H.Chunkify("", 0, myConn);
+    H.Clean();
+  }
+
+  void OutCMAF::sendNext(){
+    DTSC::Track & Trk = myMeta.tracks[segTrack];
+    uint64_t time = thisPacket.getTime();
+    if (time < segStart){return;}
+    if (CMAF::endsSegment(Trk, segStart, segEnd, thisPacket)){
+      if (samples.size()){samples.back().duration = time - lastTime;}
+      endSegment();
+      return;
+    }
+    if (samples.size()){
+      samples.back().duration = time - lastTime;
+      if (time - chunkStart >= CMAF_CHUNK_DURATION){flushChunk();}
+    }
+    if (!samples.size()){chunkStart = time;}
+    char * dataPointer = 0;
+    size_t len = 0;
+    thisPacket.getString("data", dataPointer, len);
+    CMAF::sample S;
+    S.duration = 0;
+    S.size = len;
+    S.offset = thisPacket.getInt("offset");
+    S.keyframe = (Trk.type != "video" || thisPacket.getFlag("keyframe"));
+    samples.push_back(S);
+    chunkData.append(dataPointer, len);
+    lastTime = time;
+  }
+
+  /// Ends the segment being written when the stream ends, instead of closing the connection.
+  bool OutCMAF::onFinish(){
+    if (!parseData){return false;}
+    if (samples.size()){
+      DTSC::Track & Trk = myMeta.tracks[segTrack];
+      samples.back().duration = (segEnd > lastTime) ? (segEnd - lastTime) : (Trk.lastms > lastTime ? Trk.lastms - lastTime : 0);
+    }
+    endSegment();
+    return true;
+  }
+}
+
@@ -0,0 +1,48 @@
+#pragma once
+#include "output_http.h"
+#include <mist/cmaf.h>
+
+namespace Mist{
+  ///\brief Low-latency CMAF output, with HLS (fMP4) and DASH manifests.
+  ///
+  ///Every key of a track is a segment, sent as a series of chunks while its packets arrive.
+  ///For live streams each segment is generated once, into a shared page: the first viewer to request
+  ///it writes it while sending, every other viewer sends it straight from that page.
+  class OutCMAF : public HTTPOutput{
+  public:
+    OutCMAF(Socket::Connection &conn);
+    ~OutCMAF();
+    static void init(Util::Config *cfg);
+    void onHTTP();
+    void sendNext();
+    bool onFinish();
+
+  private:
+    bool isCMAFTrack(unsigned long tid);
+    std::string hlsIndex();
+    std::string hlsIndex(unsigned long tid);
+    std::string dashIndex();
+    void sendSegment(unsigned long tid, unsigned long keyNum);
+    void sendStored();
+    void startWriting();
+    void writeSegment(const char * data, size_t len);
+    void flushChunk();
+    void endSegment();
+    CMAF::segmentPage segment;//shared page of the current segment, if stored
+    bool storing;//true if the current segment is written to its shared page
+    unsigned long segTrack;
+    unsigned long segKey;
+    uint64_t segStart;//time of the first packet of the current segment
+    uint64_t segEnd;//time of the first packet of the next segment, or zero if not known yet
+    uint64_t segWritten;//bytes of the current segment generated so far
+    uint64_t segSent;//bytes of the current segment sent to the client so far
+    uint32_t chunkNum;
+    uint64_t chunkStart;
+    uint64_t lastTime;
+    std::deque<CMAF::sample> samples;//samples of the current chunk, the last one without duration yet
+    std::string chunkData;//sample data of the current chunk
+  };
+}
+
+typedef Mist::OutCMAF mistOut;
+
@@ -4,6 +4,20 @@
 #include <mist/opus.h>
 
 namespace Mist{
+  /// The VoD layout this process calculated last, see OutEBML::calcVodSizes.
+  /// Lets connections that switch between outputs, or come back to the same file, reuse it.
+  struct EBMLVodLayout{
+    std::string key;
+    uint64_t segmentSize;
+    uint32_t tracksSize;
+    uint32_t infoSize;
+    uint32_t cuesSize;
+    uint32_t seekheadSize;
+    uint32_t seekSize;
+    std::deque<EBMLCluster> clusters;
+  };
+  static EBMLVodLayout lastLayout;
+
   OutEBML::OutEBML(Socket::Connection &conn) : HTTPOutput(conn){
     currentClusterTime = 0;
     newClusterTime = 0;
@@ -12,6 +26,7 @@ namespace Mist{
     infoSize = 0;
     cuesSize = 0;
     seekheadSize = 0;
+    seekSize = 0;
     doctype = "matroska";
   }
 
@@ -106,12 +121,20 @@ namespace Mist{
         if ((newClusterTime - currentClusterTime > 30000) || (fragIndice == Trk.fragments.size() - 1)){
           newClusterTime = currentClusterTime + 30000;
         }
-        EXTREME_MSG("Cluster: %llu - %llu (%lu/%lu) = %llu", currentClusterTime, newClusterTime, fragIndice, Trk.fragments.size(), clusterSize(currentClusterTime, newClusterTime));
       }else{
         //In live, clusters are aligned with the lookAhead time
         newClusterTime = currentClusterTime+(needsLookAhead?needsLookAhead:1);
       }
-      EBML::sendElemHead(myConn, EBML::EID_CLUSTER, clusterSize(currentClusterTime, newClusterTime));
+      //Use the precalculated size if this is a cluster of the VoD layout, otherwise calculate it now
+      uint32_t cSize = 0;
+      size_t cIndex = myMeta.vod ? findCluster(currentClusterTime) : clusters.size();
+      if (cIndex < clusters.size() && clusters[cIndex].end == newClusterTime){
+        cSize = clusters[cIndex].size;
+      }else{
+        cSize = clusterSize(currentClusterTime, newClusterTime);
+      }
+      EXTREME_MSG("Cluster: %llu - %llu = %lu", currentClusterTime, newClusterTime, cSize);
+      EBML::sendElemHead(myConn, EBML::EID_CLUSTER, cSize);
       EBML::sendElemUInt(myConn, EBML::EID_TIMECODE, currentClusterTime);
     }
 
@@ -294,9 +317,8 @@ namespace Mist{
     if (myMeta.vod){
       EBML::sendElemHead(myConn, EBML::EID_CUES, cuesSize);
       uint64_t tmpsegSize = infoSize + tracksSize + seekheadSize + cuesSize + EBML::sizeElemHead(EBML::EID_CUES, cuesSize);
-      for (std::map<uint64_t, uint64_t>::iterator it = clusterSizes.begin(); it != clusterSizes.end(); ++it){
-        EBML::sendElemCuePoint(myConn, it->first, Trk.trackID, tmpsegSize, 0);
-        tmpsegSize += it->second;
+      for (std::deque<EBMLCluster>::iterator it = clusters.begin(); it != clusters.end(); ++it){
+        EBML::sendElemCuePoint(myConn, it->start, Trk.trackID, tmpsegSize + it->offset, 0);
       }
     }
     sentHeader = true;
@@ -320,17 +342,23 @@ namespace Mist{
     }
     startPos -= headerSize;
     sentHeader = true;//skip the header
-    DTSC::Track &Trk = myMeta.tracks[getMainSelectedTrack()];
-    for (std::map<uint64_t, uint64_t>::iterator it = clusterSizes.begin(); it != clusterSizes.end(); ++it){
-      VERYHIGH_MSG("Cluster %llu (%llu bytes) -> %llu to go", it->first, it->second, startPos);
-      if (startPos < it->second){
-        HIGH_MSG("Seek to fragment at %llu ms", it->first);
-        myConn.skipBytes(startPos);
-        seek(it->first);
-        newClusterTime = it->first;
-        return;
+    //Find the last cluster starting at or before the position
+    size_t lo = 0, hi = clusters.size();
+    while (lo < hi){
+      size_t mid = (lo + hi) / 2;
+      if (clusters[mid].offset <= startPos){
+        lo = mid + 1;
+      }else{
+        hi = mid;
       }
-      startPos -= it->second;
+    }
+    if (lo && startPos < clusters[lo - 1].offset + clusters[lo - 1].fullSize){
+      EBMLCluster &C = clusters[lo - 1];
+      HIGH_MSG("Seek to fragment at %llu ms", C.start);
+      myConn.skipBytes(startPos - C.offset);
+      seek(C.start);
+      newClusterTime = C.start;
+      return;
     }
     //End of file. This probably won't work right, but who cares, it's the end of the file.
   }
@@ -413,11 +441,36 @@ namespace Mist{
     wantRequest = false;
   }
 
+  /// Identifies the stream, the selected tracks and the state of their metadata,
+  /// which together decide the layout calculated by calcVodSizes.
+  std::string OutEBML::vodLayoutKey(){
+    std::stringstream key;
+    key << streamName << ":" << getMainSelectedTrack();
+    for (std::set<long unsigned int>::iterator it = selectedTracks.begin(); it != selectedTracks.end(); it++){
+      DTSC::Track &Trk = myMeta.tracks[*it];
+      key << ":" << *it << "/" << Trk.parts.size() << "/" << Trk.lastms;
+    }
+    return key.str();
+  }
+
   void OutEBML::calcVodSizes(){
-    if (segmentSize != 0xFFFFFFFFFFFFFFFFull){
+    std::string key = vodLayoutKey();
+    if (layoutKey == key){
       //Already calculated
       return;
     }
+    if (lastLayout.key == key){
+      //Calculated before by this process
+      segmentSize = lastLayout.segmentSize;
+      tracksSize = lastLayout.tracksSize;
+      infoSize = lastLayout.infoSize;
+      cuesSize = lastLayout.cuesSize;
+      seekheadSize = lastLayout.seekheadSize;
+      seekSize = lastLayout.seekSize;
+      clusters = lastLayout.clusters;
+      layoutKey = key;
+      return;
+    }
     DTSC::Track &Trk = myMeta.tracks[getMainSelectedTrack()];
     double duration = Trk.lastms - Trk.firstms;
     //Calculate the segment size
@@ -436,6 +489,8 @@ namespace Mist{
     //Positions are relative to the first Segment, byte 0 = first byte of contents of Segment.
     //Tricky starts here: the size of the SeekHead element is dependent on the seek offsets contained inside,
     //which are in turn dependent on the size of the SeekHead element. Fun times! We loop until it stabilizes.
+    seekSize = 0;
+    seekheadSize = 0;
     uint32_t oldseekSize = 0;
     do {
       oldseekSize = seekSize;
@@ -447,6 +502,42 @@ namespace Mist{
     //The Cues are tricky: the Cluster offsets are dependent on the size of Cues itself.
     //Which, in turn, is dependent on the Cluster offsets.
     //We make this a bit easier by pre-calculating the sizes of all clusters first
+    calcClusters();
+    //Calculating Cues size
+    //We also calculate Clusters here: Clusters are grouped by fragments of the main track.
+    //CueClusterPosition uses the same offsets as SeekPosition.
+    //CueRelativePosition is the offset from that Cluster's first content byte.
+    //All this uses the same technique as above. More fun times!
+    cuesSize = 0;
+    uint32_t oldcuesSize = 0;
+    do {
+      oldcuesSize = cuesSize;
+      segmentSize = infoSize + tracksSize + seekheadSize + cuesSize + EBML::sizeElemHead(EBML::EID_CUES, cuesSize);
+      uint32_t cuesInside = 0;
+      for (std::deque<EBMLCluster>::iterator it = clusters.begin(); it != clusters.end(); ++it){
+        cuesInside += EBML::sizeElemCuePoint(it->start, Trk.trackID, segmentSize + it->offset, 0);
+      }
+      if (clusters.size()){segmentSize += clusters.back().offset + clusters.back().fullSize;}
+      cuesSize = cuesInside;
+    }while(cuesSize != oldcuesSize);
+    layoutKey = key;
+    lastLayout.key = key;
+    lastLayout.segmentSize = segmentSize;
+    lastLayout.tracksSize = tracksSize;
+    lastLayout.infoSize = infoSize;
+    lastLayout.cuesSize = cuesSize;
+    lastLayout.seekheadSize = seekheadSize;
+    lastLayout.seekSize = seekSize;
+    lastLayout.clusters = clusters;
+  }
+
+  /// Lays out all Clusters of the VoD file: their times, sizes and offsets.
+  /// Clusters are aligned with the main track fragments, limited to 30 seconds, as in sendNext.
+  /// The parts of each selected track are walked once for all Clusters together, giving the same
+  /// sizes as calling clusterSize for each Cluster without rescanning the track every time.
+  void OutEBML::calcClusters(){
+    clusters.clear();
+    DTSC::Track &Trk = myMeta.tracks[getMainSelectedTrack()];
     uint64_t fragNo = 0;
     for (std::deque<DTSC::Fragment>::iterator it = Trk.fragments.begin(); it != Trk.fragments.end(); ++it){
       uint64_t clusterStart = Trk.getKey(it->getNumber()).getTime();
@@ -460,28 +551,71 @@ namespace Mist{
         if (fragNo == Trk.fragments.size() - 1){clusterTmpEnd = clusterStart + 30000;}
         //Limit clusters to 30 seconds.
         if (clusterTmpEnd - clusterStart > 30000){clusterTmpEnd = clusterStart + 30000;}
-        uint64_t cSize = clusterSize(clusterStart, clusterTmpEnd);
-        clusterSizes[clusterStart] = cSize + EBML::sizeElemHead(EBML::EID_CLUSTER, cSize);
+        EBMLCluster C;
+        C.start = clusterStart;
+        C.end = clusterTmpEnd;
+        C.size = EBML::sizeElemUInt(EBML::EID_TIMECODE, clusterStart);
+        //A cluster starting at the same time as the previous one replaces it
+        if (clusters.size() && clusters.back().start == clusterStart){
+          clusters.back() = C;
+        }else{
+          clusters.push_back(C);
+        }
         clusterStart = clusterTmpEnd;//Continue at the end of this cluster, if continuing.
       }while(clusterTmpEnd < clusterEnd);
       ++fragNo;
     }
-    //Calculating Cues size
-    //We also calculate Clusters here: Clusters are grouped by fragments of the main track.
-    //CueClusterPosition uses the same offsets as SeekPosition.
-    //CueRelativePosition is the offset from that Cluster's first content byte.
-    //All this uses the same technique as above. More fun times!
-    uint32_t oldcuesSize = 0;
-    do {
-      oldcuesSize = cuesSize;
-      segmentSize = infoSize + tracksSize + seekheadSize + cuesSize + EBML::sizeElemHead(EBML::EID_CUES, cuesSize);
-      uint32_t cuesInside = 0;
-      for (std::map<uint64_t, uint64_t>::iterator it = clusterSizes.begin(); it != clusterSizes.end(); ++it){
-        cuesInside += EBML::sizeElemCuePoint(it->first, Trk.trackID, segmentSize, 0);
-        segmentSize += it->second;
+    for (std::set<long unsigned int>::iterator it = selectedTracks.begin();
+         it != selectedTracks.end(); it++){
+      DTSC::Track &thisTrack = myMeta.tracks[*it];
+      size_t keyNo = 0;//the last key at or before the cluster start, which part times are counted from
+      size_t keyFirstPart = 0;//the first part of that key
+      size_t curPart = 0;
+      uint64_t curMS = 0;
+      uint64_t prevEnd = 0xFFFFFFFFFFFFFFFFull;
+      size_t maxParts = thisTrack.parts.size();
+      for (std::deque<EBMLCluster>::iterator C = clusters.begin(); C != clusters.end(); ++C){
+        size_t prevKey = keyNo;
+        while (keyNo + 1 < thisTrack.keys.size() && thisTrack.keys[keyNo + 1].getTime() <= C->start){
+          keyFirstPart += thisTrack.keys[keyNo].getParts();
+          ++keyNo;
+        }
+        //Counting from the same key as the previous cluster, the parts before where it stopped all
+        //fall before this cluster: continue from there instead of from the key.
+        if (keyNo != prevKey || C->start < prevEnd){
+          curPart = keyFirstPart;
+          curMS = thisTrack.keys.size() ? thisTrack.keys[keyNo].getTime() : 0;
+        }
+        for (; curPart < maxParts && curMS < C->end; ++curPart){
+          if (curMS >= C->start){
+            C->size += EBML::sizeSimpleBlock(thisTrack.trackID, thisTrack.parts[curPart].getSize());
+          }
+          curMS += thisTrack.parts[curPart].getDuration();
+        }
+        prevEnd = C->end;
       }
-      cuesSize = cuesInside;
-    }while(cuesSize != oldcuesSize);
+    }
+    uint64_t offset = 0;
+    for (std::deque<EBMLCluster>::iterator C = clusters.begin(); C != clusters.end(); ++C){
+      C->fullSize = C->size + EBML::sizeElemHead(EBML::EID_CLUSTER, C->size);
+      C->offset = offset;
+      offset += C->fullSize;
+    }
+  }
+
+  /// Returns the index of the VoD Cluster starting at the given time, or the amount of Clusters if there is none.
+  size_t OutEBML::findCluster(uint64_t start){
+    size_t lo = 0, hi = clusters.size();
+    while (lo < hi){
+      size_t mid = (lo + hi) / 2;
+      if (clusters[mid].start < start){
+        lo = mid + 1;
+      }else{
+        hi = mid;
+      }
+    }
+    if (lo < clusters.size() && clusters[lo].start == start){return lo;}
+    return clusters.size();
   }
 
 }// namespace Mist
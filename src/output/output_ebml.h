@@ -2,6 +2,15 @@
 #include "output_http.h"
 
 namespace Mist{
+  /// A Cluster of a VoD file, covering the packets from start up to (not including) end.
+  struct EBMLCluster{
+    uint64_t start;
+    uint64_t end;
+    uint32_t size;//size of Cluster contents (excl. header)
+    uint64_t offset;//offset of the Cluster from the start of the first Cluster
+    uint64_t fullSize;//size of Cluster (incl. header)
+  };
+
   class OutEBML : public HTTPOutput{
   public:
     OutEBML(Socket::Connection &conn);
@@ -26,7 +35,11 @@ namespace Mist{
     uint32_t cuesSize;//size of Cues (excl. header)
     uint32_t seekheadSize;//size of SeekHead (incl. header)
     uint32_t seekSize;//size of contents of SeekHead (excl. header)
-    std::map<uint64_t, uint64_t> clusterSizes;//sizes of Clusters by start time (incl. header)
+    std::deque<EBMLCluster> clusters;//all Clusters, in order
+    std::string layoutKey;//identifies the stream, tracks and metadata the above sizes were calculated for
+    std::string vodLayoutKey();
+    void calcClusters();
+    size_t findCluster(uint64_t start);
     void byteSeek(uint64_t startPos);
   };
 }
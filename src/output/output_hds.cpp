@@ -35,63 +35,83 @@ namespace Mist {
   ///\return The generated bootstrap.
   std::string OutHDS::dynamicBootstrap(int tid){
     updateMeta();
-    std::string empty;
+    DTSC::Track & trk = myMeta.tracks[tid];
+    std::string bootstrap;
+    MP4::BoxWriter W(bootstrap);
+    //every fragment run takes at most 17 bytes
+    W.reserve(128 + streamName.size() + trk.fragments.size() * 17);
     
-    MP4::ASRT asrt;
-    asrt.setUpdate(false);
-    asrt.setVersion(1);
-    //asrt.setQualityEntry(empty, 0);
-    if (myMeta.live){
-      asrt.setSegmentRun(1, 4294967295ul, 0);
-    }else{
-      asrt.setSegmentRun(1, myMeta.tracks[tid].fragments.size(), 0);
-    }
+    W.startFull("abst", 1, 0);
+    W.int32(1);//bootstrap info version
+    W.int8(myMeta.live ? 0x10 : 0);//profile 0, no update
+    W.int32(1000);//timescale
+    W.int64(trk.lastms);//current media time
+    W.int64(0);//SMPTE timecode offset
+    W.string(streamName);//movie identifier
+    W.int8(0);//server entries
+    W.int8(0);//quality entries
+    W.int8(0);//DRM data
+    W.int8(0);//metadata
+    
+    W.int8(1);//segment run tables
+    W.startFull("asrt", 1, 0);
+    W.int8(0);//quality entries
+    W.int32(1);//segment runs
+    W.int32(1);//first segment
+    W.int32(myMeta.live ? 4294967295ul : trk.fragments.size());//fragments per segment
+    W.end();
     
-    MP4::AFRT afrt;
-    afrt.setUpdate(false);
-    afrt.setVersion(1);
-    afrt.setTimeScale(1000);
-    //afrt.setQualityEntry(empty, 0);
-    MP4::afrt_runtable afrtrun;
-    int i = 0;
-    int j = 0;
-    if (myMeta.tracks[tid].fragments.size()){
-      std::deque<DTSC::Fragment>::iterator fragIt = myMeta.tracks[tid].fragments.begin();
-      unsigned int firstTime = myMeta.tracks[tid].getKey(fragIt->getNumber()).getTime();
-      while (fragIt != myMeta.tracks[tid].fragments.end()){
+    W.int8(1);//fragment run tables
+    W.startFull("afrt", 1, 0);
+    W.int32(1000);//timescale
+    W.int8(0);//quality entries
+    size_t runCountPos = W.position();
+    W.int32(0);
+    uint32_t runs = 0;
+    if (trk.fragments.size()){
+      std::deque<DTSC::Fragment>::iterator fragIt = trk.fragments.begin();
+      unsigned int firstTime = trk.getKey(fragIt->getNumber()).getTime();
+      int j = 0;
+      while (fragIt != trk.fragments.end()){
         if (myMeta.vod || fragIt->getDuration() > 0){
-          afrtrun.firstFragment = myMeta.tracks[tid].missedFrags + j + 1;
-          afrtrun.firstTimestamp = myMeta.tracks[tid].getKey(fragIt->getNumber()).getTime() - firstTime;
-          if (fragIt->getDuration() > 0){
-            afrtrun.duration = fragIt->getDuration();
-          }else{
-            afrtrun.duration = myMeta.tracks[tid].lastms - afrtrun.firstTimestamp;
+          uint64_t firstTimestamp = trk.getKey(fragIt->getNumber()).getTime() - firstTime;
+          uint32_t duration = fragIt->getDuration();
+          if (!duration){
+            duration = trk.lastms - firstTimestamp;
           }
-          afrt.setFragmentRun(afrtrun, i);
-          ++i;
+          W.int32(trk.missedFrags + j + 1);
+          W.int64(firstTimestamp);
+          W.int32(duration);
+          if (!duration){
+            W.int8(0);//discontinuity indicator
+          }
+          ++runs;
         }
         ++j;
         ++fragIt;
       }
     }
+    W.setInt32(runCountPos, runs);
+    W.end();//afrt
+    W.end();//abst
     
-    MP4::ABST abst;
-    abst.setVersion(1);
-    abst.setBootstrapinfoVersion(1);
-    abst.setProfile(0);
-    abst.setUpdate(false);
-    abst.setTimeScale(1000);
-    abst.setLive(myMeta.live);
-    abst.setCurrentMediaTime(myMeta.tracks[tid].lastms);
-    abst.setSmpteTimeCodeOffset(0);
-    abst.setMovieIdentifier(streamName);
-    abst.setSegmentRunTable(asrt, 0);
-    abst.setFragmentRunTable(afrt, 0);
-    
-    DEBUG_MSG(DLVL_VERYHIGH, "Sending bootstrap: %s", abst.toPrettyString(0).c_str());
-    return std::string((char*)abst.asBox(), (int)abst.boxedSize());
+    DEBUG_MSG(DLVL_VERYHIGH, "Sending bootstrap: %s", MP4::Box((char*)bootstrap.data(), false).toPrettyString(0).c_str());
+    return bootstrap;
   }
   
+  ///\brief Returns the bootstrap of a track from the manifest cache, building and storing it if needed.
+  ///\param tid The track to get the bootstrap for.
+  ///\param version The current manifest version, as returned by manifestVersion.
+  std::string OutHDS::cachedBootstrap(int tid, uint64_t version){
+    std::string key = "abst/" + JSON::Value(tid).asString();
+    std::string bootstrap;
+    if (!manifests.get(key, version, bootstrap)){
+      bootstrap = dynamicBootstrap(tid);
+      manifests.put(key, version, bootstrap);
+    }
+    return bootstrap;
+  }
+
   ///\brief Builds an index file for HTTP Dynamic streaming.
   ///\return The index file for HTTP Dynamic Streaming.
   std::string OutHDS::dynamicIndex(){
@@ -196,6 +216,8 @@ namespace Mist {
       initialize();
       std::string streamID = H.url.substr(streamName.size() + 10);
       streamID = streamID.substr(0, streamID.find(".abst"));
+      uint64_t version = manifestVersion();
+      bool unchanged = manifestUnchanged(version);
       H.Clean();
       H.SetHeader("Content-Type", "binary/octet");
       H.SetHeader("Cache-Control", "no-cache");
@@ -205,7 +227,13 @@ namespace Mist {
         H.Clean();
         return;
       }
-      H.SetBody(dynamicBootstrap(atoll(streamID.c_str())));
+      if (version){H.SetHeader("ETag", manifestTag(version));}
+      if (unchanged){
+        H.SendResponse("304", "Not Modified", myConn);
+        H.Clean();
+        return;
+      }
+      H.SetBody(cachedBootstrap(atoll(streamID.c_str()), version));
       H.SendResponse("200", "OK", myConn);
       H.Clean(); //clean for any possible next requests
       return;
@@ -265,11 +293,10 @@ namespace Mist {
         return;
       }
       H.StartResponse(H, myConn);
-      //send the bootstrap
-      std::string bootstrap = dynamicBootstrap(tid);
+      //send the bootstrap, followed by a zero-size mdat, meaning it stretches until end of file.
+      std::string bootstrap = cachedBootstrap(tid, manifestVersion());
+      bootstrap.append("\000\000\000\000mdat", 8);
       H.Chunkify(bootstrap, myConn);
-      //send a zero-size mdat, meaning it stretches until end of file.
-      H.Chunkify("\000\000\000\000mdat", 8, myConn);
       //send init data, if needed.
       if (audioTrack > 0 && myMeta.tracks[audioTrack].init != ""){
         if (tag.DTSCAudioInit(myMeta.tracks[audioTrack])){
@@ -14,6 +14,7 @@ namespace Mist {
     protected:
       void getTracks();
       std::string dynamicBootstrap(int tid);
+      std::string cachedBootstrap(int tid, uint64_t version);
       std::string dynamicIndex();
       std::set<int> videoTracks;///<< Holds valid video tracks for playback
       long long int audioTrack;///<< Holds audio track ID for playback
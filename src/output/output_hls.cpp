@@ -15,6 +15,7 @@ namespace Mist {
   ///\brief Builds an index file for HTTP Live streaming.
   ///\return The index file for HTTP Live Streaming.
   std::string OutHLS::liveIndex(){
+    updateMeta();
     std::stringstream result;
     selectDefaultTracks();
     result << "#EXTM3U\r\n";
@@ -54,7 +55,7 @@ namespace Mist {
         if (audioId != -1) {
           result << "_" << audioId;
         }
-        result << "/index.m3u8?sessId=" << getpid() << "\r\n";
+        result << "/index.m3u8\r\n";
       }
     }
     if (!vidTracks && audioId) {
@@ -67,7 +68,8 @@ namespace Mist {
     return result.str();
   }
 
-  std::string OutHLS::liveIndex(int tid, std::string & sessId) {
+  ///\brief Builds the playlist of a single track for HTTP Live streaming, without session IDs.
+  std::string OutHLS::liveIndex(int tid) {
     updateMeta();
     std::stringstream result;
     //parse single track
@@ -84,12 +86,7 @@ namespace Mist {
         duration = myMeta.tracks[tid].lastms - starttime;
       }
       char lineBuf[400];
-
-      if (sessId.size()){
-        snprintf(lineBuf, 400, "#EXTINF:%f,\r\n%lld_%lld.ts?sessId=%s\r\n", (double)duration/1000, starttime, starttime + duration, sessId.c_str());
-      }else{
-        snprintf(lineBuf, 400, "#EXTINF:%f,\r\n%lld_%lld.ts\r\n", (double)duration/1000, starttime, starttime + duration);
-      }
+      snprintf(lineBuf, 400, "#EXTINF:%f,\r\n%lld_%lld.ts\r\n", (double)duration/1000, starttime, starttime + duration);
       durs.push_back(duration);
       total_dur += duration;
       lines.push_back(lineBuf);
@@ -121,6 +118,27 @@ namespace Mist {
     DEBUG_MSG(DLVL_HIGH, "Sending this index: %s", result.str().c_str());
     return result.str();
   } //liveIndex
+
+  /// Returns the given playlist with the session ID added to every URI in it.
+  /// Playlists are generated (and cached) without session IDs, as they are the only per-viewer part.
+  std::string OutHLS::addSession(const std::string & playlist, const std::string & sessId){
+    if (!sessId.size()){return playlist;}
+    std::string result;
+    result.reserve(playlist.size() + playlist.size() / 8);
+    size_t pos = 0;
+    while (pos < playlist.size()){
+      size_t end = playlist.find("\r\n", pos);
+      if (end == std::string::npos){end = playlist.size();}
+      result.append(playlist, pos, end - pos);
+      if (end > pos && playlist[pos] != '#'){
+        result += "?sessId=";
+        result += sessId;
+      }
+      result.append(playlist, end, 2);
+      pos = end + 2;
+    }
+    return result;
+  }
   
   
   OutHLS::OutHLS(Socket::Connection & conn) : TSOutput(conn){
@@ -261,6 +279,8 @@ namespace Mist {
     } else {
       initialize();
       std::string request = H.url.substr(H.url.find("/", 5) + 1);
+      uint64_t version = manifestVersion();
+      bool unchanged = manifestUnchanged(version);
       H.Clean();
       H.SetHeader("Content-Type", "application/vnd.apple.mpegurl");
       H.SetHeader("Cache-Control", "no-cache");
@@ -275,12 +295,29 @@ namespace Mist {
         H.Clean();
         return;
       }
+      if (version){H.SetHeader("ETag", manifestTag(version));}
+      if (unchanged){
+        H.SendResponse("304", "Not Modified", myConn);
+        H.Clean();
+        return;
+      }
       std::string manifest;
       if (request.find("/") == std::string::npos){
-        manifest = liveIndex();
+        //The track selection depends on the request, only the default one is shared
+        bool shared = !targetParams.count("audio") && !targetParams.count("video") && !targetParams.count("subtitle");
+        if (!shared || !manifests.get("hls", version, manifest)){
+          manifest = liveIndex();
+          if (shared){manifests.put("hls", version, manifest);}
+        }
+        manifest = addSession(manifest, JSON::Value(getpid()).asString());
       }else{
         int selectId = atoi(request.substr(0,request.find("/")).c_str());
-        manifest = liveIndex(selectId, sessId);
+        std::string key = "hls/" + JSON::Value(selectId).asString();
+        if (!manifests.get(key, version, manifest)){
+          manifest = liveIndex(selectId);
+          manifests.put(key, version, manifest);
+        }
+        manifest = addSession(manifest, sessId);
       }
       H.SetBody(manifest);
       H.SendResponse("200", "OK", myConn);
@@ -17,7 +17,8 @@ namespace Mist {
 
       bool hasSessionIDs(){return true;}
       std::string liveIndex();
-      std::string liveIndex(int tid, std::string & sessId);
+      std::string liveIndex(int tid);
+      static std::string addSession(const std::string & playlist, const std::string & sessId);
       int canSeekms(unsigned int ms);
       int keysToSend;      
       unsigned int vidTrack;
@@ -196,65 +196,68 @@ namespace Mist {
 
     ///\todo Select correct track (tid);
 
-    //Wrap everything in mp4 boxes
+    //Wrap everything in mp4 boxes, written in place into a single buffer
+    bool isVideo = (myMeta.tracks[tid].type == "video");
+    std::string fragment;
+    MP4::BoxWriter W(fragment);
+    W.reserve(256 + keyObj.getParts() * 17);
+    W.start("moof");
+
     MP4::MFHD mfhd_box;
-    mfhd_box.setSequenceNumber(((keyObj.getNumber() - 1) * 2) + (myMeta.tracks[tid].type == "video" ? 1 : 2));
+    mfhd_box.setSequenceNumber(((keyObj.getNumber() - 1) * 2) + (isVideo ? 1 : 2));
+    W.box(mfhd_box);
 
+    W.start("traf");
     MP4::TFHD tfhd_box;
     tfhd_box.setFlags(MP4::tfhdSampleFlag);
-    tfhd_box.setTrackID((myMeta.tracks[tid].type == "video" ? 1 : 2));
-    if (myMeta.tracks[tid].type == "video") {
+    tfhd_box.setTrackID((isVideo ? 1 : 2));
+    if (isVideo) {
       tfhd_box.setDefaultSampleFlags(0x00004001);
     } else {
       tfhd_box.setDefaultSampleFlags(0x00008002);
     }
+    W.box(tfhd_box);
 
-    MP4::TRUN trun_box;
-    trun_box.setDataOffset(42);///\todo Check if this is a placeholder, or an actually correct number
     unsigned int keySize = 0;
-    if (myMeta.tracks[tid].type == "video") {
-      trun_box.setFlags(MP4::trundataOffset | MP4::trunfirstSampleFlags | MP4::trunsampleDuration | MP4::trunsampleSize | MP4::trunsampleOffsets);
+    if (isVideo) {
+      W.startFull("trun", 0, MP4::trundataOffset | MP4::trunfirstSampleFlags | MP4::trunsampleDuration | MP4::trunsampleSize | MP4::trunsampleOffsets);
     } else {
-      trun_box.setFlags(MP4::trundataOffset | MP4::trunsampleDuration | MP4::trunsampleSize);
+      W.startFull("trun", 0, MP4::trundataOffset | MP4::trunsampleDuration | MP4::trunsampleSize);
+    }
+    W.int32(keyObj.getParts());
+    //The data offset is only known once the moof is complete
+    size_t dataOffsetPos = W.position();
+    W.int32(0);
+    if (isVideo) {
+      W.int32(0x00004002);
     }
-    trun_box.setFirstSampleFlags(0x00004002);
     for (int i = 0; i < keyObj.getParts(); i++) {
-      MP4::trunSampleInformation trunSample;
-      trunSample.sampleSize = myMeta.tracks[tid].parts[i + partOffset].getSize();
-      keySize += myMeta.tracks[tid].parts[i + partOffset].getSize();
-      trunSample.sampleDuration = myMeta.tracks[tid].parts[i + partOffset].getDuration() * 10000;
-      if (myMeta.tracks[tid].type == "video") {
-        trunSample.sampleOffset = myMeta.tracks[tid].parts[i + partOffset].getOffset() * 10000;
+      DTSC::Part & part = myMeta.tracks[tid].parts[i + partOffset];
+      keySize += part.getSize();
+      W.int32(part.getDuration() * 10000);
+      W.int32(part.getSize());
+      if (isVideo) {
+        W.int32(part.getOffset() * 10000);
       }
-      trun_box.setSampleInformation(trunSample, i);
     }
+    W.end();
 
-    MP4::SDTP sdtp_box;
-    sdtp_box.setVersion(0);
-    if (myMeta.tracks[tid].type == "video") {
-      sdtp_box.setValue(36, 4);
-      for (int i = 1; i < keyObj.getParts(); i++) {
-        sdtp_box.setValue(20, 4 + i);
-      }
-    } else {
-      sdtp_box.setValue(40, 4);
-      for (int i = 1; i < keyObj.getParts(); i++) {
-        sdtp_box.setValue(40, 4 + i);
+    W.startFull("sdtp", 0, 0);
+    for (int i = 0; i < keyObj.getParts(); i++) {
+      if (isVideo) {
+        W.int8(i ? 20 : 36);
+      } else {
+        W.int8(40);
       }
     }
-
-    MP4::TRAF traf_box;
-    traf_box.setContent(tfhd_box, 0);
-    traf_box.setContent(trun_box, 1);
-    traf_box.setContent(sdtp_box, 2);
+    W.end();
 
     //If the stream is live, we want to have a fragref box if possible
-    //////HEREHEREHERE
     if (myMeta.live) {
       MP4::UUID_TFXD tfxd_box;
       tfxd_box.setTime(keyObj.getTime());
       tfxd_box.setDuration(keyObj.getLength());
-      traf_box.setContent(tfxd_box, 3);
+      W.box(tfxd_box);
 
       MP4::UUID_TrackFragmentReference fragref_box;
       fragref_box.setVersion(1);
@@ -268,26 +271,19 @@ namespace Mist {
           fragref_box.setFragmentCount(++fragCount);
         }
       }
-      traf_box.setContent(fragref_box, 4);
+      W.box(fragref_box);
     }
-
-    MP4::MOOF moof_box;
-    moof_box.setContent(mfhd_box, 0);
-    moof_box.setContent(traf_box, 1);
-    //Setting the correct offsets.
-    moof_box.setContent(traf_box, 1);
-    trun_box.setDataOffset(moof_box.boxedSize() + 8);
-    traf_box.setContent(trun_box, 1);
-    moof_box.setContent(traf_box, 1);
+    W.end();//traf
+    W.end();//moof
+    //Data starts right after the moof and the mdat header
+    W.setInt32(dataOffsetPos, fragment.size() + 8);
+    W.header("mdat", keySize);
 
     H.Clean();
     H.SetHeader("Content-Type", "video/mp4");
     H.setCORSHeaders();
     H.StartResponse(H, myConn);
-    H.Chunkify(moof_box.asBox(), moof_box.boxedSize(), myConn);
-    int size = htonl(keySize + 8);
-    H.Chunkify((char *)&size, 4, myConn);
-    H.Chunkify("mdat", 4, myConn);
+    H.Chunkify(fragment, myConn);
     sentHeader = true;
     H.Clean();
   }
@@ -451,6 +447,8 @@ namespace Mist {
     initialize();
     if (H.url.find("Manifest") != std::string::npos) {
       //Manifest, direct reply
+      uint64_t version = manifestVersion();
+      bool unchanged = manifestUnchanged(version);
       H.Clean();
       H.SetHeader("Content-Type", "text/xml");
       H.SetHeader("Cache-Control", "no-cache");
@@ -459,7 +457,17 @@ namespace Mist {
         H.SendResponse("200", "OK", myConn);
         return;
       }
-      std::string manifest = smoothIndex();
+      if (version){H.SetHeader("ETag", manifestTag(version));}
+      if (unchanged){
+        H.SendResponse("304", "Not Modified", myConn);
+        H.Clean();
+        return;
+      }
+      std::string manifest;
+      if (!manifests.get("hss", version, manifest)){
+        manifest = smoothIndex();
+        manifests.put("hss", version, manifest);
+      }
       H.SetBody(manifest);
       H.SendResponse("200", "OK", myConn);
       H.Clean();
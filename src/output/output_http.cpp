@@ -60,119 +60,179 @@ namespace Mist {
     Output::onFail(msg, critical);
   }
   
-  bool isMatch(const std::string & url, const std::string & m, std::string & streamname){
-    size_t found = m.find('$');
-    if (found != std::string::npos){
-      if (url.size() < m.size()){return false;}
-      if (m.substr(0, found) == url.substr(0, found) && m.substr(found+1) == url.substr(url.size() - (m.size() - found) + 1)){
-        if (url.substr(found, url.size() - m.size() + 1).find('/') != std::string::npos){
-          return false;
-        }
-        streamname = url.substr(found, url.size() - m.size() + 1);
-        return true;
+  std::map<std::string, linkedHandler> HTTPOutput::linked;
+
+  /// Precompiled url patterns of all HTTP-based connectors, in capabilities order.
+  static std::vector<urlRule> urlRules;
+  static uint64_t urlRulesTime = 0;
+  /// Precompiled url patterns of the current output only.
+  static std::vector<urlRule> ownRules;
+  static std::string ownRulesName;
+
+  /// Attempts to match the given url against this pattern.
+  /// If the pattern contains a stream name placeholder, streamname is set to the matching part of the url.
+  bool urlRule::match(const std::string & url, std::string & streamname) const{
+    if (!hasStream){
+      if (prefix){return !url.compare(0, pre.size(), pre);}
+      return (url == pre);
+    }
+    if (url.size() <= pre.size() + suf.size() || url.compare(0, pre.size(), pre)){return false;}
+    size_t sufPos;
+    if (prefix){
+      sufPos = url.find(suf, pre.size());
+      if (sufPos == std::string::npos){return false;}
+    }else{
+      sufPos = url.size() - suf.size();
+      if (url.compare(sufPos, suf.size(), suf)){return false;}
+    }
+    //stream names never contain slashes
+    if (url.find('/', pre.size()) < sufPos){return false;}
+    streamname = url.substr(pre.size(), sufPos - pre.size());
+    return true;
+  }
+
+  static void addUrlRule(std::vector<urlRule> & rules, const std::string & connector, const std::string & pattern, bool prefix){
+    urlRule r;
+    r.connector = connector;
+    r.prefix = prefix;
+    size_t found = pattern.find('$');
+    r.hasStream = (found != std::string::npos);
+    r.pre = pattern.substr(0, found);
+    if (r.hasStream){r.suf = pattern.substr(found+1);}
+    rules.push_back(r);
+  }
+
+  /// Appends all url_match and url_prefix patterns from the capabilities of a connector to the given table.
+  static void addUrlRules(std::vector<urlRule> & rules, const std::string & connector, const JSON::Value & c){
+    if (c.isMember("url_match")){
+      if (c["url_match"].isArray()){
+        jsonForEachConst(c["url_match"], it){addUrlRule(rules, connector, it->asStringRef(), false);}
+      }
+      if (c["url_match"].isString()){addUrlRule(rules, connector, c["url_match"].asStringRef(), false);}
+    }
+    if (c.isMember("url_prefix")){
+      if (c["url_prefix"].isArray()){
+        jsonForEachConst(c["url_prefix"], it){addUrlRule(rules, connector, it->asStringRef(), true);}
       }
+      if (c["url_prefix"].isString()){addUrlRule(rules, connector, c["url_prefix"].asStringRef(), true);}
     }
-    return (url == m);
   }
-  
-  bool isPrefix(const std::string & url, const std::string & m, std::string & streamname){
-    size_t found = m.find('$');
-    if (found != std::string::npos){
-      if (url.size() < m.size()){return false;}
-      size_t found_suf = url.find(m.substr(found+1), found);
-      if (m.substr(0, found) == url.substr(0, found) && found_suf != std::string::npos){
-        if (url.substr(found, found_suf - found).find('/') != std::string::npos){
-          return false;
-        }
-        streamname = url.substr(found, found_suf - found);
-        return true;
+
+  /// Builds the url pattern table of all HTTP-based connectors from the shared capabilities.
+  /// Called automatically by getHandler when the table is empty or over a minute old.
+  /// Calling it in a listener before forking saves every connection the trip to shared memory.
+  void HTTPOutput::loadUrlRules(){
+    urlRules.clear();
+    urlRulesTime = Util::bootSecs();
+    Util::DTSCShmReader rCapa(SHM_CAPA);
+    DTSC::Scan conns = rCapa.getMember("connectors");
+    unsigned int conns_ctr = conns.getSize();
+    for (unsigned int i = 0; i < conns_ctr; ++i){
+      DTSC::Scan c = conns.getIndice(i);
+      //if it depends on HTTP and has a match or prefix...
+      if ((c.getMember("name").asString() == "HTTP" || c.getMember("deps").asString() == "HTTP") && (c.getMember("url_match") || c.getMember("url_prefix"))){
+        addUrlRules(urlRules, conns.getIndiceName(i), c.asJSON());
       }
-    }else{
-      return (url.substr(0, m.size()) == m);
     }
-    return false;
   }
-  
-  /// - anything else: The request should be dispatched to a connector on the named socket.
+
+  /// Returns the name of the connector that should handle the current request, or an empty string if none can.
+  /// Sets the "stream" variable of the request if the matching pattern contains a stream name.
   std::string HTTPOutput::getHandler(){
     std::string url = H.getUrl();
+    std::string streamname;
+    const urlRule * found = 0;
     //check the current output first, the most common case
-    if (capa.isMember("url_match") || capa.isMember("url_prefix")){
-      bool match = false;
-      std::string streamname;
-      //if there is a matcher, try to match
-      if (capa.isMember("url_match")){
-        if (capa["url_match"].isArray()){
-          jsonForEach(capa["url_match"], it) {
-            match |= isMatch(url, it->asStringRef(), streamname);
-          }
-        }
-        if (capa["url_match"].isString()){
-          match |= isMatch(url, capa["url_match"].asStringRef(), streamname);
-        }
-      }
-      //if there is a prefix, try to match
-      if (capa.isMember("url_prefix")){
-        if (capa["url_prefix"].isArray()){
-          jsonForEach(capa["url_prefix"], it) {
-            match |= isPrefix(url, it->asStringRef(), streamname);
-          }
-        }
-        if (capa["url_prefix"].isString()){
-          match |= isPrefix(url, capa["url_prefix"].asStringRef(), streamname);
-        }
+    if (ownRulesName != capa["name"].asStringRef()){
+      ownRulesName = capa["name"].asStringRef();
+      ownRules.clear();
+      addUrlRules(ownRules, ownRulesName, capa);
+    }
+    for (std::vector<urlRule>::const_iterator it = ownRules.begin(); it != ownRules.end(); ++it){
+      if (it->match(url, streamname)){
+        found = &*it;
+        break;
       }
-      if (match){
-        if (streamname.size()){
-          Util::sanitizeName(streamname);
-          H.SetVar("stream", streamname);
+    }
+    //then loop over all connectors
+    if (!found){
+      if (!urlRules.size() || Util::bootSecs() > urlRulesTime + 60){loadUrlRules();}
+      for (std::vector<urlRule>::const_iterator it = urlRules.begin(); it != urlRules.end(); ++it){
+        if (it->match(url, streamname)){
+          found = &*it;
+          break;
         }
-        return capa["name"].asStringRef();
       }
     }
-    
-    //loop over the connectors
-    Util::DTSCShmReader rCapa(SHM_CAPA);
-    DTSC::Scan capa = rCapa.getMember("connectors");
-    unsigned int capa_ctr = capa.getSize();
-    for (unsigned int i = 0; i < capa_ctr; ++i){
-      DTSC::Scan c = capa.getIndice(i);
-      //if it depends on HTTP and has a match or prefix...
-      if ((c.getMember("name").asString() == "HTTP" || c.getMember("deps").asString() == "HTTP") && (c.getMember("url_match") || c.getMember("url_prefix"))){
-        bool match = false;
-        std::string streamname;
-        //if there is a matcher, try to match
-        if (c.getMember("url_match")){
-          if (c.getMember("url_match").getSize()){
-            for (unsigned int j = 0; j < c.getMember("url_match").getSize(); ++j){
-              match |= isMatch(url, c.getMember("url_match").getIndice(j).asString(), streamname);
-            }
-          }else{
-            match |= isMatch(url, c.getMember("url_match").asString(), streamname);
-          }
-        }
-        //if there is a prefix, try to match
-        if (c.getMember("url_prefix")){
-          if (c.getMember("url_prefix").getSize()){
-            for (unsigned int j = 0; j < c.getMember("url_prefix").getSize(); ++j){
-              match |= isPrefix(url, c.getMember("url_prefix").getIndice(j).asString(), streamname);
-            }
-          }else{
-            match |= isPrefix(url, c.getMember("url_prefix").asString(), streamname);
-          }
-        }
-        if (match){
-          if (streamname.size()){
-            Util::sanitizeName(streamname);
-            H.SetVar("stream", streamname);
-          }
-          return capa.getIndiceName(i);
+    if (!found){return "";}
+    if (streamname.size()){
+      Util::sanitizeName(streamname);
+      H.SetVar("stream", streamname);
+    }
+    return found->connector;
+  }
+
+  /// Registers the output class that was initialized last as linked into this binary, under the given name.
+  /// The current capabilities are stored and restored whenever the handler is created.
+  void HTTPOutput::linkHandler(const std::string & name, httpOutputFactory create){
+    linked[name].create = create;
+    linked[name].capa = capa;
+  }
+
+  /// Creates an instance of a linked handler on the given connection.
+  /// Returns a null pointer if there is no such handler linked into this binary.
+  HTTPOutput * HTTPOutput::createHandler(const std::string & name, Socket::Connection & conn){
+    if (!linked.count(name)){return 0;}
+    capa = linked[name].capa;
+    return linked[name].create(conn);
+  }
+
+  static void setOption(Util::Config * cfg, const std::string & name, const JSON::Value & val){
+    JSON::Value & vals = cfg->getOption(name, true);
+    vals.shrink(0);
+    if (val.isArray()){
+      jsonForEachConst(val, it){vals.append(*it);}
+      return;
+    }
+    if (val.isString() && !val.asStringRef().size()){
+      vals.append(1);
+      return;
+    }
+    vals.append(val);
+  }
+
+  /// Hands the connection over to a handler that is linked into this binary, without exec.
+  /// The current request is put back into the receive buffer and the configuration is set to what
+  /// reConnector would have passed on the command line. The run loop then ends and the caller is
+  /// expected to create the handler named by handOffTarget() on the same connection.
+  /// Returns false, changing nothing, if the handler is not linked in or not configured.
+  bool HTTPOutput::handOff(const std::string & connector){
+    if (!linked.count(connector)){return false;}
+    std::string confName = connector;
+    JSON::Value p, connCapa;
+    if (!getProtocol(confName, p, connCapa)){return false;}
+    const JSON::Value & hCapa = linked[connector].capa;
+    for (int i = 0; i < 2; ++i){
+      const char * argType = i ? "optional" : "required";
+      if (!hCapa.isMember(argType)){continue;}
+      jsonForEachConst(hCapa[argType], it){
+        if (it->isMember("option") && p.isMember(it.key()) && config->hasOption(it.key())){
+          setOption(config, it.key(), p[it.key()]);
         }
       }
     }
-    return "";
+    setOption(config, "streamname", streamName);
+    config->getOption("prequest", true).shrink(0);
+    myConn.Received().prepend(H.BuildRequest());
+    H.Clean();
+    MEDIUM_MSG("Handing connection over to %s in-process", connector.c_str());
+    handOffTo = connector;
+    handedOff = true;
+    wantRequest = false;
+    parseData = false;
+    return true;
   }
-  
+
   void HTTPOutput::requestHandler(){
     //Handle onIdle function caller, if needed
     if (idleInterval && (Util::bootMS() > idleLast + idleInterval)){
@@ -215,6 +275,7 @@ namespace Mist {
         streamName = H.GetVar("stream");
         nProxy.userClient.finish();
         statsPage.finish();
+        if (handOff(handler)){return;}
         reConnector(handler);
         onFail("Server error - could not start connector", true);
         return;
@@ -301,30 +362,31 @@ namespace Mist {
     }
   }
   
-  ///\brief Handles requests by starting a corresponding output process.
-  ///\param connector The type of connector to be invoked.
-  void HTTPOutput::reConnector(std::string & connector){
-    //taken from CheckProtocols (controller_connectors.cpp)
-    char * argarr[32];
-    for (int i=0; i<32; i++){argarr[i] = 0;}
+  /// Looks up the configured protocol settings and the capabilities of the given connector.
+  /// The connector name gets ".exe" appended if that is how it was configured.
+  /// Returns false if the connector is not configured.
+  bool HTTPOutput::getProtocol(std::string & connector, JSON::Value & p, JSON::Value & connCapa){
     int id = -1;
-    JSON::Value pipedCapa;
-    JSON::Value p;//properties of protocol
-    
-
-    {
-      Util::DTSCShmReader rProto(SHM_PROTO);
-      DTSC::Scan prots = rProto.getScan();
-      unsigned int prots_ctr = prots.getSize();
-     
-      if (connector == "HTTP" || connector == "HTTP.exe"){
-        //restore from values in the environment, regardless of configged settings
-        if (getenv("MIST_HTTP_pubaddr")){
-          std::string pubAddrs = getenv("MIST_HTTP_pubaddr");
-          p["pubaddr"] = JSON::fromString(pubAddrs);
+    Util::DTSCShmReader rProto(SHM_PROTO);
+    DTSC::Scan prots = rProto.getScan();
+    unsigned int prots_ctr = prots.getSize();
+   
+    if (connector == "HTTP" || connector == "HTTP.exe"){
+      //restore from values in the environment, regardless of configged settings
+      if (getenv("MIST_HTTP_pubaddr")){
+        std::string pubAddrs = getenv("MIST_HTTP_pubaddr");
+        p["pubaddr"] = JSON::fromString(pubAddrs);
+      }
+    }else{
+      //find connector in config
+      for (unsigned int i=0; i < prots_ctr; ++i){
+        if (prots.getIndice(i).getMember("connector").asString() == connector) {
+          id =  i;
+          break;    //pick the first protocol in the list that matches the connector 
         }
-      }else{
-        //find connector in config
+      }
+      if (id == -1) {
+        connector = connector + ".exe";
         for (unsigned int i=0; i < prots_ctr; ++i){
           if (prots.getIndice(i).getMember("connector").asString() == connector) {
             id =  i;
@@ -332,28 +394,31 @@ namespace Mist {
           }
         }
         if (id == -1) {
-          connector = connector + ".exe";
-          for (unsigned int i=0; i < prots_ctr; ++i){
-            if (prots.getIndice(i).getMember("connector").asString() == connector) {
-              id =  i;
-              break;    //pick the first protocol in the list that matches the connector 
-            }
-          }
-          if (id == -1) {
-            connector = connector.substr(0, connector.size() - 4);
-            ERROR_MSG("No connector found for: %s", connector.c_str());
-            return;
-          }
+          connector = connector.substr(0, connector.size() - 4);
+          ERROR_MSG("No connector found for: %s", connector.c_str());
+          return false;
         }
-        //read options from found connector
-        p = prots.getIndice(id).asJSON();
       }
-      
-      HIGH_MSG("Connector found: %s", connector.c_str());
-      Util::DTSCShmReader rCapa(SHM_CAPA);
-      DTSC::Scan capa = rCapa.getMember("connectors");
-      pipedCapa = capa.getMember(connector).asJSON();
+      //read options from found connector
+      p = prots.getIndice(id).asJSON();
     }
+    
+    HIGH_MSG("Connector found: %s", connector.c_str());
+    Util::DTSCShmReader rCapa(SHM_CAPA);
+    DTSC::Scan capa = rCapa.getMember("connectors");
+    connCapa = capa.getMember(connector).asJSON();
+    return true;
+  }
+
+  ///\brief Handles requests by starting a corresponding output process.
+  ///\param connector The type of connector to be invoked.
+  void HTTPOutput::reConnector(std::string & connector){
+    //taken from CheckProtocols (controller_connectors.cpp)
+    char * argarr[32];
+    for (int i=0; i<32; i++){argarr[i] = 0;}
+    JSON::Value pipedCapa;
+    JSON::Value p;//properties of protocol
+    if (!getProtocol(connector, p, pipedCapa)){return;}
 
     //build arguments for starting output process
     std::string tmparg = Util::getMyPath() + std::string("MistOut") + connector;
@@ -381,6 +446,28 @@ namespace Mist {
     execv(argarr[0], argarr);
   }
   
+  /// Returns the version of the manifests of the current stream, opening its manifest cache if needed.
+  /// Zero means there is no cache, in which case manifests must always be generated.
+  /// The cache is opened again when its buffer went away, as a restarted buffer makes a new one.
+  uint64_t HTTPOutput::manifestVersion(){
+    if (!manifests || manifestStream != streamName || !manifests.isCurrent()){
+      manifestStream = streamName;
+      manifests.init(streamName, false);
+    }
+    return manifests.version();
+  }
+
+  /// Returns true if the request asks for a manifest only if it differs from the given version,
+  /// which it does not. Must be called before the request headers are cleared.
+  bool HTTPOutput::manifestUnchanged(uint64_t version){
+    return version && H.GetHeader("If-None-Match") == manifestTag(version);
+  }
+
+  /// Returns the ETag of manifests of the given version.
+  std::string HTTPOutput::manifestTag(uint64_t version){
+    return "\"" + JSON::Value(version).asString() + "\"";
+  }
+
   /// Parses a "Range: " header, setting byteStart and byteEnd.
   /// Assumes byteStart and byteEnd are initialized to their minimum respectively maximum values when the function is called.
   /// On error, byteEnd is set to zero and the function return false.
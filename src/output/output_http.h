@@ -6,6 +6,28 @@
 
 namespace Mist {
 
+  class HTTPOutput;
+
+  /// Creates a HTTP-based output instance on the given connection.
+  typedef HTTPOutput * (*httpOutputFactory)(Socket::Connection & conn);
+
+  /// A HTTP-based output that is linked into the current binary.
+  /// Requests for it can be handled in-process instead of through execv.
+  struct linkedHandler{
+    httpOutputFactory create;
+    JSON::Value capa;
+  };
+
+  /// A single url_match or url_prefix pattern, pre-split around the stream name placeholder.
+  struct urlRule{
+    std::string connector;
+    std::string pre;///< Literal part before the '$', or the whole pattern if there is none.
+    std::string suf;///< Literal part after the '$'.
+    bool hasStream;///< True if the pattern contains a '$'.
+    bool prefix;///< True for url_prefix patterns, false for url_match patterns.
+    bool match(const std::string & url, std::string & streamname) const;
+  };
+
   class HTTPOutput : public Output {
     public:
       HTTPOutput(Socket::Connection & conn);
@@ -23,12 +45,25 @@ namespace Mist {
       virtual bool doesWebsockets(){return false;}
       void reConnector(std::string & connector);
       std::string getHandler();
+      static void loadUrlRules();
+      static void linkHandler(const std::string & name, httpOutputFactory create);
+      static HTTPOutput * createHandler(const std::string & name, Socket::Connection & conn);
+      const std::string & handOffTarget(){return handOffTo;}
       bool parseRange(uint64_t & byteStart, uint64_t & byteEnd);
+      uint64_t manifestVersion();
+      bool manifestUnchanged(uint64_t version);
+      static std::string manifestTag(uint64_t version);
   protected:
       bool firstRun;
       HTTP::Parser H;
       HTTP::Websocket * webSock;
       uint32_t idleInterval;
       uint64_t idleLast;
+      std::string handOffTo;///< Name of the linked handler that takes over this connection, if any.
+      IPC::manifestCache manifests;///< Manifests of the current stream, shared with all other outputs.
+      std::string manifestStream;///< Stream the manifest cache was opened for.
+      bool handOff(const std::string & connector);
+      static bool getProtocol(std::string & connector, JSON::Value & p, JSON::Value & connCapa);
+      static std::map<std::string, linkedHandler> linked;
   };
 }
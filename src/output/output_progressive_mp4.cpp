@@ -132,24 +132,29 @@ namespace Mist {
   std::string OutProgressiveMP4::DTSCMeta2MP4Header(uint64_t & size) {
     //Make sure we have a proper being value for the size...
     size = 0;
-    //Stores the result of the function
-    std::stringstream header;
+    //Stores the result of the function, all boxes are written in place into it
+    std::string header;
+    MP4::BoxWriter W(header);
     //Determines whether the outputfile is larger than 4GB, in which case we need to use 64-bit boxes for offsets
     bool useLargeBoxes = (estimateFileSize() > 0xFFFFFFFFull);
     //Keeps track of the total size of the mdat box 
     uint64_t mdatSize = 0;
+    //The sample tables make up nearly all of the header, reserve room for them up front
+    size_t tableSize = 0;
+    for (std::set<unsigned long>::iterator it = selectedTracks.begin(); it != selectedTracks.end(); it++){
+      tableSize += myMeta.tracks[*it].parts.size() * (useLargeBoxes ? 28 : 24) + myMeta.tracks[*it].keys.size() * 4;
+    }
+    W.reserve(4096 + selectedTracks.size() * 1024 + tableSize);
 
 
     //Start actually creating the header
 
     //MP4 Files always start with an FTYP box. Constructor sets default values
     MP4::FTYP ftypBox;
-    header.write(ftypBox.asBox(), ftypBox.boxedSize());
+    W.box(ftypBox);
 
     //Start building the moov box. This is the metadata box for an mp4 file, and will contain all metadata. 
-    MP4::MOOV moovBox;
-    //Keep track of the current index within the moovBox
-    unsigned int moovOffset = 0;
+    W.start("moov");
 
 
     //Construct with duration of -1
@@ -166,18 +171,19 @@ namespace Mist {
     fms = firstms;
     //Set the trackid for the first "empty" track within the file.
     mvhdBox.setTrackID(selectedTracks.size() + 1);
-    moovBox.setContent(mvhdBox, moovOffset++);
+    W.box(mvhdBox);
+
+    //Position of the first chunk offset of each track, filled in once the moov is complete
+    std::map<size_t, size_t> chunkOffsets;
 
     for (std::set<unsigned long>::iterator it = selectedTracks.begin(); it != selectedTracks.end(); it++) {
       DTSC::Track & thisTrack = myMeta.tracks[*it];
       size_t partCount = thisTrack.parts.size();
       uint64_t tDuration = thisTrack.lastms - thisTrack.firstms;
-      MP4::TRAK trakBox;
-      //Keep track of the current index within the moovBox
-      unsigned int trakOffset = 0;
+      W.start("trak");
 
       MP4::TKHD tkhdBox(thisTrack, false);
-      trakBox.setContent(tkhdBox, trakOffset++);
+      W.box(tkhdBox);
 
       //Create an EDTS box, containing an ELST box with default values;
       ///\todo Figure out if this box is really needed for anything.
@@ -206,39 +212,36 @@ namespace Mist {
       }
 
       edtsBox.setContent(elstBox, 0);
-      trakBox.setContent(edtsBox, trakOffset++);
+      W.box(edtsBox);
 
-      MP4::MDIA mdiaBox;
-      size_t mdiaOffset = 0;
+      W.start("mdia");
       
       //Add the mandatory MDHD and HDLR boxes to the MDIA
       MP4::MDHD mdhdBox(tDuration);
       mdhdBox.setLanguage(thisTrack.lang);
-      mdiaBox.setContent(mdhdBox, mdiaOffset++);
+      W.box(mdhdBox);
       MP4::HDLR hdlrBox(thisTrack.type, thisTrack.getIdentifier());
-      mdiaBox.setContent(hdlrBox, mdiaOffset++);
+      W.box(hdlrBox);
       
-      MP4::MINF minfBox;
-      size_t minfOffset = 0;
-      
-      MP4::STBL stblBox;
-      unsigned int stblOffset = 0;
+      W.start("minf");
 
       //Add a track-type specific box to the MINF box
       if (thisTrack.type == "video") {
         MP4::VMHD vmhdBox;
         vmhdBox.setFlags(1);
-        minfBox.setContent(vmhdBox, minfOffset++);
+        W.box(vmhdBox);
       } else if (thisTrack.type == "audio") {
         MP4::SMHD smhdBox;
-        minfBox.setContent(smhdBox, minfOffset++);
+        W.box(smhdBox);
       }
 
       //Add the mandatory DREF (dataReference) box
       MP4::DINF dinfBox;
       MP4::DREF drefBox;
       dinfBox.setContent(drefBox, 0);
-      minfBox.setContent(dinfBox, minfOffset++);
+      W.box(dinfBox);
+
+      W.start("stbl");
 
       //Add STSD box
       MP4::STSD stsdBox(0);
@@ -249,28 +252,16 @@ namespace Mist {
         MP4::AudioSampleEntry sampleEntry(thisTrack);
         stsdBox.setEntry(sampleEntry, 0);
       }
-      stblBox.setContent(stsdBox, stblOffset++);
+      W.box(stsdBox);
 
-      //Add STTS Box
-      MP4::STTS sttsBox(0);
-      //Add STSZ Box
-      MP4::STSZ stszBox(0);
-      MP4::CTTS cttsBox;
-      cttsBox.setVersion(0);
-
-      MP4::CTTSEntry tmpEntry;
-      tmpEntry.sampleCount = 0;
-      tmpEntry.sampleOffset = thisTrack.parts[0].getOffset();
-        
+      //Collect the STTS and CTTS runs first, their entry counts precede them
       std::deque<std::pair<size_t, size_t> > sttsCounter;
-      stszBox.setEntrySize(0, partCount - 1);//Speed up allocation
-      size_t totalEntries = 0;
+      std::deque<std::pair<uint32_t, int32_t> > cttsCounter;
+      uint32_t cttsCount = 0;
+      int32_t cttsOffset = thisTrack.parts[0].getOffset();
 
       for (size_t part = 0; part < partCount; ++part){
-        stats();
-        
         uint64_t partDur = thisTrack.parts[part].getDuration();
-        uint64_t partSize = thisTrack.parts[part].getSize();
         uint64_t partOffset = thisTrack.parts[part].getOffset();
 
         //Create a new entry with current duration if EITHER there is no entry yet, or this parts duration differs from the previous
@@ -280,87 +271,84 @@ namespace Mist {
         //Update the counter
         sttsCounter.rbegin()->first++;
 
-        stszBox.setEntrySize(partSize, part);
-        size += partSize;
-
-        if (partOffset != tmpEntry.sampleOffset) {
+        if ((int32_t)partOffset != cttsOffset) {
           //If the offset of this and previous part differ, write current values and reset
-          cttsBox.setCTTSEntry(tmpEntry, totalEntries++);///\todo Again, rewrite for sanity. index FIRST, value SECOND
-          tmpEntry.sampleCount = 0;
-          tmpEntry.sampleOffset = partOffset;
+          cttsCounter.push_back(std::pair<uint32_t, int32_t>(cttsCount, cttsOffset));
+          cttsCount = 0;
+          cttsOffset = partOffset;
         }
-        tmpEntry.sampleCount++;
+        cttsCount++;
       }
-        
-      MP4::STTSEntry sttsEntry;
-      sttsBox.setSTTSEntry(sttsEntry, sttsCounter.size() - 1);
-      size_t sttsIdx = 0;
+
+      //Add CTTS box, only when there are composition offsets at all
+      if (cttsCounter.size() || cttsOffset) {
+        cttsCounter.push_back(std::pair<uint32_t, int32_t>(cttsCount, cttsOffset));
+        W.startFull("ctts", 0, 0);
+        W.int32(cttsCounter.size());
+        for (std::deque<std::pair<uint32_t, int32_t> >::iterator it2 = cttsCounter.begin(); it2 != cttsCounter.end(); it2++){
+          W.int32(it2->first);
+          W.int32(it2->second);
+        }
+        W.end();
+      }
+
+      //Add STTS Box
+      W.startFull("stts", 0, 0);
+      W.int32(sttsCounter.size());
       for (std::deque<std::pair<size_t, size_t> >::iterator it2 = sttsCounter.begin(); it2 != sttsCounter.end(); it2++){
-        sttsEntry.sampleCount = it2->first;
-        sttsEntry.sampleDelta = it2->second;
-        sttsBox.setSTTSEntry(sttsEntry, sttsIdx++);
+        W.int32(it2->first);
+        W.int32(it2->second);
       }
-      if (totalEntries || tmpEntry.sampleOffset) {
-        cttsBox.setCTTSEntry(tmpEntry, totalEntries++);
-        stblBox.setContent(cttsBox, stblOffset++);
+      W.end();
+
+      //Add STSZ Box
+      W.startFull("stsz", 0, 0);
+      W.int32(0);//no default sample size
+      W.int32(partCount);
+      for (size_t part = 0; part < partCount; ++part){
+        stats();
+        uint64_t partSize = thisTrack.parts[part].getSize();
+        W.int32(partSize);
+        size += partSize;
       }
-      stblBox.setContent(sttsBox, stblOffset++);
-      stblBox.setContent(stszBox, stblOffset++);
+      W.end();
 
       //Add STSS Box IF type is video and we are not fragmented
       if (thisTrack.type == "video") {
-        MP4::STSS stssBox(0);
+        W.startFull("stss", 0, 0);
+        W.int32(thisTrack.keys.size());
         int tmpCount = 0;
         for (int i = 0; i < thisTrack.keys.size(); i++){
-          stssBox.setSampleNumber(tmpCount + 1, i);///\todo PLEASE rewrite this for sanity.... SHOULD be: index FIRST, value SECOND
+          W.int32(tmpCount + 1);
           tmpCount += thisTrack.keys[i].getParts();
         }
-        stblBox.setContent(stssBox, stblOffset++);
+        W.end();
       }
 
       //Add STSC Box
       MP4::STSC stscBox(0);
       MP4::STSCEntry stscEntry(1,1,1);
       stscBox.setSTSCEntry(stscEntry, 0);
-      stblBox.setContent(stscBox, stblOffset++);
+      W.box(stscBox);
 
 
       //Create STCO Box (either stco or co64)
       //note: Inserting empty values on purpose here, will be fixed later.
-      if (useLargeBoxes) {
-        MP4::CO64 CO64Box;
-        CO64Box.setChunkOffset(0, partCount - 1);
-        stblBox.setContent(CO64Box, stblOffset++);
-      } else {
-        MP4::STCO stcoBox(0);
-        stcoBox.setChunkOffset(0, partCount - 1);
-        stblBox.setContent(stcoBox, stblOffset++);
-      }
-      
-      minfBox.setContent(stblBox, minfOffset++);
-      
-      mdiaBox.setContent(minfBox, mdiaOffset++);
+      W.startFull(useLargeBoxes ? "co64" : "stco", 0, 0);
+      W.int32(partCount);
+      chunkOffsets[*it] = W.position();
+      W.zeroes(partCount * (useLargeBoxes ? 8 : 4));
+      W.end();
       
-      trakBox.setContent(mdiaBox, 2);
-
-      moovBox.setContent(trakBox, moovOffset++);
+      W.end();//stbl
+      W.end();//minf
+      W.end();//mdia
+      W.end();//trak
     }
+    W.end();//moov
     //initial offset length ftyp, length moov + 8
-    uint64_t dataOffset = ftypBox.boxedSize() + moovBox.boxedSize() + 8;
-
-    std::map <size_t, MP4::STCO> checkStcoBoxes;
-    std::map <size_t, MP4::CO64> checkCO64Boxes;
+    uint64_t dataOffset = header.size() + 8;
 
-    std::deque<MP4::TRAK> trak = moovBox.getChildren<MP4::TRAK>();
-    for (std::deque<MP4::TRAK>::iterator trakIt = trak.begin(); trakIt != trak.end(); trakIt++){
-      MP4::TKHD tkhdBox = trakIt->getChild<MP4::TKHD>();
-      MP4::STBL stblBox = trakIt->getChild<MP4::MDIA>().getChild<MP4::MINF>().getChild<MP4::STBL>();
-      if (useLargeBoxes){
-        checkCO64Boxes.insert(std::pair<size_t, MP4::CO64>(tkhdBox.getTrackID(), stblBox.getChild<MP4::CO64>()));
-      }else{
-        checkStcoBoxes.insert(std::pair<size_t, MP4::STCO>(tkhdBox.getTrackID(), stblBox.getChild<MP4::STCO>()));
-      }
-    }
     //inserting right values in the STCO box header
     //total = 0;
     //Keep track of the current size of the data within the mdat
@@ -386,9 +374,9 @@ namespace Mist {
 
       //setting the right STCO size in the STCO box
       if (useLargeBoxes){//Re-using the previously defined boolean for speedup
-        checkCO64Boxes[temp.trackID].setChunkOffset(dataOffset + dataSize, temp.index);
+        W.setInt64(chunkOffsets[temp.trackID] + temp.index * 8, dataOffset + dataSize);
       } else {
-        checkStcoBoxes[temp.trackID].setChunkOffset(dataOffset + dataSize, temp.index);
+        W.setInt32(chunkOffsets[temp.trackID] + temp.index * 4, dataOffset + dataSize);
       }
       dataSize += thisTrack.parts[temp.index].getSize();
       
@@ -404,15 +392,12 @@ namespace Mist {
     ///\todo Update this thing for boxes >4G?
     mdatSize = dataSize + 8;//+8 for mp4 header
     
-    header << std::string(moovBox.asBox(), moovBox.boxedSize());
-    char mdatHeader[8] = {0x00,0x00,0x00,0x00,'m','d','a','t'};
-    if (mdatSize < 0xFFFFFFFF){
-      Bit::htobl(mdatHeader, mdatSize);
-    }
-    header.write(mdatHeader, 8);
-    size += header.str().size();
-    MEDIUM_MSG("Header %llu, file: %llu", header.str().size(), size);
-    return header.str();
+    //A size of zero means the mdat stretches until the end of the file
+    W.int32(mdatSize < 0xFFFFFFFF ? mdatSize : 0);
+    W.bytes("mdat", 4);
+    size += header.size();
+    MEDIUM_MSG("Header %llu, file: %llu", (unsigned long long)header.size(), size);
+    return header;
   }
   
   /// Calculate a seekPoint, based on byteStart, metadata, tracks and headerSize.
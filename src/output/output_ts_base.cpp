@@ -53,6 +53,20 @@ namespace Mist {
     } while(dataLen);
   }
 
+  /// Returns the SPS/PPS of the given track in Annex B form.
+  /// The conversion is only redone when the track's init data changes.
+  const std::string & TSOutput::getAnnexBInit(uint32_t trackId, const std::string & init){
+    std::string & cached = annexBInit[trackId];
+    std::string & source = annexBSource[trackId];
+    if (source != init || cached.empty()){
+      MP4::AVCC avccbox;
+      avccbox.setPayload(init);
+      cached = avccbox.asAnnexB();
+      source = init;
+    }
+    return cached;
+  }
+
   void TSOutput::sendNext(){
     //Get ready some data to speed up accesses
     uint32_t trackId = thisPacket.getTrackId();
@@ -74,91 +88,60 @@ namespace Mist {
     //prepare bufferstring    
     if (video){
       if (Trk.codec == "H264"){
-        unsigned int extraSize = 0;      
-        //dataPointer[4] & 0x1f is used to check if this should be done later: fillPacket("\000\000\000\001\011\360", 6);
-        if (Trk.codec == "H264" && (dataPointer[4] & 0x1f) != 0x09){
-          extraSize += 6;
+        //Build a scatter list of the Annex B version of this frame. AVCC length prefixes and Annex B
+        //start codes are both 4 bytes, so the elementary stream size follows from the NAL lengths alone.
+        esSlices.clear();
+        uint64_t esLen = 0;
+        if ((dataPointer[4] & 0x1f) != 0x09){
+          //End of previous nal unit, if not already present
+          esSlices.push_back(esSlice("\000\000\000\001\011\360", 6));
+          esLen += 6;
         }
         if (keyframe){
-          if (Trk.codec == "H264"){
-            MP4::AVCC avccbox;
-            avccbox.setPayload(Trk.init);
-            bs = avccbox.asAnnexB();
-            extraSize += bs.size();
+          const std::string & initData = getAnnexBInit(trackId, Trk.init);
+          esSlices.push_back(esSlice(initData.data(), initData.size()));
+          esLen += initData.size();
+        }
+        uint64_t i = 0;
+        while (i + 4 < dataLen){
+          uint64_t ThisNaluSize = Bit::btohl(dataPointer + i);
+          if (ThisNaluSize + i + 4 > dataLen){
+            WARN_MSG("Too big NALU detected (%" PRIu64 " > %" PRIu64 ") - skipping!", ThisNaluSize + i + 4, dataLen);
+            break;
           }
+          esSlices.push_back(esSlice("\000\000\000\001", 4));
+          esSlices.push_back(esSlice(dataPointer + i + 4, ThisNaluSize));
+          esLen += 4 + ThisNaluSize;
+          i += 4 + ThisNaluSize;
         }
-        
+
+        //Write PES headers and slices straight into the outgoing TS packets
         unsigned int watKunnenWeIn1Ding = 65490-13;
-        unsigned int splitCount = (dataLen+extraSize) / watKunnenWeIn1Ding;
-        unsigned int currPack = 0;
-        uint64_t ThisNaluSize = 0;
-        unsigned int i = 0;
-        unsigned int nalLead = 0;
         uint64_t offset = thisPacket.getInt("offset") * 90;
-
-        while (currPack <= splitCount){
-          unsigned int alreadySent = 0;
-          bs = TS::Packet::getPESVideoLeadIn((currPack != splitCount ? watKunnenWeIn1Ding : dataLen+extraSize - currPack*watKunnenWeIn1Ding), packTime, offset, !currPack, Trk.bps);
+        std::vector<esSlice>::iterator it = esSlices.begin();
+        size_t sliceDone = 0;
+        uint64_t esSent = 0;
+        while (esSent < esLen){
+          uint64_t pesLen = std::min((uint64_t)watKunnenWeIn1Ding, esLen - esSent);
+          bs = TS::Packet::getPESVideoLeadIn(pesLen, packTime, offset, !esSent, Trk.bps);
           fillPacket(bs.data(), bs.size(), firstPack, video, keyframe, pkgPid, contPkg);
-          if (!currPack){
-            if (Trk.codec == "H264" && (dataPointer[4] & 0x1f) != 0x09){
-              //End of previous nal unit, if not already present
-              fillPacket("\000\000\000\001\011\360", 6, firstPack, video, keyframe, pkgPid, contPkg);
-              alreadySent += 6;
-            }
-            if (keyframe){
-              if (Trk.codec == "H264"){
-                MP4::AVCC avccbox;
-                avccbox.setPayload(Trk.init);
-                bs = avccbox.asAnnexB();
-                fillPacket(bs.data(), bs.size(), firstPack, video, keyframe, pkgPid, contPkg);
-                alreadySent += bs.size();
-              }
+          uint64_t alreadySent = 0;
+          while (alreadySent < pesLen){
+            size_t toSend = std::min((uint64_t)(it->second - sliceDone), pesLen - alreadySent);
+            fillPacket(it->first + sliceDone, toSend, firstPack, video, keyframe, pkgPid, contPkg);
+            alreadySent += toSend;
+            sliceDone += toSend;
+            if (sliceDone == it->second){
+              ++it;
+              sliceDone = 0;
             }
           }
-          while (i + 4 < (unsigned int)dataLen){
-            if (nalLead){
-              fillPacket("\000\000\000\001"+4-nalLead,nalLead, firstPack, video, keyframe, pkgPid, contPkg);
-              i += nalLead;
-              alreadySent += nalLead;
-              nalLead = 0;
-            }
-            if (!ThisNaluSize){
-              ThisNaluSize = Bit::btohl(dataPointer + i);
-              if (ThisNaluSize + i + 4 > dataLen){
-                WARN_MSG("Too big NALU detected (%" PRIu64 " > %" PRIu64 ") - skipping!", ThisNaluSize + i + 4, dataLen);
-                break;
-              }
-              if (alreadySent + 4 > watKunnenWeIn1Ding){
-                nalLead = 4 - (watKunnenWeIn1Ding-alreadySent);
-                fillPacket("\000\000\000\001",watKunnenWeIn1Ding-alreadySent, firstPack, video, keyframe, pkgPid, contPkg);
-                i += watKunnenWeIn1Ding-alreadySent;
-                alreadySent += watKunnenWeIn1Ding-alreadySent;
-              }else{
-                fillPacket("\000\000\000\001",4, firstPack, video, keyframe, pkgPid, contPkg);
-                alreadySent += 4;
-                i += 4;
-              }
-            }
-            if (alreadySent + ThisNaluSize > watKunnenWeIn1Ding){
-              fillPacket(dataPointer+i,watKunnenWeIn1Ding-alreadySent, firstPack, video, keyframe, pkgPid, contPkg);
-              i += watKunnenWeIn1Ding-alreadySent;
-              ThisNaluSize -= watKunnenWeIn1Ding-alreadySent;
-              alreadySent += watKunnenWeIn1Ding-alreadySent;
-            }else{
-              fillPacket(dataPointer+i,ThisNaluSize, firstPack, video, keyframe, pkgPid, contPkg);
-              alreadySent += ThisNaluSize;
-              i += ThisNaluSize;
-              ThisNaluSize = 0;
-            }          
-            if (alreadySent == watKunnenWeIn1Ding){
-              packData.addStuffing();
-              fillPacket(0, 0, firstPack, video, keyframe, pkgPid, contPkg);
-              firstPack = true;
-              break;
-            }
+          esSent += pesLen;
+          if (pesLen == watKunnenWeIn1Ding){
+            packData.addStuffing();
+            fillPacket(0, 0, firstPack, video, keyframe, pkgPid, contPkg);
+            firstPack = true;
           }
-          currPack++;
         }
       }else{
         uint64_t offset = thisPacket.getInt("offset") * 90;
@@ -1,8 +1,10 @@
+#pragma once
 #include <mist/defines.h>
 #include "output.h"
 #include "output_http.h"
 #include <mist/mp4_generic.h>
 #include <mist/ts_packet.h>
+#include <vector>
 
 #ifndef TS_BASECLASS
 #define TS_BASECLASS Output
@@ -18,6 +20,12 @@ namespace Mist {
       virtual void sendTS(const char * tsData, unsigned int len=188){};
       void fillPacket(char const * data, size_t dataLen, bool & firstPack, bool video, bool keyframe, uint32_t pkgPid, int & contPkg);    
     protected:
+      /// A slice of elementary stream data, pointing either into thisPacket or into a constant/cached buffer.
+      typedef std::pair<const char *, size_t> esSlice;
+      const std::string & getAnnexBInit(uint32_t trackId, const std::string & init);
+      std::vector<esSlice> esSlices; ///< Reused scatter list of the current frame's Annex B data
+      std::map<unsigned int, std::string> annexBInit; ///< Cached SPS/PPS in Annex B form, per track
+      std::map<unsigned int, std::string> annexBSource; ///< Init data the annexBInit entry was generated from
       std::map<unsigned int, bool> first;
       std::map<unsigned int, int> contCounters;
       int contPAT;
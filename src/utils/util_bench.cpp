@@ -0,0 +1,869 @@
+/// \file util_bench.cpp
+/// Viewer load generation and delivery benchmark
+/// Opens many concurrent viewer sessions to a single stream URL and measures how well they are served.
+/// Intended to be ran like so:
+//MistUtilBench -n 1000 -r 50 -t 120 http://server:8080/live.flv
+//MistUtilBench -n 200 rtmp://server/play/live
+//MistUtilBench -n 500 http://server:8080/hls/live/index.m3u8
+
+//Supported are RTMP, progressive FLV, progressive MP4, TS over HTTP and HLS (with TS segments).
+//The protocol is picked from the URL scheme, or for HTTP from the extension of the URL path.
+//All sessions share a single event loop, and their data is parsed with the same parsers the
+//analysers use, so thousands of sessions can be ran from one process.
+
+//For every session, playback is assumed to start a fixed pre-buffer time after the first media
+//packet arrived. The following is recorded:
+// - Startup time: from opening the connection until the first media packet arrived.
+// - Delivery latency: how much later than its media time promised each packet arrived. The
+//   promise is based on the earliest arrival seen so far, so bursts do not count as latency.
+// - Stalls: how often playback would have had to pause because a packet arrived after it was due,
+//   and for how long.
+// - Throughput: the average bitrate of every session, and the total bitrate every second.
+//The summary is printed to stdout as JSON once the test ends. Progress is logged every second.
+
+#include <mist/defines.h>
+#include <mist/config.h>
+#include <mist/timing.h>
+#include <mist/util.h>
+#include <mist/url.h>
+#include <mist/http_parser.h>
+#include <mist/socket.h>
+#include <mist/flv_tag.h>
+#include <mist/ts_packet.h>
+#include <mist/mp4.h>
+#include <mist/mp4_generic.h>
+#include <mist/rtmpchunks.h>
+#include <mist/amf.h>
+#include <mist/bitfields.h>
+#include <mist/encode.h>
+#include <sys/resource.h>
+#include <poll.h>
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+/// Histogram of unsigned integer values, with a fixed relative precision.
+/// Values below 16 are counted exactly, larger values in 8 buckets per power of two.
+class Histogram{
+public:
+  Histogram() : buckets(16 + 60 * 8, 0), count(0), sum(0), min(0), max(0){}
+  void add(uint64_t v){
+    ++buckets[bucketOf(v)];
+    if (!count || v < min){min = v;}
+    if (v > max){max = v;}
+    ++count;
+    sum += v;
+  }
+  /// Returns the value below which the given fraction of all values lies.
+  /// This is the lowest value of the bucket it falls in, so at most 12.5% too low.
+  uint64_t percentile(double q) const{
+    uint64_t target = (uint64_t)(q * count);
+    if (target >= count){target = count - 1;}
+    uint64_t seen = 0;
+    for (size_t b = 0; b < buckets.size(); ++b){
+      seen += buckets[b];
+      if (seen > target){return std::min(std::max(bucketStart(b), min), max);}
+    }
+    return max;
+  }
+  JSON::Value toJSON() const{
+    JSON::Value ret;
+    ret["count"] = count;
+    if (!count){return ret;}
+    ret["min"] = min;
+    ret["max"] = max;
+    ret["mean"] = (double)sum / count;
+    ret["p50"] = percentile(0.5);
+    ret["p90"] = percentile(0.9);
+    ret["p99"] = percentile(0.99);
+    ret["p999"] = percentile(0.999);
+    //Nonzero buckets only, as [lowest value, count] pairs
+    for (size_t b = 0; b < buckets.size(); ++b){
+      if (!buckets[b]){continue;}
+      JSON::Value bucket;
+      bucket.append(bucketStart(b));
+      bucket.append(buckets[b]);
+      ret["buckets"].append(bucket);
+    }
+    return ret;
+  }
+
+private:
+  static size_t bucketOf(uint64_t v){
+    if (v < 16){return v;}
+    size_t bits = 63 - __builtin_clzll(v);
+    return 16 + (bits - 4) * 8 + ((v >> (bits - 3)) & 7);
+  }
+  static uint64_t bucketStart(size_t b){
+    if (b < 16){return b;}
+    size_t bits = (b - 16) / 8 + 4;
+    return (1ull << bits) + ((uint64_t)((b - 16) % 8) << (bits - 3));
+  }
+  std::vector<uint64_t> buckets;
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+};
+
+/// Results of all sessions together.
+struct Results{
+  Histogram startup;     ///< Milliseconds from connecting until the first media packet, per session
+  Histogram latency;     ///< Milliseconds each media packet arrived later than its media time promised
+  Histogram stalls;      ///< Amount of stalls, per session
+  Histogram stallTime;   ///< Milliseconds of every single stall
+  Histogram sessionRate; ///< Average bitrate in kbit/s, per session
+  Histogram totalRate;   ///< Bitrate of all sessions together in kbit/s, every second
+  uint64_t started;
+  uint64_t succeeded;
+  uint64_t ended;        ///< Sessions that succeeded, but whose stream ended before the test did
+  uint64_t bytes;
+  uint64_t packets;
+  std::map<std::string, uint64_t> errors;
+};
+
+Results results;
+uint64_t preBuffer = 500;///< Milliseconds of media a player buffers before starting playback.
+
+/// A single viewer session. Subclasses implement the protocols, and report every media packet
+/// they parse through mediaPacket.
+class Session{
+public:
+  Session(const HTTP::URL & u) : url(u), begin(Util::bootMS()), firstArrival(0), firstMedia(0), lastMedia(0),
+                                 earliestRef(0), playRef(0), stalls(0), bytes(0), packets(0){}
+  virtual ~Session(){conn.close();}
+  /// Opens the connection. Returns false if the session could not be started.
+  virtual bool start() = 0;
+  /// Handles new data, timers and state changes. Returns false once the session is over.
+  virtual bool handle(bool readable, uint64_t now) = 0;
+  /// Records the results of this session.
+  void finish(uint64_t now){
+    if (!error.size() && !packets){error = "no_media";}
+    if (error.size()){
+      ++results.errors[error];
+      return;
+    }
+    ++results.succeeded;
+    if (!conn && !isActive()){++results.ended;}
+    results.stalls.add(stalls);
+    if (now > begin){results.sessionRate.add(bytes * 8 / (now - begin));}
+  }
+  Socket::Connection conn;
+  std::string error;///< Reason this session failed, if it did
+
+protected:
+  /// True while the session still expects more data. Used to tell ended streams from active ones.
+  virtual bool isActive(){return false;}
+  void addBytes(uint64_t size){
+    bytes += size;
+    results.bytes += size;
+  }
+  /// Records timing of a media packet with the given media time in milliseconds.
+  void mediaPacket(uint64_t mediaTime){
+    uint64_t now = Util::bootMS();
+    ++packets;
+    ++results.packets;
+    //Large jumps back in media time mean a new timeline, such as a discontinuity in HLS
+    if (!firstArrival || mediaTime + 5000 < lastMedia){
+      if (!firstArrival){
+        firstArrival = now;
+        results.startup.add(now - begin);
+      }
+      firstMedia = lastMedia = mediaTime;
+      earliestRef = now;
+      playRef = now + preBuffer;
+      return;
+    }
+    if (mediaTime > lastMedia){lastMedia = mediaTime;}
+    //Latency is measured against the earliest schedule seen so far
+    int64_t late = (int64_t)(now - earliestRef) - (int64_t)(mediaTime - firstMedia);
+    if (late < 0){
+      earliestRef -= -late;
+      late = 0;
+    }
+    results.latency.add(late);
+    //Playback pauses for as long as the packet was overdue
+    int64_t overdue = (int64_t)(now - playRef) - (int64_t)(mediaTime - firstMedia);
+    if (overdue > 0){
+      ++stalls;
+      results.stallTime.add(overdue);
+      playRef += overdue;
+    }
+  }
+  HTTP::URL url;
+  uint64_t begin;
+  uint64_t firstArrival;
+  uint64_t firstMedia;
+  uint64_t lastMedia;
+  uint64_t earliestRef;///< Arrival time the first media packet would have had on the earliest schedule
+  uint64_t playRef;///< Time the first media packet was played, moved ahead by every stall
+  uint64_t stalls;
+  uint64_t bytes;
+  uint64_t packets;
+};
+
+/// Session that receives its data over HTTP, one request per connection.
+/// Subclasses parse the response body in body(), and may start a new request from responseDone().
+class HTTPSession : public Session, public Util::DataCallback{
+public:
+  HTTPSession(const HTTP::URL & u) : Session(u), statusChecked(false), statusOk(false){}
+  virtual bool start(){return request(url);}
+  virtual bool handle(bool readable, uint64_t now){
+    if (!conn){return false;}
+    if (readable){conn.spool();}
+    if (H.Read(conn, *this)){
+      conn.close();
+      if (!checkStatus()){return false;}
+      return responseDone(now);
+    }
+    if (statusChecked && !statusOk){return false;}
+    if (!conn){
+      if (!checkStatus()){return false;}
+      if (!error.size()){error = "disconnected";}
+      return false;
+    }
+    return !error.size();
+  }
+  virtual void dataCallback(const char * ptr, size_t size){
+    if (!checkStatus() || error.size()){return;}
+    addBytes(size);
+    body(ptr, size);
+  }
+
+protected:
+  bool request(const HTTP::URL & link){
+    conn.open(link.host, link.getPort(), true);
+    if (!conn){
+      error = "connect";
+      return false;
+    }
+    H.Clean();
+    H.url = "/" + Encodings::URL::encode(link.path, "/:=@[]");
+    if (link.args.size()){H.url += "?" + link.args;}
+    if (link.port.size()){
+      H.SetHeader("Host", link.host + ":" + link.port);
+    }else{
+      H.SetHeader("Host", link.host);
+    }
+    H.SetHeader("User-Agent", "MistUtilBench " PACKAGE_VERSION);
+    H.SetHeader("Accept", "*/*");
+    H.SendRequest(conn, "", true);
+    H.Clean();
+    statusChecked = false;
+    statusOk = false;
+    return true;
+  }
+  /// Called with every part of the response body.
+  virtual void body(const char * ptr, size_t size) = 0;
+  /// Called when the response was received completely. Returns false if the session is over.
+  virtual bool responseDone(uint64_t now){return false;}
+  HTTP::Parser H;
+
+private:
+  /// Returns false, and fails the session, if the response status is not 200.
+  bool checkStatus(){
+    if (statusChecked){return statusOk;}
+    if (!H.protocol.size()){return true;}//no response yet
+    statusChecked = true;
+    statusOk = (H.url == "200");
+    if (!statusOk){error = "status_" + H.url;}
+    return statusOk;
+  }
+  bool statusChecked;
+  bool statusOk;
+};
+
+/// Progressive FLV viewer.
+class FLVSession : public HTTPSession{
+public:
+  FLVSession(const HTTP::URL & u) : HTTPSession(u), headerDone(false){}
+
+protected:
+  virtual void body(const char * ptr, size_t size){
+    buffer.append(ptr, size);
+    if (!headerDone){
+      if (buffer.size() < 9){return;}
+      if (buffer.substr(0, 3) != "FLV"){
+        error = "parse";
+        return;
+      }
+      //The header is followed by the size of the (nonexistent) previous tag
+      uint64_t headerLen = Bit::btohl(buffer.data() + 5) + 4;
+      if (buffer.size() < headerLen){return;}
+      buffer.erase(0, headerLen);
+      headerDone = true;
+    }
+    uint64_t pos = 0;
+    FLV::Parse_Error = false;
+    while (tag.MemView((char *)buffer.data(), buffer.size(), pos)){
+      if ((tag.data[0] == 0x08 || tag.data[0] == 0x09) && !tag.isInitData()){mediaPacket(tag.tagTime());}
+    }
+    if (FLV::Parse_Error){
+      error = "parse";
+      return;
+    }
+    buffer.erase(0, pos);
+  }
+
+private:
+  bool headerDone;
+  std::string buffer;
+  FLV::Tag tag;
+};
+
+/// TS over HTTP viewer. Every PES packet that starts with a PTS counts as a media packet.
+class TSSession : public HTTPSession{
+public:
+  TSSession(const HTTP::URL & u) : HTTPSession(u){}
+
+protected:
+  virtual void body(const char * ptr, size_t size){
+    buffer.append(ptr, size);
+    size_t pos = 0;
+    while (pos + 188 <= buffer.size()){
+      if (buffer[pos] != 0x47){
+        //Lost sync, skip ahead to the next sync byte
+        size_t next = buffer.find((char)0x47, pos + 1);
+        pos = (next == std::string::npos) ? buffer.size() : next;
+        continue;
+      }
+      packet.FromPointer(buffer.data() + pos);
+      pos += 188;
+      if (!packet.getUnitStart() || packet.getPayloadLength() < 14){continue;}
+      const char * p = packet.getPayload();
+      if (p[0] || p[1] || p[2] != 1 || !(p[7] & 0x80)){continue;}
+      uint64_t pts = ((uint64_t)(p[9] & 0x0E) << 29) | ((uint64_t)p[10] << 22) | ((uint64_t)(p[11] & 0xFE) << 14) |
+                     ((uint64_t)p[12] << 7) | (p[13] >> 1);
+      mediaPacket(pts / 90);
+    }
+    buffer.erase(0, pos);
+  }
+
+private:
+  std::string buffer;
+  TS::Packet packet;
+};
+
+/// HLS viewer, for TS segments. Follows the first variant of a master playlist.
+/// Live playlists are started three segments from their end, and reloaded whenever all known
+/// segments were downloaded, but at most once per second.
+class HLSSession : public TSSession{
+public:
+  HLSSession(const HTTP::URL & u) : TSSession(u), inPlaylist(true), playlistUrl(u), started(false), ended(false),
+                                    nextSeq(0), lastReload(0), reloadAt(0){}
+  virtual bool handle(bool readable, uint64_t now){
+    if (reloadAt){
+      if (now < reloadAt){return true;}
+      reloadAt = 0;
+      return fetchPlaylist(now);
+    }
+    return TSSession::handle(readable, now);
+  }
+
+protected:
+  virtual bool isActive(){return !ended;}
+  virtual void body(const char * ptr, size_t size){
+    if (inPlaylist){
+      playlist.append(ptr, size);
+    }else{
+      TSSession::body(ptr, size);
+    }
+  }
+  virtual bool responseDone(uint64_t now){
+    if (inPlaylist){
+      if (!parsePlaylist()){return false;}
+      if (inPlaylist){return true;}//master playlist, variant requested
+    }
+    if (segments.size()){
+      inPlaylist = false;
+      HTTP::URL seg = segments.front();
+      segments.pop_front();
+      return request(seg);
+    }
+    if (ended){return false;}
+    if (now < lastReload + 1000){
+      reloadAt = lastReload + 1000;
+      return true;
+    }
+    return fetchPlaylist(now);
+  }
+
+private:
+  bool fetchPlaylist(uint64_t now){
+    inPlaylist = true;
+    lastReload = now;
+    playlist.clear();
+    return request(playlistUrl);
+  }
+  /// Queues all new segments in the playlist, or requests the first variant of a master playlist.
+  bool parsePlaylist(){
+    std::deque<std::string> uris;
+    uint64_t firstSeq = 0;
+    bool master = false;
+    size_t lineStart = 0;
+    while (lineStart < playlist.size()){
+      size_t lineEnd = playlist.find('\n', lineStart);
+      if (lineEnd == std::string::npos){lineEnd = playlist.size();}
+      std::string line = playlist.substr(lineStart, lineEnd - lineStart);
+      lineStart = lineEnd + 1;
+      while (line.size() && (line[line.size() - 1] == '\r' || line[line.size() - 1] == ' ')){
+        line.erase(line.size() - 1);
+      }
+      if (!line.size()){continue;}
+      if (line[0] != '#'){
+        uris.push_back(line);
+        continue;
+      }
+      if (line.substr(0, 22) == "#EXT-X-MEDIA-SEQUENCE:"){firstSeq = JSON::Value(line.substr(22)).asInt();}
+      if (line.substr(0, 18) == "#EXT-X-STREAM-INF:"){master = true;}
+      if (line == "#EXT-X-ENDLIST"){ended = true;}
+    }
+    if (playlist.substr(0, 7) != "#EXTM3U"){
+      error = "parse";
+      return false;
+    }
+    if (master){
+      if (!uris.size()){
+        error = "parse";
+        return false;
+      }
+      playlistUrl = playlistUrl.link(uris.front());
+      playlist.clear();
+      return request(playlistUrl);
+    }
+    if (!started){
+      started = true;
+      nextSeq = firstSeq;
+      if (!ended && uris.size() > 3){nextSeq = firstSeq + uris.size() - 3;}
+    }
+    //Segments that dropped out of the playlist before they were downloaded are skipped
+    if (nextSeq < firstSeq){nextSeq = firstSeq;}
+    for (size_t i = 0; i < uris.size(); ++i){
+      if (firstSeq + i < nextSeq){continue;}
+      segments.push_back(playlistUrl.link(uris[i]));
+      nextSeq = firstSeq + i + 1;
+    }
+    inPlaylist = false;
+    return true;
+  }
+  bool inPlaylist;
+  std::string playlist;
+  HTTP::URL playlistUrl;
+  std::deque<HTTP::URL> segments;
+  bool started;
+  bool ended;
+  uint64_t nextSeq;
+  uint64_t lastReload;
+  uint64_t reloadAt;
+};
+
+/// Progressive MP4 viewer.
+/// The sample tables in the moov box tell where every sample is stored. Every sample counts as a
+/// media packet once all of its bytes arrived.
+class MP4Session : public HTTPSession{
+public:
+  MP4Session(const HTTP::URL & u) : HTTPSession(u), streamPos(0), mdatLeft(0), nextSample(0){}
+
+protected:
+  virtual void body(const char * ptr, size_t size){
+    while (size && !error.size()){
+      if (mdatLeft){
+        size_t n = std::min((uint64_t)size, mdatLeft);
+        mdatLeft -= n;
+        streamPos += n;
+        ptr += n;
+        size -= n;
+        while (nextSample < samples.size() && samples[nextSample].first <= streamPos){
+          mediaPacket(samples[nextSample].second);
+          ++nextSample;
+        }
+        continue;
+      }
+      //Collect the box header first, then the box itself unless it is the mdat box
+      size_t want = 8;
+      if (box.size() >= 8){
+        uint64_t boxSize = Bit::btohl(box.data());
+        size_t headerSize = 8;
+        if (boxSize == 1){
+          headerSize = 16;
+          if (box.size() >= 16){boxSize = Bit::btohll(box.data() + 8);}
+        }
+        want = headerSize;
+        if (box.size() >= headerSize){
+          if (box.substr(4, 4) == "mdat"){
+            streamPos += headerSize;
+            mdatLeft = boxSize ? boxSize - headerSize : 0xFFFFFFFFFFFFFFFFull;
+            box.clear();
+            continue;
+          }
+          if (boxSize < headerSize || boxSize > 256 * 1024 * 1024){
+            error = "parse";
+            return;
+          }
+          want = boxSize;
+          if (box.size() >= want){
+            streamPos += box.size();
+            if (box.substr(4, 4) == "moov"){readMoov();}
+            box.clear();
+            continue;
+          }
+        }
+      }
+      size_t n = std::min(size, want - box.size());
+      box.append(ptr, n);
+      ptr += n;
+      size -= n;
+    }
+  }
+
+private:
+  /// Lists the end position and media time of every sample, in order of their end positions.
+  /// Consumes the box buffer.
+  void readMoov(){
+    MP4::MOOV moov;
+    moov.read(box);
+    std::deque<MP4::TRAK> traks = moov.getChildren<MP4::TRAK>();
+    for (std::deque<MP4::TRAK>::iterator it = traks.begin(); it != traks.end(); ++it){
+      MP4::MDIA mdia = it->getChild<MP4::MDIA>();
+      uint64_t timeScale = mdia.getChild<MP4::MDHD>().getTimeScale();
+      MP4::STBL stbl = mdia.getChild<MP4::MINF>().getChild<MP4::STBL>();
+      MP4::STTS stts = stbl.getChild<MP4::STTS>();
+      MP4::STSZ stsz = stbl.getChild<MP4::STSZ>();
+      MP4::STSC stsc = stbl.getChild<MP4::STSC>();
+      MP4::STCO stco = stbl.getChild<MP4::STCO>();
+      MP4::CO64 co64 = stbl.getChild<MP4::CO64>();
+      bool is64 = co64.isType("co64");
+      if (!timeScale || !stts.isType("stts") || !stsz.isType("stsz") || !stsc.isType("stsc") || (!is64 && !stco.isType("stco"))){
+        continue;
+      }
+      uint32_t chunks = is64 ? co64.getEntryCount() : stco.getEntryCount();
+      uint32_t sampleCount = stsz.getSampleCount();
+      uint32_t fixedSize = stsz.getSampleSize();
+      uint32_t stscIdx = 0, sttsIdx = 0, sttsLeft = 0, sttsDelta = 0;
+      uint32_t sample = 0;
+      uint64_t time = 0;
+      for (uint32_t chunk = 0; chunk < chunks && sample < sampleCount; ++chunk){
+        while (stscIdx + 1 < stsc.getEntryCount() && stsc.getSTSCEntry(stscIdx + 1).firstChunk <= chunk + 1){++stscIdx;}
+        uint32_t perChunk = stsc.getSTSCEntry(stscIdx).samplesPerChunk;
+        uint64_t offset = is64 ? co64.getChunkOffset(chunk) : stco.getChunkOffset(chunk);
+        for (uint32_t i = 0; i < perChunk && sample < sampleCount; ++i, ++sample){
+          offset += fixedSize ? fixedSize : stsz.getEntrySize(sample);
+          samples.push_back(std::pair<uint64_t, uint64_t>(offset, time * 1000 / timeScale));
+          while (!sttsLeft && sttsIdx < stts.getEntryCount()){
+            MP4::STTSEntry entry = stts.getSTTSEntry(sttsIdx++);
+            sttsLeft = entry.sampleCount;
+            sttsDelta = entry.sampleDelta;
+          }
+          if (sttsLeft){--sttsLeft;}
+          time += sttsDelta;
+        }
+      }
+    }
+    std::sort(samples.begin(), samples.end());
+  }
+  std::string box;
+  uint64_t streamPos;
+  uint64_t mdatLeft;
+  std::vector<std::pair<uint64_t, uint64_t> > samples;
+  size_t nextSample;
+};
+
+/// RTMP viewer. Does a plain handshake, then connect, createStream and play.
+/// The chunk parsing state in RTMPStream is global, so it is swapped in while handling a session.
+class RTMPSession : public Session{
+public:
+  RTMPSession(const HTTP::URL & u) : Session(u), shaken(false), chunkRecMax(128), window(0), lastAck(0), lastDown(0){
+    app = url.path.substr(0, url.path.find('/'));
+    if (url.path.find('/') != std::string::npos){streamName = url.path.substr(url.path.find('/') + 1);}
+    if (url.args.size()){streamName += "?" + url.args;}
+  }
+  virtual bool start(){
+    conn.open(url.host, url.getPort(), true);
+    if (!conn){
+      error = "connect";
+      return false;
+    }
+    //C0 and C1: version 3, zero time, zero version and filler
+    std::string handshake(1537, (char)0);
+    handshake[0] = 3;
+    for (size_t i = 9; i < handshake.size(); ++i){handshake[i] = FILLER_DATA[i % (sizeof(FILLER_DATA) - 1)];}
+    conn.SendNow(handshake);
+    return true;
+  }
+  virtual bool handle(bool readable, uint64_t now){
+    if (readable){conn.spool();}
+    addBytes(conn.dataDown() - lastDown);
+    lastDown = conn.dataDown();
+    swapState();
+    if (!shaken && conn.Received().available(3073)){
+      //S0, S1 and S2; C2 is a copy of S1
+      std::string reply = conn.Received().remove(3073);
+      conn.SendNow(reply.data() + 1, 1536);
+      shaken = true;
+      AMF::Object amf("container", AMF::AMF0_DDV_CONTAINER);
+      amf.addContent(AMF::Object("", "connect"));
+      amf.addContent(AMF::Object("", (double)1));
+      amf.addContent(AMF::Object(""));
+      amf.getContentP(2)->addContent(AMF::Object("app", app));
+      amf.getContentP(2)->addContent(AMF::Object("tcUrl", "rtmp://" + url.host + ":" + JSON::Value((int64_t)url.getPort()).asString() + "/" + app));
+      conn.SendNow(RTMPStream::SendChunk(3, 20, 0, amf.Pack()));
+    }
+    if (shaken){
+      RTMPStream::Chunk next;
+      while (!error.size() && next.Parse(conn.Received())){handleMessage(next);}
+      if (window && conn.dataDown() - lastAck >= window / 2){
+        lastAck = conn.dataDown();
+        conn.SendNow(RTMPStream::SendCTL(3, lastAck));
+      }
+    }
+    swapState();
+    if (!conn && !error.size() && !packets){error = "disconnected";}
+    return conn && !error.size();
+  }
+
+private:
+  void swapState(){
+    RTMPStream::lastrecv.swap(lastRecv);
+    RTMPStream::lastsend.swap(lastSend);
+    std::swap(RTMPStream::chunk_rec_max, chunkRecMax);
+  }
+  void handleMessage(RTMPStream::Chunk & msg){
+    switch (msg.msg_type_id){
+    case 1: RTMPStream::chunk_rec_max = Bit::btohl(msg.data.data()); break;
+    case 5: window = Bit::btohl(msg.data.data()); break;
+    case 4:
+      //Ping requests are answered with the same value
+      if (msg.data.size() >= 6 && Bit::btohs(msg.data.data()) == 6){
+        conn.SendNow(RTMPStream::SendUSR(7, Bit::btohl(msg.data.data() + 2)));
+      }
+      break;
+    case 8:
+    case 9:
+      if (!tag.ChunkLoader(msg)){break;}
+      if (!tag.isInitData()){mediaPacket(tag.tagTime());}
+      break;
+    case 20:{
+      AMF::Object amf = AMF::parse(msg.data);
+      std::string cmd = amf.getContentP(0)->StrValue();
+      if (cmd == "_error"){
+        error = "rtmp_error";
+        return;
+      }
+      if (cmd == "onStatus" && amf.getContentP(3) && amf.getContentP(3)->getContentP("level") &&
+          amf.getContentP(3)->getContentP("level")->StrValue() == "error"){
+        error = "rtmp_error";
+        return;
+      }
+      if (cmd != "_result"){break;}
+      if (amf.getContentP(1)->NumValue() == 1){
+        AMF::Object req("container", AMF::AMF0_DDV_CONTAINER);
+        req.addContent(AMF::Object("", "createStream"));
+        req.addContent(AMF::Object("", (double)2));
+        req.addContent(AMF::Object("", (double)0, AMF::AMF0_NULL));
+        conn.SendNow(RTMPStream::SendChunk(3, 20, 0, req.Pack()));
+      }
+      if (amf.getContentP(1)->NumValue() == 2){
+        AMF::Object req("container", AMF::AMF0_DDV_CONTAINER);
+        req.addContent(AMF::Object("", "play"));
+        req.addContent(AMF::Object("", (double)3));
+        req.addContent(AMF::Object("", (double)0, AMF::AMF0_NULL));
+        req.addContent(AMF::Object("", streamName));
+        conn.SendNow(RTMPStream::SendChunk(8, 20, (unsigned int)amf.getContentP(3)->NumValue(), req.Pack()));
+      }
+    }break;
+    }
+  }
+  bool shaken;
+  std::string app;
+  std::string streamName;
+  std::map<unsigned int, RTMPStream::Chunk> lastRecv;
+  std::map<unsigned int, RTMPStream::Chunk> lastSend;
+  size_t chunkRecMax;
+  uint64_t window;
+  uint64_t lastAck;
+  uint64_t lastDown;
+  FLV::Tag tag;
+};
+
+/// Returns the protocol to use for the given URL, or an empty string if it is not supported.
+std::string protocolOf(const HTTP::URL & u){
+  if (u.protocol == "rtmp"){return "rtmp";}
+  if (u.protocol != "http"){return "";}
+  std::string ext = u.getExt();
+  if (ext == "flv"){return "flv";}
+  if (ext == "mp4"){return "mp4";}
+  if (ext == "ts"){return "ts";}
+  if (ext == "m3u8"){return "hls";}
+  return "";
+}
+
+Session * newSession(const std::string & protocol, const HTTP::URL & u){
+  if (protocol == "rtmp"){return new RTMPSession(u);}
+  if (protocol == "flv"){return new FLVSession(u);}
+  if (protocol == "mp4"){return new MP4Session(u);}
+  if (protocol == "ts"){return new TSSession(u);}
+  return new HLSSession(u);
+}
+
+int main(int argc, char **argv){
+  Util::redirectLogsIfNeeded();
+  Util::Config conf(argv[0]);
+  JSON::Value opt;
+  opt["arg_num"] = 1;
+  opt["arg"] = "string";
+  opt["help"] = "URL of the stream to view: rtmp://, or http:// ending in .flv, .mp4, .ts or .m3u8";
+  conf.addOption("url", opt);
+  opt.null();
+  opt["long"] = "sessions";
+  opt["short"] = "n";
+  opt["arg"] = "integer";
+  opt["help"] = "Amount of viewer sessions to open (default: 100)";
+  opt["value"].append(100);
+  conf.addOption("sessions", opt);
+  opt.null();
+  opt["long"] = "rate";
+  opt["short"] = "r";
+  opt["arg"] = "integer";
+  opt["help"] = "Amount of sessions to open per second (default: 100)";
+  opt["value"].append(100);
+  conf.addOption("rate", opt);
+  opt.null();
+  opt["long"] = "time";
+  opt["short"] = "t";
+  opt["arg"] = "integer";
+  opt["help"] = "Duration of the test in seconds (default: 60)";
+  opt["value"].append(60);
+  conf.addOption("time", opt);
+  opt.null();
+  opt["long"] = "buffer";
+  opt["short"] = "b";
+  opt["arg"] = "integer";
+  opt["help"] = "Milliseconds of media viewers buffer before starting playback (default: 500)";
+  opt["value"].append(500);
+  conf.addOption("buffer", opt);
+  if (!conf.parseArgs(argc, argv)){
+    conf.printHelp(std::cout);
+    return 1;
+  }
+  conf.activate();
+
+  HTTP::URL url(conf.getString("url"));
+  std::string protocol = protocolOf(url);
+  if (!protocol.size()){
+    FAIL_MSG("Cannot view %s: unsupported protocol", conf.getString("url").c_str());
+    return 1;
+  }
+  uint64_t count = conf.getInteger("sessions");
+  uint64_t rate = conf.getInteger("rate");
+  if (!rate){rate = 1;}
+  preBuffer = conf.getInteger("buffer");
+
+  //Every session needs a socket
+  struct rlimit lim;
+  if (!getrlimit(RLIMIT_NOFILE, &lim) && lim.rlim_cur < lim.rlim_max){
+    lim.rlim_cur = lim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &lim);
+  }
+  if (!getrlimit(RLIMIT_NOFILE, &lim) && lim.rlim_cur < count + 16){
+    WARN_MSG("Only %lu files can be opened, not all sessions may succeed", (unsigned long)lim.rlim_cur);
+  }
+
+  std::list<Session *> sessions;
+  std::vector<struct pollfd> pfds;
+  uint64_t begin = Util::bootMS();
+  uint64_t end = begin + conf.getInteger("time") * 1000;
+  uint64_t now = begin;
+  uint64_t lastReport = begin;
+  uint64_t lastBytes = 0;
+  while (conf.is_active && now < end){
+    //Open sessions at the requested rate
+    uint64_t due = std::min(count, (now - begin) * rate / 1000 + 1);
+    while (results.started < due){
+      ++results.started;
+      Session * s = newSession(protocol, url);
+      if (!s->start()){
+        s->finish(now);
+        delete s;
+        continue;
+      }
+      sessions.push_back(s);
+    }
+    if (!sessions.size() && results.started == count){break;}
+
+    pfds.clear();
+    for (std::list<Session *>::iterator it = sessions.begin(); it != sessions.end(); ++it){
+      struct pollfd pfd;
+      pfd.fd = (*it)->conn.getSocket();
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      pfds.push_back(pfd);
+    }
+    if (pfds.size()){
+      poll(&pfds[0], pfds.size(), 10);
+    }else{
+      Util::sleep(10);
+    }
+    now = Util::bootMS();
+
+    size_t i = 0;
+    std::list<Session *>::iterator it = sessions.begin();
+    while (it != sessions.end()){
+      bool readable = (pfds[i].fd >= 0 && pfds[i].revents);
+      ++i;
+      if ((*it)->handle(readable, now)){
+        ++it;
+        continue;
+      }
+      (*it)->finish(now);
+      delete *it;
+      it = sessions.erase(it);
+    }
+
+    if (now >= lastReport + 1000){
+      uint64_t kbps = (results.bytes - lastBytes) * 8 / (now - lastReport);
+      results.totalRate.add(kbps);
+      INFO_MSG("%lu/%lu sessions active, %lu failed, %lu kbit/s", (unsigned long)sessions.size(),
+               (unsigned long)results.started, (unsigned long)(results.started - sessions.size() - results.succeeded),
+               (unsigned long)kbps);
+      lastReport = now;
+      lastBytes = results.bytes;
+    }
+  }
+  uint64_t active = sessions.size();
+  while (sessions.size()){
+    sessions.front()->finish(now);
+    delete sessions.front();
+    sessions.pop_front();
+  }
+
+  JSON::Value out;
+  out["url"] = conf.getString("url");
+  out["protocol"] = protocol;
+  out["version"] = PACKAGE_VERSION;
+  out["duration_ms"] = now - begin;
+  out["prebuffer_ms"] = preBuffer;
+  out["sessions"]["requested"] = count;
+  out["sessions"]["started"] = results.started;
+  out["sessions"]["succeeded"] = results.succeeded;
+  out["sessions"]["ended"] = results.ended;
+  out["sessions"]["active_at_end"] = active;
+  out["sessions"]["failed"] = results.started - results.succeeded;
+  out["errors"] = JSON::fromString("{}");
+  for (std::map<std::string, uint64_t>::iterator it = results.errors.begin(); it != results.errors.end(); ++it){
+    out["errors"][it->first] = it->second;
+  }
+  out["bytes"] = results.bytes;
+  out["packets"] = results.packets;
+  out["startup_ms"] = results.startup.toJSON();
+  out["delivery_latency_ms"] = results.latency.toJSON();
+  out["stalls"] = results.stalls.toJSON();
+  out["stall_ms"] = results.stallTime.toJSON();
+  out["session_kbps"] = results.sessionRate.toJSON();
+  out["total_kbps"] = results.totalRate.toJSON();
+  std::cout << out.toString() << std::endl;
+  return 0;
+}
@@ -0,0 +1,281 @@
+/// \file util_index.cpp
+/// Media library indexing utility
+/// Generates the header files of all media files in a directory tree ahead of time, so that the
+/// first viewer of a file does not have to wait for the input to scan it.
+/// Intended to be ran like so:
+//MistUtilIndex /path/to/media
+//MistUtilIndex --watch /path/to/media
+
+//The headers are generated by the regular inputs, started with --headeronly. Any indexes an input
+//keeps in its header file are thus generated as well.
+//In watch mode, files that are written to or moved into the tree are indexed as soon as they are
+//complete. Header files less than 15 seconds newer than their media file are considered outdated
+//by the inputs, so files are never indexed sooner than that after they were last changed.
+
+#include <mist/defines.h>
+#include <mist/config.h>
+#include <mist/procs.h>
+#include <mist/timing.h>
+#include <mist/util.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <poll.h>
+#include <string.h>
+#include <errno.h>
+#include <iostream>
+#include <map>
+#include <string>
+
+/// Input capabilities, by binary path, of all inputs that read files.
+JSON::Value inputs;
+/// Files waiting to be indexed, with the time (in seconds since epoch) they can be indexed at.
+std::map<std::string, uint64_t> pending;
+/// Files currently being indexed, by PID of the input indexing them.
+std::map<pid_t, std::string> running;
+/// Watched directories, by inotify watch descriptor.
+std::map<int, std::string> watches;
+int inotifyFd = -1;
+
+/// Asks every input binary for its capabilities, keeping the ones that match files.
+void loadInputs(){
+  std::deque<std::string> execs;
+  Util::getMyExec(execs);
+  for (std::deque<std::string>::iterator it = execs.begin(); it != execs.end(); ++it){
+    if ((*it).substr(0, 6) != "MistIn" || (*it) == "MistInfo"){continue;}
+    std::deque<std::string> args;
+    args.push_back(Util::getMyPath() + (*it));
+    args.push_back("-j");
+    JSON::Value capa = JSON::fromString(Util::Procs::getOutputOf(args));
+    if (!capa.isMember("source_match")){continue;}
+    if (capa["version"].asStringRef() != PACKAGE_VERSION){
+      WARN_MSG("Input %s version mismatch (%s != " PACKAGE_VERSION ")", (*it).c_str(), capa["version"].asStringRef().c_str());
+      continue;
+    }
+    inputs[args.front()] = capa;
+  }
+  INFO_MSG("Found %u inputs", inputs.size());
+}
+
+/// Returns true if the pattern (containing a single '*' wildcard) matches the file name.
+/// Only patterns that start with a slash match files, all others are for other kinds of sources.
+bool matchesPattern(const std::string & pattern, const std::string & file){
+  if (!pattern.size() || pattern[0] != '/' || pattern.find('*') == std::string::npos){return false;}
+  std::string front = pattern.substr(0, pattern.find('*'));
+  std::string back = pattern.substr(pattern.find('*') + 1);
+  if (file.size() < front.size() + back.size()){return false;}
+  return (file.substr(0, front.size()) == front && file.substr(file.size() - back.size()) == back);
+}
+
+/// Returns the path of the input that would be used for the given file, or an empty string if none.
+/// Picks the matching input with the highest priority, like Util::startInput does.
+std::string findInput(const std::string & file){
+  std::string ret;
+  long long int curPrio = -1;
+  jsonForEach(inputs, it){
+    if ((*it)["priority"].asInt() <= curPrio){continue;}
+    bool match = false;
+    if ((*it)["source_match"].isArray()){
+      jsonForEach((*it)["source_match"], src){
+        if (matchesPattern(src->asStringRef(), file)){match = true;}
+      }
+    }else{
+      match = matchesPattern((*it)["source_match"].asStringRef(), file);
+    }
+    if (match){
+      curPrio = (*it)["priority"].asInt();
+      ret = it.key();
+    }
+  }
+  return ret;
+}
+
+/// Queues a file for indexing, if an input can read it and its header is missing or outdated.
+void consider(const std::string & file){
+  if (file.size() >= 5 && file.substr(file.size() - 5) == ".dtsh"){return;}
+  struct stat fileStat;
+  if (stat(file.c_str(), &fileStat) || !S_ISREG(fileStat.st_mode)){return;}
+  if (!findInput(file).size()){return;}
+  struct stat headerStat;
+  if (!stat((file + ".dtsh").c_str(), &headerStat) && headerStat.st_mtime >= fileStat.st_mtime + 15){
+    if (pending.erase(file)){VERYHIGH_MSG("Header for %s is up to date", file.c_str());}
+    return;
+  }
+  pending[file] = fileStat.st_mtime + 16;
+  HIGH_MSG("Queued %s", file.c_str());
+}
+
+/// Considers all files in the given directory and its subdirectories, watching them if watching.
+/// Hidden files and directories are skipped.
+void scan(const std::string & dir){
+  if (inotifyFd != -1){
+    int wd = inotify_add_watch(inotifyFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR);
+    if (wd == -1){
+      WARN_MSG("Could not watch %s: %s", dir.c_str(), strerror(errno));
+    }else{
+      watches[wd] = dir;
+    }
+  }
+  DIR * D = opendir(dir.c_str());
+  if (!D){
+    WARN_MSG("Could not open directory %s: %s", dir.c_str(), strerror(errno));
+    return;
+  }
+  struct dirent * entry;
+  while ((entry = readdir(D))){
+    if (entry->d_name[0] == '.'){continue;}
+    std::string path = dir + "/" + entry->d_name;
+    struct stat pathStat;
+    if (stat(path.c_str(), &pathStat)){continue;}
+    if (S_ISDIR(pathStat.st_mode)){
+      scan(path);
+    }else{
+      consider(path);
+    }
+  }
+  closedir(D);
+}
+
+/// Handles all pending inotify events.
+void readEvents(){
+  char buffer[64 * 1024];
+  ssize_t len;
+  while ((len = read(inotifyFd, buffer, sizeof(buffer))) > 0){
+    for (char * p = buffer; p < buffer + len; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len){
+      struct inotify_event * ev = (struct inotify_event *)p;
+      if (ev->mask & IN_IGNORED){
+        watches.erase(ev->wd);
+        continue;
+      }
+      if (!ev->len || !watches.count(ev->wd) || ev->name[0] == '.'){continue;}
+      std::string path = watches[ev->wd] + "/" + ev->name;
+      if (ev->mask & IN_ISDIR){
+        //New directories may already hold files by the time the watch is added
+        if (ev->mask & (IN_CREATE | IN_MOVED_TO)){scan(path);}
+        continue;
+      }
+      //Files are only complete once closed after writing, or moved in whole
+      if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)){consider(path);}
+    }
+  }
+}
+
+/// Starts indexing queued files that are due, as long as fewer than maxJobs are running.
+void startJobs(size_t maxJobs){
+  uint64_t now = Util::epoch();
+  std::map<std::string, uint64_t>::iterator it = pending.begin();
+  while (it != pending.end() && running.size() < maxJobs){
+    if (it->second > now){
+      ++it;
+      continue;
+    }
+    std::string file = it->first;
+    pending.erase(it++);
+    std::string input = findInput(file);
+    if (!input.size()){continue;}
+    std::deque<std::string> args;
+    args.push_back(input);
+    args.push_back("--headeronly");
+    args.push_back("-g");
+    args.push_back(JSON::Value((int64_t)Util::Config::printDebugLevel).asString());
+    args.push_back(file);
+    int fdErr = 2;
+    pid_t pid = Util::Procs::StartPiped(args, 0, 0, &fdErr);
+    if (!pid){
+      FAIL_MSG("Could not start %s for %s", input.c_str(), file.c_str());
+      continue;
+    }
+    MEDIUM_MSG("Indexing %s", file.c_str());
+    running[pid] = file;
+  }
+}
+
+/// Forgets about finished jobs, reporting whether they succeeded.
+void reapJobs(){
+  std::map<pid_t, std::string>::iterator it = running.begin();
+  while (it != running.end()){
+    if (Util::Procs::isActive(it->first)){
+      ++it;
+      continue;
+    }
+    struct stat headerStat;
+    if (stat((it->second + ".dtsh").c_str(), &headerStat)){
+      WARN_MSG("Could not index %s", it->second.c_str());
+    }else{
+      INFO_MSG("Indexed %s", it->second.c_str());
+    }
+    running.erase(it++);
+  }
+}
+
+int main(int argc, char **argv){
+  Util::redirectLogsIfNeeded();
+  Util::Config conf(argv[0]);
+  JSON::Value opt;
+  opt["arg_num"] = 1;
+  opt["arg"] = "string";
+  opt["help"] = "Directory to index, including all its subdirectories";
+  conf.addOption("path", opt);
+  opt.null();
+  opt["long"] = "watch";
+  opt["short"] = "w";
+  opt["help"] = "Keep running, indexing files as soon as they are added or changed";
+  opt["value"].append(0);
+  conf.addOption("watch", opt);
+  opt.null();
+  opt["long"] = "jobs";
+  opt["short"] = "j";
+  opt["arg"] = "integer";
+  opt["help"] = "Amount of files to index at the same time (default: amount of processors)";
+  opt["value"].append(0);
+  conf.addOption("jobs", opt);
+  if (!conf.parseArgs(argc, argv)){
+    conf.printHelp(std::cout);
+    return 1;
+  }
+  conf.activate();
+
+  std::string root = conf.getString("path");
+  while (root.size() > 1 && root[root.size() - 1] == '/'){root.erase(root.size() - 1);}
+  if (root.size() && root[0] != '/'){
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd))){root = std::string(cwd) + "/" + root;}
+  }
+  size_t maxJobs = conf.getInteger("jobs");
+  if (!maxJobs){
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    maxJobs = (cpus > 1) ? cpus : 1;
+  }
+
+  loadInputs();
+  if (!inputs.size()){
+    FAIL_MSG("No inputs found next to %s, aborting", argv[0]);
+    return 1;
+  }
+  if (conf.getBool("watch")){
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd == -1){
+      FAIL_MSG("Could not set up file system watches: %s", strerror(errno));
+      return 1;
+    }
+  }
+  scan(root);
+  INFO_MSG("%lu files need indexing", (unsigned long)pending.size());
+
+  while (conf.is_active){
+    reapJobs();
+    startJobs(maxJobs);
+    if (inotifyFd == -1){
+      if (!pending.size() && !running.size()){break;}
+      //Files that are not due yet were changed within the last few seconds
+      Util::sleep(running.size() ? 100 : 1000);
+      continue;
+    }
+    struct pollfd pfd;
+    pfd.fd = inotifyFd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, running.size() ? 100 : 1000) > 0){readEvents();}
+  }
+  if (inotifyFd != -1){close(inotifyFd);}
+  return 0;
+}
@@ -2,13 +2,44 @@
 #include <mist/util.h>
 #include <mist/shared_memory.h>
 
+/// Prints a RelAccX structure with a known schema as one tab-separated line per record.
+/// Returns false if the structure is not ready or does not match the schema.
+template <class Schema> bool printTable(char * data){
+  const Util::RelAccXTable<Schema> T(data, false);
+  if (!T.isReady()){return false;}
+  for (size_t f = 0; f < Schema::FIELD_COUNT; ++f){
+    std::cout << (f ? "\t" : "#") << Schema::fields[f].name;
+  }
+  std::cout << std::endl;
+  uint64_t endPos = T.getEndPos();
+  for (uint64_t i = T.getDeleted(); i < endPos; ++i){
+    for (size_t f = 0; f < Schema::FIELD_COUNT; ++f){
+      if (f){std::cout << "\t";}
+      switch (Schema::fields[f].type & 0xF0){
+        case RAX_INT: std::cout << (int64_t)T.getInt(f, i); break;
+        case RAX_UINT: std::cout << T.getInt(f, i); break;
+        case RAX_STRING: std::cout << T.getPointer(f, i); break;
+        default: std::cout << "[UNIMPLEMENTED]"; break;
+      }
+    }
+    std::cout << std::endl;
+  }
+  return true;
+}
+
 int main(int argc, char ** argv){
   Util::redirectLogsIfNeeded();
-  if (argc < 1){
-    FAIL_MSG("Usage: %s MEMORY_PAGE_NAME");
+  if (argc < 2){
+    FAIL_MSG("Usage: %s MEMORY_PAGE_NAME", argv[0]);
     return 1;
   }
   IPC::sharedPage f(argv[1], 0, false, false);
+  const std::string pageName = argv[1];
+  bool printed = false;
+  if (pageName == SHM_STATE_LOGS){printed = printTable<Util::StateLogSchema>(f.mapped);}
+  if (pageName == SHM_STATE_ACCS){printed = printTable<Util::StateAccsSchema>(f.mapped);}
+  if (pageName == SHM_STATE_STREAMS){printed = printTable<Util::StateStreamsSchema>(f.mapped);}
+  if (printed){return 0;}
   const Util::RelAccX A(f.mapped, false);
   if (A.isReady()){
     std::cout << A.toPrettyString() << std::endl;
@@ -16,4 +47,3 @@ int main(int argc, char ** argv){
     std::cout << "Memory structure " << argv[1] << " is not ready" << std::endl;
   }
 }
-
@@ -0,0 +1,98 @@
+/// \file framing_bench.cpp
+/// Measures throughput of chunked HTTP and websocket framing over a loopback TCP socket.
+/// Drives HTTP::Parser::Chunkify and HTTP::Websocket::sendFrame, once with the connection sending
+/// header, payload and trailer as separate writes and once as one vectored write, for a range of
+/// payload sizes.
+/// Build: g++ -funsigned-char -I<build dir> framing_bench.cpp <build dir>/libmist.a -lpthread -lrt
+/// Usage: framing_bench [port] [megabytes per run]
+
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <sys/wait.h>
+#include <mist/http_parser.h>
+#include <mist/socket.h>
+#include <mist/timing.h>
+#include <mist/websocket.h>
+
+/// Reads and discards everything arriving on the connection until it closes.
+void drain(Socket::Connection & C){
+  char buf[64 * 1024];
+  while (true){
+    ssize_t r = recv(C.getSocket(), buf, sizeof(buf), 0);
+    if (r <= 0){return;}
+  }
+}
+
+/// Runs one measurement: connects to the drain process and sends totalBytes in frames of frameSize.
+/// Chunked mode sends through HTTP::Parser::Chunkify, websocket mode through
+/// HTTP::Websocket::sendFrame. Clearing vectored makes the connection send the framing and
+/// payload as separate writes, as both did before they switched to a single vectored write.
+double runOnce(int port, bool websocket, bool vectored, size_t frameSize, uint64_t totalBytes){
+  Socket::Connection C("127.0.0.1", port, false);
+  if (!C){
+    std::cerr << "Could not connect to port " << port << std::endl;
+    exit(1);
+  }
+  C.vectoredWrites = vectored;
+  std::string payload(frameSize, 'x');
+  HTTP::Parser H;
+  H.sendingChunks = true;
+  //The upgrade response goes to the drain process along with the frames
+  HTTP::Parser upgrade;
+  upgrade.SetHeader("Connection", "Upgrade");
+  upgrade.SetHeader("Upgrade", "websocket");
+  upgrade.SetHeader("Sec-WebSocket-Version", "13");
+  upgrade.SetHeader("Sec-WebSocket-Key", "dGhlIHNhbXBsZSBub25jZQ==");
+  HTTP::Websocket W(C, upgrade);
+  uint64_t frames = totalBytes / frameSize;
+  uint64_t start = Util::getMicros();
+  for (uint64_t i = 0; i < frames && C; ++i){
+    if (websocket){
+      W.sendFrame(payload.data(), frameSize, 2);
+    }else{
+      H.Chunkify(payload.data(), frameSize, C);
+    }
+  }
+  uint64_t spent = Util::getMicros() - start;
+  C.close();
+  return (double)(frames * frameSize) / (double)(spent ? spent : 1);
+}
+
+int main(int argc, char ** argv){
+  int port = (argc > 1) ? atoi(argv[1]) : 17357;
+  uint64_t totalBytes = ((argc > 2) ? atoll(argv[2]) : 256) * 1024 * 1024;
+  Socket::Server S(port, "127.0.0.1", false);
+  if (!S.connected()){
+    std::cerr << "Could not listen on port " << port << std::endl;
+    return 1;
+  }
+  pid_t child = fork();
+  if (!child){
+    while (S.connected()){
+      Socket::Connection C = S.accept();
+      if (C){
+        drain(C);
+        C.close();
+      }else{
+        Util::sleep(1);
+      }
+    }
+    return 0;
+  }
+  size_t sizes[] = {188, 1316, 4096, 16384, 65536};
+  const char * modes[] = {"chunked, separate", "chunked, vectored", "websocket, separate", "websocket, vectored"};
+  std::cout << std::setw(22) << "mode";
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s){std::cout << std::setw(10) << sizes[s];}
+  std::cout << "   (MB/s per payload size)" << std::endl;
+  for (int mode = 0; mode < 4; ++mode){
+    std::cout << std::setw(22) << modes[mode];
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s){
+      std::cout << std::setw(10) << std::fixed << std::setprecision(1) << runOnce(port, mode > 1, mode % 2, sizes[s], totalBytes) << std::flush;
+    }
+    std::cout << std::endl;
+  }
+  kill(child, SIGTERM);
+  waitpid(child, 0, 0);
+  return 0;
+}
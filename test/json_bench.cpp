@@ -0,0 +1,91 @@
+/// \file json_bench.cpp
+/// Measures JSON parsing and serialization speed on a controller-sized document.
+/// Compares the std::istream parser with the single-pass buffer parser behind JSON::fromString,
+/// checks that both produce the same value, and times toString on the result.
+/// Build: g++ -funsigned-char -I<build dir> json_bench.cpp <build dir>/libmist.a -lpthread -lrt
+/// Usage: json_bench [file to parse instead of the generated document] [iterations]
+
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <mist/json.h>
+#include <mist/timing.h>
+
+/// Builds a document shaped like a controller configuration with stream and track details.
+JSON::Value generate(){
+  JSON::Value ret;
+  ret["config"]["controller"]["interface"] = "0.0.0.0";
+  ret["config"]["controller"]["port"] = 4242;
+  for (int p = 0; p < 12; ++p){
+    JSON::Value proto;
+    proto["connector"] = "HTTP";
+    proto["port"] = 8080 + p;
+    proto["pubaddr"].append("http://example.com:8080/");
+    ret["config"]["protocols"].append(proto);
+  }
+  for (int s = 0; s < 200; ++s){
+    std::stringstream name;
+    name << "stream_" << s;
+    JSON::Value &strm = ret["streams"][name.str()];
+    strm["name"] = name.str();
+    strm["source"] = "push://";
+    strm["stopsessions"] = false;
+    strm["DVR"] = 50000;
+    for (int t = 0; t < 4; ++t){
+      JSON::Value trk;
+      trk["codec"] = (t % 2) ? "AAC" : "H264";
+      trk["type"] = (t % 2) ? "audio" : "video";
+      trk["bps"] = 128000 * (t + 1);
+      trk["firstms"] = (int64_t)1234567890ll;
+      trk["lastms"] = (int64_t)1234597890ll;
+      trk["fpks"] = 25000;
+      trk["rate"] = 48000.5;
+      trk["init"] = "\x01\x64\x00\x1f\xff\xe1\"quoted\" and \\escaped\\ \xc3\xa9";
+      strm["meta"]["tracks"][name.str() + "_" + trk["codec"].asStringRef()].append(trk);
+    }
+  }
+  return ret;
+}
+
+int main(int argc, char **argv){
+  std::string text;
+  if (argc > 1 && std::string(argv[1]) != "-"){
+    text = JSON::fromFile(argv[1]).toString();
+  }else{
+    text = generate().toString();
+  }
+  int iterations = (argc > 2) ? atoi(argv[2]) : 50;
+  if (iterations < 1){iterations = 1;}
+
+  uint64_t start = Util::getMicros();
+  JSON::Value streamed;
+  for (int i = 0; i < iterations; ++i){
+    std::istringstream is(text);
+    streamed = JSON::Value(is);
+  }
+  uint64_t streamTime = Util::getMicros() - start;
+
+  start = Util::getMicros();
+  JSON::Value buffered;
+  for (int i = 0; i < iterations; ++i){JSON::fromString(text.data(), text.size(), buffered);}
+  uint64_t bufferTime = Util::getMicros() - start;
+
+  start = Util::getMicros();
+  size_t written = 0;
+  for (int i = 0; i < iterations; ++i){written += buffered.toString().size();}
+  uint64_t writeTime = Util::getMicros() - start;
+
+  double mb = (double)text.size() * iterations;
+  std::cout << "Document: " << text.size() << " bytes, " << iterations << " iterations" << std::endl;
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << std::setw(20) << "istream parse" << std::setw(10) << mb / (streamTime ? streamTime : 1) << " MB/s" << std::endl;
+  std::cout << std::setw(20) << "buffer parse" << std::setw(10) << mb / (bufferTime ? bufferTime : 1) << " MB/s" << std::endl;
+  std::cout << std::setw(20) << "toString" << std::setw(10) << (double)written / (writeTime ? writeTime : 1) << " MB/s" << std::endl;
+
+  if (streamed != buffered || buffered.toString() != text){
+    std::cerr << "Parsers disagree on the document!" << std::endl;
+    return 1;
+  }
+  return 0;
+}
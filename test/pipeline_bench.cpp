@@ -0,0 +1,249 @@
+/// \file pipeline_bench.cpp
+/// Measures the live shared memory pipeline from pushing input to outputs.
+/// Synthesizes a live stream with a number of video tracks and one audio track, and pushes it in
+/// real time into a real buffer through negotiationProxy::bufferLivePacket. A number of forked
+/// outputs read it back through Output::prepareNext, as soon as it is available.
+/// Reports ingest packets/sec (achieved, and the maximum the time spent buffering allows), the cost
+/// of buffering a packet that flips to a new data page compared to one that does not, and per
+/// output the packets/sec, CPU time and live-edge latency (time between a packet being due and an
+/// output reading it, for packets that became due after the output started).
+/// The stream must be configured as a push:// stream in a running controller.
+/// Build: g++ -funsigned-char -DSHM_ENABLED=1 -I<build dir> -I<source dir>/src pipeline_bench.cpp <source dir>/src/io.cpp
+///        <source dir>/src/output/output.cpp <build dir>/libmist.a -lpthread -lrt
+/// Usage: pipeline_bench stream [video tracks] [outputs] [seconds] [video kbps] [gop ms] [fps]
+
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <mist/stream.h>
+#include <mist/timing.h>
+#include "output/output.h"
+
+/// Audio is always a single 128kbit/s track with 20ms frames.
+#define AUDIO_KBPS 128
+#define AUDIO_FRAME_MS 20
+/// Outputs start reading this long after the input started pushing, so the stream has keyframes.
+#define OUTPUT_DELAY 3000
+
+uint64_t t0;///< Boot time in ms at which media time 0 is due.
+uint64_t deadline;///< Boot time in ms at which outputs stop reading.
+
+/// Returns the value below which the given fraction of the sorted values lies.
+uint64_t percentile(const std::vector<uint64_t> & sorted, double q){
+  if (!sorted.size()){return 0;}
+  size_t i = (size_t)(q * sorted.size());
+  return sorted[std::min(i, sorted.size() - 1)];
+}
+
+/// Pushes synthetic packets into the buffer, timing every bufferLivePacket call.
+class Pusher : public Mist::InOutBase{
+public:
+  Pusher(const std::string & name, size_t videos, uint64_t kbps, uint64_t gop, uint64_t fps)
+      : videos(videos), kbps(kbps), gop(gop), fps(fps), packets(0), flips(0), flipTime(0), flipMax(0), otherTime(0){
+    streamName = name;
+    nProxy.streamName = name;
+    standAlone = false;
+    for (size_t t = 1; t <= videos; ++t){
+      DTSC::Track & T = myMeta.tracks[t];
+      T.trackID = t;
+      T.type = "video";
+      T.codec = "H264";
+      T.width = 1280;
+      T.height = 720;
+      T.fpks = fps * 1000;
+      T.init = std::string("\001\144\000\037\377\341\000\000\001\000\000", 11);
+    }
+    DTSC::Track & A = myMeta.tracks[videos + 1];
+    A.trackID = videos + 1;
+    A.type = "audio";
+    A.codec = "AAC";
+    A.rate = 48000;
+    A.channels = 2;
+    A.size = 16;
+    A.init = std::string("\x11\x90", 2);
+  }
+  /// Pushes packets as they become due, until the given boot time.
+  void run(uint64_t until){
+    uint64_t frameMs = 1000 / fps;
+    std::string video(kbps * 1000 / 8 / fps, 'v');
+    std::string audio(AUDIO_KBPS * 1000 / 8 * AUDIO_FRAME_MS / 1000, 'a');
+    uint64_t nextVideo = 0, nextAudio = 0;
+    while (Util::bootMS() < until){
+      uint64_t now = Util::bootMS() - t0;
+      while (nextVideo <= now || nextAudio <= now){
+        if (nextVideo <= nextAudio){
+          bool key = (nextVideo % gop) < frameMs;
+          for (size_t t = 1; t <= videos; ++t){push(nextVideo, t, video, key);}
+          nextVideo += frameMs;
+        }else{
+          push(nextAudio, videos + 1, audio, (nextAudio % gop) < AUDIO_FRAME_MS);
+          nextAudio += AUDIO_FRAME_MS;
+        }
+      }
+      Util::sleep(std::min(nextVideo, nextAudio) - now);
+    }
+  }
+  size_t videos;
+  uint64_t kbps;
+  uint64_t gop;
+  uint64_t fps;
+  uint64_t packets;
+  uint64_t flips;
+  uint64_t flipTime;
+  uint64_t flipMax;
+  uint64_t otherTime;
+
+private:
+  void push(uint64_t time, size_t track, const std::string & data, bool key){
+    DTSC::Packet P;
+    P.genericFill(time, 0, track, data.data(), data.size(), 0, key);
+    bool hadPage = nProxy.curPageNum.count(track);
+    unsigned long page = hadPage ? nProxy.curPageNum[track] : 0;
+    uint64_t start = Util::getMicros();
+    bufferLivePacket(P);
+    uint64_t spent = Util::getMicros() - start;
+    ++packets;
+    if (hadPage && nProxy.curPageNum.count(track) && nProxy.curPageNum[track] != page){
+      ++flips;
+      flipTime += spent;
+      if (spent > flipMax){flipMax = spent;}
+    }else{
+      otherTime += spent;
+    }
+  }
+};
+
+/// Output that reads all tracks and records when every packet arrived.
+class BenchOutput : public Mist::Output{
+public:
+  BenchOutput(Socket::Connection & conn, const std::string & name) : Output(conn), firstMs(0), lastMs(0), packets(0){
+    streamName = name;
+    capa["codecs"][0u][0u].append("+H264");
+    capa["codecs"][0u][1u].append("+AAC");
+    realTime = 0;
+    wantRequest = false;
+    parseData = true;
+  }
+  void sendNext(){
+    uint64_t now = Util::bootMS();
+    if (!firstMs){firstMs = now;}
+    lastMs = now;
+    ++packets;
+    //Packets that were due before this output started are backlog, not live edge
+    uint64_t due = t0 + thisPacket.getTime();
+    if (due >= t0 + OUTPUT_DELAY){latencies.push_back(now > due ? now - due : 0);}
+  }
+  void stats(bool force = false){
+    if (Util::bootMS() >= deadline){config->is_active = false;}
+    Output::stats(force);
+  }
+  uint64_t firstMs;
+  uint64_t lastMs;
+  uint64_t packets;
+  std::vector<uint64_t> latencies;
+};
+
+/// Runs a single output until the deadline and writes its results to fd as one line.
+void runOutput(const std::string & name, int fd){
+  int sockets[2];
+  socketpair(AF_UNIX, SOCK_STREAM, 0, sockets);
+  Socket::Connection conn(sockets[0], sockets[0]);
+  BenchOutput out(conn, name);
+  out.run();
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  uint64_t cpu = usage.ru_utime.tv_sec * 1000000 + usage.ru_utime.tv_usec + usage.ru_stime.tv_sec * 1000000 + usage.ru_stime.tv_usec;
+  std::sort(out.latencies.begin(), out.latencies.end());
+  uint64_t duration = out.lastMs - out.firstMs;
+  char line[256];
+  int len = snprintf(line, sizeof(line), "%lu %lu %lu %lu %lu %lu %lu\n", (unsigned long)out.packets,
+                     (unsigned long)duration, (unsigned long)cpu, (unsigned long)percentile(out.latencies, 0.5),
+                     (unsigned long)percentile(out.latencies, 0.9), (unsigned long)percentile(out.latencies, 0.99),
+                     (unsigned long)(out.latencies.size() ? out.latencies.back() : 0));
+  if (write(fd, line, len) != len){std::cerr << "Could not report results" << std::endl;}
+}
+
+int main(int argc, char ** argv){
+  if (argc < 2){
+    std::cerr << "Usage: " << argv[0] << " stream [video tracks] [outputs] [seconds] [video kbps] [gop ms] [fps]" << std::endl;
+    return 1;
+  }
+  std::string name = argv[1];
+  size_t videos = (argc > 2) ? atoi(argv[2]) : 3;
+  size_t outputs = (argc > 3) ? atoi(argv[3]) : 4;
+  uint64_t seconds = (argc > 4) ? atoi(argv[4]) : 20;
+  uint64_t kbps = (argc > 5) ? atoi(argv[5]) : 2000;
+  uint64_t gop = (argc > 6) ? atoi(argv[6]) : 2000;
+  uint64_t fps = (argc > 7) ? atoi(argv[7]) : 25;
+  if (!videos || !fps || !gop || seconds * 1000 <= OUTPUT_DELAY){
+    std::cerr << "Need at least one video track, a nonzero fps and gop, and a longer run" << std::endl;
+    return 1;
+  }
+  Util::Config conf(argv[0]);
+  Mist::Output::config = &conf;
+  Util::Config::is_active = true;
+  Util::Config::streamName = name;
+  if (!Util::startInput(name, "", true, true)){
+    std::cerr << "Could not start the buffer for " << name << "; is it a push:// stream in a running controller?" << std::endl;
+    return 1;
+  }
+
+  t0 = Util::bootMS() + 500;
+  deadline = t0 + seconds * 1000;
+  std::vector<pid_t> pids;
+  std::vector<int> fds;
+  for (size_t i = 0; i < outputs; ++i){
+    int p[2];
+    if (pipe(p)){
+      std::cerr << "Could not create pipe" << std::endl;
+      return 1;
+    }
+    pid_t pid = fork();
+    if (!pid){
+      close(p[0]);
+      Util::sleep((int64_t)(t0 + OUTPUT_DELAY) - (int64_t)Util::bootMS());
+      runOutput(name, p[1]);
+      _exit(0);
+    }
+    close(p[1]);
+    pids.push_back(pid);
+    fds.push_back(p[0]);
+  }
+
+  //Keep pushing a little past the deadline, so outputs are never waiting for the end of the stream
+  Pusher push(name, videos, kbps, gop, fps);
+  Util::sleep((int64_t)t0 - (int64_t)Util::bootMS());
+  push.run(deadline + 1000);
+  uint64_t pushed = Util::bootMS() - t0;
+
+  std::cout << "Input: " << videos << "x" << kbps << "kbit/s video at " << fps << "fps, " << AUDIO_KBPS
+            << "kbit/s audio, " << gop << "ms GOP, " << seconds << "s" << std::endl;
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << "  ingest: " << push.packets * 1000.0 / pushed << " packets/s, "
+            << push.packets * 1000000.0 / std::max(push.flipTime + push.otherTime, (uint64_t)1) << " packets/s capacity" << std::endl;
+  std::cout << "  buffering: " << (double)push.otherTime / std::max(push.packets - push.flips, (uint64_t)1)
+            << "us/packet, page flips: " << push.flips << " at " << (double)push.flipTime / std::max(push.flips, (uint64_t)1)
+            << "us average, " << push.flipMax << "us max" << std::endl;
+
+  std::cout << std::setw(8) << "output" << std::setw(12) << "packets/s" << std::setw(14) << "cpu us/pkt" << std::setw(10) << "p50 ms"
+            << std::setw(10) << "p90 ms" << std::setw(10) << "p99 ms" << std::setw(10) << "max ms" << std::endl;
+  for (size_t i = 0; i < pids.size(); ++i){
+    waitpid(pids[i], 0, 0);
+    char line[256];
+    ssize_t len = read(fds[i], line, sizeof(line) - 1);
+    close(fds[i]);
+    unsigned long packets = 0, duration = 0, cpu = 0, p50 = 0, p90 = 0, p99 = 0, max = 0;
+    if (len <= 0 || sscanf(std::string(line, len).c_str(), "%lu %lu %lu %lu %lu %lu %lu", &packets, &duration, &cpu, &p50, &p90, &p99, &max) != 7){
+      std::cout << std::setw(8) << i << "  failed" << std::endl;
+      continue;
+    }
+    std::cout << std::setw(8) << i << std::setw(12) << packets * 1000.0 / std::max(duration, 1ul) << std::setw(14)
+              << (double)cpu / std::max(packets, 1ul) << std::setw(10) << p50 << std::setw(10) << p90 << std::setw(10) << p99
+              << std::setw(10) << max << std::endl;
+  }
+  return 0;
+}